@@ -0,0 +1,584 @@
+/*  gstpylonsrc.cpp: Definition file for the pylonsrc GStreamer element.
+    This presents a Basler camera (through CInstantCameraAppSrc) as a native GStreamer source element, for use in any pipeline, including gst-launch-1.0.
+
+	Copyright 2017, 2018, 2019 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+	*/
+
+/*
+	pylonsrc:
+	+--------------------------------------------------------------+    +----------+    +---------------+
+	| pylonsrc (GstPushSrc)                                        |    |  other   |    | sink element  |
+	|                                                              |    | elements |    |               |
+	|  start() -----------> CInstantCameraAppSrc::InitCamera()     |    |          |    |               |
+	|                       CInstantCameraAppSrc::StartCamera()    |    |          |    |               |
+	|  create() ----------> CInstantCameraAppSrc::GrabBuffer()----------src--sink       src--sink             |
+	|  get_caps() --------> CInstantCameraAppSrc::GetCaps()        |    |          |    |               |
+	|  set_caps() --------> CInstantCameraAppSrc::SetPixelFormat() |    |          |    |               |
+	|  LATENCY query -----> CInstantCameraAppSrc::GetLatency()     |    |          |    |               |
+	|  ALLOCATION query --> CInstantCameraAppSrc::HandleAllocationQuery()   |          |    |               |
+	+--------------------------------------------------------------+    +----------+    +---------------+
+
+	Build with the Makefile in this folder, then point GStreamer at it:
+	export GST_PLUGIN_PATH=<this folder>
+	gst-inspect-1.0 pylonsrc
+	gst-launch-1.0 pylonsrc pfs-file=NodeMap.pfs grab-strategy=onebyone ! videoconvert ! autovideosink
+*/
+
+#include "gstpylonsrc.h"
+
+#ifndef PACKAGE
+#define PACKAGE "gstpylonsrc"
+#endif
+#ifndef VERSION
+#define VERSION "1.0.0"
+#endif
+
+using namespace std;
+
+GST_DEBUG_CATEGORY_STATIC(gst_pylon_src_debug);
+#define GST_CAT_DEFAULT gst_pylon_src_debug
+
+enum
+{
+	PROP_0,
+	PROP_SERIAL,
+	PROP_WIDTH,
+	PROP_HEIGHT,
+	PROP_FRAMERATE,
+	PROP_PFS_FILE,
+	PROP_GRAB_STRATEGY,
+	PROP_MAX_BUFFERS,
+	PROP_ZERO_COPY,
+	PROP_BUFFER_POOL,
+	PROP_HW_TIMESTAMPS,
+	PROP_STATS_INTERVAL,
+	PROP_STATSD,
+	PROP_PROMETHEUS_FILE,
+	PROP_RECONNECT_INTERVAL,
+	PROP_GRAB_THREAD,
+	PROP_STREAMING_THREAD,
+	PROP_ANALYSIS_STEP
+};
+
+// The formats the camera can be set up to deliver. The actual caps (size, framerate) come from the camera once it's open, see gst_pylon_src_get_caps().
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE("src",
+	GST_PAD_SRC,
+	GST_PAD_ALWAYS,
+	GST_STATIC_CAPS("video/x-raw, "
+		"format = (string) { GRAY8, RGB, BGR, BGRx, YUY2, UYVY, I420, NV12 }, "
+		"width = (int) [ 1, MAX ], "
+		"height = (int) [ 1, MAX ], "
+		"framerate = (fraction) [ 0/1, MAX ]; "
+		"video/x-bayer, "
+		"format = (string) { rggb, bggr, grbg, gbrg }, "
+		"width = (int) [ 1, MAX ], "
+		"height = (int) [ 1, MAX ], "
+		"framerate = (fraction) [ 0/1, MAX ]"));
+
+#define GST_TYPE_PYLON_SRC_GRAB_STRATEGY (gst_pylon_src_grab_strategy_get_type())
+static GType gst_pylon_src_grab_strategy_get_type()
+{
+	static gsize type = 0;
+	static const GEnumValue values[] =
+	{
+		{ Pylon::GrabStrategy_LatestImageOnly, "Always deliver the newest image (display)", "latest" },
+		{ Pylon::GrabStrategy_LatestImages, "Deliver the newest images, up to the output queue size", "latestimages" },
+		{ Pylon::GrabStrategy_OneByOne, "Deliver every image in order (recording)", "onebyone" },
+		{ Pylon::GrabStrategy_UpcomingImage, "Wait for the next image when asked (GigE only)", "upcoming" },
+		{ 0, NULL, NULL }
+	};
+
+	if (g_once_init_enter(&type))
+	{
+		GType newType = g_enum_register_static("GstPylonSrcGrabStrategy", values);
+		g_once_init_leave(&type, newType);
+	}
+	return (GType)type;
+}
+
+#define gst_pylon_src_parent_class parent_class
+G_DEFINE_TYPE(GstPylonSrc, gst_pylon_src, GST_TYPE_PUSH_SRC);
+
+static void gst_pylon_src_set_property(GObject *object, guint propId, const GValue *value, GParamSpec *pspec)
+{
+	GstPylonSrc *self = GST_PYLON_SRC(object);
+
+	switch (propId)
+	{
+	case PROP_SERIAL:
+		g_free(self->serial);
+		self->serial = g_value_dup_string(value);
+		break;
+	case PROP_WIDTH:
+		self->width = g_value_get_int(value);
+		break;
+	case PROP_HEIGHT:
+		self->height = g_value_get_int(value);
+		break;
+	case PROP_FRAMERATE:
+		self->framerate = g_value_get_int(value);
+		break;
+	case PROP_PFS_FILE:
+		g_free(self->pfsFile);
+		self->pfsFile = g_value_dup_string(value);
+		break;
+	case PROP_GRAB_STRATEGY:
+		self->grabStrategy = (Pylon::EGrabStrategy)g_value_get_enum(value);
+		break;
+	case PROP_MAX_BUFFERS:
+		self->maxBuffers = g_value_get_int(value);
+		break;
+	case PROP_ZERO_COPY:
+		self->zeroCopy = g_value_get_boolean(value);
+		break;
+	case PROP_BUFFER_POOL:
+		self->bufferPool = g_value_get_boolean(value);
+		break;
+	case PROP_HW_TIMESTAMPS:
+		self->hwTimestamps = g_value_get_boolean(value);
+		break;
+	case PROP_STATS_INTERVAL:
+		self->statsInterval = g_value_get_int(value);
+		break;
+	case PROP_ANALYSIS_STEP:
+		self->analysisStep = g_value_get_int(value);
+		break;
+	case PROP_STATSD:
+		g_free(self->statsd);
+		self->statsd = g_value_dup_string(value);
+		break;
+	case PROP_PROMETHEUS_FILE:
+		g_free(self->prometheusFile);
+		self->prometheusFile = g_value_dup_string(value);
+		break;
+	case PROP_RECONNECT_INTERVAL:
+		self->reconnectInterval = g_value_get_int(value);
+		break;
+	case PROP_GRAB_THREAD:
+		g_free(self->grabThread);
+		self->grabThread = g_value_dup_string(value);
+		break;
+	case PROP_STREAMING_THREAD:
+		g_free(self->streamingThread);
+		self->streamingThread = g_value_dup_string(value);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, propId, pspec);
+		break;
+	}
+}
+
+static void gst_pylon_src_get_property(GObject *object, guint propId, GValue *value, GParamSpec *pspec)
+{
+	GstPylonSrc *self = GST_PYLON_SRC(object);
+
+	switch (propId)
+	{
+	case PROP_SERIAL:
+		g_value_set_string(value, self->serial);
+		break;
+	case PROP_WIDTH:
+		g_value_set_int(value, self->width);
+		break;
+	case PROP_HEIGHT:
+		g_value_set_int(value, self->height);
+		break;
+	case PROP_FRAMERATE:
+		g_value_set_int(value, self->framerate);
+		break;
+	case PROP_PFS_FILE:
+		g_value_set_string(value, self->pfsFile);
+		break;
+	case PROP_GRAB_STRATEGY:
+		g_value_set_enum(value, self->grabStrategy);
+		break;
+	case PROP_MAX_BUFFERS:
+		g_value_set_int(value, self->maxBuffers);
+		break;
+	case PROP_ZERO_COPY:
+		g_value_set_boolean(value, self->zeroCopy);
+		break;
+	case PROP_BUFFER_POOL:
+		g_value_set_boolean(value, self->bufferPool);
+		break;
+	case PROP_HW_TIMESTAMPS:
+		g_value_set_boolean(value, self->hwTimestamps);
+		break;
+	case PROP_STATS_INTERVAL:
+		g_value_set_int(value, self->statsInterval);
+		break;
+	case PROP_ANALYSIS_STEP:
+		g_value_set_int(value, self->analysisStep);
+		break;
+	case PROP_STATSD:
+		g_value_set_string(value, self->statsd);
+		break;
+	case PROP_PROMETHEUS_FILE:
+		g_value_set_string(value, self->prometheusFile);
+		break;
+	case PROP_RECONNECT_INTERVAL:
+		g_value_set_int(value, self->reconnectInterval);
+		break;
+	case PROP_GRAB_THREAD:
+		g_value_set_string(value, self->grabThread);
+		break;
+	case PROP_STREAMING_THREAD:
+		g_value_set_string(value, self->streamingThread);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, propId, pspec);
+		break;
+	}
+}
+
+// READY->PAUSED: open and set up the camera, and start the Grab Engine.
+static gboolean gst_pylon_src_start(GstBaseSrc *src)
+{
+	GstPylonSrc *self = GST_PYLON_SRC(src);
+
+	try
+	{
+		self->camera = new CInstantCameraAppSrc(self->serial != NULL ? self->serial : "");
+		if (self->camera->IsPylonDeviceAttached() == false)
+		{
+			GST_ELEMENT_ERROR(self, RESOURCE, NOT_FOUND, ("Could not find camera %s.", self->serial != NULL ? self->serial : ""), (NULL));
+			delete self->camera;
+			self->camera = NULL;
+			return FALSE;
+		}
+
+		GrabSettings grabSettings;
+		grabSettings.strategy = self->grabStrategy;
+		grabSettings.maxNumBuffer = self->maxBuffers;
+		grabSettings.useZeroCopy = self->zeroCopy == TRUE;
+		grabSettings.useBufferPool = self->bufferPool == TRUE;
+		grabSettings.useHardwareTimestamps = self->hwTimestamps == TRUE;
+		grabSettings.statsInterval = self->statsInterval;
+		grabSettings.statsdAddress = self->statsd != NULL ? self->statsd : "";
+		grabSettings.prometheusFile = self->prometheusFile != NULL ? self->prometheusFile : "";
+		grabSettings.reconnectInterval = self->reconnectInterval;
+		grabSettings.analysisStep = self->analysisStep;
+		// the element's streaming thread asks for each image, so push mode doesn't apply here.
+		grabSettings.usePushMode = false;
+		// (the grab thread's priority still goes to Pylon's internal grab engine thread)
+		if ((self->grabThread != NULL && grabSettings.grabThread.Parse(self->grabThread) == false) ||
+			(self->streamingThread != NULL && grabSettings.streamingThread.Parse(self->streamingThread) == false))
+		{
+			GST_ELEMENT_ERROR(self, RESOURCE, SETTINGS, ("Thread cores and priority must look like 2,3:50."), (NULL));
+			delete self->camera;
+			self->camera = NULL;
+			return FALSE;
+		}
+
+		// InitCamera() applies the AOI after the pfs file, so the properties win, and the framerate after the AOI, as the maximum depends on it.
+		int width = (self->width > 0) ? self->width : self->camera->GetWidth();
+		int height = (self->height > 0) ? self->height : self->camera->GetHeight();
+		if (self->camera->InitCamera(width, height, self->framerate, false, false, -1, -1, -1, -1, self->pfsFile != NULL ? self->pfsFile : "", grabSettings) == false)
+		{
+			GST_ELEMENT_ERROR(self, RESOURCE, SETTINGS, ("Could not initialize camera."), (NULL));
+			delete self->camera;
+			self->camera = NULL;
+			return FALSE;
+		}
+
+		// With hardware timestamps the camera sets the timestamps. Otherwise the base class stamps each buffer with the running time when create() returns.
+		gst_base_src_set_do_timestamp(src, self->hwTimestamps == TRUE ? FALSE : TRUE);
+
+		self->camera->AttachToElement(GST_ELEMENT(self));
+		if (self->camera->StartCamera() == false)
+		{
+			GST_ELEMENT_ERROR(self, RESOURCE, FAILED, ("Could not start camera."), (NULL));
+			delete self->camera;
+			self->camera = NULL;
+			return FALSE;
+		}
+
+		GST_INFO_OBJECT(self, "Using camera %s, %dx%d @ %f fps", self->camera->GetDeviceInfo().GetFriendlyName().c_str(),
+			self->camera->GetWidth(), self->camera->GetHeight(), self->camera->GetFrameRate());
+		return TRUE;
+	}
+	catch (GenICam::GenericException &e)
+	{
+		GST_ELEMENT_ERROR(self, RESOURCE, SETTINGS, ("An exception occured in gst_pylon_src_start(): %s", e.GetDescription()), (NULL));
+	}
+	catch (std::exception &e)
+	{
+		GST_ELEMENT_ERROR(self, RESOURCE, SETTINGS, ("An exception occurred in gst_pylon_src_start(): %s", e.what()), (NULL));
+	}
+
+	delete self->camera;
+	self->camera = NULL;
+	return FALSE;
+}
+
+// PAUSED->READY: stop grabbing and close the camera.
+static gboolean gst_pylon_src_stop(GstBaseSrc *src)
+{
+	GstPylonSrc *self = GST_PYLON_SRC(src);
+
+	if (self->camera != NULL)
+	{
+		self->camera->StopCamera();
+		delete self->camera; // closes the camera
+		self->camera = NULL;
+	}
+	return TRUE;
+}
+
+// Called when the streaming thread must stop waiting: PLAYING->PAUSED (we're live), a flushing seek, going to READY.
+// The camera's Unlock() wakes up GrabBuffer() right away, rather than after its timeout, and create() then returns FLUSHING.
+// The Grab Engine keeps running, so after unlock_stop() (back to PLAYING) the images carry on. stop() is what stops grabbing.
+static gboolean gst_pylon_src_unlock(GstBaseSrc *src)
+{
+	GstPylonSrc *self = GST_PYLON_SRC(src);
+
+	self->isUnlocked = TRUE; // (stops create() waiting for an unplugged camera)
+	if (self->camera != NULL)
+		self->camera->Unlock();
+	return TRUE;
+}
+
+// The streaming thread may wait for images again.
+static gboolean gst_pylon_src_unlock_stop(GstBaseSrc *src)
+{
+	GstPylonSrc *self = GST_PYLON_SRC(src);
+
+	if (self->camera != NULL)
+		self->camera->UnlockStop();
+	self->isUnlocked = FALSE;
+	return TRUE;
+}
+
+// Before the camera is open, we can only offer the template caps. Afterwards, exactly what the camera is set up for.
+static GstCaps* gst_pylon_src_get_caps(GstBaseSrc *src, GstCaps *filter)
+{
+	GstPylonSrc *self = GST_PYLON_SRC(src);
+
+	GstCaps *caps = NULL;
+	if (self->camera != NULL)
+		caps = self->camera->GetCaps();
+	else
+		caps = gst_pad_get_pad_template_caps(GST_BASE_SRC_PAD(src));
+
+	if (filter != NULL)
+	{
+		GstCaps *intersection = gst_caps_intersect_full(filter, caps, GST_CAPS_INTERSECT_FIRST);
+		gst_caps_unref(caps);
+		caps = intersection;
+	}
+	return caps;
+}
+
+// Downstream picked one of the formats from get_caps(). Set the camera up to deliver it.
+static gboolean gst_pylon_src_set_caps(GstBaseSrc *src, GstCaps *caps)
+{
+	GstPylonSrc *self = GST_PYLON_SRC(src);
+
+	GST_DEBUG_OBJECT(self, "set caps %" GST_PTR_FORMAT, caps);
+	if (self->camera == NULL || self->camera->SetPixelFormat(caps) == false)
+	{
+		GST_ELEMENT_ERROR(self, CORE, NEGOTIATION, ("Camera can't deliver the format downstream picked."), ("%" GST_PTR_FORMAT, caps));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+// Downstream tells us how many buffers it holds on to. With buffer-pool=true, the camera's pool is grown to match.
+static gboolean gst_pylon_src_decide_allocation(GstBaseSrc *src, GstQuery *query)
+{
+	GstPylonSrc *self = GST_PYLON_SRC(src);
+
+	if (self->camera != NULL)
+		self->camera->HandleAllocationQuery(query);
+
+	return GST_BASE_SRC_CLASS(parent_class)->decide_allocation(src, query);
+}
+
+// Report the real latency of the camera, so live sinks wait for our images instead of dropping them as late.
+static gboolean gst_pylon_src_query(GstBaseSrc *src, GstQuery *query)
+{
+	GstPylonSrc *self = GST_PYLON_SRC(src);
+
+	if (GST_QUERY_TYPE(query) == GST_QUERY_LATENCY && self->camera != NULL)
+	{
+		GstClockTime minLatency, maxLatency;
+		self->camera->GetLatency(minLatency, maxLatency);
+		GST_DEBUG_OBJECT(self, "latency min %" GST_TIME_FORMAT " max %" GST_TIME_FORMAT, GST_TIME_ARGS(minLatency), GST_TIME_ARGS(maxLatency));
+		gst_query_set_latency(query, TRUE, minLatency, maxLatency);
+		return TRUE;
+	}
+
+	return GST_BASE_SRC_CLASS(parent_class)->query(src, query);
+}
+
+// Runs on the streaming thread for every buffer.
+static GstFlowReturn gst_pylon_src_create(GstPushSrc *pushSrc, GstBuffer **buffer)
+{
+	GstPylonSrc *self = GST_PYLON_SRC(pushSrc);
+
+	if (self->camera->IsGrabbing() == false && self->camera->IsReconnecting() == false)
+		return GST_FLOW_FLUSHING; // we're being stopped, see gst_pylon_src_stop()
+	if (self->isUnlocked == TRUE)
+		return GST_FLOW_FLUSHING; // see gst_pylon_src_unlock()
+
+	*buffer = self->camera->GrabBuffer();
+	// With reconnect-interval, wait for an unplugged camera to come back rather than end the stream. The pipeline stays PLAYING, with a gap in the timestamps.
+	while (*buffer == NULL && self->camera->IsReconnecting() == true && self->isUnlocked == FALSE)
+	{
+		if (self->camera->WaitForReconnect(100) == true)
+			*buffer = self->camera->GrabBuffer();
+	}
+	if (*buffer == NULL)
+	{
+		if (self->isUnlocked == TRUE)
+			return GST_FLOW_FLUSHING;
+		// like the AppSrc, end the stream rather than fail it. The camera has posted "pylon-camera-removed" already.
+		if (self->camera->IsCameraDeviceRemoved() == true)
+			return GST_FLOW_EOS;
+		if (self->camera->IsGrabbing() == false)
+			return GST_FLOW_FLUSHING;
+		GST_ELEMENT_ERROR(self, RESOURCE, READ, ("Could not retrieve an image from the camera."), (NULL));
+		return GST_FLOW_ERROR;
+	}
+	return GST_FLOW_OK;
+}
+
+static void gst_pylon_src_finalize(GObject *object)
+{
+	GstPylonSrc *self = GST_PYLON_SRC(object);
+
+	delete self->camera;
+	g_free(self->serial);
+	g_free(self->pfsFile);
+	g_free(self->statsd);
+	g_free(self->prometheusFile);
+	g_free(self->grabThread);
+	g_free(self->streamingThread);
+
+	G_OBJECT_CLASS(parent_class)->finalize(object);
+}
+
+static void gst_pylon_src_class_init(GstPylonSrcClass *klass)
+{
+	GObjectClass *gobjectClass = G_OBJECT_CLASS(klass);
+	GstElementClass *elementClass = GST_ELEMENT_CLASS(klass);
+	GstBaseSrcClass *baseSrcClass = GST_BASE_SRC_CLASS(klass);
+	GstPushSrcClass *pushSrcClass = GST_PUSH_SRC_CLASS(klass);
+
+	gobjectClass->set_property = gst_pylon_src_set_property;
+	gobjectClass->get_property = gst_pylon_src_get_property;
+	gobjectClass->finalize = gst_pylon_src_finalize;
+
+	GParamFlags flags = (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY);
+	g_object_class_install_property(gobjectClass, PROP_SERIAL,
+		g_param_spec_string("serial", "Serial number", "Serial number of the camera to use. If not set, the first camera found is used.", NULL, flags));
+	g_object_class_install_property(gobjectClass, PROP_WIDTH,
+		g_param_spec_int("width", "Width", "Width of the camera's Area Of Interest (-1 = as set up in the camera or pfs file)", -1, G_MAXINT, -1, flags));
+	g_object_class_install_property(gobjectClass, PROP_HEIGHT,
+		g_param_spec_int("height", "Height", "Height of the camera's Area Of Interest (-1 = as set up in the camera or pfs file)", -1, G_MAXINT, -1, flags));
+	g_object_class_install_property(gobjectClass, PROP_FRAMERATE,
+		g_param_spec_int("framerate", "Framerate", "Frames per second (-1 = camera's maximum under current settings)", -1, G_MAXINT, -1, flags));
+	g_object_class_install_property(gobjectClass, PROP_PFS_FILE,
+		g_param_spec_string("pfs-file", "Camera parameter file", "pylon feature file (.pfs) to load into the camera before starting", NULL, flags));
+	g_object_class_install_property(gobjectClass, PROP_GRAB_STRATEGY,
+		g_param_spec_enum("grab-strategy", "Grab strategy", "How the pylon Grab Engine queues images", GST_TYPE_PYLON_SRC_GRAB_STRATEGY, Pylon::GrabStrategy_LatestImageOnly, flags));
+	g_object_class_install_property(gobjectClass, PROP_MAX_BUFFERS,
+		g_param_spec_int("max-buffers", "Max buffers", "Number of buffers the Grab Engine grabs into (-1 = pylon default)", -1, G_MAXINT, -1, flags));
+	g_object_class_install_property(gobjectClass, PROP_ZERO_COPY,
+		g_param_spec_boolean("zero-copy", "Zero copy", "Hand the Grab Engine's buffers to the pipeline instead of copying each image", FALSE, flags));
+	g_object_class_install_property(gobjectClass, PROP_BUFFER_POOL,
+		g_param_spec_boolean("buffer-pool", "Buffer pool", "Let the Grab Engine grab into a GStreamer buffer pool sized for downstream (implies zero-copy)", FALSE, flags));
+	g_object_class_install_property(gobjectClass, PROP_HW_TIMESTAMPS,
+		g_param_spec_boolean("hw-timestamps", "Hardware timestamps", "Timestamp buffers with the camera's exposure time instead of their arrival time", FALSE, flags));
+	g_object_class_install_property(gobjectClass, PROP_STATS_INTERVAL,
+		g_param_spec_int("stats-interval", "Statistics interval", "Post a \"pylon-stats\" element message with the acquisition statistics every so many ms (0 = never)", 0, G_MAXINT, 0, flags));
+	g_object_class_install_property(gobjectClass, PROP_STATSD,
+		g_param_spec_string("statsd", "statsd server", "Also send the statistics to statsd at host:port", NULL, flags));
+	g_object_class_install_property(gobjectClass, PROP_PROMETHEUS_FILE,
+		g_param_spec_string("prometheus-file", "Prometheus file", "Also write the statistics to this file in Prometheus text format", NULL, flags));
+	g_object_class_install_property(gobjectClass, PROP_RECONNECT_INTERVAL,
+		g_param_spec_int("reconnect-interval", "Reconnect interval", "When the camera is unplugged, look for it every so many ms and carry on when it's back, instead of ending the stream (0 = don't)", 0, G_MAXINT, 0, flags));
+	g_object_class_install_property(gobjectClass, PROP_GRAB_THREAD,
+		g_param_spec_string("grab-thread", "Grab thread", "SCHED_FIFO priority of Pylon's grab engine thread, as \":<priority>\" (eg: :50)", NULL, flags));
+	g_object_class_install_property(gobjectClass, PROP_STREAMING_THREAD,
+		g_param_spec_string("streaming-thread", "Streaming thread", "Cores and SCHED_FIFO priority of the element's streaming thread, as \"<cores>[:<priority>]\" (eg: 1 or 2,3:60)", NULL, flags));
+	g_object_class_install_property(gobjectClass, PROP_ANALYSIS_STEP,
+		g_param_spec_int("analysis-step", "Analysis step", "Measure luminance, motion and focus of each image from every so many pixels and rows, into its PylonFrameMeta (0 = don't)", 0, 256, 0, flags));
+
+	gst_element_class_set_static_metadata(elementClass,
+		"Basler pylon camera source", "Source/Video",
+		"Grabs images from a Basler camera using the pylon Instant Camera",
+		"Matthew Breit <matt.breit@gmail.com>");
+	gst_element_class_add_static_pad_template(elementClass, &src_template);
+
+	baseSrcClass->start = GST_DEBUG_FUNCPTR(gst_pylon_src_start);
+	baseSrcClass->stop = GST_DEBUG_FUNCPTR(gst_pylon_src_stop);
+	baseSrcClass->unlock = GST_DEBUG_FUNCPTR(gst_pylon_src_unlock);
+	baseSrcClass->unlock_stop = GST_DEBUG_FUNCPTR(gst_pylon_src_unlock_stop);
+	baseSrcClass->get_caps = GST_DEBUG_FUNCPTR(gst_pylon_src_get_caps);
+	baseSrcClass->set_caps = GST_DEBUG_FUNCPTR(gst_pylon_src_set_caps);
+	baseSrcClass->decide_allocation = GST_DEBUG_FUNCPTR(gst_pylon_src_decide_allocation);
+	baseSrcClass->query = GST_DEBUG_FUNCPTR(gst_pylon_src_query);
+	pushSrcClass->create = GST_DEBUG_FUNCPTR(gst_pylon_src_create);
+}
+
+static void gst_pylon_src_init(GstPylonSrc *self)
+{
+	self->camera = NULL;
+	self->serial = NULL;
+	self->width = -1;
+	self->height = -1;
+	self->framerate = -1;
+	self->pfsFile = NULL;
+	self->grabStrategy = Pylon::GrabStrategy_LatestImageOnly;
+	self->maxBuffers = -1;
+	self->zeroCopy = FALSE;
+	self->bufferPool = FALSE;
+	self->hwTimestamps = FALSE;
+	self->statsInterval = 0;
+	self->statsd = NULL;
+	self->prometheusFile = NULL;
+	self->reconnectInterval = 0;
+	self->grabThread = NULL;
+	self->streamingThread = NULL;
+	self->analysisStep = 0;
+	self->isUnlocked = FALSE;
+
+	// a camera is a live source: it produces images whether or not anyone is ready for them, and only in PLAYING.
+	gst_base_src_set_live(GST_BASE_SRC(self), TRUE);
+	gst_base_src_set_format(GST_BASE_SRC(self), GST_FORMAT_TIME);
+}
+
+static gboolean plugin_init(GstPlugin *plugin)
+{
+	GST_DEBUG_CATEGORY_INIT(gst_pylon_src_debug, "pylonsrc", 0, "Basler pylon camera source");
+	return gst_element_register(plugin, "pylonsrc", GST_RANK_NONE, GST_TYPE_PYLON_SRC);
+}
+
+// GStreamer only recognises a few license names. The code is Apache 2.0 licensed, see LICENSE.
+GST_PLUGIN_DEFINE(
+	GST_VERSION_MAJOR,
+	GST_VERSION_MINOR,
+	pylonsrc,
+	"Basler pylon camera source",
+	plugin_init,
+	VERSION,
+	"Apache 2.0",
+	PACKAGE,
+	"Unknown package origin")
@@ -0,0 +1,75 @@
+/*  gstpylonsrc.h: header file for the pylonsrc GStreamer element.
+    This presents a Basler camera (through CInstantCameraAppSrc) as a native GStreamer source element, for use in any pipeline, including gst-launch-1.0.
+
+	Copyright 2017 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+
+*/
+
+#pragma once
+
+#include "../InstantCameraAppSrc/CInstantCameraAppSrc.h"
+#include <gst/gst.h>
+#include <gst/base/gstpushsrc.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_PYLON_SRC (gst_pylon_src_get_type())
+#define GST_PYLON_SRC(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_PYLON_SRC, GstPylonSrc))
+#define GST_PYLON_SRC_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST((klass), GST_TYPE_PYLON_SRC, GstPylonSrcClass))
+#define GST_IS_PYLON_SRC(obj) (G_TYPE_CHECK_INSTANCE_TYPE((obj), GST_TYPE_PYLON_SRC))
+
+// ******* GstPylonSrc *******
+// A GstPushSrc which owns a CInstantCameraAppSrc. The camera is opened and configured when the element goes to PAUSED,
+// and each create() from the streaming thread retrieves one image (CInstantCameraAppSrc::GrabBuffer()). No AppSrc or signals in between.
+struct GstPylonSrc
+{
+	GstPushSrc parent;
+
+	CInstantCameraAppSrc *camera;
+
+	// properties
+	gchar *serial;
+	gint width;
+	gint height;
+	gint framerate;
+	gchar *pfsFile;
+	Pylon::EGrabStrategy grabStrategy;
+	gint maxBuffers;
+	gboolean zeroCopy;
+	gboolean bufferPool;
+	gboolean hwTimestamps;
+	gint statsInterval;
+	gchar *statsd;
+	gchar *prometheusFile;
+	gint reconnectInterval;
+	gchar *grabThread;
+	gchar *streamingThread;
+	gint analysisStep;
+
+	gboolean isUnlocked; // between unlock() and unlock_stop()
+};
+
+struct GstPylonSrcClass
+{
+	GstPushSrcClass parent_class;
+};
+
+GType gst_pylon_src_get_type();
+
+G_END_DECLS
@@ -0,0 +1,378 @@
+/*  CAcquisitionStats.cpp: Definition file for CAcquisitionStats Class.
+    This counts and times what happens to each image on its way from the Grab Engine to the pipeline, and reports it.
+
+	Copyright 2017, 2018, 2019 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+	*/
+
+#include "CAcquisitionStats.h"
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+
+using namespace std;
+
+// 50us to 1s. A frame at 60 fps is 16.7ms.
+const gint64 LatencyHistogram::bounds[LatencyHistogram::numBounds] = { 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000 };
+
+LatencyHistogram::LatencyHistogram()
+{
+	for (int i = 0; i <= numBounds; i++)
+		counts[i] = 0;
+	count = 0;
+	sum = 0;
+}
+
+void LatencyHistogram::Add(gint64 microseconds)
+{
+	int bucket = 0;
+	while (bucket < numBounds && microseconds > bounds[bucket])
+		bucket++;
+	counts[bucket]++;
+	count++;
+	sum += microseconds;
+}
+
+double LatencyHistogram::Mean() const
+{
+	return count > 0 ? (double)sum / count : 0.0;
+}
+
+gint64 LatencyHistogram::Percentile(double fraction) const
+{
+	if (count == 0)
+		return 0;
+	guint64 wanted = (guint64)(fraction * count);
+	guint64 seen = 0;
+	for (int i = 0; i < numBounds; i++)
+	{
+		seen += counts[i];
+		if (seen > wanted)
+			return bounds[i];
+	}
+	return bounds[numBounds - 1] * 2; // longer than the last bucket
+}
+
+AcquisitionStats::AcquisitionStats()
+{
+	frames = 0;
+	failedGrabs = 0;
+	retrieveErrors = 0;
+	skippedImages = 0;
+	lostFrames = 0;
+	buffersInFlight = 0;
+	fps = 0.0;
+	targetFps = 0.0;
+}
+
+// Prometheus text exposition format, one series per metric, labelled with the camera.
+static void prometheus_metric(ostringstream &out, const char *name, const char *type, const char *help, const string &labels, double value)
+{
+	out << "# HELP " << name << " " << help << "\n";
+	out << "# TYPE " << name << " " << type << "\n";
+	out << name << "{" << labels << "} " << value << "\n";
+}
+
+static void prometheus_histogram(ostringstream &out, const char *name, const char *help, const string &labels, const LatencyHistogram &histogram)
+{
+	out << "# HELP " << name << " " << help << "\n";
+	out << "# TYPE " << name << " histogram\n";
+	guint64 cumulative = 0;
+	for (int i = 0; i < LatencyHistogram::numBounds; i++)
+	{
+		cumulative += histogram.counts[i];
+		out << name << "_bucket{" << labels << ",le=\"" << LatencyHistogram::bounds[i] / 1e6 << "\"} " << cumulative << "\n";
+	}
+	out << name << "_bucket{" << labels << ",le=\"+Inf\"} " << histogram.count << "\n";
+	out << name << "_sum{" << labels << "} " << histogram.sum / 1e6 << "\n";
+	out << name << "_count{" << labels << "} " << histogram.count << "\n";
+}
+
+string AcquisitionStats::ToPrometheus(const string &camera) const
+{
+	ostringstream out;
+	string labels = "camera=\"" + camera + "\"";
+	prometheus_metric(out, "pylon_frames_total", "counter", "Images handed to the pipeline.", labels, (double)frames);
+	prometheus_metric(out, "pylon_failed_grabs_total", "counter", "Grab Results which came back failed.", labels, (double)failedGrabs);
+	prometheus_metric(out, "pylon_retrieve_errors_total", "counter", "RetrieveResult() timeouts and errors.", labels, (double)retrieveErrors);
+	prometheus_metric(out, "pylon_skipped_images_total", "counter", "Images the Grab Engine dropped before they were retrieved.", labels, (double)skippedImages);
+	prometheus_metric(out, "pylon_lost_frames_total", "counter", "Images missing from the camera's frame ids.", labels, (double)lostFrames);
+	prometheus_metric(out, "pylon_buffers_in_flight", "gauge", "Zero-copy buffers held by the pipeline.", labels, buffersInFlight);
+	prometheus_metric(out, "pylon_fps", "gauge", "Frames per second achieved.", labels, fps);
+	prometheus_metric(out, "pylon_target_fps", "gauge", "Frames per second the camera is set up for.", labels, targetFps);
+	prometheus_histogram(out, "pylon_grab_to_push_seconds", "From RetrieveResult() to the buffer being handed to the pipeline.", labels, grabToPush);
+	prometheus_histogram(out, "pylon_retrieve_wait_seconds", "Time spent waiting in RetrieveResult().", labels, retrieveWait);
+	return out.str();
+}
+
+CAcquisitionStats::CAcquisitionStats()
+{
+	m_lastFrameTime = 0;
+	m_frameInterval = 0.0;
+	m_isReporting = false;
+	m_intervalMs = 0;
+	m_element = NULL;
+	m_statsdSocket = NULL;
+	m_statsdAddress = NULL;
+}
+
+CAcquisitionStats::~CAcquisitionStats()
+{
+	StopReporting();
+}
+
+void CAcquisitionStats::AddFrame(gint64 grabToPushMicroseconds)
+{
+	gint64 now = g_get_monotonic_time();
+	lock_guard<mutex> lock(m_lock);
+	m_stats.frames++;
+	m_stats.grabToPush.Add(grabToPushMicroseconds);
+
+	// the frame rate follows a moving average of the time between frames, over roughly the last 16 frames.
+	if (m_lastFrameTime != 0)
+	{
+		double interval = (double)(now - m_lastFrameTime);
+		if (m_frameInterval == 0.0)
+			m_frameInterval = interval;
+		else
+			m_frameInterval += (interval - m_frameInterval) / 16.0;
+	}
+	m_lastFrameTime = now;
+}
+
+void CAcquisitionStats::AddRetrieveWait(gint64 microseconds)
+{
+	lock_guard<mutex> lock(m_lock);
+	m_stats.retrieveWait.Add(microseconds);
+}
+
+void CAcquisitionStats::AddFailedGrab()
+{
+	lock_guard<mutex> lock(m_lock);
+	m_stats.failedGrabs++;
+}
+
+void CAcquisitionStats::AddRetrieveError()
+{
+	lock_guard<mutex> lock(m_lock);
+	m_stats.retrieveErrors++;
+}
+
+void CAcquisitionStats::AddSkippedImages(guint64 count)
+{
+	lock_guard<mutex> lock(m_lock);
+	m_stats.skippedImages += count;
+}
+
+void CAcquisitionStats::AddLostFrames(guint64 count)
+{
+	lock_guard<mutex> lock(m_lock);
+	m_stats.lostFrames += count;
+}
+
+AcquisitionStats CAcquisitionStats::Get()
+{
+	lock_guard<mutex> lock(m_lock);
+	AcquisitionStats stats = m_stats;
+	// if frames have stopped coming, the time since the last one counts, so the rate drops instead of staying where it was.
+	if (m_frameInterval > 0.0)
+	{
+		double sinceLast = (double)(g_get_monotonic_time() - m_lastFrameTime);
+		stats.fps = 1e6 / (sinceLast > m_frameInterval ? sinceLast : m_frameInterval);
+	}
+	return stats;
+}
+
+bool CAcquisitionStats::StartReporting(int intervalMs, GstElement *element, const string &camera, const string &statsdAddress, const string &prometheusFile,
+	function<void(AcquisitionStats&)> fillGauges)
+{
+	if (intervalMs <= 0 || m_reporter.joinable())
+		return false;
+
+	m_intervalMs = intervalMs;
+	m_element = element;
+	if (m_element != NULL)
+		gst_object_ref(m_element);
+	m_camera = camera;
+	m_prometheusFile = prometheusFile;
+	m_fillGauges = fillGauges;
+	m_lastReport = AcquisitionStats();
+	if (statsdAddress != "" && open_statsd(statsdAddress) == false)
+		cerr << "Statistics will not be sent to statsd." << endl;
+
+	m_isReporting = true;
+	m_reporter = std::thread(&CAcquisitionStats::reporter_thread, this);
+	return true;
+}
+
+void CAcquisitionStats::StopReporting()
+{
+	if (m_reporter.joinable() == false)
+		return;
+
+	{
+		lock_guard<mutex> lock(m_reporterLock);
+		m_isReporting = false;
+	}
+	m_wakeReporter.notify_all();
+	m_reporter.join();
+
+	if (m_statsdSocket != NULL)
+	{
+		g_object_unref(m_statsdSocket);
+		m_statsdSocket = NULL;
+	}
+	if (m_statsdAddress != NULL)
+	{
+		g_object_unref(m_statsdAddress);
+		m_statsdAddress = NULL;
+	}
+	if (m_element != NULL)
+	{
+		gst_object_unref(m_element);
+		m_element = NULL;
+	}
+}
+
+void CAcquisitionStats::reporter_thread()
+{
+	unique_lock<mutex> lock(m_reporterLock);
+	while (m_isReporting == true)
+	{
+		if (m_wakeReporter.wait_for(lock, chrono::milliseconds(m_intervalMs), [this] { return m_isReporting == false; }) == true)
+			break;
+		lock.unlock();
+		report();
+		lock.lock();
+	}
+}
+
+void CAcquisitionStats::report()
+{
+	AcquisitionStats stats = Get();
+	if (m_fillGauges)
+		m_fillGauges(stats);
+
+	if (m_element != NULL)
+		post_message(stats);
+	if (m_statsdSocket != NULL)
+		send_statsd(stats);
+	if (m_prometheusFile != "")
+		write_prometheus(stats);
+
+	m_lastReport = stats;
+}
+
+// An element message, so applications can pick it out in their bus watch with gst_message_has_name(msg, "pylon-stats").
+void CAcquisitionStats::post_message(const AcquisitionStats &stats)
+{
+	GstStructure *structure = gst_structure_new("pylon-stats",
+		"camera", G_TYPE_STRING, m_camera.c_str(),
+		"frames", G_TYPE_UINT64, stats.frames,
+		"failed-grabs", G_TYPE_UINT64, stats.failedGrabs,
+		"retrieve-errors", G_TYPE_UINT64, stats.retrieveErrors,
+		"skipped-images", G_TYPE_UINT64, stats.skippedImages,
+		"lost-frames", G_TYPE_UINT64, stats.lostFrames,
+		"buffers-in-flight", G_TYPE_INT, stats.buffersInFlight,
+		"fps", G_TYPE_DOUBLE, stats.fps,
+		"target-fps", G_TYPE_DOUBLE, stats.targetFps,
+		"grab-to-push-mean-us", G_TYPE_DOUBLE, stats.grabToPush.Mean(),
+		"grab-to-push-p99-us", G_TYPE_INT64, stats.grabToPush.Percentile(0.99),
+		"retrieve-wait-mean-us", G_TYPE_DOUBLE, stats.retrieveWait.Mean(),
+		"retrieve-wait-p99-us", G_TYPE_INT64, stats.retrieveWait.Percentile(0.99),
+		NULL);
+	gst_element_post_message(m_element, gst_message_new_element(GST_OBJECT(m_element), structure));
+}
+
+// "host:port". The host can be a name or an address.
+bool CAcquisitionStats::open_statsd(const string &address)
+{
+	size_t colon = address.rfind(':');
+	if (colon == string::npos)
+	{
+		cerr << "statsd address must be host:port, not " << address << "." << endl;
+		return false;
+	}
+	string host = address.substr(0, colon);
+	guint16 port = (guint16)atoi(address.substr(colon + 1).c_str());
+
+	GError *error = NULL;
+	GResolver *resolver = g_resolver_get_default();
+	GList *addresses = g_resolver_lookup_by_name(resolver, host.c_str(), NULL, &error);
+	g_object_unref(resolver);
+	if (addresses == NULL)
+	{
+		cerr << "Could not resolve statsd host " << host << ": " << (error != NULL ? error->message : "") << endl;
+		if (error != NULL)
+			g_error_free(error);
+		return false;
+	}
+	GInetAddress *inetAddress = (GInetAddress*)addresses->data;
+	m_statsdAddress = g_inet_socket_address_new(inetAddress, port);
+	m_statsdSocket = g_socket_new(g_inet_address_get_family(inetAddress), G_SOCKET_TYPE_DATAGRAM, G_SOCKET_PROTOCOL_UDP, &error);
+	g_resolver_free_addresses(addresses);
+	if (m_statsdSocket == NULL)
+	{
+		cerr << "Could not open a UDP socket for statsd: " << error->message << endl;
+		g_error_free(error);
+		g_object_unref(m_statsdAddress);
+		m_statsdAddress = NULL;
+		return false;
+	}
+	return true;
+}
+
+// Counters go as the change since the last report, everything else as gauges. All in one datagram.
+void CAcquisitionStats::send_statsd(const AcquisitionStats &stats)
+{
+	ostringstream out;
+	string prefix = "pylon." + m_camera + ".";
+	out << prefix << "frames:" << stats.frames - m_lastReport.frames << "|c\n";
+	out << prefix << "failed_grabs:" << stats.failedGrabs - m_lastReport.failedGrabs << "|c\n";
+	out << prefix << "retrieve_errors:" << stats.retrieveErrors - m_lastReport.retrieveErrors << "|c\n";
+	out << prefix << "skipped_images:" << stats.skippedImages - m_lastReport.skippedImages << "|c\n";
+	out << prefix << "lost_frames:" << stats.lostFrames - m_lastReport.lostFrames << "|c\n";
+	out << prefix << "buffers_in_flight:" << stats.buffersInFlight << "|g\n";
+	out << prefix << "fps:" << stats.fps << "|g\n";
+	out << prefix << "target_fps:" << stats.targetFps << "|g\n";
+	out << prefix << "grab_to_push_us.mean:" << stats.grabToPush.Mean() << "|g\n";
+	out << prefix << "grab_to_push_us.p99:" << stats.grabToPush.Percentile(0.99) << "|g\n";
+	out << prefix << "retrieve_wait_us.mean:" << stats.retrieveWait.Mean() << "|g\n";
+	out << prefix << "retrieve_wait_us.p99:" << stats.retrieveWait.Percentile(0.99) << "|g";
+
+	string packet = out.str();
+	GError *error = NULL;
+	if (g_socket_send_to(m_statsdSocket, m_statsdAddress, packet.c_str(), packet.size(), NULL, &error) < 0)
+	{
+		// statsd is best effort. Say what went wrong, and try again next time.
+		cerr << "Could not send statistics to statsd: " << error->message << endl;
+		g_error_free(error);
+	}
+}
+
+// g_file_set_contents() writes a temporary file and renames it, so the collector never sees half a file.
+void CAcquisitionStats::write_prometheus(const AcquisitionStats &stats)
+{
+	string text = stats.ToPrometheus(m_camera);
+	GError *error = NULL;
+	if (g_file_set_contents(m_prometheusFile.c_str(), text.c_str(), text.size(), &error) == FALSE)
+	{
+		cerr << "Could not write statistics to " << m_prometheusFile << ": " << error->message << endl;
+		g_error_free(error);
+	}
+}
@@ -0,0 +1,120 @@
+/*  CAcquisitionStats.h: header file for CAcquisitionStats Class.
+    This counts and times what happens to each image on its way from the Grab Engine to the pipeline, and reports it.
+
+	Copyright 2017 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+
+*/
+
+#pragma once
+
+#include <gst/gst.h>
+#include <gio/gio.h>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// ******* LatencyHistogram *******
+// Times in microseconds, counted in fixed buckets (the same ones Prometheus is given), plus their sum.
+struct LatencyHistogram
+{
+	static const int numBounds = 14;
+	static const gint64 bounds[numBounds]; // upper bound of each bucket, in us. The last bucket (counts[numBounds]) is everything longer.
+
+	guint64 counts[numBounds + 1];
+	guint64 count;
+	gint64 sum;
+
+	LatencyHistogram();
+	void Add(gint64 microseconds);
+	double Mean() const;
+	gint64 Percentile(double fraction) const; // upper bound of the bucket the percentile falls in
+};
+
+// ******* AcquisitionStats *******
+// A snapshot of the counters, from CInstantCameraAppSrc::GetStats(). Counts are since the camera was opened.
+struct AcquisitionStats
+{
+	guint64 frames;          // images handed to the pipeline
+	guint64 failedGrabs;     // Grab Results which came back failed (the last good image went out instead)
+	guint64 retrieveErrors;  // RetrieveResult() timeouts and other exceptions while grabbing
+	guint64 skippedImages;   // images the Grab Engine dropped before we retrieved them (GetNumberOfSkippedImages())
+	guint64 lostFrames;      // images missing from the camera's frame ids (never reached the Grab Engine, or skipped)
+	int buffersInFlight;     // zero-copy buffers held by the pipeline right now
+	double fps;              // frames per second achieved lately
+	double targetFps;        // what the camera is set up for (GetFrameRate()), 0 if unknown (eg: triggered)
+	LatencyHistogram grabToPush;   // from RetrieveResult() handing over the image to the pipeline having its buffer
+	LatencyHistogram retrieveWait; // time spent waiting in RetrieveResult()
+
+	AcquisitionStats();
+	std::string ToPrometheus(const std::string &camera) const;
+};
+
+// ******* CAcquisitionStats *******
+// Collects the statistics from whichever thread grabs (need-data, the grab loop thread, or pylonsrc's streaming thread),
+// and can report them every so often from a thread of its own:
+//  - as an element message named "pylon-stats" on the bus of the pipeline the element is in
+//  - to a statsd server, over UDP ("host:port")
+//  - as a Prometheus text file (eg: for the node_exporter textfile collector), replaced atomically each time
+class CAcquisitionStats
+{
+public:
+	CAcquisitionStats();
+	~CAcquisitionStats();
+
+	void AddFrame(gint64 grabToPushMicroseconds);
+	void AddRetrieveWait(gint64 microseconds);
+	void AddFailedGrab();
+	void AddRetrieveError();
+	void AddSkippedImages(guint64 count);
+	void AddLostFrames(guint64 count);
+	AcquisitionStats Get();
+
+	// fillGauges() is called for each report, to add what the camera knows right then (buffers in flight, target fps).
+	bool StartReporting(int intervalMs, GstElement *element, const std::string &camera, const std::string &statsdAddress, const std::string &prometheusFile,
+		std::function<void(AcquisitionStats&)> fillGauges);
+	void StopReporting();
+
+private:
+	std::mutex m_lock;
+	AcquisitionStats m_stats;
+	gint64 m_lastFrameTime;
+	double m_frameInterval; // moving average, in us
+
+	std::thread m_reporter;
+	std::mutex m_reporterLock;
+	std::condition_variable m_wakeReporter;
+	bool m_isReporting;
+	int m_intervalMs;
+	GstElement *m_element;
+	std::string m_camera;
+	std::string m_prometheusFile;
+	std::function<void(AcquisitionStats&)> m_fillGauges;
+	GSocket *m_statsdSocket;
+	GSocketAddress *m_statsdAddress;
+	AcquisitionStats m_lastReport;
+
+	void reporter_thread();
+	void report();
+	void post_message(const AcquisitionStats &stats);
+	void send_statsd(const AcquisitionStats &stats);
+	void write_prometheus(const AcquisitionStats &stats);
+	bool open_statsd(const std::string &address);
+};
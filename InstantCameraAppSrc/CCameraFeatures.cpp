@@ -0,0 +1,209 @@
+/*  CCameraFeatures.cpp: Definition file for CCameraFeatures Class.
+    The camera features used at runtime, looked up once in the node map instead of by name on every call.
+
+	Copyright 2017, 2018, 2019 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+	*/
+
+#include "CCameraFeatures.h"
+#include <algorithm>
+
+using namespace GenApi;
+
+CCameraFeatures::CCameraFeatures()
+{
+	m_isResolved = false;
+}
+
+// The node of that name, or of the alternative name if there is none. NULL if neither exists.
+INode* CCameraFeatures::find(INodeMap &nodeMap, const char *name, const char *alternative)
+{
+	INode *node = nodeMap.GetNode(name);
+	if (node == NULL && alternative != NULL)
+		node = nodeMap.GetNode(alternative);
+	return node;
+}
+
+// Look up every feature once. isSfnc2: the camera follows SFNC 2.x or later (CInstantCamera::GetSfncVersion()), so its names are tried first.
+// The other name is still tried, as some cameras have a little of both (eg: BCON, which doesn't support USB's migration mode).
+// Assigning a node to a handle of the wrong type (eg: GainRaw is an integer) leaves the handle invalid.
+void CCameraFeatures::Resolve(INodeMap &nodeMap, bool isSfnc2)
+{
+	Width = nodeMap.GetNode("Width");
+	Height = nodeMap.GetNode("Height");
+	OffsetX = nodeMap.GetNode("OffsetX");
+	OffsetY = nodeMap.GetNode("OffsetY");
+	CenterX = nodeMap.GetNode("CenterX");
+	CenterY = nodeMap.GetNode("CenterY");
+	BinningHorizontal = nodeMap.GetNode("BinningHorizontal");
+	BinningVertical = nodeMap.GetNode("BinningVertical");
+	DecimationHorizontal = nodeMap.GetNode("DecimationHorizontal");
+	DecimationVertical = nodeMap.GetNode("DecimationVertical");
+	PixelFormat = nodeMap.GetNode("PixelFormat");
+	PayloadSize = nodeMap.GetNode("PayloadSize");
+	AcquisitionFrameRateEnable = nodeMap.GetNode("AcquisitionFrameRateEnable");
+	ExposureAuto = nodeMap.GetNode("ExposureAuto");
+	GainAuto = nodeMap.GetNode("GainAuto");
+	BalanceWhiteAuto = nodeMap.GetNode("BalanceWhiteAuto");
+	TriggerSelector = nodeMap.GetNode("TriggerSelector");
+	TriggerMode = nodeMap.GetNode("TriggerMode");
+	TriggerSource = nodeMap.GetNode("TriggerSource");
+	GainRaw = nodeMap.GetNode("GainRaw");
+	Gain = nodeMap.GetNode("Gain");
+
+	if (isSfnc2 == true)
+	{
+		ResultingFrameRate = find(nodeMap, "ResultingFrameRate", "ResultingFrameRateAbs");
+		AcquisitionFrameRate = find(nodeMap, "AcquisitionFrameRate", "AcquisitionFrameRateAbs");
+		ExposureTime = find(nodeMap, "ExposureTime", "ExposureTimeAbs");
+	}
+	else
+	{
+		ResultingFrameRate = find(nodeMap, "ResultingFrameRateAbs", "ResultingFrameRate");
+		AcquisitionFrameRate = find(nodeMap, "AcquisitionFrameRateAbs", "AcquisitionFrameRate");
+		ExposureTime = find(nodeMap, "ExposureTimeAbs", "ExposureTime");
+	}
+	// MIPI cameras don't report a resulting frame rate. What they're set to is the best there is.
+	if (ResultingFrameRate.IsValid() == false)
+		ResultingFrameRate = AcquisitionFrameRate;
+
+	m_isResolved = true;
+}
+
+// Let go of every handle (before the node map goes away with its device).
+void CCameraFeatures::Reset()
+{
+	Width.Release();
+	Height.Release();
+	OffsetX.Release();
+	OffsetY.Release();
+	CenterX.Release();
+	CenterY.Release();
+	BinningHorizontal.Release();
+	BinningVertical.Release();
+	DecimationHorizontal.Release();
+	DecimationVertical.Release();
+	PixelFormat.Release();
+	PayloadSize.Release();
+	ResultingFrameRate.Release();
+	AcquisitionFrameRateEnable.Release();
+	AcquisitionFrameRate.Release();
+	ExposureTime.Release();
+	ExposureAuto.Release();
+	Gain.Release();
+	GainRaw.Release();
+	GainAuto.Release();
+	BalanceWhiteAuto.Release();
+	TriggerSelector.Release();
+	TriggerMode.Release();
+	TriggerSource.Release();
+	m_isResolved = false;
+}
+
+bool CCameraFeatures::IsResolved()
+{
+	return m_isResolved;
+}
+
+int CCameraFeatures::GetWidth()
+{
+	return IsReadable(Width) ? (int)Width->GetValue() : -1;
+}
+
+int CCameraFeatures::GetHeight()
+{
+	return IsReadable(Height) ? (int)Height->GetValue() : -1;
+}
+
+// The frame rate the camera achieves with its current settings (exposure, AOI, bandwidth...).
+double CCameraFeatures::GetFrameRate()
+{
+	return IsReadable(ResultingFrameRate) ? ResultingFrameRate->GetValue() : -1;
+}
+
+bool CCameraFeatures::SetFrameRate(double framesPerSecond)
+{
+	if (IsWritable(AcquisitionFrameRateEnable))
+		AcquisitionFrameRateEnable->SetValue(true);
+	if (IsWritable(AcquisitionFrameRate) == false)
+		return false;
+	AcquisitionFrameRate->SetValue(framesPerSecond);
+	return true;
+}
+
+// Without the limit, the camera runs at whatever its settings allow. MIPI cameras have no enable, so their limit is set as high as it goes.
+bool CCameraFeatures::SetMaxFrameRate()
+{
+	if (IsWritable(AcquisitionFrameRateEnable))
+	{
+		AcquisitionFrameRateEnable->SetValue(false);
+		return true;
+	}
+	if (IsWritable(AcquisitionFrameRate) == false)
+		return false;
+	AcquisitionFrameRate->SetValue(AcquisitionFrameRate->GetMax());
+	return true;
+}
+
+double CCameraFeatures::GetExposureTime()
+{
+	return IsReadable(ExposureTime) ? ExposureTime->GetValue() : -1;
+}
+
+bool CCameraFeatures::SetExposureTime(double microseconds)
+{
+	if (IsWritable(ExposureTime) == false)
+		return false;
+	ExposureTime->SetValue(microseconds);
+	return true;
+}
+
+// In dB, or in the camera's raw units for SFNC 1.x cameras.
+double CCameraFeatures::GetGain()
+{
+	if (IsReadable(Gain))
+		return Gain->GetValue();
+	if (IsReadable(GainRaw))
+		return (double)GainRaw->GetValue();
+	return -1;
+}
+
+bool CCameraFeatures::SetGain(double gain)
+{
+	if (IsWritable(Gain))
+	{
+		Gain->SetValue(gain);
+		return true;
+	}
+	if (IsWritable(GainRaw))
+	{
+		// raw gain goes in steps, and within limits of its own.
+		int64_t raw = (int64_t)gain;
+		raw = std::max(GainRaw->GetMin(), std::min(GainRaw->GetMax(), raw));
+		if (GainRaw->GetInc() > 1)
+			raw -= (raw - GainRaw->GetMin()) % GainRaw->GetInc();
+		GainRaw->SetValue(raw);
+		return true;
+	}
+	return false;
+}
+
+int64_t CCameraFeatures::GetPayloadSize()
+{
+	return IsReadable(PayloadSize) ? PayloadSize->GetValue() : -1;
+}
@@ -0,0 +1,85 @@
+/*  CCameraFeatures.h: header file for CCameraFeatures Class.
+    The camera features used at runtime, looked up once in the node map instead of by name on every call.
+
+	Copyright 2017 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+
+*/
+
+#pragma once
+
+#include <pylon/PylonIncludes.h>
+
+// ******* CCameraFeatures *******
+// GetNode("name") searches the node map by string every time, and some features have a different name depending on the camera:
+// GigE cameras follow SFNC 1.x (eg: ExposureTimeAbs, ResultingFrameRateAbs), USB and BCON cameras follow SFNC 2.x and up (eg: ExposureTime, ResultingFrameRate),
+// and MIPI cameras have no resulting frame rate at all. Resolve() sorts this out once, when the camera is opened, and keeps typed handles to the features.
+// A handle is invalid if the camera doesn't have the feature. IsReadable() / IsWritable() still apply, as access can depend on other settings.
+// The handles belong to the node map of one device: Reset() before the device is closed or destroyed, and Resolve() again after (re)opening it.
+class CCameraFeatures
+{
+public:
+	CCameraFeatures();
+
+	void Resolve(GenApi::INodeMap &nodeMap, bool isSfnc2);
+	void Reset();
+	bool IsResolved();
+
+	// Reads give -1 if the camera doesn't have the feature (or it can't be read right now). Writes give false if it can't be written.
+	int GetWidth();
+	int GetHeight();
+	double GetFrameRate();
+	bool SetFrameRate(double framesPerSecond);
+	// Let the camera run as fast as its AOI, binning and exposure allow.
+	bool SetMaxFrameRate();
+	double GetExposureTime();
+	bool SetExposureTime(double microseconds);
+	double GetGain();
+	bool SetGain(double gain);
+	int64_t GetPayloadSize();
+
+	GenApi::CIntegerPtr Width;
+	GenApi::CIntegerPtr Height;
+	GenApi::CIntegerPtr OffsetX;
+	GenApi::CIntegerPtr OffsetY;
+	GenApi::CBooleanPtr CenterX;
+	GenApi::CBooleanPtr CenterY;
+	GenApi::CIntegerPtr BinningHorizontal;
+	GenApi::CIntegerPtr BinningVertical;
+	GenApi::CIntegerPtr DecimationHorizontal;   // (not on every camera)
+	GenApi::CIntegerPtr DecimationVertical;
+	GenApi::CEnumerationPtr PixelFormat;
+	GenApi::CIntegerPtr PayloadSize;
+	GenApi::CFloatPtr ResultingFrameRate;       // ResultingFrameRateAbs (SFNC 1.x) or ResultingFrameRate. MIPI: AcquisitionFrameRate
+	GenApi::CBooleanPtr AcquisitionFrameRateEnable;
+	GenApi::CFloatPtr AcquisitionFrameRate;     // AcquisitionFrameRateAbs (SFNC 1.x) or AcquisitionFrameRate
+	GenApi::CFloatPtr ExposureTime;             // ExposureTimeAbs (SFNC 1.x) or ExposureTime, in us
+	GenApi::CEnumerationPtr ExposureAuto;
+	GenApi::CFloatPtr Gain;                     // Gain in dB (SFNC 2.x). SFNC 1.x cameras have GainRaw instead (GetGain() / SetGain() use whichever there is)
+	GenApi::CIntegerPtr GainRaw;
+	GenApi::CEnumerationPtr GainAuto;
+	GenApi::CEnumerationPtr BalanceWhiteAuto;
+	GenApi::CEnumerationPtr TriggerSelector;
+	GenApi::CEnumerationPtr TriggerMode;
+	GenApi::CEnumerationPtr TriggerSource;
+
+private:
+	bool m_isResolved;
+
+	static GenApi::INode* find(GenApi::INodeMap &nodeMap, const char *name, const char *alternative = NULL);
+};
@@ -0,0 +1,523 @@
+/*  CCameraManager.cpp: Definition file for CCameraManager Class.
+    Opens several cameras for one pipeline, shares the bandwidth between them, and starts them together.
+
+	Copyright 2017, 2018, 2019 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+	*/
+
+#include "CCameraManager.h"
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+
+using namespace Pylon;
+using namespace GenApi;
+using namespace std;
+
+// An integer feature set as near as it can be to a value: within its limits, and on its increment.
+static void set_nearest(CIntegerPtr ptrInteger, int64_t value)
+{
+	value = max(ptrInteger->GetMin(), min(ptrInteger->GetMax(), value));
+	if (ptrInteger->GetInc() > 1)
+		value -= (value - ptrInteger->GetMin()) % ptrInteger->GetInc();
+	ptrInteger->SetValue(value);
+}
+
+// The broadcast address of a GigE camera's subnet (eg: 192.168.1.255 for 192.168.1.20 with 255.255.255.0). "" if its addresses can't be read.
+static string subnet_broadcast(const CDeviceInfo &info)
+{
+	String_t ipAddress, subnetMask;
+	unsigned int ip[4], mask[4];
+	if (info.GetPropertyValue("IpAddress", ipAddress) == false || info.GetPropertyValue("SubnetMask", subnetMask) == false ||
+		sscanf(ipAddress.c_str(), "%u.%u.%u.%u", &ip[0], &ip[1], &ip[2], &ip[3]) != 4 ||
+		sscanf(subnetMask.c_str(), "%u.%u.%u.%u", &mask[0], &mask[1], &mask[2], &mask[3]) != 4)
+		return "";
+	char address[16];
+	snprintf(address, sizeof(address), "%u.%u.%u.%u", (ip[0] | ~mask[0]) & 0xFF, (ip[1] | ~mask[1]) & 0xFF, (ip[2] | ~mask[2]) & 0xFF, (ip[3] | ~mask[3]) & 0xFF);
+	return address;
+}
+
+CCameraManager::CCameraManager()
+{
+	// (CTlFactory is used before any camera is made)
+	Pylon::PylonInitialize();
+	m_isTriggering = false;
+	m_triggerRate = 0;
+	m_isPtp = false;
+	m_gigeTl = NULL;
+	m_deviceKey = 0;
+	m_groupKey = 1;
+	m_groupMask = 0xffffffff;
+}
+
+CCameraManager::~CCameraManager()
+{
+	stop_trigger();
+	m_synchronizer.Detach();
+	for (size_t i = 0; i < m_cameras.size(); i++)
+		delete m_cameras[i];
+	if (m_gigeTl != NULL)
+		CTlFactory::GetInstance().ReleaseTl(m_gigeTl);
+	Pylon::PylonTerminate();
+}
+
+int CCameraManager::Open(const vector<string> &serialNumbers, int maxCameras)
+{
+	try
+	{
+		vector<string> serials = serialNumbers;
+		if (serials.empty() == true)
+		{
+			DeviceInfoList_t devices;
+			CTlFactory::GetInstance().EnumerateDevices(devices);
+			for (size_t i = 0; i < devices.size(); i++)
+				serials.push_back(devices[i].GetSerialNumber().c_str());
+		}
+
+		for (size_t i = 0; i < serials.size() && (maxCameras < 0 || (int)m_cameras.size() < maxCameras); i++)
+		{
+			CInstantCameraAppSrc *pCamera = new CInstantCameraAppSrc(serials[i]);
+			if (pCamera->IsPylonDeviceAttached() == false)
+			{
+				cout << "Could not open camera " << serials[i] << "." << endl;
+				delete pCamera;
+				continue;
+			}
+			cout << "Opened camera " << m_cameras.size() << ": " << pCamera->GetDeviceInfo().GetFriendlyName() << endl;
+			m_cameras.push_back(pCamera);
+		}
+		return (int)m_cameras.size();
+	}
+	catch (GenICam::GenericException &e)
+	{
+		cerr << "An exception occured in Open(): " << endl << e.GetDescription() << endl;
+		return (int)m_cameras.size();
+	}
+	catch (std::exception &e)
+	{
+		cerr << "An exception occurred in Open(): " << endl << e.what() << endl;
+		return (int)m_cameras.size();
+	}
+}
+
+size_t CCameraManager::GetSize()
+{
+	return m_cameras.size();
+}
+
+CInstantCameraAppSrc& CCameraManager::GetCamera(size_t index)
+{
+	return *m_cameras.at(index);
+}
+
+bool CCameraManager::InitCameras(int width, int height, int framesPerSecond, bool useOnDemand, bool useTrigger, int scaledWidth, int scaledHeight, int rotation,
+	int numFramesToGrab, string filename, const GrabSettings &grabSettings)
+{
+	bool isInitialized = true;
+	for (size_t i = 0; i < m_cameras.size(); i++)
+	{
+		if (m_cameras[i]->InitCamera(width, height, framesPerSecond, useOnDemand, useTrigger, scaledWidth, scaledHeight, rotation, numFramesToGrab, filename, grabSettings) == false)
+		{
+			cout << "Could not initialize camera " << i << "." << endl;
+			isInitialized = false;
+		}
+	}
+	return isInitialized;
+}
+
+// Which link a camera shares with others. All USB cameras share the host's USB bandwidth (unless you know better about your host's controllers).
+// GigE cameras share the network interface they're reached through. Other interfaces (BCON, MIPI, CXP) are point to point, so each camera has its own.
+string CCameraManager::link_name(CInstantCameraAppSrc &camera)
+{
+	CDeviceInfo info = camera.GetDeviceInfo();
+	if (info.GetDeviceClass() == BaslerUsbDeviceClass)
+		return "USB";
+	if (info.GetDeviceClass() == BaslerGigEDeviceClass)
+		return string("GigE interface ") + info.GetInterface().c_str();
+	return string(info.GetDeviceClass().c_str()) + " " + info.GetSerialNumber().c_str();
+}
+
+// Hold a camera to so many bytes per second.
+// USB cameras (and newer GigE cameras) have a throughput limit. Older GigE cameras instead wait between packets (GevSCPD, in ticks), so the wait is worked out from the packet size.
+bool CCameraManager::set_throughput_limit(CInstantCameraAppSrc &camera, double bytesPerSecond)
+{
+	INodeMap &nodeMap = camera.GetNodeMap();
+	if (IsWritable(nodeMap.GetNode("DeviceLinkThroughputLimitMode")))
+	{
+		CEnumerationPtr(nodeMap.GetNode("DeviceLinkThroughputLimitMode"))->FromString("On");
+		set_nearest(nodeMap.GetNode("DeviceLinkThroughputLimit"), (int64_t)bytesPerSecond);
+		return true;
+	}
+
+	CIntegerPtr ptrPacketDelay = nodeMap.GetNode("GevSCPD");
+	CIntegerPtr ptrPacketSize = nodeMap.GetNode("GevSCPSPacketSize");
+	CIntegerPtr ptrTickFrequency = nodeMap.GetNode("GevTimestampTickFrequency");
+	if (IsWritable(ptrPacketDelay) && IsReadable(ptrPacketSize) && IsReadable(ptrTickFrequency))
+	{
+		// each packet takes packetSize / 125 MB/s on the wire. To average bytesPerSecond, wait the rest of packetSize / bytesPerSecond.
+		double packetSize = (double)ptrPacketSize->GetValue();
+		double delay = packetSize / bytesPerSecond - packetSize / 125000000.0;
+		set_nearest(ptrPacketDelay, (int64_t)(max(0.0, delay) * ptrTickFrequency->GetValue()));
+		return true;
+	}
+	return false;
+}
+
+bool CCameraManager::ShareBandwidth(double usbBytesPerSecond, double gigeBytesPerSecond)
+{
+	try
+	{
+		// What each camera needs for its AOI, pixel format and frame rate. The frame rate it's set to, if it has one (otherwise whatever it achieves right now).
+		vector<double> needs;
+		map<string, double> linkNeeds;
+		for (size_t i = 0; i < m_cameras.size(); i++)
+		{
+			CCameraFeatures &features = m_cameras[i]->GetFeatures();
+			double frameRate = features.GetFrameRate();
+			if (IsReadable(features.AcquisitionFrameRate) && (IsReadable(features.AcquisitionFrameRateEnable) == false || features.AcquisitionFrameRateEnable->GetValue() == true))
+				frameRate = features.AcquisitionFrameRate->GetValue();
+			double need = (double)max((int64_t)0, features.GetPayloadSize()) * max(0.0, frameRate);
+			needs.push_back(need);
+			linkNeeds[link_name(*m_cameras[i])] += need;
+		}
+
+		// Each camera gets the link's bandwidth in proportion to its need. If they all fit, that leaves each one some headroom.
+		// If they don't, each one slows down by the same fraction (the frame rates follow, see SetCommonFrameRate()).
+		bool isShared = true;
+		for (size_t i = 0; i < m_cameras.size(); i++)
+		{
+			string link = link_name(*m_cameras[i]);
+			CDeviceInfo info = m_cameras[i]->GetDeviceInfo();
+			double linkBandwidth = (info.GetDeviceClass() == BaslerUsbDeviceClass) ? usbBytesPerSecond : gigeBytesPerSecond;
+			if (info.GetDeviceClass() != BaslerUsbDeviceClass && info.GetDeviceClass() != BaslerGigEDeviceClass)
+				continue; // (nothing shared)
+
+			double share = (linkNeeds[link] > 0) ? linkBandwidth * needs[i] / linkNeeds[link] : linkBandwidth;
+			cout << "Camera " << i << " (" << link << ") needs " << needs[i] / 1000000 << " MB/s, gets " << share / 1000000 << " MB/s." << endl;
+			if (linkNeeds[link] > linkBandwidth)
+				cout << "  The cameras on " << link << " need more than it can carry (" << linkNeeds[link] / 1000000 << " MB/s). They'll be slower." << endl;
+			if (set_throughput_limit(*m_cameras[i], share) == false)
+			{
+				cout << "  Camera " << i << " can't limit its bandwidth." << endl;
+				isShared = false;
+			}
+		}
+		return isShared;
+	}
+	catch (GenICam::GenericException &e)
+	{
+		cerr << "An exception occured in ShareBandwidth(): " << endl << e.GetDescription() << endl;
+		return false;
+	}
+	catch (std::exception &e)
+	{
+		cerr << "An exception occurred in ShareBandwidth(): " << endl << e.what() << endl;
+		return false;
+	}
+}
+
+double CCameraManager::SetCommonFrameRate(double framesPerSecond)
+{
+	try
+	{
+		// settings like exposure time, bandwidth and AOI decide what each camera can do. The slowest one sets the pace.
+		double frameRate = framesPerSecond;
+		if (frameRate <= 0)
+		{
+			for (size_t i = 0; i < m_cameras.size(); i++)
+			{
+				double cameraFrameRate = m_cameras[i]->GetFrameRate();
+				if (cameraFrameRate > 0 && (frameRate <= 0 || cameraFrameRate < frameRate))
+					frameRate = cameraFrameRate;
+			}
+		}
+		if (frameRate <= 0)
+			return -1;
+
+		for (size_t i = 0; i < m_cameras.size(); i++)
+			m_cameras[i]->SetFrameRate(frameRate);
+		cout << "Common frame rate: " << frameRate << " fps" << endl;
+		return frameRate;
+	}
+	catch (GenICam::GenericException &e)
+	{
+		cerr << "An exception occured in SetCommonFrameRate(): " << endl << e.GetDescription() << endl;
+		return -1;
+	}
+	catch (std::exception &e)
+	{
+		cerr << "An exception occurred in SetCommonFrameRate(): " << endl << e.what() << endl;
+		return -1;
+	}
+}
+
+// Note: the cameras must not use Image-on-Demand (InitCamera(..., useOnDemand = false, useTrigger = false, ...)), as that triggers each one by itself.
+bool CCameraManager::UseSynchronizedTrigger(double framesPerSecond, bool usePtp)
+{
+	try
+	{
+		if (m_cameras.empty() == true || framesPerSecond <= 0)
+			return false;
+		for (size_t i = 0; i < m_cameras.size(); i++)
+		{
+			if (m_cameras[i]->GetDeviceInfo().GetDeviceClass() != BaslerGigEDeviceClass || IsWritable(m_cameras[i]->GetNodeMap().GetNode("ActionDeviceKey")) == false)
+			{
+				cout << "Camera " << i << " has no action commands (GigE only). Cameras will run freely at the common frame rate." << endl;
+				return false;
+			}
+		}
+
+		if (m_gigeTl == NULL)
+			m_gigeTl = dynamic_cast<IGigETransportLayer*>(CTlFactory::GetInstance().CreateTl(BaslerGigEDeviceClass));
+		if (m_gigeTl == NULL)
+			return false;
+
+		// Sent to the cameras' subnet only (all on one. Otherwise, everywhere).
+		m_broadcastAddress = subnet_broadcast(m_cameras[0]->GetDeviceInfo());
+		for (size_t i = 1; i < m_cameras.size(); i++)
+		{
+			if (subnet_broadcast(m_cameras[i]->GetDeviceInfo()) != m_broadcastAddress)
+				m_broadcastAddress = "";
+		}
+		if (m_broadcastAddress == "")
+			m_broadcastAddress = "255.255.255.255";
+
+		// The device key keeps other hosts' commands away from our cameras (and ours from theirs).
+		m_deviceKey = g_random_int();
+		for (size_t i = 0; i < m_cameras.size(); i++)
+		{
+			INodeMap &nodeMap = m_cameras[i]->GetNodeMap();
+			CIntegerPtr(nodeMap.GetNode("ActionSelector"))->SetValue(1);
+			CIntegerPtr(nodeMap.GetNode("ActionDeviceKey"))->SetValue(m_deviceKey);
+			CIntegerPtr(nodeMap.GetNode("ActionGroupKey"))->SetValue(m_groupKey);
+			CIntegerPtr(nodeMap.GetNode("ActionGroupMask"))->SetValue(m_groupMask);
+
+			CCameraFeatures &features = m_cameras[i]->GetFeatures();
+			features.TriggerSelector->FromString("FrameStart");
+			features.TriggerMode->FromString("On");
+			features.TriggerSource->FromString("Action1");
+			// the triggers set the pace now
+			if (IsWritable(features.AcquisitionFrameRateEnable))
+				features.AcquisitionFrameRateEnable->SetValue(false);
+
+			if (usePtp == true && IsWritable(nodeMap.GetNode("GevIEEE1588")))
+				CBooleanPtr(nodeMap.GetNode("GevIEEE1588"))->SetValue(true);
+			else if (usePtp == true && IsWritable(nodeMap.GetNode("PtpEnable")))
+				CBooleanPtr(nodeMap.GetNode("PtpEnable"))->SetValue(true);
+		}
+
+		// The cameras agree on a master clock between themselves. Until they have, their clocks can't be compared, so triggers are sent straight away instead of scheduled.
+		m_isPtp = false;
+		if (usePtp == true)
+		{
+			cout << "Waiting for the cameras' clocks to synchronize (PTP)..." << endl;
+			m_isPtp = wait_for_ptp(20000);
+			if (m_isPtp == false)
+				cout << "The cameras' clocks did not synchronize. Triggering without PTP." << endl;
+		}
+
+		m_triggerRate = framesPerSecond;
+		cout << "Cameras will be triggered together at " << m_triggerRate << " fps" << (m_isPtp ? ", scheduled with PTP." : ".") << endl;
+		return true;
+	}
+	catch (GenICam::GenericException &e)
+	{
+		cerr << "An exception occured in UseSynchronizedTrigger(): " << endl << e.GetDescription() << endl;
+		return false;
+	}
+	catch (std::exception &e)
+	{
+		cerr << "An exception occurred in UseSynchronizedTrigger(): " << endl << e.what() << endl;
+		return false;
+	}
+}
+
+// Wait until every camera is either the PTP master or a slave of it.
+bool CCameraManager::wait_for_ptp(int timeoutMs)
+{
+	gint64 deadline = g_get_monotonic_time() + (gint64)timeoutMs * 1000;
+	while (g_get_monotonic_time() < deadline)
+	{
+		bool isLocked = true;
+		for (size_t i = 0; i < m_cameras.size() && isLocked == true; i++)
+		{
+			INodeMap &nodeMap = m_cameras[i]->GetNodeMap();
+			string status = "";
+			if (IsWritable(nodeMap.GetNode("GevIEEE1588DataSetLatch")))
+			{
+				CCommandPtr(nodeMap.GetNode("GevIEEE1588DataSetLatch"))->Execute();
+				status = CEnumerationPtr(nodeMap.GetNode("GevIEEE1588StatusLatched"))->ToString().c_str();
+			}
+			else if (IsWritable(nodeMap.GetNode("PtpDataSetLatch")))
+			{
+				CCommandPtr(nodeMap.GetNode("PtpDataSetLatch"))->Execute();
+				status = CEnumerationPtr(nodeMap.GetNode("PtpStatus"))->ToString().c_str();
+			}
+			isLocked = (status == "Master" || status == "Slave");
+		}
+		if (isLocked == true)
+			return true;
+		g_usleep(500000);
+	}
+	return false;
+}
+
+// The camera's clock right now, in ns with PTP.
+gint64 CCameraManager::get_camera_time(CInstantCameraAppSrc &camera)
+{
+	INodeMap &nodeMap = camera.GetNodeMap();
+	if (IsWritable(nodeMap.GetNode("GevTimestampControlLatch")))
+	{
+		CCommandPtr(nodeMap.GetNode("GevTimestampControlLatch"))->Execute();
+		return (gint64)CIntegerPtr(nodeMap.GetNode("GevTimestampValue"))->GetValue();
+	}
+	CCommandPtr(nodeMap.GetNode("TimestampLatch"))->Execute();
+	return (gint64)CIntegerPtr(nodeMap.GetNode("TimestampLatchValue"))->GetValue();
+}
+
+// Sends an action command to all cameras at the trigger rate, until StopCameras().
+// With PTP, the triggers are at base + n periods on the cameras' common clock, which is latched once for the base. Each command goes out a lead ahead of
+// its time and says when to trigger, so network delays, this thread's wake-ups and the latch's round trip don't get into the period.
+// The host's clock is only matched to the cameras' to know when to send: once a second (one latch), so its drift doesn't eat into the lead.
+void CCameraManager::trigger_thread()
+{
+	const gint64 lead = 20000000; // ns
+	gint64 period = (gint64)(1000000.0 / m_triggerRate); // us
+	gint64 nextTrigger = g_get_monotonic_time();
+	gint64 periodNs = (gint64)(1000000000.0 / m_triggerRate);
+	gint64 base = 0;
+	gint64 cameraTime = 0; // the cameras' clock (ns) at hostTime (us), last time it was latched
+	gint64 hostTime = 0;
+	gint64 n = 0;
+	std::unique_lock<std::mutex> lock(m_triggerLock);
+	while (m_isTriggering == true)
+	{
+		try
+		{
+			if (m_isPtp == true)
+			{
+				if (base == 0 || g_get_monotonic_time() - hostTime > 1000000)
+				{
+					cameraTime = get_camera_time(*m_cameras[0]);
+					hostTime = g_get_monotonic_time();
+					if (base == 0)
+						base = cameraTime + lead;
+				}
+				// (behind by more than the lead, eg: the host stalled: skip the triggers which are past, rather than schedule them in the past)
+				gint64 cameraNow = cameraTime + (g_get_monotonic_time() - hostTime) * 1000;
+				if (base + n * periodNs < cameraNow)
+					n = (cameraNow - base) / periodNs + 1;
+				m_gigeTl->IssueScheduledActionCommand(m_deviceKey, m_groupKey, m_groupMask, (uint64_t)(base + n * periodNs), m_broadcastAddress.c_str());
+				n++;
+				// send the next one a lead ahead of its trigger
+				nextTrigger = hostTime + (base + n * periodNs - lead - cameraTime) / 1000;
+			}
+			else
+			{
+				m_gigeTl->IssueActionCommand(m_deviceKey, m_groupKey, m_groupMask, m_broadcastAddress.c_str());
+				// keep to the rate, rather than a period after each command.
+				nextTrigger += period;
+			}
+		}
+		catch (GenICam::GenericException &e)
+		{
+			cerr << "An exception occured in trigger_thread(): " << endl << e.GetDescription() << endl;
+			nextTrigger += period;
+		}
+
+		if (nextTrigger < g_get_monotonic_time())
+			nextTrigger = g_get_monotonic_time();
+		m_wakeTrigger.wait_for(lock, std::chrono::microseconds(nextTrigger - g_get_monotonic_time()), [this] { return m_isTriggering == false; });
+	}
+}
+
+void CCameraManager::stop_trigger()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_triggerLock);
+		m_isTriggering = false;
+		m_wakeTrigger.notify_all();
+	}
+	if (m_triggerThread.joinable())
+		m_triggerThread.join();
+}
+
+vector<GstElement*> CCameraManager::GetSources()
+{
+	vector<GstElement*> sources;
+	for (size_t i = 0; i < m_cameras.size(); i++)
+		sources.push_back(m_cameras[i]->GetSource());
+	return sources;
+}
+
+bool CCameraManager::SynchronizeFrames(const vector<GstElement*> &sources, gint64 tolerance)
+{
+	// Triggered together, the cameras' frame ids count alike, which is exact. Otherwise, their images are matched by when they were taken (or arrived), on the pipeline clock.
+	FrameSyncMode mode = (m_triggerRate > 0) ? FrameSyncFrameId : FrameSyncRunningTime;
+
+	double frameRate = (m_triggerRate > 0) ? m_triggerRate : (m_cameras.empty() == false) ? m_cameras[0]->GetFrameRate() : 0;
+	guint64 maxDifference = 0;
+	if (mode != FrameSyncFrameId)
+	{
+		if (tolerance >= 0)
+			maxDifference = (guint64)tolerance;
+		else if (frameRate > 0)
+			maxDifference = (guint64)(GST_SECOND / frameRate / 2);
+		else
+			maxDifference = GST_SECOND / 60;
+	}
+
+	// an image waits for the others a few frames at most
+	int timeoutMs = (frameRate > 0) ? max(200, (int)(3000 / frameRate)) : 1000;
+	return m_synchronizer.Attach(sources, mode, maxDifference, timeoutMs);
+}
+
+CFrameSynchronizer& CCameraManager::GetSynchronizer()
+{
+	return m_synchronizer;
+}
+
+// Start all cameras grabbing, then (with the synchronized trigger) start triggering them, so the first trigger reaches all of them.
+bool CCameraManager::StartCameras()
+{
+	for (size_t i = 0; i < m_cameras.size(); i++)
+	{
+		if (m_cameras[i]->StartCamera() == false)
+		{
+			cout << "Could not start camera " << i << "." << endl;
+			return false;
+		}
+	}
+
+	if (m_triggerRate > 0 && m_triggerThread.joinable() == false)
+	{
+		m_isTriggering = true;
+		m_triggerThread = std::thread(&CCameraManager::trigger_thread, this);
+	}
+	return true;
+}
+
+bool CCameraManager::StopCameras()
+{
+	stop_trigger();
+	bool isStopped = true;
+	for (size_t i = 0; i < m_cameras.size(); i++)
+		isStopped = m_cameras[i]->StopCamera() && isStopped;
+	return isStopped;
+}
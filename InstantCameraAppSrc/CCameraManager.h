@@ -0,0 +1,104 @@
+/*  CCameraManager.h: header file for CCameraManager Class.
+    Opens several cameras for one pipeline, shares the bandwidth between them, and starts them together.
+
+	Copyright 2017 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+
+*/
+
+#pragma once
+
+#include "CInstantCameraAppSrc.h"
+#include "CFrameSynchronizer.h"
+#include <pylon/gige/GigETransportLayer.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// ******* CCameraManager *******
+// Like Pylon's CInstantCameraArray, for CInstantCameraAppSrc cameras:
+//   CCameraManager cameras;
+//   cameras.Open();                 // every camera found (or the serial numbers given)
+//   cameras.InitCameras(...);       // the same settings for each, like InitCamera()
+//   cameras.ShareBandwidth();       // split each link between the cameras on it
+//   cameras.SetCommonFrameRate();   // the fastest rate all of them can do
+//   cameras.UseSynchronizedTrigger(); // optional, GigE only
+//   vector<GstElement*> sources = cameras.GetSources();
+//   cameras.SynchronizeFrames(sources); // optional, release the images in matched sets
+//   ... link the sources into the pipeline ...
+//   cameras.StartCameras();
+// Cameras sharing a link (all USB cameras on the host, GigE cameras on the same network interface) get a share of its bandwidth in proportion to what they
+// need (AOI x fps x bytes per pixel, ie: PayloadSize x fps). So no camera's images get corrupted by the others, and the split follows the AOIs without tuning.
+class CCameraManager
+{
+public:
+	CCameraManager();
+	~CCameraManager();
+	CCameraManager(const CCameraManager&) = delete;
+	CCameraManager& operator=(const CCameraManager&) = delete;
+
+	// Open the cameras with these serial numbers (in this order), or every camera found if none are given (up to maxCameras, -1 = no limit). Returns how many were opened.
+	int Open(const std::vector<std::string> &serialNumbers = std::vector<std::string>(), int maxCameras = -1);
+	size_t GetSize();
+	CInstantCameraAppSrc& GetCamera(size_t index);
+
+	// InitCamera() on each camera. False if any of them fails.
+	bool InitCameras(int width, int height, int framesPerSecond, bool useOnDemand, bool useTrigger, int scaledWidth = -1, int scaledHeight = -1, int rotation = -1,
+		int numFramesToGrab = -1, std::string filename = "", const GrabSettings &grabSettings = GrabSettings());
+	// Bytes per second each link can carry. A USB 3 host typically manages 350-400 MB/s, but it depends on the chipset, so 300 MB/s is a safe start. GigE is 125 MB/s, less the protocol overhead.
+	bool ShareBandwidth(double usbBytesPerSecond = 300000000.0, double gigeBytesPerSecond = 115000000.0);
+	// Set every camera to the same frame rate: the given one, or the fastest all of them can do with their current settings (-1). Returns the frame rate set, -1 on failure.
+	double SetCommonFrameRate(double framesPerSecond = -1);
+	// Trigger all cameras at once with GigE action commands at this rate, instead of letting each one run free. With PTP (IEEE 1588) the cameras' clocks are synchronized,
+	// and each trigger is scheduled a little ahead, so the exposures start together regardless of network delays. Their hardware timestamps match (GrabSettings::useHardwareTimestamps).
+	bool UseSynchronizedTrigger(double framesPerSecond, bool usePtp = true);
+	// One source element for each camera (see CInstantCameraAppSrc::GetSource()), in the order the cameras were opened. Each call makes new ones.
+	std::vector<GstElement*> GetSources();
+	// Group the sources' images into matched sets (see CFrameSynchronizer), by frame id if the cameras are triggered together, otherwise by timestamp.
+	// sources: from GetSources(). tolerance: how far apart the images of a set can be, in ns (-1 = half a frame at the common frame rate).
+	bool SynchronizeFrames(const std::vector<GstElement*> &sources, gint64 tolerance = -1);
+	CFrameSynchronizer& GetSynchronizer();
+	bool StartCameras();
+	bool StopCameras();
+
+private:
+	std::vector<CInstantCameraAppSrc*> m_cameras;
+	CFrameSynchronizer m_synchronizer;
+
+	// synchronized trigger
+	std::thread m_triggerThread;
+	std::mutex m_triggerLock;
+	std::condition_variable m_wakeTrigger;
+	bool m_isTriggering;
+	double m_triggerRate;
+	bool m_isPtp;
+	Pylon::IGigETransportLayer *m_gigeTl;
+	uint32_t m_deviceKey;
+	uint32_t m_groupKey;
+	uint32_t m_groupMask;
+	std::string m_broadcastAddress; // where the action commands go: the cameras' subnet
+
+	std::string link_name(CInstantCameraAppSrc &camera);
+	bool set_throughput_limit(CInstantCameraAppSrc &camera, double bytesPerSecond);
+	bool wait_for_ptp(int timeoutMs);
+	gint64 get_camera_time(CInstantCameraAppSrc &camera);
+	void trigger_thread();
+	void stop_trigger();
+};
@@ -0,0 +1,241 @@
+/*  CFrameAnalyzer.cpp: Definition file for CFrameAnalyzer Class.
+    Measures each image on the grab thread, from a sample of its pixels: luminance and its histogram, motion, focus.
+
+	Copyright 2017-2019 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+
+*/
+
+#include "CFrameAnalyzer.h"
+#include <stdlib.h>
+
+using namespace std;
+
+FrameAnalysis::FrameAnalysis()
+{
+	isValid = false;
+	meanLuminance = 0;
+	for (int i = 0; i < PYLON_FRAME_META_HISTOGRAM_BINS; i++)
+		histogram[i] = 0;
+	motion = 0;
+	focus = 0;
+	score = 0;
+}
+
+CFrameAnalyzer::CFrameAnalyzer()
+{
+	m_step = 8;
+	m_pixelType = Pylon::PixelType_Undefined;
+	m_width = 0;
+	m_height = 0;
+	m_paddingX = 0;
+	m_layout = Layout_None;
+	m_bytesPerPixel = 0;
+	m_offset = 0;
+	m_shift = 0;
+	m_neighbour = 1;
+	m_hasPrevious = false;
+}
+
+void CFrameAnalyzer::SetStep(int step)
+{
+	// even, so a Bayer pattern's samples are all the same colour
+	m_step = (step < 2) ? 2 : step + (step & 1);
+	m_pixelType = Pylon::PixelType_Undefined; // start over with the next image
+}
+
+int CFrameAnalyzer::GetStep()
+{
+	return m_step;
+}
+
+void CFrameAnalyzer::SetCallback(FrameAnalysisCallback callback)
+{
+	m_callback = callback;
+}
+
+void CFrameAnalyzer::configure(Pylon::EPixelType pixelType, int width, int height, size_t paddingX)
+{
+	m_pixelType = pixelType;
+	m_width = width;
+	m_height = height;
+	m_paddingX = paddingX;
+	m_layout = Layout_None;
+	m_offset = 0;
+	m_shift = 0;
+	m_neighbour = 1;
+	m_hasPrevious = false;
+
+	switch (pixelType)
+	{
+	case Pylon::PixelType_BayerGR8:
+	case Pylon::PixelType_BayerRG8:
+	case Pylon::PixelType_BayerGB8:
+	case Pylon::PixelType_BayerBG8:
+		m_neighbour = 2;
+		// (fall through)
+	case Pylon::PixelType_Mono8:
+		m_layout = Layout_Luma8;
+		m_bytesPerPixel = 1;
+		break;
+	case Pylon::PixelType_BayerGR10:
+	case Pylon::PixelType_BayerRG10:
+	case Pylon::PixelType_BayerGB10:
+	case Pylon::PixelType_BayerBG10:
+		m_neighbour = 2;
+		// (fall through)
+	case Pylon::PixelType_Mono10:
+		m_layout = Layout_Luma16;
+		m_bytesPerPixel = 2;
+		m_shift = 2;
+		break;
+	case Pylon::PixelType_BayerGR12:
+	case Pylon::PixelType_BayerRG12:
+	case Pylon::PixelType_BayerGB12:
+	case Pylon::PixelType_BayerBG12:
+		m_neighbour = 2;
+		// (fall through)
+	case Pylon::PixelType_Mono12:
+		m_layout = Layout_Luma16;
+		m_bytesPerPixel = 2;
+		m_shift = 4;
+		break;
+	case Pylon::PixelType_BayerGR16:
+	case Pylon::PixelType_BayerRG16:
+	case Pylon::PixelType_BayerGB16:
+	case Pylon::PixelType_BayerBG16:
+		m_neighbour = 2;
+		// (fall through)
+	case Pylon::PixelType_Mono16:
+		m_layout = Layout_Luma16;
+		m_bytesPerPixel = 2;
+		m_shift = 8;
+		break;
+	case Pylon::PixelType_YUV422_YUYV_Packed: // Y U Y V
+		m_layout = Layout_Yuv422;
+		m_bytesPerPixel = 2;
+		m_offset = 0;
+		break;
+	case Pylon::PixelType_YUV422packed: // U Y V Y
+		m_layout = Layout_Yuv422;
+		m_bytesPerPixel = 2;
+		m_offset = 1;
+		break;
+	case Pylon::PixelType_RGB8packed:
+		m_layout = Layout_Rgb8;
+		m_bytesPerPixel = 3;
+		m_offset = 0;
+		break;
+	case Pylon::PixelType_BGR8packed:
+		m_layout = Layout_Rgb8;
+		m_bytesPerPixel = 3;
+		m_offset = 2;
+		break;
+	default:
+		break;
+	}
+
+	int samplesWide = (width + m_step - 1) / m_step;
+	int samplesHigh = (height + m_step - 1) / m_step;
+	m_samples.assign((size_t)samplesWide * samplesHigh, 0);
+	m_previous.assign(m_samples.size(), 0);
+}
+
+// the next pixel of the same colour after position, or the one before at the end (or itself, if the image is that small)
+inline int CFrameAnalyzer::neighbour_of(int position, int size)
+{
+	if (position + m_neighbour < size)
+		return position + m_neighbour;
+	return (position >= m_neighbour) ? position - m_neighbour : position;
+}
+
+// 0-255
+inline int CFrameAnalyzer::luminance(const uint8_t *pRow, int x)
+{
+	const uint8_t *pPixel = pRow + (size_t)x * m_bytesPerPixel;
+	switch (m_layout)
+	{
+	case Layout_Luma8:
+		return pPixel[0];
+	case Layout_Luma16:
+		return ((pPixel[0] | (pPixel[1] << 8)) >> m_shift) & 0xFF;
+	case Layout_Yuv422:
+		return pPixel[m_offset];
+	case Layout_Rgb8:
+		// BT.601 weights, in 1/256ths
+		return (77 * pPixel[m_offset] + 150 * pPixel[1] + 29 * pPixel[2 - m_offset]) >> 8;
+	default:
+		return 0;
+	}
+}
+
+FrameAnalysis CFrameAnalyzer::Analyze(Pylon::EPixelType pixelType, int width, int height, size_t paddingX, const void *pImage)
+{
+	FrameAnalysis analysis;
+	if (pixelType != m_pixelType || width != m_width || height != m_height || paddingX != m_paddingX)
+		configure(pixelType, width, height, paddingX);
+	if (m_layout == Layout_None || pImage == NULL || width <= 0 || height <= 0)
+		return analysis;
+
+	const uint8_t *pSource = (const uint8_t*)pImage;
+	size_t stride = (size_t)width * m_bytesPerPixel + paddingX;
+	int samplesWide = (width + m_step - 1) / m_step;
+	int samplesHigh = (height + m_step - 1) / m_step;
+	guint64 sum = 0;
+	guint64 gradient = 0;
+	guint64 difference = 0;
+	size_t count = 0;
+
+	for (int y = 0; y < height; y += m_step)
+	{
+		const uint8_t *pRow = pSource + (size_t)y * stride;
+		// the last rows and columns have no neighbours below or to the right: they're compared with the ones above or to the left instead
+		const uint8_t *pBelow = pSource + (size_t)neighbour_of(y, height) * stride;
+		for (int x = 0; x < width; x += m_step)
+		{
+			int value = luminance(pRow, x);
+			int right = luminance(pRow, neighbour_of(x, width));
+			int below = luminance(pBelow, x);
+
+			sum += value;
+			gradient += abs(value - right) + abs(value - below);
+			difference += abs(value - m_previous[count]);
+			analysis.histogram[value * PYLON_FRAME_META_HISTOGRAM_BINS / 256]++;
+			m_samples[count++] = (uint8_t)value;
+		}
+	}
+
+	analysis.isValid = true;
+	analysis.meanLuminance = (double)sum / count;
+	analysis.focus = (double)gradient / (2 * count);
+	analysis.motion = m_hasPrevious ? (double)difference / count : 0;
+	m_samples.swap(m_previous);
+	m_hasPrevious = true;
+
+	if (m_callback)
+	{
+		// (the samples just taken are in m_previous now)
+		AnalysisSamples samples;
+		samples.pLuminance = m_previous.data();
+		samples.width = samplesWide;
+		samples.height = samplesHigh;
+		samples.step = m_step;
+		m_callback(samples, analysis);
+	}
+	return analysis;
+}
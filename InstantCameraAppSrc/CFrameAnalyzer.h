@@ -0,0 +1,106 @@
+/*  CFrameAnalyzer.h: header file for CFrameAnalyzer Class.
+    Measures each image on the grab thread, from a sample of its pixels: luminance and its histogram, motion, focus.
+
+	Copyright 2017 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+
+*/
+
+#pragma once
+
+#include <pylon/PylonIncludes.h>
+#include <gst/gst.h>
+#include <vector>
+#include <functional>
+#include <stdint.h>
+#include <stddef.h>
+#include "PylonFrameMeta.h"
+
+// ******* FrameAnalysis *******
+// What CFrameAnalyzer found in one image. It goes with the image's buffer, in its PylonFrameMeta.
+struct FrameAnalysis
+{
+	bool isValid;          // false if the camera's pixel format isn't one the analyzer reads (packed 10/12 bit, eg)
+	double meanLuminance;  // 0 (black) to 255 (white)
+	guint32 histogram[PYLON_FRAME_META_HISTOGRAM_BINS]; // samples per 16 levels of luminance
+	double motion;         // mean absolute difference from the same samples of the image before, 0-255. 0 for the first image, and after the AOI or format changes
+	double focus;          // mean absolute difference between each sample and the pixels (of its colour) right of and below it. Higher is sharper, for images of the same scene
+	double score;          // whatever the application's FrameAnalysisCallback makes of it. 0 unless set
+
+	FrameAnalysis();
+};
+
+// ******* AnalysisSamples *******
+// The luminance (0-255) of every step-th pixel of every step-th row, row by row, as the analyzer took it. Valid during the callback only.
+struct AnalysisSamples
+{
+	const uint8_t *pLuminance;
+	int width;   // samples per row
+	int height;  // rows of samples
+	int step;    // pixels between samples, across and down
+};
+
+// Called on the grab thread for each image, after the analyzer's own measurements, with the samples they came from. Anything it puts in
+// the analysis goes with the image too. Keep it short: the image waits for it. Hand anything slow (eg: AutoAdjustImage(), recording a clip) to another thread or the main loop.
+typedef std::function<void(const AnalysisSamples &samples, FrameAnalysis &analysis)> FrameAnalysisCallback;
+
+// ******* CFrameAnalyzer *******
+// Downstream, an element like videoanalyse maps every image and reads all of it (again). Here 1 in step x step pixels are read, from the
+// Grab Result's own buffer, right before it's copied or converted for the pipeline. With the default step of 8, that's 1/64 of the image.
+// Reads Mono and Bayer 8 bit and 10-16 bit unpacked (Bayer samples are read as if they were mono: one colour per pixel, good enough for
+// luminance and motion), YUV 4:2:2 (the Y) and RGB/BGR 8. The step is rounded up to even, so Bayer samples all fall on the same colour.
+class CFrameAnalyzer
+{
+public:
+	CFrameAnalyzer();
+
+	void SetStep(int step);
+	int GetStep();
+	void SetCallback(FrameAnalysisCallback callback);
+	// The layout is taken from the image each time, and the motion starts over when it changes (eg: SetRoi()).
+	FrameAnalysis Analyze(Pylon::EPixelType pixelType, int width, int height, size_t paddingX, const void *pImage);
+
+private:
+	enum ELayout
+	{
+		Layout_None,
+		Layout_Luma8,   // 1 byte per pixel
+		Layout_Luma16,  // 2 bytes per pixel, little endian, m_shift to 8 bits
+		Layout_Yuv422,  // 2 bytes per pixel, Y at m_offset
+		Layout_Rgb8     // 3 bytes per pixel, red at m_offset (0: RGB, 2: BGR)
+	};
+
+	int m_step;
+	FrameAnalysisCallback m_callback;
+	Pylon::EPixelType m_pixelType;
+	int m_width;
+	int m_height;
+	size_t m_paddingX;
+	ELayout m_layout;
+	int m_bytesPerPixel;
+	int m_offset;
+	int m_shift;
+	int m_neighbour; // pixels to the next one of the same colour (2 for Bayer)
+	std::vector<uint8_t> m_samples;
+	std::vector<uint8_t> m_previous;
+	bool m_hasPrevious;
+
+	void configure(Pylon::EPixelType pixelType, int width, int height, size_t paddingX);
+	inline int neighbour_of(int position, int size);
+	inline int luminance(const uint8_t *pRow, int x);
+};
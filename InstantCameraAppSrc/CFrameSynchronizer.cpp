@@ -0,0 +1,286 @@
+/*  CFrameSynchronizer.cpp: Definition file for CFrameSynchronizer Class.
+    Groups the images of several cameras into matched sets, by timestamp or frame id, before they reach the rest of the pipeline.
+
+	Copyright 2017, 2018, 2019 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+	*/
+
+#include "CFrameSynchronizer.h"
+#include "PylonFrameMeta.h"
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+
+CFrameSynchronizer::CFrameSynchronizer()
+{
+	m_mode = FrameSyncRunningTime;
+	m_tolerance = 0;
+	m_timeoutMs = 200;
+	m_isDetaching = false;
+	m_stats.sets = 0;
+	m_stats.orphans = 0;
+}
+
+// Only once the pipeline has stopped (so no streaming thread is still in a probe).
+CFrameSynchronizer::~CFrameSynchronizer()
+{
+	Detach();
+}
+
+bool CFrameSynchronizer::Attach(const vector<GstElement*> &sources, FrameSyncMode mode, guint64 tolerance, int timeoutMs)
+{
+	Detach();
+	if (sources.size() < 2)
+	{
+		cout << "CFrameSynchronizer: Nothing to synchronize with fewer than two cameras." << endl;
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_mode = mode;
+	m_tolerance = tolerance;
+	m_timeoutMs = timeoutMs;
+	m_isDetaching = false;
+	m_stats.sets = 0;
+	m_stats.orphans = 0;
+
+	for (size_t i = 0; i < sources.size(); i++)
+	{
+		Slot slot;
+		slot.pad = gst_element_get_static_pad(sources[i], "src");
+		slot.probeId = 0;
+		slot.state = SlotEmpty;
+		slot.buffer = NULL;
+		slot.key = 0;
+		slot.pts = GST_CLOCK_TIME_NONE;
+		slot.lastPts = GST_CLOCK_TIME_NONE;
+		slot.isEnded = false;
+		if (slot.pad == NULL)
+			cout << "CFrameSynchronizer: Source " << i << " has no src pad." << endl;
+		m_slots.push_back(slot);
+	}
+
+	for (size_t i = 0; i < m_slots.size(); i++)
+	{
+		if (m_slots[i].pad == NULL)
+			continue;
+		// the probe data goes with the probe (which may still be running when it's removed)
+		ProbeData *probeData = new ProbeData();
+		probeData->synchronizer = this;
+		probeData->index = i;
+		m_slots[i].probeId = gst_pad_add_probe(m_slots[i].pad, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM), cb_probe, probeData,
+			[](gpointer data) { delete (ProbeData*)data; });
+	}
+	return true;
+}
+
+void CFrameSynchronizer::Detach()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_isDetaching = true;
+		m_changed.notify_all();
+	}
+
+	for (size_t i = 0; i < m_slots.size(); i++)
+	{
+		if (m_slots[i].pad == NULL)
+			continue;
+		if (m_slots[i].probeId != 0)
+			gst_pad_remove_probe(m_slots[i].pad, m_slots[i].probeId);
+		gst_object_unref(m_slots[i].pad);
+	}
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_slots.clear();
+}
+
+void CFrameSynchronizer::SetOnFrameSet(std::function<void(guint64 setNumber, const vector<GstBuffer*> &buffers)> onFrameSet)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_onFrameSet = onFrameSet;
+}
+
+FrameSyncStats CFrameSynchronizer::GetStats()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_stats;
+}
+
+GstPadProbeReturn CFrameSynchronizer::cb_probe(GstPad *pad, GstPadProbeInfo *info, gpointer data)
+{
+	ProbeData *probeData = (ProbeData*)data;
+	if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER)
+		return probeData->synchronizer->on_buffer(probeData->index, info);
+	if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+		probeData->synchronizer->on_event(probeData->index, GST_PAD_PROBE_INFO_EVENT(info));
+	return GST_PAD_PROBE_OK;
+}
+
+// What the image has in common with the other cameras' images of its set.
+bool CFrameSynchronizer::get_key(GstBuffer *buffer, guint64 &key)
+{
+	if (m_mode == FrameSyncRunningTime)
+	{
+		key = GST_BUFFER_PTS(buffer);
+		return GST_BUFFER_PTS_IS_VALID(buffer);
+	}
+
+	PylonFrameMeta *frameMeta = gst_buffer_get_pylon_frame_meta(buffer);
+	if (frameMeta == NULL)
+		return false;
+	key = (m_mode == FrameSyncCameraTimestamp) ? frameMeta->cameraTimestamp : frameMeta->frameId;
+	return true;
+}
+
+// On the source's streaming thread: wait here until the image is part of a set, or can't be.
+GstPadProbeReturn CFrameSynchronizer::on_buffer(size_t index, GstPadProbeInfo *info)
+{
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+	guint64 key = 0;
+	if (get_key(buffer, key) == false)
+		return GST_PAD_PROBE_OK; // (can't be matched, eg: no timestamp yet)
+
+	std::unique_lock<std::mutex> lock(m_lock);
+	if (m_isDetaching == true || index >= m_slots.size())
+		return GST_PAD_PROBE_OK;
+
+	m_slots[index].state = SlotWaiting;
+	m_slots[index].buffer = buffer;
+	m_slots[index].key = key;
+	m_slots[index].pts = GST_BUFFER_PTS(buffer);
+	match();
+
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_timeoutMs);
+	m_changed.wait_until(lock, deadline, [this, index] { return m_isDetaching == true || m_slots[index].state != SlotWaiting; });
+	if (m_isDetaching == true)
+		return GST_PAD_PROBE_OK;
+
+	Slot &slot = m_slots[index];
+	SlotState state = slot.state;
+	GstClockTime pts = slot.pts;
+	slot.state = SlotEmpty;
+	slot.buffer = NULL;
+
+	if (state == SlotWaiting)
+	{
+		// waited too long. The other cameras may be slower, or stopped. Either way, there's a newer image coming.
+		m_stats.orphans++;
+		return GST_PAD_PROBE_DROP;
+	}
+	if (state == SlotDropped)
+		return GST_PAD_PROBE_DROP;
+	lock.unlock();
+
+	// the whole set gets the same PTS
+	if (pts != GST_BUFFER_PTS(buffer))
+	{
+		buffer = gst_buffer_make_writable(buffer);
+		GST_BUFFER_PTS(buffer) = pts;
+		GST_BUFFER_DTS(buffer) = pts;
+		GST_PAD_PROBE_INFO_DATA(info) = buffer;
+	}
+	return GST_PAD_PROBE_OK;
+}
+
+void CFrameSynchronizer::on_event(size_t index, GstEvent *event)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (index >= m_slots.size())
+		return;
+
+	// a camera which ended won't deliver any more images, so don't wait for it. If it starts again (eg: after a seek or restart), wait for it again.
+	if (GST_EVENT_TYPE(event) == GST_EVENT_EOS)
+	{
+		m_slots[index].isEnded = true;
+		match();
+	}
+	else if (GST_EVENT_TYPE(event) == GST_EVENT_STREAM_START || GST_EVENT_TYPE(event) == GST_EVENT_FLUSH_STOP)
+		m_slots[index].isEnded = false;
+}
+
+// With the lock held: see if the waiting images make a set, or which of them never will.
+void CFrameSynchronizer::match()
+{
+	// every camera still delivering must have an image waiting. (A camera whose last image was just released hasn't got its next one here yet.)
+	guint64 newest = 0;
+	size_t numWaiting = 0;
+	for (size_t i = 0; i < m_slots.size(); i++)
+	{
+		if (m_slots[i].isEnded == true)
+			continue;
+		if (m_slots[i].state != SlotWaiting)
+			return;
+		newest = max(newest, m_slots[i].key);
+		numWaiting++;
+	}
+	if (numWaiting == 0)
+		return;
+
+	// an image further behind the newest one than the tolerance never will have a match. Its partners were lost, or dropped by the grab strategy.
+	// The camera brings its next image, and we try again.
+	bool isOrphaned = false;
+	for (size_t i = 0; i < m_slots.size(); i++)
+	{
+		if (m_slots[i].state == SlotWaiting && newest - m_slots[i].key > m_tolerance)
+		{
+			m_slots[i].state = SlotDropped;
+			m_stats.orphans++;
+			isOrphaned = true;
+		}
+	}
+	if (isOrphaned == true)
+	{
+		m_changed.notify_all();
+		return;
+	}
+
+	// A set. It's timestamped as when its first image arrived (or was exposed), but never earlier than a camera's previous image.
+	GstClockTime pts = GST_CLOCK_TIME_NONE;
+	for (size_t i = 0; i < m_slots.size(); i++)
+	{
+		if (m_slots[i].state == SlotWaiting && GST_CLOCK_TIME_IS_VALID(m_slots[i].pts) && (pts == GST_CLOCK_TIME_NONE || m_slots[i].pts < pts))
+			pts = m_slots[i].pts;
+	}
+
+	vector<GstBuffer*> buffers(m_slots.size(), (GstBuffer*)NULL);
+	for (size_t i = 0; i < m_slots.size(); i++)
+	{
+		Slot &slot = m_slots[i];
+		if (slot.state != SlotWaiting)
+			continue;
+		if (GST_CLOCK_TIME_IS_VALID(pts))
+		{
+			slot.pts = pts;
+			if (GST_CLOCK_TIME_IS_VALID(slot.lastPts) && slot.pts <= slot.lastPts)
+				slot.pts = slot.lastPts + 1;
+			slot.lastPts = slot.pts;
+		}
+		slot.state = SlotMatched;
+		buffers[i] = slot.buffer;
+	}
+	m_stats.sets++;
+
+	// the set is complete and no streaming thread moves meanwhile, so the buffers are safe to look at.
+	if (m_onFrameSet)
+		m_onFrameSet(m_stats.sets, buffers);
+
+	m_changed.notify_all();
+}
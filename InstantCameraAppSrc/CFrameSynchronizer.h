@@ -0,0 +1,105 @@
+/*  CFrameSynchronizer.h: header file for CFrameSynchronizer Class.
+    Groups the images of several cameras into matched sets, by timestamp or frame id, before they reach the rest of the pipeline.
+
+	Copyright 2017 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+
+*/
+
+#pragma once
+
+#include <gst/gst.h>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// What the images of a set have in common
+enum FrameSyncMode
+{
+	FrameSyncRunningTime,     // their PTS: when they reached the AppSrc, or with hardware timestamps, when they were exposed (mapped onto the pipeline clock)
+	FrameSyncCameraTimestamp, // the cameras' own timestamps. Only comparable when the cameras' clocks are synchronized (PTP), but then the most precise.
+	FrameSyncFrameId          // the cameras' frame ids. For cameras triggered together since they started (eg: CCameraManager::UseSynchronizedTrigger()).
+};
+
+// ******* FrameSyncStats *******
+struct FrameSyncStats
+{
+	guint64 sets;    // matched sets released to the pipeline
+	guint64 orphans; // images dropped because the other cameras had nothing to match them
+};
+
+// ******* CFrameSynchronizer *******
+// Each camera's source pushes its images by itself, so a compositor (or anything else taking several cameras) pairs whatever arrives together,
+// which can be up to a frame apart, and it repeats images when one camera is late.
+// Attach() puts a pad probe on each source's src pad. Each image waits there (on its source's streaming thread) for the images of the other cameras which match it:
+//  - when every camera has one within the tolerance, they're released together as a set, all with the same PTS, so aggregators take them as one.
+//  - an image older than the others by more than the tolerance can never be matched (its partners were lost), so it's dropped.
+//  - so is an image which waits longer than the timeout (eg: another camera stopped delivering).
+// A camera which sent EOS is no longer waited for.
+class CFrameSynchronizer
+{
+public:
+	CFrameSynchronizer();
+	~CFrameSynchronizer();
+	CFrameSynchronizer(const CFrameSynchronizer&) = delete;
+	CFrameSynchronizer& operator=(const CFrameSynchronizer&) = delete;
+
+	// tolerance: how far apart images of a set can be, in ns (or frame ids). timeoutMs: how long an image waits for the others.
+	bool Attach(const std::vector<GstElement*> &sources, FrameSyncMode mode, guint64 tolerance, int timeoutMs = 200);
+	void Detach();
+	// Called with each set (one buffer per camera in order, NULL for cameras no longer waited for) as it's released, on one of the streaming threads.
+	// The buffers are only borrowed, and the synchronizer waits meanwhile (so don't call back into it). Eg: for stitching or stereo, straight from the cameras.
+	void SetOnFrameSet(std::function<void(guint64 setNumber, const std::vector<GstBuffer*> &buffers)> onFrameSet);
+	FrameSyncStats GetStats();
+
+private:
+	enum SlotState { SlotEmpty, SlotWaiting, SlotMatched, SlotDropped };
+	struct Slot
+	{
+		GstPad *pad;
+		gulong probeId;
+		SlotState state;
+		GstBuffer *buffer;
+		guint64 key;
+		GstClockTime pts;
+		GstClockTime lastPts;
+		bool isEnded;
+	};
+	struct ProbeData
+	{
+		CFrameSynchronizer *synchronizer;
+		size_t index;
+	};
+
+	std::mutex m_lock;
+	std::condition_variable m_changed;
+	std::vector<Slot> m_slots;
+	FrameSyncMode m_mode;
+	guint64 m_tolerance;
+	int m_timeoutMs;
+	bool m_isDetaching;
+	FrameSyncStats m_stats;
+	std::function<void(guint64, const std::vector<GstBuffer*>&)> m_onFrameSet;
+
+	static GstPadProbeReturn cb_probe(GstPad *pad, GstPadProbeInfo *info, gpointer data);
+	GstPadProbeReturn on_buffer(size_t index, GstPadProbeInfo *info);
+	void on_event(size_t index, GstEvent *event);
+	bool get_key(GstBuffer *buffer, guint64 &key);
+	void match();
+};
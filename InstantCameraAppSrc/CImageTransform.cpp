@@ -0,0 +1,294 @@
+/*  CImageTransform.cpp: Definition file for CImageTransform Class.
+    This rescales and rotates images in one pass on the cpu, for when the host has no hardware video converter.
+
+	Copyright 2017, 2018, 2019 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+	*/
+
+/*
+	Output pixel (x, y) is at (rx, ry) in the rotated image, scaled to the output size (nearest neighbour, sampling pixel centres).
+	Where that is in the camera image (w x h) depends on the rotation (clockwise):
+	  0:   (rx,        ry)
+	  90:  (ry,        h - 1 - rx)
+	  180: (w - 1 - rx, h - 1 - ry)
+	  270: (w - 1 - ry, rx)
+	Either way the source offset is the sum of a part that only depends on x and a part that only depends on y, so both are worked out once, in Configure().
+*/
+
+#include "CImageTransform.h"
+#include <iostream>
+#include <string.h>
+
+using namespace std;
+
+// output tile size, in elements. 32 rows of a rotated source tile are 32 cache lines or so.
+static const int tileWidth = 32;
+static const int tileHeight = 32;
+
+template <int bytesPerElement>
+static void transform_plane(const uint8_t *pSource, uint8_t *pDest, size_t destStride, int outputWidth, int outputHeight,
+	const size_t *rowOffsets, const size_t *columnOffsets)
+{
+	for (int tileY = 0; tileY < outputHeight; tileY += tileHeight)
+	{
+		int endY = tileY + tileHeight < outputHeight ? tileY + tileHeight : outputHeight;
+		for (int tileX = 0; tileX < outputWidth; tileX += tileWidth)
+		{
+			int endX = tileX + tileWidth < outputWidth ? tileX + tileWidth : outputWidth;
+			for (int y = tileY; y < endY; y++)
+			{
+				const uint8_t *pRow = pSource + rowOffsets[y];
+				uint8_t *pOut = pDest + y * destStride + tileX * bytesPerElement;
+				for (int x = tileX; x < endX; x++, pOut += bytesPerElement)
+					memcpy(pOut, pRow + columnOffsets[x], bytesPerElement);
+			}
+		}
+	}
+}
+
+CImageTransform::CImageTransform()
+{
+	m_width = 0;
+	m_height = 0;
+	m_outputWidth = 0;
+	m_outputHeight = 0;
+	m_rotation = 0;
+	m_sourceStride = 0;
+	m_sourceSize = 0;
+	m_outputSize = 0;
+	m_pool = NULL;
+}
+
+CImageTransform::~CImageTransform()
+{
+	// buffers still in the pipeline keep the pool alive until they're freed.
+	if (m_pool != NULL)
+	{
+		gst_buffer_pool_set_active(m_pool, FALSE);
+		gst_object_unref(m_pool);
+	}
+}
+
+bool CImageTransform::IsSupported(const string &format)
+{
+	return format == "GRAY8" || format == "RGB" || format == "BGR" || format == "BGRx" || format == "I420" || format == "NV12";
+}
+
+void CImageTransform::GetOutputSize(int width, int height, int scaledWidth, int scaledHeight, int rotation, int &outputWidth, int &outputHeight)
+{
+	if (scaledWidth > 0 && scaledHeight > 0)
+	{
+		outputWidth = scaledWidth;
+		outputHeight = scaledHeight;
+	}
+	else if (rotation == 90 || rotation == 270)
+	{
+		outputWidth = height;
+		outputHeight = width;
+	}
+	else
+	{
+		outputWidth = width;
+		outputHeight = height;
+	}
+	// I420 and NV12 need even sizes, and it keeps all formats the same.
+	outputWidth &= ~1;
+	outputHeight &= ~1;
+}
+
+// Where the planes of an image are, as GStreamer lays them out, or for GRAY8 / RGB / BGR / BGRx with rows of rowStride bytes (if not 0).
+// Returns the image size (the last row needn't have its padding).
+size_t CImageTransform::plane_layout(const string &format, int width, int height, size_t rowStride, vector<size_t> &offsets, vector<size_t> &strides, vector<int> &subsampling, vector<int> &bytesPerElement)
+{
+	offsets.clear();
+	strides.clear();
+	subsampling.clear();
+	bytesPerElement.clear();
+
+	if (format == "I420")
+	{
+		size_t yStride = GST_ROUND_UP_4(width);
+		size_t chromaStride = GST_ROUND_UP_4(width / 2);
+		offsets.push_back(0); strides.push_back(yStride); subsampling.push_back(1); bytesPerElement.push_back(1);
+		offsets.push_back(yStride * height); strides.push_back(chromaStride); subsampling.push_back(2); bytesPerElement.push_back(1);
+		offsets.push_back(yStride * height + chromaStride * (height / 2)); strides.push_back(chromaStride); subsampling.push_back(2); bytesPerElement.push_back(1);
+		return yStride * height + 2 * chromaStride * (height / 2);
+	}
+	if (format == "NV12")
+	{
+		size_t stride = GST_ROUND_UP_4(width);
+		offsets.push_back(0); strides.push_back(stride); subsampling.push_back(1); bytesPerElement.push_back(1);
+		offsets.push_back(stride * height); strides.push_back(stride); subsampling.push_back(2); bytesPerElement.push_back(2); // U and V move together
+		return stride * height + stride * (height / 2);
+	}
+
+	int bytesPerPixel = 1;
+	if (format == "RGB" || format == "BGR")
+		bytesPerPixel = 3;
+	else if (format == "BGRx")
+		bytesPerPixel = 4;
+	size_t stride = rowStride != 0 ? rowStride : GST_ROUND_UP_4(width * bytesPerPixel);
+	offsets.push_back(0); strides.push_back(stride); subsampling.push_back(1); bytesPerElement.push_back(bytesPerPixel);
+	return stride * (height - 1) + width * bytesPerPixel;
+}
+
+// The lookup tables, for source images with rows of sourceStride bytes (see plane_layout()).
+void CImageTransform::make_planes(size_t sourceStride)
+{
+	vector<size_t> sourceOffsets, sourceStrides, destOffsets, destStrides;
+	vector<int> subsampling, bytesPerElement;
+	m_sourceSize = plane_layout(m_format, m_width, m_height, sourceStride, sourceOffsets, sourceStrides, subsampling, bytesPerElement);
+	m_outputSize = plane_layout(m_format, m_outputWidth, m_outputHeight, 0, destOffsets, destStrides, subsampling, bytesPerElement);
+	m_sourceStride = sourceStride;
+
+	m_planes.clear();
+	for (size_t i = 0; i < sourceOffsets.size(); i++)
+	{
+		add_plane(sourceOffsets[i], sourceStrides[i], m_width / subsampling[i], m_height / subsampling[i],
+			destOffsets[i], destStrides[i], m_outputWidth / subsampling[i], m_outputHeight / subsampling[i], bytesPerElement[i], m_rotation);
+	}
+}
+
+void CImageTransform::add_plane(size_t sourceOffset, size_t sourceStride, int width, int height, size_t destOffset, size_t destStride, int outputWidth, int outputHeight, int bytesPerElement, int rotation)
+{
+	SPlane plane;
+	plane.sourceOffset = sourceOffset;
+	plane.destOffset = destOffset;
+	plane.destStride = destStride;
+	plane.bytesPerElement = bytesPerElement;
+	plane.outputWidth = outputWidth;
+	plane.outputHeight = outputHeight;
+	plane.columnOffsets.resize(outputWidth);
+	plane.rowOffsets.resize(outputHeight);
+
+	bool isSideways = rotation == 90 || rotation == 270;
+	int rotatedWidth = isSideways ? height : width;
+	int rotatedHeight = isSideways ? width : height;
+
+	for (int x = 0; x < outputWidth; x++)
+	{
+		size_t rx = ((size_t)(2 * x + 1) * rotatedWidth) / (2 * outputWidth);
+		if (rotation == 90)
+			plane.columnOffsets[x] = (height - 1 - rx) * sourceStride;
+		else if (rotation == 180)
+			plane.columnOffsets[x] = (width - 1 - rx) * bytesPerElement;
+		else if (rotation == 270)
+			plane.columnOffsets[x] = rx * sourceStride;
+		else
+			plane.columnOffsets[x] = rx * bytesPerElement;
+	}
+	for (int y = 0; y < outputHeight; y++)
+	{
+		size_t ry = ((size_t)(2 * y + 1) * rotatedHeight) / (2 * outputHeight);
+		if (rotation == 90)
+			plane.rowOffsets[y] = ry * bytesPerElement;
+		else if (rotation == 180)
+			plane.rowOffsets[y] = (height - 1 - ry) * sourceStride;
+		else if (rotation == 270)
+			plane.rowOffsets[y] = (width - 1 - ry) * bytesPerElement;
+		else
+			plane.rowOffsets[y] = ry * sourceStride;
+	}
+
+	m_planes.push_back(plane);
+}
+
+bool CImageTransform::Configure(const string &format, int width, int height, int outputWidth, int outputHeight, int rotation)
+{
+	if (IsSupported(format) == false)
+	{
+		cerr << "CImageTransform: Can't rescale or rotate " << format << " images." << endl;
+		return false;
+	}
+	if (rotation != 0 && rotation != 90 && rotation != 180 && rotation != 270)
+	{
+		cerr << "CImageTransform: Can only rotate 0, 90, 180 or 270 degrees, not " << rotation << "." << endl;
+		return false;
+	}
+	if (width < 2 || height < 2 || outputWidth < 2 || outputHeight < 2 || outputWidth % 2 != 0 || outputHeight % 2 != 0)
+	{
+		cerr << "CImageTransform: Can't transform " << width << "x" << height << " to " << outputWidth << "x" << outputHeight << "." << endl;
+		return false;
+	}
+
+	m_format = format;
+	m_width = width;
+	m_height = height;
+	m_outputWidth = outputWidth;
+	m_outputHeight = outputHeight;
+	m_rotation = rotation;
+	// (remade by Transform() for the camera's row stride, once it's seen one)
+	make_planes(0);
+
+	// a fresh pool for the new size. The old one lives on until its buffers come back.
+	if (m_pool != NULL)
+	{
+		gst_buffer_pool_set_active(m_pool, FALSE);
+		gst_object_unref(m_pool);
+	}
+	m_pool = gst_buffer_pool_new();
+	GstStructure *config = gst_buffer_pool_get_config(m_pool);
+	gst_buffer_pool_config_set_params(config, NULL, (guint)m_outputSize, 4, 0);
+	if (gst_buffer_pool_set_config(m_pool, config) == FALSE || gst_buffer_pool_set_active(m_pool, TRUE) == FALSE)
+	{
+		cerr << "CImageTransform: Could not configure the gst buffer pool." << endl;
+		gst_object_unref(m_pool);
+		m_pool = NULL;
+		return false;
+	}
+
+	cout << "Images will be transformed on the cpu: " << format << " " << width << "x" << height << " -> " << outputWidth << "x" << outputHeight << ", rotated " << rotation << " degrees." << endl;
+	return true;
+}
+
+GstBuffer* CImageTransform::Transform(const void *pSource, size_t sourceSize, size_t sourceStride)
+{
+	if (m_pool == NULL || pSource == NULL)
+		return NULL;
+
+	// I420 and NV12 only come in GStreamer's layout. For the others, the tables follow the rows as they are (the same for every image, in practice).
+	if (m_format == "I420" || m_format == "NV12")
+		sourceStride = 0;
+	if (sourceStride != m_sourceStride)
+		make_planes(sourceStride);
+	if (sourceSize < m_sourceSize)
+		return NULL;
+
+	GstBuffer *output = NULL;
+	if (gst_buffer_pool_acquire_buffer(m_pool, &output, NULL) != GST_FLOW_OK)
+		return NULL;
+
+	GstMapInfo outMap;
+	gst_buffer_map(output, &outMap, GST_MAP_WRITE);
+	for (size_t i = 0; i < m_planes.size(); i++)
+	{
+		const SPlane &plane = m_planes[i];
+		const uint8_t *pPlane = (const uint8_t*)pSource + plane.sourceOffset;
+		uint8_t *pDest = outMap.data + plane.destOffset;
+		switch (plane.bytesPerElement)
+		{
+		case 1: transform_plane<1>(pPlane, pDest, plane.destStride, plane.outputWidth, plane.outputHeight, &plane.rowOffsets[0], &plane.columnOffsets[0]); break;
+		case 2: transform_plane<2>(pPlane, pDest, plane.destStride, plane.outputWidth, plane.outputHeight, &plane.rowOffsets[0], &plane.columnOffsets[0]); break;
+		case 3: transform_plane<3>(pPlane, pDest, plane.destStride, plane.outputWidth, plane.outputHeight, &plane.rowOffsets[0], &plane.columnOffsets[0]); break;
+		default: transform_plane<4>(pPlane, pDest, plane.destStride, plane.outputWidth, plane.outputHeight, &plane.rowOffsets[0], &plane.columnOffsets[0]); break;
+		}
+	}
+	gst_buffer_unmap(output, &outMap);
+
+	return output;
+}
@@ -0,0 +1,83 @@
+/*  CImageTransform.h: header file for CImageTransform Class.
+    This rescales and rotates images in one pass on the cpu, for when the host has no hardware video converter.
+
+	Copyright 2017 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+
+*/
+
+#pragma once
+
+#include <gst/gst.h>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// ******* CImageTransform *******
+// The cpu fallback of the source bin's rescale and rotate stage (see CInstantCameraAppSrc::GetSource()).
+// Instead of a videoscale element followed by a videoflip element (two full-frame passes, the second one reading the image column by column),
+// each output pixel is fetched straight from where it is in the camera image: rotation and nearest-neighbour scaling come down to a lookup table
+// of source offsets for the output rows and one for the output columns. The image is done in small tiles, so rotated reads stay in the cache.
+// Works on GRAY8, RGB, BGR, BGRx, I420 and NV12. The image is read where it is (the Grab Result's buffer, or the converter's output), and the
+// output buffers come from a GstBufferPool: one pass over the image, not a copy and then the transform.
+class CImageTransform
+{
+public:
+	CImageTransform();
+	~CImageTransform();
+
+	// width, height: the camera image. outputWidth, outputHeight: after rotation and scaling. rotation: 0, 90, 180 or 270 degrees clockwise.
+	bool Configure(const std::string &format, int width, int height, int outputWidth, int outputHeight, int rotation);
+	// Make a new gst buffer from the pool with the image at pSource, transformed. Returns NULL if the image is too small.
+	// sourceStride: the bytes per row of a GRAY8 / RGB / BGR / BGRx image, eg: with the camera's PaddingX. 0 = GStreamer's layout (rows on 4 byte boundaries),
+	// which I420 and NV12 images (from CPixelConverter) always have. The output always has GStreamer's layout.
+	GstBuffer* Transform(const void *pSource, size_t sourceSize, size_t sourceStride = 0);
+	static bool IsSupported(const std::string &format);
+	// The output size for a camera image: the scaled size if one is given (-1 = not scaled), otherwise the rotated camera size. Always even.
+	static void GetOutputSize(int width, int height, int scaledWidth, int scaledHeight, int rotation, int &outputWidth, int &outputHeight);
+
+private:
+	// One plane of the image (I420 has three, NV12 two, the others one). Offsets are from the start of the plane.
+	struct SPlane
+	{
+		size_t sourceOffset;
+		size_t destOffset;
+		size_t destStride;
+		int bytesPerElement;
+		int outputWidth;
+		int outputHeight;
+		std::vector<size_t> rowOffsets; // source offset of each output row
+		std::vector<size_t> columnOffsets; // source offset of each output column, from the row offset
+	};
+
+	std::string m_format;
+	int m_width;
+	int m_height;
+	int m_outputWidth;
+	int m_outputHeight;
+	int m_rotation;
+	std::vector<SPlane> m_planes;
+	size_t m_sourceStride; // what m_planes were made for (0 = GStreamer's layout)
+	size_t m_sourceSize;
+	size_t m_outputSize;
+	GstBufferPool *m_pool;
+
+	void make_planes(size_t sourceStride);
+	void add_plane(size_t sourceOffset, size_t sourceStride, int width, int height, size_t destOffset, size_t destStride, int outputWidth, int outputHeight, int bytesPerElement, int rotation);
+	static size_t plane_layout(const std::string &format, int width, int height, size_t rowStride, std::vector<size_t> &offsets, std::vector<size_t> &strides, std::vector<int> &subsampling, std::vector<int> &bytesPerElement);
+};
@@ -49,15 +49,27 @@
 	2. LatestImageOnly strategy means the Grab Engine keeps the latest image received ready for retrieval.
 	3. When AppSrc needs data, it sends the "need-data" signal.
 	4. This fires cb_need_data which calls RetrieveImage().
-	5. RetrieveImage() retrieves the image from the Grab Engine, converts it to RGB, and places it in a PylonImage container.
-	6. The memory of the PylonImage container is then wrapped and pushed to AppSrc's src pad by sending the "push-buffer" signal.
-	7. AppSrc provides the image to the rescaler element, which then pushes it to image rotation element.
-	8. AppSrc, rescaler, and rotator elements are binned together into sourceBin.
+	5. RetrieveImage() retrieves the image from the Grab Engine and copies it into a newly allocated gst buffer.
+	   In zero-copy mode, the Grab Result itself is wrapped instead, and is handed back to the Grab Engine only when the pipeline frees the gst buffer.
+	6. The gst buffer is then pushed to AppSrc's src pad by sending the "push-buffer" signal.
+	7. If rescaling or rotation was asked for, AppSrc provides the image to the rescale/rotate element (nvvidconv or v4l2convert, where the host has one).
+	   Without a hardware converter, the image is rescaled and rotated in one pass on the cpu (CImageTransform) before it's pushed to AppSrc.
+	8. AppSrc and the rescale/rotate element are binned together into sourceBin.
 	9. The output of sourceBin (it's src pad) is then the input to the rest of the pipeline
+
+	In push mode, steps 3 and 4 are replaced by the Pylon grab loop thread: it retrieves each image as soon as it is grabbed and pushes it to AppSrc.
+	AppSrc then blocks the grab loop thread when its queue is full, so the camera's timing is separated from the pipeline's scheduling.
+
+	Every gst buffer carries a PylonFrameMeta (frame id, camera timestamp, lost frames). With hardware timestamps, the buffer's PTS is the camera's
+	exposure timestamp mapped onto the pipeline clock, instead of the time the image happened to reach AppSrc (see stamp_buffer()).
 	*/
 
 #include "CInstantCameraAppSrc.h"
 #include <gst/app/gstappsrc.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <math.h>
 
 //#include <mcheck.h>
 
@@ -67,15 +79,118 @@ using namespace Pylon;
 using namespace GenApi;
 using namespace std;
 
+// In push mode, the Pylon grab loop thread calls OnImageGrabbed() for every image, and we push it to the AppSrc right there.
+class CAppSrcImageEventHandler : public CImageEventHandler
+{
+public:
+	CAppSrcImageEventHandler(CInstantCameraAppSrc *pCamera) : m_pCamera(pCamera) {}
+	virtual void OnImageGrabbed(CInstantCamera& camera, const CGrabResultPtr& ptrGrabResult)
+	{
+		m_pCamera->apply_thread_policy(m_pCamera->m_grabThreadPolicy, m_pCamera->m_grabPolicyThread, "grab thread");
+		m_pCamera->push_grab_result(ptrGrabResult);
+	}
+private:
+	CInstantCameraAppSrc *m_pCamera;
+};
+
+// Tells the camera as soon as Pylon notices it's gone (Pylon calls this from its own thread), so it doesn't wait for the next grab to fail.
+// And when grabbing starts and stops (from whichever thread calls StartGrabbing() / StopGrabbing()).
+class CAppSrcConfigurationEventHandler : public CConfigurationEventHandler
+{
+public:
+	CAppSrcConfigurationEventHandler(CInstantCameraAppSrc *pCamera) : m_pCamera(pCamera) {}
+	virtual void OnCameraDeviceRemoved(CInstantCamera& camera)
+	{
+		m_pCamera->on_device_removed();
+	}
+	// However grabbing is restarted (StartCamera(), a new AOI or PixelFormat, reconnecting...), the software triggers start and stop with it.
+	virtual void OnGrabStarted(CInstantCamera& camera)
+	{
+		if (m_pCamera->m_isOnDemand == true)
+			m_pCamera->m_triggers.Start();
+	}
+	virtual void OnGrabStop(CInstantCamera& camera)
+	{
+		m_pCamera->m_triggers.Stop();
+	}
+private:
+	CInstantCameraAppSrc *m_pCamera;
+};
+
+// The count of zero-copy gst buffers in the pipeline. Shared by the camera and each of those buffers, as a buffer can be freed after the camera
+// is gone (held by an appsink's sample, a queue, the application...). Whichever lets go last also ends the camera's use of the pylon runtime,
+// so that Grab Result is released before PylonTerminate().
+struct SInFlightBuffers
+{
+	std::atomic<int> count;
+
+	SInFlightBuffers() : count(0) {}
+	~SInFlightBuffers()
+	{
+		Pylon::PylonTerminate();
+	}
+};
+
+// A Grab Result held alive by a zero-copy gst buffer (see wrap_grab_result()).
+struct SHeldGrabResult
+{
+	std::shared_ptr<SInFlightBuffers> buffersInFlight; // (declared first, so it's let go of after the Grab Result)
+	Pylon::CGrabResultPtr ptrGrabResult;
+};
+
 // Here we extend the Pylon CInstantCamera class with a few things to make it easier to integrate with Appsrc.
-CInstantCameraAppSrc::CInstantCameraAppSrc(string serialnumber)
+CInstantCameraAppSrc::CInstantCameraAppSrc(string serialnumber) : m_triggers(*this)
 {
 	//mtrace();
-	// initialize Pylon runtime
+	m_startupBegin = g_get_monotonic_time();
+	m_imagesWaitBegin = 0;
+	m_isStartupReported = false;
+	m_startupName = "Startup";
+
+	// initialize Pylon runtime. It's terminated when the last zero-copy buffer is freed, or with us (see SInFlightBuffers).
 	Pylon::PylonInitialize();
+	m_buffersInFlight = std::make_shared<SInFlightBuffers>();
 
 	m_serialNumber = serialnumber;
 	m_isOpen = false;
+	m_isZeroCopy = false;
+	m_maxBuffersInFlight = 0;
+	m_bufferPool = NULL;
+	m_isPushMode = false;
+	m_grabStrategy = Pylon::GrabStrategy_LatestImageOnly;
+	m_requiredNumBuffers = 0;
+	m_isPoolResizePending = false;
+	m_isPoolResizing = false;
+	m_isRoiChangePending = false;
+	m_isUnlocked = false;
+	m_unlockWait = Pylon::WaitObjectEx::Create();
+	m_isAnalyzing = false;
+	m_isHardwareTimestamps = false;
+	m_tickFrequency = GST_SECOND;
+	m_clockOffset = 0;
+	m_isClockOffsetValid = false;
+	m_lastFrameId = -1;
+	m_isFrameIdWrapping = false;
+	m_lastCameraTimestamp = 0;
+	m_lastPts = GST_CLOCK_TIME_NONE;
+	m_totalLostFrames = 0;
+	m_retrievedTime = 0;
+	m_targetFps = 0.0;
+	m_statsInterval = 0;
+	m_isEosOnDeviceRemoved = true;
+	m_isDeviceRemoved = false;
+	m_reconnectInterval = 0;
+	m_isReconnectStopping = false;
+	m_gstBuffer = NULL;
+	m_lastGoodBuffer = NULL;
+	m_appsrc = NULL;
+	m_element = NULL;
+	m_isConverting = false;
+	m_pixelConverter = NULL;
+	m_imageTransform = NULL;
+	m_outputWidth = -1;
+	m_outputHeight = -1;
+	m_sourceBin = NULL;
 	
 	try
 	{
@@ -88,10 +203,13 @@ CInstantCameraAppSrc::CInstantCameraAppSrc(string serialnumber)
 			info.SetSerialNumber(m_serialNumber.c_str());
 			Attach(CTlFactory::GetInstance().CreateFirstDevice(info));
 		}
+		// the serial number identifies the camera in bus messages and statistics, even if we just took the first one found.
+		m_serialNumber = GetDeviceInfo().GetSerialNumber().c_str();
 
-		// open the camera to access settings
+		// open the camera to access settings. InitCamera() carries on with it open.
 		OpenCamera();
 		m_isOpen = true;
+		add_startup_phase("open camera", m_startupBegin);
 	}
 	catch (GenICam::GenericException &e)
 	{
@@ -105,53 +223,48 @@ CInstantCameraAppSrc::CInstantCameraAppSrc(string serialnumber)
 
 CInstantCameraAppSrc::~CInstantCameraAppSrc()
 {
+	stop_reconnecting();
+	stop_resizing_pool();
+	m_stats.StopReporting();
+	m_triggers.Join();
+	// a new AOI which never got its turn
+	if (m_pendingRoiDone)
+		m_pendingRoiDone(false);
+	if (m_lastGoodBuffer != NULL)
+		gst_buffer_unref(m_lastGoodBuffer);
 	CloseCamera();
-	// free resources allocated by pylon runtime.
-	Pylon::PylonTerminate();
+	delete_pixel_converter();
+	if (m_imageTransform != NULL)
+		delete m_imageTransform;
+	// the buffer factory must outlive the device, which gives its buffers back when it's destroyed. Buffers the pipeline still holds keep it
+	// (and their pixels) alive after that: the last one deletes it.
+	if (m_bufferPool != NULL)
+		m_bufferPool->Unref();
+	// free resources allocated by pylon runtime, now or once the pipeline has freed the last of our zero-copy buffers.
+	m_buffersInFlight.reset();
 }
 
+// The features are looked up once, when the camera is opened (see CCameraFeatures), so these are cheap enough to call for every status print or buffer.
 int CInstantCameraAppSrc::GetWidth()
 {
-	if (GenApi::IsReadable(GetNodeMap().GetNode("Width")))
-		return CIntegerPtr(GetNodeMap().GetNode("Width"))->GetValue();
-	else
-		return -1;
+	return m_features.GetWidth();
 }
 
 int CInstantCameraAppSrc::GetHeight()
 {
-	if (GenApi::IsReadable(GetNodeMap().GetNode("Height")))
-		return CIntegerPtr(GetNodeMap().GetNode("Height"))->GetValue();
-	else
-		return -1;
+	return m_features.GetHeight();
 }
 
 double CInstantCameraAppSrc::GetFrameRate()
 {
-	if (GenApi::IsReadable(GetNodeMap().GetNode("ResultingFrameRateAbs")))
-		return CFloatPtr(GetNodeMap().GetNode("ResultingFrameRateAbs"))->GetValue();
-	else if (GenApi::IsReadable(GetNodeMap().GetNode("ResultingFrameRate")))
-		return CFloatPtr(GetNodeMap().GetNode("ResultingFrameRate"))->GetValue(); // BCON LVDS and USB use SFNC3 names
-	else if (GenApi::IsReadable(GetNodeMap().GetNode("AcquisitionFrameRate")))
-		return CFloatPtr(GetNodeMap().GetNode("AcquisitionFrameRate"))->GetValue(); // MIPI
-	else
-		return -1;
-
-	// default
-	//return 0;
+	return m_features.GetFrameRate(); // ResultingFrameRateAbs, ResultingFrameRate (BCON LVDS and USB use SFNC3 names), or AcquisitionFrameRate (MIPI)
 }
 
 bool CInstantCameraAppSrc::SetFrameRate(double framesPerSecond)
 {
 	try
 	{
-		if (GenApi::IsWritable(GetNodeMap().GetNode("AcquisitionFrameRateEnable")))
-			CBooleanPtr(GetNodeMap().GetNode("AcquisitionFrameRateEnable"))->SetValue(true);
-		if (GenApi::IsWritable(GetNodeMap().GetNode("AcquisitionFrameRate")))
-			CFloatPtr(GetNodeMap().GetNode("AcquisitionFrameRate"))->SetValue(framesPerSecond);
-		if (GenApi::IsWritable(GetNodeMap().GetNode("AcquisitionFrameRateAbs")))
-			CFloatPtr(GetNodeMap().GetNode("AcquisitionFrameRateAbs"))->SetValue(framesPerSecond);
-		
+		m_features.SetFrameRate(framesPerSecond);
 		return true;
 	}
 	catch (GenICam::GenericException &e)
@@ -167,10 +280,11 @@ bool CInstantCameraAppSrc::SetFrameRate(double framesPerSecond)
 }
 
 // Open the camera and adjust some settings
-bool CInstantCameraAppSrc::InitCamera(int width, int height, int framesPerSecond, bool useOnDemand, bool useTrigger, int scaledWidth, int scaledHeight, int rotation, int numFramesToGrab, string filename)
+bool CInstantCameraAppSrc::InitCamera(int width, int height, int framesPerSecond, bool useOnDemand, bool useTrigger, int scaledWidth, int scaledHeight, int rotation, int numFramesToGrab, string filename, const GrabSettings &grabSettings)
 {
 	try
 	{
+		gint64 phaseBegin = g_get_monotonic_time();
 		m_isInitialized = false;
 		m_width = width;
 		m_height = height;
@@ -180,7 +294,34 @@ bool CInstantCameraAppSrc::InitCamera(int width, int height, int framesPerSecond
 		m_scaledWidth = scaledWidth;
 		m_scaledHeight = scaledHeight;
 		m_rotation = rotation;
+		if (m_rotation == -1)
+			m_rotation = 0;
+		if (m_rotation != 0 && m_rotation != 90 && m_rotation != 180 && m_rotation != 270)
+		{
+			cout << "Can only rotate 0, 90, 180 or 270 degrees clockwise. Images will not be rotated." << endl;
+			m_rotation = 0;
+		}
 		m_numFramesToGrab = numFramesToGrab;
+		m_isZeroCopy = grabSettings.useZeroCopy;
+		m_isPushMode = grabSettings.usePushMode;
+		m_grabStrategy = grabSettings.strategy;
+		m_statsInterval = grabSettings.statsInterval;
+		m_statsdAddress = grabSettings.statsdAddress;
+		m_prometheusFile = grabSettings.prometheusFile;
+		m_isEosOnDeviceRemoved = grabSettings.sendEosOnDeviceRemoved;
+		// the stream can't carry on after EOS, so waiting for the camera means no EOS.
+		m_reconnectInterval = grabSettings.reconnectInterval;
+		if (m_reconnectInterval > 0)
+			m_isEosOnDeviceRemoved = false;
+		m_grabThreadPolicy = grabSettings.grabThread;
+		m_streamingThreadPolicy = grabSettings.streamingThread;
+		m_isAnalyzing = (grabSettings.analysisStep > 0);
+		if (m_isAnalyzing == true)
+			m_analyzer.SetStep(grabSettings.analysisStep);
+
+		// The buffer pool only makes sense if the Grab Engine's buffers are handed to the pipeline, so it implies zero-copy.
+		if (grabSettings.useBufferPool == true)
+			m_isZeroCopy = true;
  
 		// since Image On Demand uses software trigger, it cannot be used with isTriggered
 		if (m_isOnDemand == true && m_isTriggered == true)
@@ -189,6 +330,18 @@ bool CInstantCameraAppSrc::InitCamera(int width, int height, int framesPerSecond
 			m_isOnDemand = false;
 		}
 
+		// A trigger rate, or triggers from the application, use the software trigger too.
+		m_triggers.Configure(grabSettings.triggerSchedule, grabSettings.triggerDepth, grabSettings.triggerRate);
+		if (m_triggers.GetSchedule() != TriggerSchedule_OnDemand && m_isTriggered == false)
+			m_isOnDemand = true;
+
+		// Image On Demand triggers the camera when the AppSrc asks for an image. In push mode the AppSrc never asks.
+		if (m_isOnDemand == true && m_isPushMode == true && m_triggers.GetSchedule() == TriggerSchedule_OnDemand)
+		{
+			cout << "Cannot use both Image-on-Demand and Push mode. Using only Push mode." << endl;
+			m_isOnDemand = false;
+		}
+
 		// setup the camera. Here we use the GenICam GenAPI method so we can support multiple interfaces like usb and gige
 		// Note: Get the "Node names" from pylon viewer
 
@@ -219,41 +372,43 @@ bool CInstantCameraAppSrc::InitCamera(int width, int height, int framesPerSecond
 		//const char Filename[] = "LowLight.pfs";
 		//CFeaturePersistence::Save( Filename, &GetNodeMap() );
 		//string testfile = "NodeMap.pfs";
-		CFeaturePersistence::Load( filename.c_str(), &GetNodeMap(), true );
-		cout << filename << endl;
-
-		/*
-		if (m_width == -1)
-		{
-			if (IsReadable(GetNodeMap().GetNode("Width")))
-				m_width = GenApi::CIntegerPtr(GetNodeMap().GetNode("Width"))->GetMax();
-		}
-		else
-		{
-			if (IsWritable(GetNodeMap().GetNode("Width")))
-				GenApi::CIntegerPtr(GetNodeMap().GetNode("Width"))->SetValue(m_width);
-		}
-		if (m_height == -1)
+		// A user set is stored in the camera, so loading it is one command instead of a write for every feature in a pfs file.
+		if (grabSettings.userSet != "")
 		{
-			if (IsReadable(GetNodeMap().GetNode("Height")))
-				m_height = GenApi::CIntegerPtr(GetNodeMap().GetNode("Height"))->GetMax();
+			cout << "Loading camera settings from " << grabSettings.userSet << "..." << endl;
+			GenApi::CEnumerationPtr(GetNodeMap().GetNode("UserSetSelector"))->FromString(grabSettings.userSet.c_str());
+			GenApi::CCommandPtr(GetNodeMap().GetNode("UserSetLoad"))->Execute();
 		}
-		else
+		else if (filename != "")
 		{
-			if (IsWritable(GetNodeMap().GetNode("Height")))
-				GenApi::CIntegerPtr(GetNodeMap().GetNode("Height"))->SetValue(m_height);
+			ifstream file(filename.c_str());
+			if (file.is_open() == false)
+			{
+				cout << "Could not open camera settings file " << filename << endl;
+				return false;
+			}
+			stringstream settings;
+			settings << file.rdbuf();
+			cout << "Loading camera settings from " << filename << "..." << endl;
+			load_settings(settings.str(), grabSettings.writeChangedFeaturesOnly);
 		}
+		add_startup_phase("camera settings", phaseBegin);
+		phaseBegin = g_get_monotonic_time();
 
-		/// Application Specific Offset ///
-		if (IsWritable(GetNodeMap().GetNode("OffsetX"))){
-			GenApi::CIntegerPtr(GetNodeMap().GetNode("OffsetX"))->SetValue(726);
+		// -aoi: the size asked for, centered. Otherwise the AOI is what the pfs file (or the camera) has.
+		if (m_width != -1 || m_height != -1)
+		{
+			RoiSettings roi = GetRoi();
+			roi.width = (m_width != -1) ? m_width : roi.width;
+			roi.height = (m_height != -1) ? m_height : roi.height;
+			roi.offsetX = -1;
+			roi.offsetY = -1;
+			apply_roi(roi);
 		}
-		///============================///
-		*/
-		if (IsWritable(GetNodeMap().GetNode("CenterX")))
-			GenApi::CBooleanPtr(GetNodeMap().GetNode("CenterX"))->SetValue(true);
-		if (IsWritable(GetNodeMap().GetNode("CenterY")))
-			GenApi::CBooleanPtr(GetNodeMap().GetNode("CenterY"))->SetValue(true);
+		if (IsWritable(m_features.CenterX))
+			m_features.CenterX->SetValue(true);
+		if (IsWritable(m_features.CenterY))
+			m_features.CenterY->SetValue(true);
 		/*
 		GenApi::CEnumerationPtr ptrAutoExposure = GetNodeMap().GetNode("ExposureAuto");
 		if (IsWritable(GetNodeMap().GetNode("ExposureAuto")))
@@ -261,27 +416,27 @@ bool CInstantCameraAppSrc::InitCamera(int width, int height, int framesPerSecond
 		*/
 		if (m_isOnDemand == true || m_isTriggered == true)
 		{
-			if (IsWritable(GetNodeMap().GetNode("TriggerSelector")))
+			if (IsWritable(m_features.TriggerSelector))
 			{
-				GenApi::CEnumerationPtr ptrTriggerSelector = GetNodeMap().GetNode("TriggerSelector");
+				GenApi::CEnumerationPtr ptrTriggerSelector = m_features.TriggerSelector;
 				if (IsWritable(ptrTriggerSelector->GetEntryByName("AcquisitionStart")))
 				{
 					ptrTriggerSelector->FromString("AcquisitionStart");
-					GenApi::CEnumerationPtr(GetNodeMap().GetNode("TriggerMode"))->FromString("Off");
+					m_features.TriggerMode->FromString("Off");
 				}
 				if (IsWritable(ptrTriggerSelector->GetEntryByName("FrameBurstStart"))) // BCON and USB use SFNC3 names
 				{
 					ptrTriggerSelector->FromString("FrameBurstStart");
-					GenApi::CEnumerationPtr(GetNodeMap().GetNode("TriggerMode"))->FromString("Off");
+					m_features.TriggerMode->FromString("Off");
 				}
 				if (IsWritable(ptrTriggerSelector->GetEntryByName("FrameStart")))
 				{
 					ptrTriggerSelector->FromString("FrameStart");
-					GenApi::CEnumerationPtr(GetNodeMap().GetNode("TriggerMode"))->FromString("On");
+					m_features.TriggerMode->FromString("On");
 					if (m_isOnDemand == true)
-						GenApi::CEnumerationPtr(GetNodeMap().GetNode("TriggerSource"))->FromString("Software");
+						m_features.TriggerSource->FromString("Software");
 					if (m_isTriggered == true)
-						GenApi::CEnumerationPtr(GetNodeMap().GetNode("TriggerSource"))->FromString("Line1");
+						m_features.TriggerSource->FromString("Line1");
 				}
 				else
 				{
@@ -300,27 +455,10 @@ bool CInstantCameraAppSrc::InitCamera(int width, int height, int framesPerSecond
 
 
 		// now setup some unique-to-usb and unique-to-gige features
-		if (GetDeviceInfo().GetDeviceClass() == "BaslerUsb")
-		{
-			// some usb-specific settings for performance
-			GenApi::CIntegerPtr(GetStreamGrabberNodeMap().GetNode("NumMaxQueuedUrbs"))->SetValue(100);
-
-			// if only connected as usb 2, reduce bandwidth to something stable, like 24MB/sec.
-			if (GenApi::CEnumerationPtr(GetNodeMap().GetNode("BslUSBSpeedMode"))->ToString() == "HighSpeed")
-			{
-				cout << "WARNING:Device Connected in USB 2.0 Mode, performace will be impacted..." << endl;
-				GenApi::CEnumerationPtr(GetNodeMap().GetNode("DeviceLinkThroughputLimitMode"))->FromString("On");
-				GenApi::CIntegerPtr(GetNodeMap().GetNode("DeviceLinkThroughputLimit"))->SetValue(24000000);
-			}
-		}
-		else if (GetDeviceInfo().GetDeviceClass() == "BaslerGigE")
-		{
-			// some gige-specific settings for performance
-			GenApi::CIntegerPtr(GetNodeMap().GetNode("GevSCPSPacketSize"))->SetValue(1500); // set a usually-known-good gige packet size, like 1500.
-		}
+		set_transport_settings();
 
 		// Check the current pixelFormat of the camera to see if the camera should be treated as color or mono
-		GenApi::CEnumerationPtr PixelFormat = GetNodeMap().GetNode("PixelFormat");
+		GenApi::CEnumerationPtr PixelFormat = m_features.PixelFormat;
 		if (Pylon::IsMonoImage(Pylon::CPixelTypeMapper::GetPylonPixelTypeByName(PixelFormat->ToString())) == true)
 			m_isColor = false;
 		else
@@ -336,11 +474,73 @@ bool CInstantCameraAppSrc::InitCamera(int width, int height, int framesPerSecond
 		// Configure some Pylon driver settings
 		//MaxNumBuffer.SetValue(20); // in case we use a grab strategy besides 'latest image only'
 
-		// Configure the Pylon image format converter
-		// We're going to use GStreamer's RGB format in pipelines, so we may need to use Pylon to convert the camera's image to RGB (depending on the camera used)
-		//EPixelType pixelType = Pylon::EPixelType::PixelType_RGB8packed;
-		EPixelType pixelType = Pylon::EPixelType::PixelType_YUV422_YUYV_Packed;
-		//m_FormatConverter.OutputPixelFormat.SetValue(pixelType);
+		// In push mode, the instant camera's grab loop thread delivers each image to our image event handler. We own the handler.
+		if (m_isPushMode == true)
+			RegisterImageEventHandler(new CAppSrcImageEventHandler(this), Pylon::RegistrationMode_ReplaceAll, Pylon::Cleanup_Delete);
+		// Appended, so the configuration loaded with the camera (eg: CAcquireContinuousConfiguration) keeps working.
+		RegisterConfiguration(new CAppSrcConfigurationEventHandler(this), Pylon::RegistrationMode_Append, Pylon::Cleanup_Delete);
+
+		// UpcomingImage waits for the next image after RetrieveResult() is called. That needs our own grab loop, and it's not supported by USB cameras.
+		if (m_grabStrategy == Pylon::GrabStrategy_UpcomingImage && (m_isPushMode == true || GetDeviceInfo().GetDeviceClass() == "BaslerUsb"))
+		{
+			cout << "UpcomingImage grab strategy not available with this camera or in push mode. Using LatestImageOnly." << endl;
+			m_grabStrategy = Pylon::GrabStrategy_LatestImageOnly;
+		}
+
+		// Images triggered ahead have to wait their turn in the Grab Engine. With LatestImageOnly the next would overwrite the one before, which then never comes.
+		if (m_isOnDemand == true && m_triggers.GetSchedule() == TriggerSchedule_OnDemand && grabSettings.triggerDepth > 0 &&
+			(m_grabStrategy == Pylon::GrabStrategy_LatestImageOnly || m_grabStrategy == Pylon::GrabStrategy_UpcomingImage))
+		{
+			cout << "Triggering ahead needs the images queued. Using the OneByOne grab strategy." << endl;
+			m_grabStrategy = Pylon::GrabStrategy_OneByOne;
+		}
+
+		// The number of buffers is how many images the Grab Engine can hold for us. With OneByOne or LatestImages, it's how long a hiccup downstream can be without losing images.
+		if (grabSettings.maxNumBuffer > 0)
+			MaxNumBuffer.SetValue(grabSettings.maxNumBuffer);
+
+		// In zero-copy mode, every buffer travelling through the pipeline is a Grab Engine buffer.
+		// Give the Grab Engine enough buffers so downstream queues can hold a few frames without starving it.
+		if (m_isZeroCopy == true && MaxNumBuffer.GetValue() < 16)
+			MaxNumBuffer.SetValue(16);
+
+		// With LatestImages, the output queue keeps the newest OutputQueueSize images (other strategies ignore it). It can't be larger than MaxNumBuffer.
+		if (grabSettings.outputQueueSize > 0)
+			OutputQueueSize.SetValue(min((int64_t)grabSettings.outputQueueSize, MaxNumBuffer.GetValue()));
+
+		// Let the Grab Engine allocate its buffers from a GstBufferPool, so it grabs straight into memory GStreamer owns.
+		// The factory must be set while not grabbing. We keep ownership of it (Cleanup_None).
+		if (grabSettings.useBufferPool == true)
+		{
+			if (m_bufferPool == NULL)
+				m_bufferPool = new CPylonBufferPool();
+			SetBufferFactory(m_bufferPool, Pylon::Cleanup_None);
+		}
+
+		// The camera latches its clock at the start of each exposure. Where the camera can send it as chunk data with each image, ask for it.
+		// Otherwise the timestamp the driver puts in the Grab Result is used. Either way, see stamp_buffer().
+		m_isHardwareTimestamps = grabSettings.useHardwareTimestamps;
+		m_tickFrequency = GST_SECOND; // USB and BCON cameras count in nanoseconds
+		if (m_isHardwareTimestamps == true)
+		{
+			if (IsWritable(GetNodeMap().GetNode("ChunkModeActive")))
+			{
+				GenApi::CBooleanPtr(GetNodeMap().GetNode("ChunkModeActive"))->SetValue(true);
+				GenApi::CEnumerationPtr ptrChunkSelector = GetNodeMap().GetNode("ChunkSelector");
+				if (IsWritable(ptrChunkSelector->GetEntryByName("Timestamp")))
+				{
+					ptrChunkSelector->FromString("Timestamp");
+					GenApi::CBooleanPtr(GetNodeMap().GetNode("ChunkEnable"))->SetValue(true);
+				}
+			}
+			// GigE cameras count in ticks of their own clock
+			if (IsReadable(GetNodeMap().GetNode("GevTimestampTickFrequency")))
+				m_tickFrequency = (guint64)GenApi::CIntegerPtr(GetNodeMap().GetNode("GevTimestampTickFrequency"))->GetValue();
+		}
+
+		// The Pylon image format converter is only used when downstream wants a format the camera can't produce itself (see SetPixelFormat()).
+		// Normally the camera's own pixel format is passed straight through.
+		m_isConverting = false;
 
 		// setup some settings common to most cameras (it's always best to check if a feature is available before setting it)
 		if (m_isTriggered == false)
@@ -350,17 +550,15 @@ bool CInstantCameraAppSrc::InitCamera(int width, int height, int framesPerSecond
 				m_frameRate = this->GetFrameRate();
 			}
 
-			if (IsWritable(GetNodeMap().GetNode("AcquisitionFrameRateEnable")))
-				GenApi::CBooleanPtr(GetNodeMap().GetNode("AcquisitionFrameRateEnable"))->SetValue(true);
-			if (IsWritable(GetNodeMap().GetNode("AcquisitionFrameRateAbs")))
-				GenApi::CFloatPtr(GetNodeMap().GetNode("AcquisitionFrameRateAbs"))->SetValue(m_frameRate); // this is called "AcquisitionFrameRate" (not abs) in usb cameras. Migration mode lets us use the old name though.
-			if (IsWritable(GetNodeMap().GetNode("AcquisitionFrameRate")))
-				GenApi::CFloatPtr(GetNodeMap().GetNode("AcquisitionFrameRate"))->SetValue(m_frameRate); // BCON and USB use SFNC3 names.
+			// this is called "AcquisitionFrameRateAbs" in gige cameras. BCON and USB use SFNC3 names ("AcquisitionFrameRate"). CCameraFeatures knows which.
+			m_features.SetFrameRate(m_frameRate);
 		}
 
 		// Initialize the Pylon image to a blank image on the off chance that the very first m_Image can't be supplied by the instant camera (ie: missing trigger signal)
-		m_Image.Reset(Pylon::EPixelType::PixelType_RGB8packed, m_width, m_height);
+		// It must match the caps, so it's in the camera's format (SetPixelFormat() resets it when the format changes).
+		m_Image.Reset(Pylon::CPixelTypeMapper::GetPylonPixelTypeByName(PixelFormat->ToString()), this->GetWidth(), this->GetHeight());
 
+		add_startup_phase("configure", phaseBegin);
 		m_isInitialized = true;
 		return true;
 	}
@@ -377,11 +575,35 @@ bool CInstantCameraAppSrc::InitCamera(int width, int height, int framesPerSecond
 	}
 }
 
+// Some unique-to-usb and unique-to-gige settings for performance. Also used when the camera is reconnected, as the stream grabber's settings aren't in the node map.
+void CInstantCameraAppSrc::set_transport_settings()
+{
+	if (GetDeviceInfo().GetDeviceClass() == "BaslerUsb")
+	{
+		// some usb-specific settings for performance
+		GenApi::CIntegerPtr(GetStreamGrabberNodeMap().GetNode("NumMaxQueuedUrbs"))->SetValue(100);
+
+		// if only connected as usb 2, reduce bandwidth to something stable, like 24MB/sec.
+		if (GenApi::CEnumerationPtr(GetNodeMap().GetNode("BslUSBSpeedMode"))->ToString() == "HighSpeed")
+		{
+			cout << "WARNING:Device Connected in USB 2.0 Mode, performace will be impacted..." << endl;
+			GenApi::CEnumerationPtr(GetNodeMap().GetNode("DeviceLinkThroughputLimitMode"))->FromString("On");
+			GenApi::CIntegerPtr(GetNodeMap().GetNode("DeviceLinkThroughputLimit"))->SetValue(24000000);
+		}
+	}
+	else if (GetDeviceInfo().GetDeviceClass() == "BaslerGigE")
+	{
+		// some gige-specific settings for performance
+		GenApi::CIntegerPtr(GetNodeMap().GetNode("GevSCPSPacketSize"))->SetValue(1500); // set a usually-known-good gige packet size, like 1500.
+	}
+}
+
 // Start the image grabbing of camera and driver
 bool CInstantCameraAppSrc::StartCamera()
 {
 	try
 	{
+		gint64 phaseBegin = g_get_monotonic_time();
 		if (m_isInitialized == false)
 		{
 			cout << "Camera not initialized. Run InitCamera() first." << endl;
@@ -389,15 +611,44 @@ bool CInstantCameraAppSrc::StartCamera()
 		}
 
 		// Start grabbing images with the camera and pylon.
-		// Here we use Pylon's GrabStrategy_LatestImageOnly.
+		// By default we use Pylon's GrabStrategy_LatestImageOnly (see GrabSettings in InitCamera()).
 		// This is good for display, and for benchmarking (because any "lag" between images is solely due to how fast the application can call app->grabFrame())
+		// For recording, OneByOne or LatestImages keep images queued in the Grab Engine while the pipeline catches up.
 
 		cout << "Starting Camera image acquistion and Pylon driver Grab Engine..." << endl;
 		if (m_isTriggered == true)
 		{
-			cout << "Camera will now expect a hardware trigger on: " << GenApi::CEnumerationPtr(GetNodeMap().GetNode("TriggerSource"))->ToString() << "..." << endl;
+			cout << "Camera will now expect a hardware trigger on: " << m_features.TriggerSource->ToString() << "..." << endl;
+		}
+		else if (m_isOnDemand == true && m_triggers.GetSchedule() == TriggerSchedule_Rate)
+			cout << "Camera will be triggered " << m_triggers.GetRate() << " times a second..." << endl;
+		// The pipeline is linked by now, so find out which of the camera's formats downstream wants, and set the camera up for it.
+		if (m_appsrc != NULL)
+			negotiate_caps();
+		set_sequence_caps();
+
+		if (m_reconnectInterval > 0)
+		{
+			keep_camera_settings();
+			if (m_reconnecter.joinable() == false)
+			{
+				m_isReconnectStopping = false;
+				m_reconnecter = std::thread(&CInstantCameraAppSrc::reconnect_thread, this);
+			}
 		}
-		StartGrabbing(Pylon::EGrabStrategy::GrabStrategy_LatestImageOnly);
+
+		start_grabbing();
+
+		// what the achieved frame rate is compared to. Read here, so reports don't have to touch the camera's node map.
+		double targetFps = this->GetFrameRate();
+		m_targetFps = targetFps > 0 ? targetFps : 0.0;
+		// (already running if this is a reconnect)
+		if (m_statsInterval > 0)
+			m_stats.StartReporting(m_statsInterval, m_element, this->GetDeviceInfo().GetSerialNumber().c_str(), m_statsdAddress, m_prometheusFile,
+				[this](AcquisitionStats &stats) { stats.buffersInFlight = m_buffersInFlight->count; stats.targetFps = m_targetFps; });
+
+		add_startup_phase("start grabbing", phaseBegin);
+		m_imagesWaitBegin = g_get_monotonic_time();
 
 		// Note: At this point, the camera is acquiring and transmitting images, and the driver's Grab Engine is grabbing them.
 		//       When the Grab Engine has an image, it places it into it's Output Queue for retrieval by CInstantCamera::RetrieveResult().
@@ -434,15 +685,65 @@ bool CInstantCameraAppSrc::StartCamera()
 	}
 }
 
-// Retrieve an image from the driver and place it into an image container
+// Retrieve an image from the driver and push it to the AppSrc in a gst buffer
 bool CInstantCameraAppSrc::retrieve_image()
+{
+	GstBuffer *buffer = GrabBuffer();
+	// The AppSrc doesn't ask again until it's given an image. So while an unplugged camera is looked for, the streaming thread waits here,
+	// and grabs as usual once reconnect() has it back (or stops waiting when StopCamera() stops looking).
+	while (buffer == NULL && IsReconnecting() == true)
+	{
+		if (WaitForReconnect(100) == true)
+			buffer = GrabBuffer();
+	}
+	if (buffer == NULL)
+		return false;
+	return push_buffer(buffer);
+}
+
+// Retrieve an image from the driver and return it in a new gst buffer (with its PylonFrameMeta, and timestamps in hardware timestamp mode).
+// Used by retrieve_image() for the AppSrc, and by elements using the camera directly (see AttachToElement()). Returns NULL on failure.
+GstBuffer* CInstantCameraAppSrc::GrabBuffer()
 {
 	try
 	{
+		// (called from pylonsrc's streaming thread)
+		apply_thread_policy(m_streamingThreadPolicy, m_streamingPolicyThread, "streaming thread");
+		std::lock_guard<std::mutex> grabLock(m_grabLock);
+
+		// While the camera is gone there is nothing to retrieve. With reconnecting, the caller waits for it to be back (see retrieve_image()).
+		if (m_isDeviceRemoved == true || m_isUnlocked == true)
+			return NULL;
+		if (IsCameraDeviceRemoved() == true)
+		{
+			on_device_removed();
+			return NULL;
+		}
 		if (IsGrabbing() == false)
 		{
 			cout << "Camera is not Grabbing. Run StartCamera() first." << endl;
-			return false;
+			return NULL;
+		}
+
+		// If downstream told us (in the ALLOCATION query) that it holds on to more buffers than the pool has to spare, grow the pool.
+		// The Grab Engine can only change its number of buffers while not grabbing, so restart it. This normally happens once, before the first image.
+		if (m_isPoolResizePending == true)
+			resize_pool();
+
+		// Likewise a new AOI (SetRoi()), here between two images, so nothing is being retrieved while the Grab Engine restarts.
+		if (m_isRoiChangePending == true)
+		{
+			m_isRoiChangePending = false;
+			RoiSettings roi;
+			RoiCallback done;
+			{
+				std::lock_guard<std::mutex> lock(m_roiLock);
+				roi = m_pendingRoi;
+				done.swap(m_pendingRoiDone);
+			}
+			bool isApplied = change_roi(roi);
+			if (done)
+				done(isApplied);
 		}
 
 		// Description of "Grabbing" procedure:
@@ -456,54 +757,476 @@ bool CInstantCameraAppSrc::retrieve_image()
 		// The CGrabResultPtr smart pointer contains information about the grab in question, as well as access to the buffer of pixel data.
 		Pylon::CGrabResultPtr ptrGrabResult;
 
-		if (m_isOnDemand == true)
+		// On demand, the image is triggered now (unless it was already, ahead). A trigger the camera isn't ready for is lost, and so is its image,
+		// so the scheduler waits for the camera to be ready first (this was the "Grab Timeout" seen with camera 21949158 in the twocameras_compositor sample).
+		bool isOnDemand = (m_isOnDemand == true && m_triggers.GetSchedule() == TriggerSchedule_OnDemand);
+		if (isOnDemand == true && m_triggers.BeforeRetrieve(5000) == false)
+		{
+			m_stats.AddRetrieveError();
+			cout << "Camera was not ready for a trigger in 5 seconds." << endl;
+			return NULL;
+		}
+		gint64 waitStart = g_get_monotonic_time();
+		if (m_isOnDemand == true && isOnDemand == false)
+		{
+			// Triggered at a rate or by the application, the next image comes whenever it comes. Until grabbing stops (StopCamera()).
+			do
+			{
+				if (IsGrabbing() == false || wait_for_result(5000) == false)
+					return NULL;
+			} while (RetrieveResult(0, ptrGrabResult, Pylon::ETimeoutHandling::TimeoutHandling_Return) == false);
+		}
+		else
+		{
+			// Retrieve a Grab Result from the Grab Engine's Output Queue. If nothing comes to the output queue in 5 seconds, throw a timeout exception.
+			if (wait_for_result(5000) == false)
+				return NULL;
+			RetrieveResult(5000, ptrGrabResult, Pylon::ETimeoutHandling::TimeoutHandling_ThrowException);
+		}
+		// With a sequence, images of the other streams are passed on to their AppSrcs, until there's one for this one.
+		for (int stream = sequence_stream(ptrGrabResult); stream != 0; stream = sequence_stream(ptrGrabResult))
 		{
-			ExecuteSoftwareTrigger(); // TODO: Check for bug or broken camera on 21949158. It would "Grab Timeout" when used in the twocameras_compositor sample. Other camera combinations worked just fine.
+			push_sequence_image(stream, ptrGrabResult);
+			// each step of the sequence is an image of its own, with a trigger of its own
+			if (isOnDemand == true)
+			{
+				m_triggers.Retrieved();
+				if (m_triggers.BeforeRetrieve(5000) == false)
+				{
+					m_stats.AddRetrieveError();
+					cout << "Camera was not ready for a trigger in 5 seconds." << endl;
+					return NULL;
+				}
+			}
+			if (wait_for_result(5000) == false)
+				return NULL;
+			RetrieveResult(5000, ptrGrabResult, Pylon::ETimeoutHandling::TimeoutHandling_ThrowException);
 		}
-		// Retrieve a Grab Result from the Grab Engine's Output Queue. If nothing comes to the output queue in 5 seconds, throw a timeout exception.
-		RetrieveResult(5000, ptrGrabResult, Pylon::ETimeoutHandling::TimeoutHandling_ThrowException);
+		m_stats.AddRetrieveWait(g_get_monotonic_time() - waitStart);
+		// the next image is on its way while this one goes down the pipeline
+		if (isOnDemand == true)
+			m_triggers.Retrieved();
+
+		GstBuffer *buffer = make_buffer(ptrGrabResult);
+		// With the AppSrc, the frame counts once it's pushed (push_buffer()). An element calling us directly (pylonsrc) pushes it itself, right after this.
+		if (buffer != NULL && m_appsrc == NULL)
+			m_stats.AddFrame(g_get_monotonic_time() - m_retrievedTime);
+		return buffer;
+	}
+	catch (GenICam::GenericException &e)
+	{
+		m_stats.AddRetrieveError();
+		// (a timeout: the triggers ahead aren't coming either)
+		m_triggers.Reset();
+		cerr << "An exception occured in GrabBuffer(): " << endl << e.GetDescription() << endl;
+		return NULL;
+	}
+	catch (std::exception &e)
+	{
+		m_stats.AddRetrieveError();
+		m_triggers.Reset();
+		cerr << "An exception occurred in GrabBuffer(): " << endl << e.what() << endl;
+		return NULL;
+	}
+}
+
+// Wait for the Grab Engine to have a result, or for Unlock(). False if unlocked. After a timeout, true: RetrieveResult() reports it, as before.
+bool CInstantCameraAppSrc::wait_for_result(unsigned int timeoutMs)
+{
+	Pylon::WaitObjects waitObjects;
+	waitObjects.Add(GetGrabResultWaitObject());
+	waitObjects.Add(m_unlockWait);
+	unsigned int index = 0;
+	if (waitObjects.WaitForAny(timeoutMs, &index) == false)
+		return true;
+	return m_isUnlocked == false;
+}
+
+void CInstantCameraAppSrc::Unlock()
+{
+	m_isUnlocked = true;
+	m_unlockWait.Signal();
+}
+
+void CInstantCameraAppSrc::UnlockStop()
+{
+	m_unlockWait.Reset();
+	m_isUnlocked = false;
+}
+
+// Put the image of a Grab Result into a gst buffer and push it to the AppSrc.
+// Runs on the Pylon grab loop thread (push mode).
+bool CInstantCameraAppSrc::push_grab_result(const Pylon::CGrabResultPtr &ptrGrabResult)
+{
+	// the sequence's other streams have AppSrcs of their own
+	int stream = sequence_stream(ptrGrabResult);
+	if (stream != 0)
+	{
+		push_sequence_image(stream, ptrGrabResult);
+		return true;
+	}
+
+	GstBuffer *buffer = make_buffer(ptrGrabResult);
+	if (buffer == NULL)
+		return false;
+	return push_buffer(buffer);
+}
+
+// The bytes per row of an image as the camera (or Pylon) lays it out: its pixels, and its PaddingX.
+static size_t row_stride(Pylon::EPixelType pixelType, uint32_t width, size_t paddingX)
+{
+	return (size_t)width * Pylon::BitPerPixel(pixelType) / 8 + paddingX;
+}
+
+// Put the image of a Grab Result into a new gst buffer. If the grab failed, the last good image is used instead.
+GstBuffer* CInstantCameraAppSrc::make_buffer(const Pylon::CGrabResultPtr &ptrGrabResult)
+{
+	m_retrievedTime = g_get_monotonic_time();
+	if (m_isStartupReported == false)
+		report_startup();
+	try
+	{
 		// if the Grab Result indicates success, then we have a good image within the result.
+		m_analysis = FrameAnalysis();
 		if (ptrGrabResult->GrabSucceeded())
 		{
-			m_Image.CopyImage(ptrGrabResult);
+			// Measured here, from the Grab Result's own buffer, just before it's copied or converted: no second pass over the image downstream.
+			if (m_isAnalyzing == true)
+				m_analysis = m_analyzer.Analyze(ptrGrabResult->GetPixelType(), (int)ptrGrabResult->GetWidth(), (int)ptrGrabResult->GetHeight(),
+					ptrGrabResult->GetPaddingX(), ptrGrabResult->GetBuffer());
+
+			// Zero-copy: wrap the Grab Result's own buffer, as long as the Grab Engine has buffers to spare.
+			// Otherwise copy the pixel data into a fresh gst buffer, so the Grab Result can go back to the Grab Engine right away.
+			// If downstream wants a format the camera can't produce, the converter writes into a fresh gst buffer instead.
+			// For I420 / NV12 the host converter writes into a buffer from its own pool.
+			// Rescaled / rotated on the cpu, the transform reads the image where it is instead, and writes the buffer that goes downstream.
+			if (m_imageTransform != NULL)
+				m_gstBuffer = transform_grab_result(ptrGrabResult);
+			else if (m_pixelConverter != NULL)
+				m_gstBuffer = m_pixelConverter->Convert(ptrGrabResult->GetBuffer(), ptrGrabResult->GetImageSize());
+			else if (m_isConverting == true)
+				m_gstBuffer = convert_grab_result(ptrGrabResult);
+			else if (m_isZeroCopy == true && m_buffersInFlight->count < m_maxBuffersInFlight)
+				m_gstBuffer = wrap_grab_result(ptrGrabResult);
+			else
+				m_gstBuffer = copy_grab_result(ptrGrabResult);
+			if (m_gstBuffer == NULL)
+			{
+				cerr << "Could not convert the image to the negotiated format." << endl;
+				return NULL;
+			}
+
+			// remember this image in case the next grab fails.
+			// gst_buffer_copy() only references the memory, and keeps our copy free of the timestamps AppSrc will put on the pushed buffer.
+			if (m_lastGoodBuffer != NULL)
+				gst_buffer_unref(m_lastGoodBuffer);
+			m_lastGoodBuffer = gst_buffer_copy(m_gstBuffer);
 		}
 		else
 		{
 			// If a Grab Failed, the Grab Result is tagged with information about why it failed (technically you could even still access the pixel data to look at the bad image too).
+			m_stats.AddFailedGrab();
 			cout << "Pylon: Grab Result Failed! Error: " << ptrGrabResult->GetErrorDescription() << endl;
 			cout << "Will push last good image instead..." << endl;
+
+			if (m_lastGoodBuffer != NULL)
+			{
+				// the pixel memory is shared, not copied. The new buffer gets its own timestamp when pushed.
+				m_gstBuffer = gst_buffer_copy(m_lastGoodBuffer);
+			}
+			else if (m_pixelConverter != NULL)
+			{
+				// no good image yet. The blank image is in the camera's format, so it goes through the converter like any other.
+				m_gstBuffer = transform_buffer(m_pixelConverter->Convert(m_Image.GetBuffer(), m_Image.GetImageSize()));
+				if (m_gstBuffer == NULL)
+					return NULL;
+			}
+			else if (m_imageTransform != NULL)
+			{
+				m_gstBuffer = m_imageTransform->Transform(m_Image.GetBuffer(), m_Image.GetImageSize(), row_stride(m_Image.GetPixelType(), m_Image.GetWidth(), m_Image.GetPaddingX()));
+				if (m_gstBuffer == NULL)
+					return NULL;
+			}
+			else
+			{
+				// no good image yet, so push the blank image we made in InitCamera(). It's never modified, so it's safe to wrap.
+				m_gstBuffer = gst_buffer_new_wrapped_full(
+					(GstMemoryFlags)(GST_MEMORY_FLAG_PHYSICALLY_CONTIGUOUS | GST_MEMORY_FLAG_READONLY),
+					(gpointer)m_Image.GetBuffer(),
+					m_Image.GetImageSize(),
+					0,
+					m_Image.GetImageSize(),
+					NULL,
+					NULL);
+			}
 		}
 
+		// tag the buffer with the frame information (and in hardware timestamp mode, set its timestamps).
+		stamp_buffer(m_gstBuffer, ptrGrabResult);
+		if (m_analysis.isValid == true)
+		{
+			PylonFrameMeta *frameMeta = gst_buffer_get_pylon_frame_meta(m_gstBuffer);
+			frameMeta->isAnalyzed = TRUE;
+			frameMeta->meanLuminance = m_analysis.meanLuminance;
+			for (int i = 0; i < PYLON_FRAME_META_HISTOGRAM_BINS; i++)
+				frameMeta->histogram[i] = m_analysis.histogram[i];
+			frameMeta->motion = m_analysis.motion;
+			frameMeta->focus = m_analysis.focus;
+			frameMeta->score = m_analysis.score;
+		}
 
-		// create a gst buffer wrapping the image container's buffer
-		m_gstBuffer = gst_buffer_new_wrapped_full(
-			(GstMemoryFlags)GST_MEMORY_FLAG_PHYSICALLY_CONTIGUOUS,
-			(gpointer)m_Image.GetBuffer(),
-			m_Image.GetImageSize(),
-			0,
-			m_Image.GetImageSize(),
-			NULL,
-			NULL);
+		return m_gstBuffer;
+	}
+	catch (GenICam::GenericException &e)
+	{
+		cerr << "An exception occured in make_buffer(): " << endl << e.GetDescription() << endl;
+		return NULL;
+	}
+	catch (std::exception &e)
+	{
+		cerr << "An exception occurred in make_buffer(): " << endl << e.what() << endl;
+		return NULL;
+	}
+}
+
+// Push a gst buffer to the AppSrc. Takes ownership of the buffer.
+// Runs on the AppSrc streaming thread (pull mode, via retrieve_image()) or on the Pylon grab loop thread (push mode).
+bool CInstantCameraAppSrc::push_buffer(GstBuffer *buffer)
+{
+	try
+	{
 		/*
 		// Push the gst buffer wrapping the image buffer to the source pads of the AppSrc element, where it's picked up by the rest of the pipeline
 		GstFlowReturn ret;
-		g_signal_emit_by_name(m_appsrc, "push-buffer", m_gstBuffer, &ret);
+		g_signal_emit_by_name(m_appsrc, "push-buffer", buffer, &ret);
 		*/
-		gst_app_src_push_buffer(GST_APP_SRC(m_appsrc), m_gstBuffer);
-		return true;
+		// In push mode the AppSrc is set to block when its queue is full, so this is where backpressure from the pipeline is felt.
+		// Meanwhile the Grab Engine keeps grabbing into its own buffers (and with LatestImageOnly, keeps only the newest).
+		// FLUSHING just means the pipeline isn't running (yet, or anymore), so the image is dropped.
+		GstFlowReturn ret = gst_app_src_push_buffer(GST_APP_SRC(m_appsrc), buffer);
+		if (ret != GST_FLOW_OK && ret != GST_FLOW_FLUSHING)
+			cout << "AppSrc did not accept the image: " << gst_flow_get_name(ret) << endl;
+		if (ret == GST_FLOW_OK)
+			m_stats.AddFrame(g_get_monotonic_time() - m_retrievedTime);
+		return ret == GST_FLOW_OK;
 	}
 	catch (GenICam::GenericException &e)
 	{
-		cerr << "An exception occured in retrieve_image(): " << endl << e.GetDescription() << endl;
+		cerr << "An exception occured in push_buffer(): " << endl << e.GetDescription() << endl;
 		return false;
 	}
 	catch (std::exception &e)
 	{
-		cerr << "An exception occurred in retrieve_image(): " << endl << e.what() << endl;
+		cerr << "An exception occurred in push_buffer(): " << endl << e.what() << endl;
 		return false;
 	}
 }
 
+// The number of Grab Engine buffers zero-copy mode leaves to the Grab Engine, so it can keep grabbing while the pipeline holds the rest.
+int CInstantCameraAppSrc::reserved_buffers()
+{
+	// LatestImageOnly swaps between two buffers. LatestImages also keeps its output queue filled.
+	if (m_grabStrategy == Pylon::GrabStrategy_LatestImages)
+		return (int)OutputQueueSize.GetValue() + 1;
+	return 2;
+}
+
+// The running time of the pipeline right now (the clock time the pipeline synchronises buffers against), or GST_CLOCK_TIME_NONE if there is no clock yet.
+GstClockTime CInstantCameraAppSrc::get_running_time()
+{
+	if (m_element == NULL)
+		return GST_CLOCK_TIME_NONE;
+	GstClock *clock = gst_element_get_clock(m_element);
+	if (clock == NULL)
+		return GST_CLOCK_TIME_NONE;
+
+	GstClockTime now = gst_clock_get_time(clock);
+	GstClockTime baseTime = gst_element_get_base_time(m_element);
+	gst_object_unref(clock);
+
+	if (now < baseTime)
+		return 0;
+	return now - baseTime;
+}
+
+// Attach a PylonFrameMeta to a gst buffer about to be pushed, and in hardware timestamp mode, set its PTS/DTS and duration.
+// The buffer must be writable (fresh from wrap_grab_result(), copy_grab_result(), or gst_buffer_copy()).
+void CInstantCameraAppSrc::stamp_buffer(GstBuffer *buffer, const Pylon::CGrabResultPtr &ptrGrabResult)
+{
+	bool isGood = ptrGrabResult->GrabSucceeded();
+	PylonFrameMeta *frameMeta = gst_buffer_add_pylon_frame_meta(buffer);
+
+	// Lost frames: the camera numbers every frame it sends, so any gap in the frame ids (besides the images the grab strategy skipped on purpose) never made it to us.
+	gint64 frameId = (gint64)ptrGrabResult->GetBlockID();
+	guint32 skippedImages = (guint32)ptrGrabResult->GetNumberOfSkippedImages();
+	guint32 lostFrames = 0;
+	if (m_lastFrameId >= 0)
+	{
+		gint64 gap = frameId - m_lastFrameId;
+		// GigE (GVSP 1.x) block ids are 16 bits, and wrap from 65535 to 1. The transport layer says which, not the id: USB3 ids start small too.
+		// Going back anywhere else is the camera starting over, which loses nothing.
+		if (gap < 0 && m_isFrameIdWrapping == true)
+			gap += 0xFFFF;
+		if (gap - 1 > (gint64)skippedImages)
+			lostFrames = (guint32)(gap - 1 - skippedImages);
+	}
+	if (isGood == false)
+		lostFrames++; // this one didn't make it either. The last good image goes out in its place.
+	m_lastFrameId = frameId;
+	m_totalLostFrames += lostFrames;
+	m_stats.AddSkippedImages(skippedImages);
+	m_stats.AddLostFrames(lostFrames);
+
+	// The camera's timestamp of this image, in nanoseconds. Prefer the chunk timestamp, which comes straight from the camera with the image.
+	guint64 cameraTimestamp = ptrGrabResult->GetTimeStamp();
+	if (m_isHardwareTimestamps == true && ptrGrabResult->IsChunkDataAvailable())
+	{
+		GenApi::CIntegerPtr ptrChunkTimestamp = ptrGrabResult->GetChunkDataNodeMap().GetNode("ChunkTimestamp");
+		if (IsReadable(ptrChunkTimestamp))
+			cameraTimestamp = (guint64)ptrChunkTimestamp->GetValue();
+	}
+	if (m_tickFrequency != GST_SECOND && m_tickFrequency != 0)
+		cameraTimestamp = gst_util_uint64_scale(cameraTimestamp, GST_SECOND, m_tickFrequency);
+
+	frameMeta->frameId = (guint64)frameId;
+	frameMeta->cameraTimestamp = cameraTimestamp;
+	frameMeta->lostFrames = lostFrames;
+	frameMeta->totalLostFrames = m_totalLostFrames;
+	frameMeta->skippedImages = skippedImages;
+	frameMeta->isRepeated = isGood ? FALSE : TRUE;
+
+	if (m_isHardwareTimestamps == false)
+		return; // AppSrc timestamps the buffer when it's pushed (do-timestamp)
+
+	GstClockTime now = get_running_time();
+	if (now == GST_CLOCK_TIME_NONE)
+		return;
+
+	GstClockTime pts = now;
+	GstClockTime duration = (m_frameRate > 0) ? GST_SECOND / m_frameRate : GST_CLOCK_TIME_NONE;
+	if (isGood == true)
+	{
+		// Map the camera clock onto the running time. Each image gives a sample of the offset between the two clocks,
+		// plus however long the image took to get here (transmission, queueing in the Grab Engine, waiting for need-data), which is never negative.
+		// So the smallest sample is the best estimate: follow smaller samples straight away, and larger ones only very slowly.
+		// The slow creep tracks the drift between the camera's clock and the host's without picking up the jitter of the delivery path.
+		gint64 sample = (gint64)now - (gint64)cameraTimestamp;
+		if (m_isClockOffsetValid == false || cameraTimestamp < m_lastCameraTimestamp)
+		{
+			// first image, or the camera clock was reset
+			m_clockOffset = sample;
+			m_isClockOffsetValid = true;
+		}
+		else if (sample < m_clockOffset)
+			m_clockOffset = sample;
+		else
+			m_clockOffset += (sample - m_clockOffset) / 256;
+
+		gint64 mappedTimestamp = (gint64)cameraTimestamp + m_clockOffset;
+		pts = (mappedTimestamp > 0) ? (GstClockTime)mappedTimestamp : 0;
+
+		if (m_lastCameraTimestamp != 0 && cameraTimestamp > m_lastCameraTimestamp)
+			duration = cameraTimestamp - m_lastCameraTimestamp;
+		m_lastCameraTimestamp = cameraTimestamp;
+	}
+
+	// timestamps must never go backwards, even when the offset estimate jumps down.
+	if (m_lastPts != GST_CLOCK_TIME_NONE && pts <= m_lastPts)
+		pts = m_lastPts + 1;
+	m_lastPts = pts;
+
+	GST_BUFFER_PTS(buffer) = pts;
+	GST_BUFFER_DTS(buffer) = pts;
+	GST_BUFFER_DURATION(buffer) = duration;
+}
+
+// Wrap the buffer of a Grab Result in a gst buffer without copying.
+// The gst buffer keeps its own reference to the Grab Result, so the Grab Engine can't reuse the memory until the pipeline frees the gst buffer.
+GstBuffer* CInstantCameraAppSrc::wrap_grab_result(const Pylon::CGrabResultPtr &ptrGrabResult)
+{
+	// the held reference travels with the gst buffer and is released in cb_release_grab_result().
+	SHeldGrabResult *pHeld = new SHeldGrabResult();
+	pHeld->ptrGrabResult = ptrGrabResult;
+	pHeld->buffersInFlight = m_buffersInFlight;
+	m_buffersInFlight->count++;
+
+	// the memory is marked read-only, so any element wanting to modify the image in place will make its own copy first.
+	return gst_buffer_new_wrapped_full(
+		(GstMemoryFlags)(GST_MEMORY_FLAG_PHYSICALLY_CONTIGUOUS | GST_MEMORY_FLAG_READONLY),
+		ptrGrabResult->GetBuffer(),
+		ptrGrabResult->GetImageSize(),
+		0,
+		ptrGrabResult->GetImageSize(),
+		pHeld,
+		cb_release_grab_result);
+}
+
+// Copy the pixel data of a Grab Result into a newly allocated gst buffer.
+// Each frame gets its own memory, so nothing downstream can still be reading a buffer we overwrite.
+GstBuffer* CInstantCameraAppSrc::copy_grab_result(const Pylon::CGrabResultPtr &ptrGrabResult)
+{
+	GstBuffer *buffer = gst_buffer_new_allocate(NULL, ptrGrabResult->GetImageSize(), NULL);
+	gst_buffer_fill(buffer, 0, ptrGrabResult->GetBuffer(), ptrGrabResult->GetImageSize());
+	return buffer;
+}
+
+// Convert the image of a Grab Result into a newly allocated gst buffer, in the format set up in SetPixelFormat().
+GstBuffer* CInstantCameraAppSrc::convert_grab_result(const Pylon::CGrabResultPtr &ptrGrabResult)
+{
+	size_t size = m_FormatConverter.GetBufferSizeForConversion(ptrGrabResult->GetPixelType(), ptrGrabResult->GetWidth(), ptrGrabResult->GetHeight());
+	GstBuffer *buffer = gst_buffer_new_allocate(NULL, size, NULL);
+
+	GstMapInfo map;
+	gst_buffer_map(buffer, &map, GST_MAP_WRITE);
+	m_FormatConverter.Convert(map.data, map.size, ptrGrabResult);
+	gst_buffer_unmap(buffer, &map);
+
+	return buffer;
+}
+
+// Rescale / rotate the image of a Grab Result on the cpu, if the source bin does it that way (see make_source_bin()).
+// The transform reads the image where it is: the Grab Result's own buffer (with the camera's row padding), or the converter's output.
+GstBuffer* CInstantCameraAppSrc::transform_grab_result(const Pylon::CGrabResultPtr &ptrGrabResult)
+{
+	if (m_pixelConverter != NULL)
+		return transform_buffer(m_pixelConverter->Convert(ptrGrabResult->GetBuffer(), ptrGrabResult->GetImageSize()));
+	if (m_isConverting == true)
+	{
+		// into the same image every time. Its rows are laid out like GStreamer's (OutputPaddingX, see SetPixelFormat()).
+		m_FormatConverter.Convert(m_convertedImage, ptrGrabResult);
+		return m_imageTransform->Transform(m_convertedImage.GetBuffer(), m_convertedImage.GetImageSize(), 0);
+	}
+	return m_imageTransform->Transform(ptrGrabResult->GetBuffer(), ptrGrabResult->GetImageSize(),
+		row_stride(ptrGrabResult->GetPixelType(), ptrGrabResult->GetWidth(), ptrGrabResult->GetPaddingX()));
+}
+
+// Rescale / rotate an image CPixelConverter made (in GStreamer's layout), reading it from the converter's buffer. The input buffer is given up.
+GstBuffer* CInstantCameraAppSrc::transform_buffer(GstBuffer *buffer)
+{
+	if (m_imageTransform == NULL || buffer == NULL)
+		return buffer;
+
+	GstMapInfo map;
+	if (gst_buffer_map(buffer, &map, GST_MAP_READ) == FALSE)
+	{
+		gst_buffer_unref(buffer);
+		return NULL;
+	}
+	GstBuffer *transformed = m_imageTransform->Transform(map.data, map.size, 0);
+	gst_buffer_unmap(buffer, &map);
+	gst_buffer_unref(buffer);
+	return transformed;
+}
+
+// Called by GStreamer (from whichever thread drops the last reference) when a zero-copy gst buffer is freed.
+// Releasing the Grab Result hands its buffer back to the Pylon Grab Engine.
+void CInstantCameraAppSrc::cb_release_grab_result(gpointer user_data)
+{
+	SHeldGrabResult *pHeld = (SHeldGrabResult*)user_data;
+	pHeld->buffersInFlight->count--;
+	delete pHeld;
+}
+
 // Stop the image grabbing of camera and driver
 bool CInstantCameraAppSrc::StopCamera()
 {
@@ -511,11 +1234,21 @@ bool CInstantCameraAppSrc::StopCamera()
 	{
 		// send an EOS event to effectively stop need-data signals. Otherwise the clearing of grab engine buffers by stopgrabbing()
 		// may occur during a subsequent retrieve_image(), which could lead to a null grabresult pointer ("no grab result data referenced error")
-		cout << "Sending EOS event..." << endl;
-		gst_element_send_event(m_appsrc, gst_event_new_eos());
+		if (m_appsrc != NULL)
+		{
+			cout << "Sending EOS event..." << endl;
+			gst_element_send_event(m_appsrc, gst_event_new_eos());
+		}
+		for (size_t i = 1; i < m_sequenceSources.size(); i++)
+			gst_element_send_event(m_sequenceSources[i], gst_event_new_eos());
 
 		cout << "Stopping Camera image acquistion and Pylon image grabbing..." << endl;
+		stop_reconnecting();
+		stop_resizing_pool();
 		StopGrabbing();
+		// (OnGrabStop() only told the rate's clock thread to idle: it can't wait for it inside the camera's lock)
+		m_triggers.Join();
+		m_stats.StopReporting();
 
 		return true;
 	}
@@ -537,7 +1270,11 @@ bool CInstantCameraAppSrc::OpenCamera()
 {
 	try
 	{
+		// The constructor opened the camera already. Opening again would do nothing, but the features would be looked up again.
+		if (IsOpen() == true && m_features.IsResolved() == true)
+			return true;
 		Open();
+		m_features.Resolve(GetNodeMap(), GetSfncVersion() >= Sfnc_2_0_0);
 		return true;
 	}
 	catch (GenICam::GenericException &e)
@@ -557,6 +1294,7 @@ bool CInstantCameraAppSrc::CloseCamera()
 {
 	try
 	{
+		m_features.Reset();
 		Close();
 		// below is rather redundant. The pylon device is by default attached with the tag 'cleanup delete' which means the device is destroyed when the camera is destroyed.
 		DetachDevice();
@@ -582,8 +1320,10 @@ bool CInstantCameraAppSrc::ResetCamera()
 	{
 		if (GenApi::IsWritable(GetNodeMap().GetNode("UserSetSelector")))
 		{
+			gint64 phaseBegin = g_get_monotonic_time();
 			GenApi::CEnumerationPtr(GetNodeMap().GetNode("UserSetSelector"))->FromString("Default");
 			GenApi::CCommandPtr(GetNodeMap().GetNode("UserSetLoad"))->Execute();
+			add_startup_phase("reset to defaults", phaseBegin);
 			return false;
 		}
 		return true;
@@ -605,17 +1345,17 @@ bool CInstantCameraAppSrc::AutoAdjustImage()
 {
 	try
 	{
-		if (GenApi::IsWritable(GetNodeMap().GetNode("ExposureAuto")))
+		if (GenApi::IsWritable(m_features.ExposureAuto))
 		{
-			GenApi::CEnumerationPtr(GetNodeMap().GetNode("ExposureAuto"))->FromString("Once");
+			m_features.ExposureAuto->FromString("Once");
 		}
-		if (GenApi::IsWritable(GetNodeMap().GetNode("GainAuto")))
+		if (GenApi::IsWritable(m_features.GainAuto))
 		{
-			GenApi::CEnumerationPtr(GetNodeMap().GetNode("GainAuto"))->FromString("Once");
+			m_features.GainAuto->FromString("Once");
 		}
-		if (GenApi::IsWritable(GetNodeMap().GetNode("BalanceWhiteAuto")))
+		if (GenApi::IsWritable(m_features.BalanceWhiteAuto))
 		{
-			GenApi::CEnumerationPtr(GetNodeMap().GetNode("BalanceWhiteAuto"))->FromString("Once");
+			m_features.BalanceWhiteAuto->FromString("Once");
 		}
 		return true;
 	}
@@ -680,6 +1420,7 @@ GstElement* CInstantCameraAppSrc::GetSource()
 		string appsrcName = "source";
 		appsrcName.append(this->GetDeviceInfo().GetSerialNumber());
 		m_appsrc = gst_element_factory_make("appsrc", appsrcName.c_str());
+		m_element = m_appsrc;
 
 		// setup the appsrc properties
 		g_object_set(G_OBJECT(m_appsrc),
@@ -687,66 +1428,1384 @@ GstElement* CInstantCameraAppSrc::GetSource()
 			"format", GST_FORMAT_TIME,
 			"is-live", TRUE,
 			"num-buffers", m_numFramesToGrab,
-			"do-timestamp", TRUE, // required for H264 streaming
+			"do-timestamp", m_isHardwareTimestamps ? FALSE : TRUE, // required for H264 streaming, unless we timestamp the buffers ourselves
 			NULL);
 
+		// Hardware timestamps are from the start of exposure, so each buffer arrives a little after its PTS. Tell downstream about that delay, so sinks don't drop the buffers as late.
+		if (m_isHardwareTimestamps == true && this->GetFrameRate() > 0)
+			g_object_set(G_OBJECT(m_appsrc), "min-latency", (gint64)(GST_SECOND / this->GetFrameRate()), NULL);
+
 		// setup the appsrc caps (what kind of video is coming out of the source element?
-		string format = "";
-		EPixelType pixelType = m_Image.GetPixelType();
-		format = "YUY2";
-		
-		g_object_set(G_OBJECT(m_appsrc), "caps",
-			gst_caps_new_simple("video/x-raw",
-			"format", G_TYPE_STRING, format.c_str(),
-			"width", G_TYPE_INT, this->GetWidth(), // just in case the camera used a different value than our desired, due to increment constraints
-			"height", G_TYPE_INT, this->GetHeight(),
-			"framerate", GST_TYPE_FRACTION, (int)this->GetFrameRate(), 1, NULL), NULL); // just in case we desired an u
+		// For now, every format the camera can deliver. StartCamera() fixes them to the one downstream picks, once the pipeline is linked.
+		GstCaps *caps = GetCaps();
+		g_object_set(G_OBJECT(m_appsrc), "caps", caps, NULL);
+		gst_caps_unref(caps);
+
+		if (m_isPushMode == true)
+		{
+			// In push mode images are pushed as soon as they are grabbed. The AppSrc blocks the grab loop thread when it already holds a couple of images,
+			// so a slow pipeline holds back the grab loop instead of piling up memory.
+			guint64 frameSize = (guint64)this->GetWidth() * this->GetHeight() * 2;
+			if (m_features.GetPayloadSize() > 0)
+				frameSize = (guint64)m_features.GetPayloadSize();
+			g_object_set(G_OBJECT(m_appsrc),
+				"block", TRUE,
+				"max-bytes", 2 * frameSize,
+				NULL);
+		}
+		else
+		{
+			// connect the appsrc to the cb_need_data callback function. When appsrc sends the need-data signal, cb_need_data will run.
+			g_signal_connect(m_appsrc, "need-data", G_CALLBACK(cb_need_data), this);
+		}
+
+		// the streaming thread is the AppSrc's own, so its policy is applied from there, with the first buffer it pushes (and again if it's a new thread, eg: after a restart).
+		if (m_streamingThreadPolicy.IsSet() == true)
+		{
+			GstPad *srcPad = gst_element_get_static_pad(m_appsrc, "src");
+			gst_pad_add_probe(srcPad, GST_PAD_PROBE_TYPE_BUFFER, cb_streaming_thread, this, NULL);
+			gst_object_unref(srcPad);
+		}
 
-		// connect the appsrc to the cb_need_data callback function. When appsrc sends the need-data signal, cb_need_data will run.
-		g_signal_connect(m_appsrc, "need-data", G_CALLBACK(cb_need_data), this);
+		// watch the answer to the ALLOCATION query, so the buffer pool can be sized for what downstream holds on to.
+		if (m_bufferPool != NULL)
+		{
+			GstPad *srcPad = gst_element_get_static_pad(m_appsrc, "src");
+			gst_pad_add_probe(srcPad, (GstPadProbeType)(GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM | GST_PAD_PROBE_TYPE_PULL), cb_allocation_query, this, NULL);
+			gst_object_unref(srcPad);
+		}
 
-		return m_appsrc;
+		// Without rescaling or rotation, the AppSrc is all there is to the source.
+		if (m_scaledWidth == -1 && m_scaledHeight == -1 && m_rotation == 0)
+			return m_appsrc;
+		return make_source_bin();
 	}
 	catch (GenICam::GenericException &e)
 	{
 		cerr << "An exception occured in GetSource(): " << endl << e.GetDescription() << endl;
-		//return m_sourceBin;
-		return m_appsrc;
+		return m_sourceBin != NULL ? m_sourceBin : m_appsrc;
 	}
 	catch (std::exception &e)
 	{
 		cerr << "An exception occurred in GetSource(): " << endl << e.what() << endl;
-		//return m_sourceBin;
-		return m_appsrc;
+		return m_sourceBin != NULL ? m_sourceBin : m_appsrc;
 	}
 }
 
-// the callback that's fired when the appsrc element sends the 'need-data' signal.
-void CInstantCameraAppSrc::cb_need_data(GstElement *appsrc, guint unused_size, gpointer user_data)
+// Bin the AppSrc together with the rescale / rotate stage, ghosting the last element's src pad as the bin's.
+// nvvidconv (Jetson) rescales and rotates in hardware. v4l2convert (a V4L2 mem2mem converter, eg: Raspberry Pi, i.MX) rescales in hardware, but can't rotate.
+// Otherwise the AppSrc is alone in the bin, and the images are rescaled and rotated on the cpu before they're pushed (CImageTransform), still only one pass over the image.
+GstElement* CInstantCameraAppSrc::make_source_bin()
 {
-	try
-	{
-		// remember, the "user data" the signal passes to the callback is really the address of the Instant Camera
-		CInstantCameraAppSrc *pCamera = (CInstantCameraAppSrc*)user_data;
+	string serialNumber = this->GetDeviceInfo().GetSerialNumber().c_str();
+	m_sourceBin = gst_bin_new(("sourcebin" + serialNumber).c_str());
+	gst_bin_add(GST_BIN(m_sourceBin), m_appsrc);
 
-		// If we request data, and discover the camera is removed, send the EOS signal.
-		if (pCamera->IsCameraDeviceRemoved() == true)
-		{
-			cout << "Camera Removed!" << endl;
-			GstFlowReturn ret;
-			g_signal_emit_by_name(appsrc, "end-of-stream", &ret);
-		}
+	CImageTransform::GetOutputSize(this->GetWidth(), this->GetHeight(), m_scaledWidth, m_scaledHeight, m_rotation, m_outputWidth, m_outputHeight);
 
-		// tell the CInstantCameraAppSrc to Retrieve an Image. It will pull an image from the pylon driver, and place it into it's CInstantCameraAppSrc::image container.
-		pCamera->retrieve_image();
-	}
-	catch (GenICam::GenericException &e)
+	GstElement *converter = NULL;
+	GstElementFactory *factory = gst_element_factory_find("nvvidconv");
+	if (factory != NULL)
 	{
-		cerr << "An exception occured in cb_need_data(): " << endl << e.GetDescription() << endl;
+		converter = gst_element_factory_create(factory, ("nvvidconv" + serialNumber).c_str());
+		// flip-method counts counterclockwise: 1 = 90 degrees counterclockwise (270 clockwise), 2 = 180, 3 = 90 clockwise.
+		int flipMethod = 0;
+		if (m_rotation == 90)
+			flipMethod = 3;
+		else if (m_rotation == 180)
+			flipMethod = 2;
+		else if (m_rotation == 270)
+			flipMethod = 1;
+		g_object_set(G_OBJECT(converter), "flip-method", flipMethod, NULL);
+		gst_object_unref(factory);
 	}
-	catch (std::exception &e)
+	else if (m_rotation == 0 && (factory = gst_element_factory_find("v4l2convert")) != NULL)
 	{
-		cerr << "An exception occurred in cb_need_data(): " << endl << e.what() << endl;
+		converter = gst_element_factory_create(factory, ("v4l2convert" + serialNumber).c_str());
+		gst_object_unref(factory);
 	}
 
+	GstElement *last = m_appsrc;
+	if (converter != NULL)
+	{
+		// the converter takes the camera's images, and the capsfilter tells it what size to make.
+		cout << "Source bin will rescale/rotate using " << GST_OBJECT_NAME(gst_element_get_factory(converter)) << "." << endl;
+		GstElement *filter = gst_element_factory_make("capsfilter", ("sourcebinfilter" + serialNumber).c_str());
+		GstCaps *caps = gst_caps_new_simple("video/x-raw",
+			"width", G_TYPE_INT, m_outputWidth,
+			"height", G_TYPE_INT, m_outputHeight,
+			NULL);
+		g_object_set(G_OBJECT(filter), "caps", caps, NULL);
+		gst_caps_unref(caps);
+
+		gst_bin_add_many(GST_BIN(m_sourceBin), converter, filter, NULL);
+		gst_element_link_many(m_appsrc, converter, filter, NULL);
+		last = filter;
+	}
+	else
+	{
+		cout << "No hardware video converter found. Source bin will rescale/rotate on the cpu." << endl;
+		m_imageTransform = new CImageTransform();
+		// the AppSrc's caps now describe the transformed images.
+		GstCaps *caps = GetCaps();
+		g_object_set(G_OBJECT(m_appsrc), "caps", caps, NULL);
+		gst_caps_unref(caps);
+	}
+
+	GstPad *srcPad = gst_element_get_static_pad(last, "src");
+	gst_element_add_pad(m_sourceBin, gst_ghost_pad_new("src", srcPad));
+	gst_object_unref(srcPad);
+
+	return m_sourceBin;
+}
+
+// The camera's pixel formats, and how GStreamer calls them. GigE and USB cameras have different names for some of the same formats.
+struct SPixelFormatCaps
+{
+	const char *pylonName;
+	const char *mediaType;
+	const char *gstFormat;
+};
+
+static const SPixelFormatCaps cameraFormats[] =
+{
+	{ "Mono8", "video/x-raw", "GRAY8" },
+	{ "RGB8", "video/x-raw", "RGB" },
+	{ "RGB8Packed", "video/x-raw", "RGB" },
+	{ "BGR8", "video/x-raw", "BGR" },
+	{ "BGR8Packed", "video/x-raw", "BGR" },
+	{ "YCbCr422_8", "video/x-raw", "YUY2" },
+	{ "YUV422_YUYV_Packed", "video/x-raw", "YUY2" },
+	{ "YUV422_8_UYVY", "video/x-raw", "UYVY" },
+	{ "YUV422Packed", "video/x-raw", "UYVY" },
+	{ "BayerRG8", "video/x-bayer", "rggb" },
+	{ "BayerBG8", "video/x-bayer", "bggr" },
+	{ "BayerGR8", "video/x-bayer", "grbg" },
+	{ "BayerGB8", "video/x-bayer", "gbrg" }
+};
+
+// The formats CPixelConverter makes on the host (SIMD, several threads), from a Bayer or YUY2 camera format. Mostly for the hardware encoders.
+static const char *hostConvertedFormats[] = { "I420", "NV12" };
+
+// The camera format to convert to I420 / NV12 from: the current one if it can be, otherwise Bayer (half the bandwidth of YUY2), otherwise YUY2.
+static const SPixelFormatCaps* find_host_conversion_source(GenApi::CEnumerationPtr ptrPixelFormat, const string &currentFormat)
+{
+	const SPixelFormatCaps *pSource = NULL;
+	for (size_t i = 0; i < sizeof(cameraFormats) / sizeof(cameraFormats[0]); i++)
+	{
+		if (CPixelConverter::IsSupported(cameraFormats[i].gstFormat) == false || IsAvailable(ptrPixelFormat->GetEntryByName(cameraFormats[i].pylonName)) == false)
+			continue;
+		if (currentFormat == cameraFormats[i].pylonName)
+			return &cameraFormats[i];
+		if (pSource == NULL || (string(cameraFormats[i].mediaType) == "video/x-bayer" && string(pSource->mediaType) != "video/x-bayer"))
+			pSource = &cameraFormats[i];
+	}
+	return pSource;
+}
+
+// The formats the Pylon image format converter can make from any camera format, for when the camera can't produce what downstream wants.
+struct SConvertedFormat
+{
+	const char *gstFormat;
+	Pylon::EPixelType pixelType;
+	int bytesPerPixel;
+};
+
+static const SConvertedFormat convertedFormats[] =
+{
+	{ "GRAY8", Pylon::PixelType_Mono8, 1 },
+	{ "RGB", Pylon::PixelType_RGB8packed, 3 },
+	{ "BGR", Pylon::PixelType_BGR8packed, 3 },
+	{ "BGRx", Pylon::PixelType_BGRA8packed, 4 },
+	{ "YUY2", Pylon::PixelType_YUV422_YUYV_Packed, 2 },
+	{ "UYVY", Pylon::PixelType_YUV422packed, 2 }
+};
+
+// The caps of the images the camera can deliver: every pixel format the camera supports, then I420 / NV12 if it has a format to make them from,
+// and then the ones the Pylon format converter can make.
+// The camera's current format comes first, so it's picked when downstream doesn't mind.
+GstCaps* CInstantCameraAppSrc::GetCaps()
+{
+	GstCaps *caps = gst_caps_new_empty();
+
+	try
+	{
+		int width = this->GetWidth(); // just in case the camera used a different value than our desired, due to increment constraints
+		int height = this->GetHeight();
+		// when the images are rescaled / rotated on the cpu, that's the size that comes out, and only the formats CImageTransform works on.
+		if (m_imageTransform != NULL)
+		{
+			width = m_outputWidth;
+			height = m_outputHeight;
+		}
+		int frameRate = (int)this->GetFrameRate(); // just in case we desired an unreachable framerate
+		if (frameRate < 0)
+			frameRate = 0; // unknown, eg: triggered
+
+		GenApi::CEnumerationPtr ptrPixelFormat = m_features.PixelFormat;
+		string currentFormat = ptrPixelFormat->ToString().c_str();
+
+		for (int pass = 0; pass < 2; pass++)
+		{
+			for (size_t i = 0; i < sizeof(cameraFormats) / sizeof(cameraFormats[0]); i++)
+			{
+				bool isCurrent = currentFormat == cameraFormats[i].pylonName;
+				if ((pass == 0) != isCurrent || IsAvailable(ptrPixelFormat->GetEntryByName(cameraFormats[i].pylonName)) == false)
+					continue;
+				if (m_imageTransform != NULL && CImageTransform::IsSupported(cameraFormats[i].gstFormat) == false)
+					continue;
+				caps = gst_caps_merge_structure(caps, gst_structure_new(cameraFormats[i].mediaType,
+					"format", G_TYPE_STRING, cameraFormats[i].gstFormat,
+					"width", G_TYPE_INT, width,
+					"height", G_TYPE_INT, height,
+					"framerate", GST_TYPE_FRACTION, frameRate, 1, NULL));
+			}
+		}
+
+		if (find_host_conversion_source(ptrPixelFormat, currentFormat) != NULL)
+		{
+			for (size_t i = 0; i < sizeof(hostConvertedFormats) / sizeof(hostConvertedFormats[0]); i++)
+			{
+				caps = gst_caps_merge_structure(caps, gst_structure_new("video/x-raw",
+					"format", G_TYPE_STRING, hostConvertedFormats[i],
+					"width", G_TYPE_INT, width,
+					"height", G_TYPE_INT, height,
+					"framerate", GST_TYPE_FRACTION, frameRate, 1, NULL));
+			}
+		}
+
+		for (size_t i = 0; i < sizeof(convertedFormats) / sizeof(convertedFormats[0]); i++)
+		{
+			if (m_imageTransform != NULL && CImageTransform::IsSupported(convertedFormats[i].gstFormat) == false)
+				continue;
+			caps = gst_caps_merge_structure(caps, gst_structure_new("video/x-raw",
+				"format", G_TYPE_STRING, convertedFormats[i].gstFormat,
+				"width", G_TYPE_INT, width,
+				"height", G_TYPE_INT, height,
+				"framerate", GST_TYPE_FRACTION, frameRate, 1, NULL));
+		}
+	}
+	catch (GenICam::GenericException &e)
+	{
+		cerr << "An exception occured in GetCaps(): " << endl << e.GetDescription() << endl;
+	}
+	return caps;
+}
+
+// Set the camera up to deliver the format of the (fixed) caps downstream picked.
+// If the camera can produce the format itself, its PixelFormat is changed (restarting grabbing if needed).
+// Otherwise I420 / NV12 are converted on the host by CPixelConverter, and everything else by the Pylon format converter.
+// When the source bin rescales / rotates on the cpu, that's set up for the format too.
+bool CInstantCameraAppSrc::SetPixelFormat(GstCaps *caps)
+{
+	if (set_pixel_format(caps) == false)
+		return false;
+	if (m_imageTransform == NULL)
+		return true;
+
+	const gchar *format = gst_structure_get_string(gst_caps_get_structure(caps, 0), "format");
+	return m_imageTransform->Configure(format, this->GetWidth(), this->GetHeight(), m_outputWidth, m_outputHeight, m_rotation);
+}
+
+bool CInstantCameraAppSrc::set_pixel_format(GstCaps *caps)
+{
+	try
+	{
+		GstStructure *structure = gst_caps_get_structure(caps, 0);
+		string mediaType = gst_structure_get_name(structure);
+		const gchar *format = gst_structure_get_string(structure, "format");
+		if (format == NULL)
+			return false;
+
+		GenApi::CEnumerationPtr ptrPixelFormat = m_features.PixelFormat;
+		string currentFormat = ptrPixelFormat->ToString().c_str();
+
+		// Find the camera's name for the format. Prefer the current one, in case the camera has two names for the same format.
+		const SPixelFormatCaps *pCameraFormat = NULL;
+		for (size_t i = 0; i < sizeof(cameraFormats) / sizeof(cameraFormats[0]); i++)
+		{
+			if (mediaType != cameraFormats[i].mediaType || string(format) != cameraFormats[i].gstFormat)
+				continue;
+			if (IsAvailable(ptrPixelFormat->GetEntryByName(cameraFormats[i].pylonName)) == false)
+				continue;
+			if (pCameraFormat == NULL || currentFormat == cameraFormats[i].pylonName)
+				pCameraFormat = &cameraFormats[i];
+		}
+
+		if (pCameraFormat != NULL)
+		{
+			m_isConverting = false;
+			set_camera_pixel_format(pCameraFormat->pylonName);
+			delete_pixel_converter();
+			m_Image.Reset(Pylon::CPixelTypeMapper::GetPylonPixelTypeByName(pCameraFormat->pylonName), this->GetWidth(), this->GetHeight());
+			cout << "Camera will deliver " << mediaType << " " << format << " (PixelFormat " << pCameraFormat->pylonName << ")." << endl;
+			return true;
+		}
+
+		const SPixelFormatCaps *pSourceFormat = find_host_conversion_source(ptrPixelFormat, currentFormat);
+		if (mediaType == "video/x-raw" && (string(format) == "I420" || string(format) == "NV12") && pSourceFormat != NULL)
+		{
+			// (restarting grabbing renegotiates, which may already have made the converter)
+			set_camera_pixel_format(pSourceFormat->pylonName);
+			if (m_pixelConverter == NULL)
+				m_pixelConverter = new CPixelConverter();
+			if (m_pixelConverter->Configure(pSourceFormat->gstFormat, string(format) == "I420" ? CPixelConverter::OutputFormat_I420 : CPixelConverter::OutputFormat_NV12,
+				this->GetWidth(), this->GetHeight()) == false)
+			{
+				delete_pixel_converter();
+				return false;
+			}
+			m_isConverting = false;
+			m_Image.Reset(Pylon::CPixelTypeMapper::GetPylonPixelTypeByName(pSourceFormat->pylonName), this->GetWidth(), this->GetHeight());
+			cout << "Camera can't deliver " << format << " itself. Will convert on the host from PixelFormat " << pSourceFormat->pylonName << "." << endl;
+			return true;
+		}
+
+		for (size_t i = 0; i < sizeof(convertedFormats) / sizeof(convertedFormats[0]); i++)
+		{
+			if (mediaType != "video/x-raw" || string(format) != convertedFormats[i].gstFormat)
+				continue;
+
+			delete_pixel_converter();
+
+			// GStreamer expects each line of these formats to start on a 4 byte boundary.
+			int lineSize = this->GetWidth() * convertedFormats[i].bytesPerPixel;
+			m_FormatConverter.OutputPixelFormat.SetValue(convertedFormats[i].pixelType);
+			m_FormatConverter.OutputPaddingX.SetValue(GST_ROUND_UP_4(lineSize) - lineSize);
+			m_isConverting = true;
+			m_Image.Reset(convertedFormats[i].pixelType, this->GetWidth(), this->GetHeight(), GST_ROUND_UP_4(lineSize) - lineSize);
+			cout << "Camera can't deliver " << format << " itself. Pylon will convert from PixelFormat " << currentFormat << "." << endl;
+			return true;
+		}
+
+		cout << "Camera can't deliver " << mediaType << " " << format << "." << endl;
+		return false;
+	}
+	catch (GenICam::GenericException &e)
+	{
+		cerr << "An exception occured in SetPixelFormat(): " << endl << e.GetDescription() << endl;
+		return false;
+	}
+	catch (std::exception &e)
+	{
+		cerr << "An exception occurred in SetPixelFormat(): " << endl << e.what() << endl;
+		return false;
+	}
+}
+
+// Change the camera's PixelFormat, if it isn't already. PixelFormat can't change while grabbing, so grabbing is restarted if needed.
+// The new caps are the caller's to set (negotiate_caps() on the AppSrc, or the element calling SetPixelFormat()).
+bool CInstantCameraAppSrc::set_camera_pixel_format(const char *pylonName)
+{
+	GenApi::CEnumerationPtr ptrPixelFormat = m_features.PixelFormat;
+	if (string(ptrPixelFormat->ToString().c_str()) == pylonName)
+		return false;
+
+	bool wasGrabbing = IsGrabbing();
+	if (wasGrabbing == true)
+		StopGrabbing();
+	ptrPixelFormat->FromString(pylonName);
+	if (wasGrabbing == true)
+	{
+		if (m_reconnectInterval > 0)
+			keep_camera_settings();
+		restart_grabbing();
+	}
+	return true;
+}
+
+bool CInstantCameraAppSrc::SetRoi(const RoiSettings &roi, RoiCallback done)
+{
+	if (m_features.IsResolved() == false || m_features.Width.IsValid() == false || m_features.Height.IsValid() == false)
+	{
+		cout << "Camera not open, or it has no AOI. Run InitCamera() first." << endl;
+		if (done)
+			done(false);
+		return false;
+	}
+
+	// Retrieving (pull mode, or an element like pylonsrc): let the streaming thread do it between images. The outcome comes with done.
+	// Pushing, the grab loop is the instant camera's, and stopping grabbing waits for it. So it's done from here.
+	if (IsGrabbing() == true && m_isPushMode == false)
+	{
+		RoiCallback replaced;
+		{
+			std::lock_guard<std::mutex> lock(m_roiLock);
+			replaced.swap(m_pendingRoiDone);
+			m_pendingRoi = roi;
+			m_pendingRoiDone = done;
+			m_isRoiChangePending = true;
+		}
+		// (never made: this one goes instead)
+		if (replaced)
+			replaced(false);
+		return true;
+	}
+	bool isApplied = change_roi(roi);
+	if (done)
+		done(isApplied);
+	return isApplied;
+}
+
+// What the camera has now. maxFrameRate is false: the frame rate is left as it is.
+RoiSettings CInstantCameraAppSrc::GetRoi()
+{
+	RoiSettings roi;
+	try
+	{
+		roi.width = m_features.GetWidth();
+		roi.height = m_features.GetHeight();
+		roi.offsetX = (IsReadable(m_features.CenterX) && m_features.CenterX->GetValue() == true) ? -1 : (IsReadable(m_features.OffsetX) ? (int)m_features.OffsetX->GetValue() : -1);
+		roi.offsetY = (IsReadable(m_features.CenterY) && m_features.CenterY->GetValue() == true) ? -1 : (IsReadable(m_features.OffsetY) ? (int)m_features.OffsetY->GetValue() : -1);
+		roi.binningH = IsReadable(m_features.BinningHorizontal) ? (int)m_features.BinningHorizontal->GetValue() : 1;
+		roi.binningV = IsReadable(m_features.BinningVertical) ? (int)m_features.BinningVertical->GetValue() : 1;
+		roi.decimationH = IsReadable(m_features.DecimationHorizontal) ? (int)m_features.DecimationHorizontal->GetValue() : 1;
+		roi.decimationV = IsReadable(m_features.DecimationVertical) ? (int)m_features.DecimationVertical->GetValue() : 1;
+		roi.maxFrameRate = false;
+	}
+	catch (GenICam::GenericException &e)
+	{
+		cerr << "An exception occured in GetRoi(): " << endl << e.GetDescription() << endl;
+	}
+	return roi;
+}
+
+// Stop grabbing (if it is), change the geometry, and start again. All of it, or none of it if downstream won't take the new size.
+bool CInstantCameraAppSrc::change_roi(const RoiSettings &roi)
+{
+	try
+	{
+		gint64 begin = g_get_monotonic_time();
+		RoiSettings previous = GetRoi();
+		bool wasGrabbing = IsGrabbing();
+		if (wasGrabbing == true)
+			StopGrabbing();
+
+		apply_roi(roi);
+		bool isAccepted = (m_appsrc == NULL || is_accepted_downstream());
+		if (isAccepted == false)
+		{
+			cout << "Downstream elements won't take " << this->GetWidth() << "x" << this->GetHeight() << " images. Keeping the AOI as it was." << endl;
+			apply_roi(previous);
+		}
+		else if (roi.maxFrameRate == true)
+			m_features.SetMaxFrameRate();
+		if (this->GetFrameRate() > 0)
+			m_frameRate = (int)this->GetFrameRate();
+
+		// the AppSrc's caps, and the converters, for the new size
+		if (isAccepted == true && m_appsrc != NULL)
+		{
+			update_caps();
+			set_sequence_caps();
+		}
+		if (wasGrabbing == true)
+		{
+			if (m_reconnectInterval > 0)
+				keep_camera_settings();
+			restart_grabbing();
+		}
+
+		if (isAccepted == true)
+			cout << "AOI now " << this->GetWidth() << "x" << this->GetHeight() << ", binning " << roi.binningH << "x" << roi.binningV << ", " << this->GetFrameRate() << " fps (" <<
+				(g_get_monotonic_time() - begin) / 1000 << " ms without images)." << endl;
+		// for the application's bus watch, as SetRoi() may have returned long before
+		if (m_element != NULL)
+		{
+			GstStructure *structure = gst_structure_new("pylon-roi-changed",
+				"camera", G_TYPE_STRING, m_serialNumber.c_str(),
+				"applied", G_TYPE_BOOLEAN, (gboolean)isAccepted,
+				"width", G_TYPE_INT, (gint)this->GetWidth(),
+				"height", G_TYPE_INT, (gint)this->GetHeight(),
+				NULL);
+			gst_element_post_message(m_element, gst_message_new_element(GST_OBJECT(m_element), structure));
+		}
+		return isAccepted;
+	}
+	catch (GenICam::GenericException &e)
+	{
+		cerr << "An exception occured in change_roi(): " << endl << e.GetDescription() << endl;
+		return false;
+	}
+	catch (std::exception &e)
+	{
+		cerr << "An exception occurred in change_roi(): " << endl << e.what() << endl;
+		return false;
+	}
+}
+
+// Set value, rounded down to the feature's increment and kept within its range. Nothing if it can't be written (eg: the camera has no decimation).
+static void set_within_range(GenApi::CIntegerPtr feature, int64_t value)
+{
+	if (IsWritable(feature) == false)
+		return;
+	int64_t minimum = feature->GetMin();
+	int64_t increment = std::max<int64_t>(feature->GetInc(), 1);
+	value = std::min(std::max(value, minimum), feature->GetMax());
+	feature->SetValue(minimum + (value - minimum) / increment * increment);
+}
+
+// Not while grabbing: the camera doesn't let the AOI change then.
+void CInstantCameraAppSrc::apply_roi(const RoiSettings &roi)
+{
+	// Binning and decimation first, as they decide how big the AOI can be. Then the offsets go to 0, so the AOI can grow, and finally onto the new AOI.
+	set_within_range(m_features.BinningHorizontal, roi.binningH);
+	set_within_range(m_features.BinningVertical, roi.binningV);
+	set_within_range(m_features.DecimationHorizontal, roi.decimationH);
+	set_within_range(m_features.DecimationVertical, roi.decimationV);
+
+	if (IsWritable(m_features.CenterX))
+		m_features.CenterX->SetValue(false);
+	if (IsWritable(m_features.CenterY))
+		m_features.CenterY->SetValue(false);
+	set_within_range(m_features.OffsetX, 0);
+	set_within_range(m_features.OffsetY, 0);
+
+	int64_t sensorWidth = IsReadable(m_features.Width) ? m_features.Width->GetMax() : 0;
+	int64_t sensorHeight = IsReadable(m_features.Height) ? m_features.Height->GetMax() : 0;
+	set_within_range(m_features.Width, roi.width == -1 ? sensorWidth : roi.width);
+	set_within_range(m_features.Height, roi.height == -1 ? sensorHeight : roi.height);
+
+	// centered: by the camera if it can (it keeps it centered when the AOI changes later), else by us
+	if (roi.offsetX == -1 && IsWritable(m_features.CenterX))
+		m_features.CenterX->SetValue(true);
+	else
+		set_within_range(m_features.OffsetX, roi.offsetX == -1 ? (sensorWidth - this->GetWidth()) / 2 : roi.offsetX);
+	if (roi.offsetY == -1 && IsWritable(m_features.CenterY))
+		m_features.CenterY->SetValue(true);
+	else
+		set_within_range(m_features.OffsetY, roi.offsetY == -1 ? (sensorHeight - this->GetHeight()) / 2 : roi.offsetY);
+
+	m_width = this->GetWidth();
+	m_height = this->GetHeight();
+	update_output_size();
+}
+
+// Would downstream take the camera's images at its current size? The same query negotiate_caps() makes.
+bool CInstantCameraAppSrc::is_accepted_downstream()
+{
+	GstCaps *cameraCaps = GetCaps();
+	GstPad *srcPad = gst_element_get_static_pad(m_appsrc, "src");
+	GstCaps *peerCaps = gst_pad_peer_query_caps(srcPad, cameraCaps);
+	bool isAccepted = gst_caps_is_empty(peerCaps) == FALSE;
+	gst_caps_unref(peerCaps);
+	gst_object_unref(srcPad);
+	gst_caps_unref(cameraCaps);
+	return isAccepted;
+}
+
+// The source bin's rescale / rotate has a new input size. Without rescaling, that's a new output size too.
+void CInstantCameraAppSrc::update_output_size()
+{
+	if (m_sourceBin == NULL)
+		return;
+	CImageTransform::GetOutputSize(this->GetWidth(), this->GetHeight(), m_scaledWidth, m_scaledHeight, m_rotation, m_outputWidth, m_outputHeight);
+
+	string serialNumber = this->GetDeviceInfo().GetSerialNumber().c_str();
+	GstElement *filter = gst_bin_get_by_name(GST_BIN(m_sourceBin), ("sourcebinfilter" + serialNumber).c_str());
+	if (filter != NULL)
+	{
+		GstCaps *caps = gst_caps_new_simple("video/x-raw",
+			"width", G_TYPE_INT, m_outputWidth,
+			"height", G_TYPE_INT, m_outputHeight,
+			NULL);
+		g_object_set(G_OBJECT(filter), "caps", caps, NULL);
+		gst_caps_unref(caps);
+		gst_object_unref(filter);
+	}
+}
+
+bool CInstantCameraAppSrc::SetSequence(const vector<SequenceSet> &sets)
+{
+	try
+	{
+		INodeMap &nodeMap = GetNodeMap();
+		GenApi::CEnumerationPtr ptrMode = nodeMap.GetNode("SequencerMode");
+		GenApi::CEnumerationPtr ptrConfiguration = nodeMap.GetNode("SequencerConfigurationMode");
+		if (IsWritable(ptrMode) == false || IsWritable(ptrConfiguration) == false)
+		{
+			// (GigE cameras have a sequencer of another kind, SequenceEnable)
+			cout << "This camera has no sequencer (SequencerMode)." << endl;
+			return false;
+		}
+		ptrMode->FromString("Off");
+		m_sequence.clear();
+		if (sets.empty() == true)
+			return true;
+
+		ptrConfiguration->FromString("On");
+		GenApi::CIntegerPtr ptrSetSelector = nodeMap.GetNode("SequencerSetSelector");
+		GenApi::CCommandPtr ptrSetSave = nodeMap.GetNode("SequencerSetSave");
+		GenApi::CIntegerPtr ptrPathSelector = nodeMap.GetNode("SequencerPathSelector");
+		GenApi::CIntegerPtr ptrSetNext = nodeMap.GetNode("SequencerSetNext");
+		GenApi::CEnumerationPtr ptrTriggerSource = nodeMap.GetNode("SequencerTriggerSource");
+		if (IsWritable(ptrSetSelector) == false || IsWritable(ptrTriggerSource) == false || IsAvailable(ptrTriggerSource->GetEntryByName("FrameStart")) == false)
+		{
+			cout << "This camera's sequencer can't step with every image." << endl;
+			ptrConfiguration->FromString("Off");
+			return false;
+		}
+		if ((int64_t)sets.size() > ptrSetSelector->GetMax() + 1)
+		{
+			cout << "This camera's sequencer has " << ptrSetSelector->GetMax() + 1 << " sets, not " << sets.size() << "." << endl;
+			ptrConfiguration->FromString("Off");
+			return false;
+		}
+
+		int streams = 1;
+		for (size_t i = 0; i < sets.size(); i++)
+		{
+			ptrSetSelector->SetValue((int64_t)i);
+			SequenceSet set = sets[i];
+			apply_roi(set.roi);
+			// the offsets are saved with the set. Centering isn't, so it's turned into the offsets it made.
+			if (IsReadable(m_features.CenterX) && m_features.CenterX->GetValue() == true)
+			{
+				int64_t offsetX = m_features.OffsetX->GetValue();
+				m_features.CenterX->SetValue(false);
+				m_features.OffsetX->SetValue(offsetX);
+			}
+			if (IsReadable(m_features.CenterY) && m_features.CenterY->GetValue() == true)
+			{
+				int64_t offsetY = m_features.OffsetY->GetValue();
+				m_features.CenterY->SetValue(false);
+				m_features.OffsetY->SetValue(offsetY);
+			}
+			if (set.exposureTime > 0)
+				m_features.SetExposureTime(set.exposureTime);
+
+			// path 1 goes on to the next set with every image
+			ptrPathSelector->SetValue(1);
+			ptrSetNext->SetValue((int64_t)((i + 1) % sets.size()));
+			ptrTriggerSource->FromString("FrameStart");
+			ptrSetSave->Execute();
+
+			// what the camera made of it, which is how its images are known without the chunk
+			set.roi = GetRoi();
+			m_sequence.push_back(set);
+			streams = std::max(streams, set.stream + 1);
+		}
+
+		// Set 0 first. Its size is what the camera reports from now on, so it's the AppSrc's.
+		GenApi::CIntegerPtr ptrSetStart = nodeMap.GetNode("SequencerSetStart");
+		if (IsWritable(ptrSetStart))
+			ptrSetStart->SetValue(0);
+		ptrSetSelector->SetValue(0);
+		GenApi::CCommandPtr ptrSetLoad = nodeMap.GetNode("SequencerSetLoad");
+		if (IsWritable(ptrSetLoad))
+			ptrSetLoad->Execute();
+		ptrConfiguration->FromString("Off");
+		ptrMode->FromString("On");
+		m_width = this->GetWidth();
+		m_height = this->GetHeight();
+
+		// which set each image came from
+		if (IsWritable(nodeMap.GetNode("ChunkModeActive")))
+		{
+			GenApi::CBooleanPtr(nodeMap.GetNode("ChunkModeActive"))->SetValue(true);
+			GenApi::CEnumerationPtr ptrChunkSelector = nodeMap.GetNode("ChunkSelector");
+			if (IsWritable(ptrChunkSelector->GetEntryByName("SequencerSetActive")))
+			{
+				ptrChunkSelector->FromString("SequencerSetActive");
+				GenApi::CBooleanPtr(nodeMap.GetNode("ChunkEnable"))->SetValue(true);
+			}
+		}
+
+		// An AppSrc for each of the other streams. They're fed from the thread feeding the main one, so rather than hold it up, a full one drops its oldest image.
+		// (room for four of the largest images, at up to 4 bytes a pixel)
+		guint64 maxImageSize = 0;
+		for (size_t i = 0; i < m_sequence.size(); i++)
+			maxImageSize = std::max(maxImageSize, (guint64)m_sequence[i].roi.width * m_sequence[i].roi.height * 4);
+		string serialNumber = this->GetDeviceInfo().GetSerialNumber().c_str();
+		m_sequenceSources.resize(std::max((int)m_sequenceSources.size(), streams), NULL);
+		for (int stream = 1; stream < streams; stream++)
+		{
+			if (m_sequenceSources[stream] != NULL)
+				continue;
+			GstElement *appsrc = gst_element_factory_make("appsrc", ("source" + serialNumber + "_" + to_string(stream)).c_str());
+			g_object_set(G_OBJECT(appsrc),
+				"stream-type", 0, // 0 = GST_APP_STREAM_TYPE_STREAM
+				"format", GST_FORMAT_TIME,
+				"is-live", TRUE,
+				"do-timestamp", m_isHardwareTimestamps ? FALSE : TRUE,
+				"max-bytes", 4 * maxImageSize,
+				NULL);
+			// (leaky-type is GStreamer 1.20 and later. Before that, a stream nobody takes from grows its queue)
+			if (g_object_class_find_property(G_OBJECT_GET_CLASS(appsrc), "leaky-type") != NULL)
+				g_object_set(G_OBJECT(appsrc), "leaky-type", 2, NULL); // GST_APP_LEAKY_TYPE_DOWNSTREAM
+			m_sequenceSources[stream] = appsrc;
+		}
+
+		cout << "Sequencer: " << sets.size() << " steps, into " << streams << " streams." << endl;
+		return true;
+	}
+	catch (GenICam::GenericException &e)
+	{
+		cerr << "An exception occured in SetSequence(): " << endl << e.GetDescription() << endl;
+		return false;
+	}
+	catch (std::exception &e)
+	{
+		cerr << "An exception occurred in SetSequence(): " << endl << e.what() << endl;
+		return false;
+	}
+}
+
+GstElement* CInstantCameraAppSrc::GetSequenceSource(int stream)
+{
+	if (stream < 1 || stream >= (int)m_sequenceSources.size())
+		return NULL;
+	return m_sequenceSources[stream];
+}
+
+bool CInstantCameraAppSrc::FireTrigger(int timeoutMs)
+{
+	if (m_isOnDemand == false || m_triggers.GetSchedule() != TriggerSchedule_Application)
+	{
+		cout << "The software trigger is not the application's to fire. Use TriggerSchedule_Application in the GrabSettings." << endl;
+		return false;
+	}
+	return m_triggers.Fire(timeoutMs);
+}
+
+TriggerStats CInstantCameraAppSrc::GetTriggerStats()
+{
+	return m_triggers.GetStats();
+}
+
+void CInstantCameraAppSrc::SetFrameAnalysisCallback(FrameAnalysisCallback callback)
+{
+	m_analyzer.SetCallback(callback);
+}
+
+// The stream the image belongs to: its set's, from the SequencerSetActive chunk, or from the first set of its size and place. 0 without a sequence.
+int CInstantCameraAppSrc::sequence_stream(const Pylon::CGrabResultPtr &ptrGrabResult)
+{
+	if (m_sequenceSources.size() < 2 || ptrGrabResult->GrabSucceeded() == false)
+		return 0;
+
+	int set = -1;
+	if (ptrGrabResult->IsChunkDataAvailable())
+	{
+		GenApi::CIntegerPtr ptrChunkSet = ptrGrabResult->GetChunkDataNodeMap().GetNode("ChunkSequencerSetActive");
+		if (IsReadable(ptrChunkSet))
+			set = (int)ptrChunkSet->GetValue();
+	}
+	for (size_t i = 0; set == -1 && i < m_sequence.size(); i++)
+	{
+		const RoiSettings &roi = m_sequence[i].roi;
+		if ((int)ptrGrabResult->GetWidth() == roi.width && (int)ptrGrabResult->GetHeight() == roi.height &&
+			(int)ptrGrabResult->GetOffsetX() == roi.offsetX && (int)ptrGrabResult->GetOffsetY() == roi.offsetY)
+			set = (int)i;
+	}
+	return (set >= 0 && set < (int)m_sequence.size()) ? m_sequence[set].stream : 0;
+}
+
+// As the camera delivers it: a copy, so the Grab Result goes straight back to the Grab Engine.
+void CInstantCameraAppSrc::push_sequence_image(int stream, const Pylon::CGrabResultPtr &ptrGrabResult)
+{
+	GstElement *appsrc = GetSequenceSource(stream);
+	if (appsrc == NULL)
+		return;
+	GstBuffer *buffer = copy_grab_result(ptrGrabResult);
+	stamp_buffer(buffer, ptrGrabResult);
+	GstFlowReturn ret = gst_app_src_push_buffer(GST_APP_SRC(appsrc), buffer);
+	if (ret != GST_FLOW_OK && ret != GST_FLOW_FLUSHING)
+		cout << "Sequence stream " << stream << " did not accept the image: " << gst_flow_get_name(ret) << endl;
+}
+
+// The caps of the other streams: the camera's PixelFormat (as negotiated for the AppSrc), at each stream's size.
+void CInstantCameraAppSrc::set_sequence_caps()
+{
+	if (m_sequenceSources.size() < 2)
+		return;
+
+	string pixelFormat = m_features.PixelFormat->ToString().c_str();
+	const SPixelFormatCaps *pFormat = NULL;
+	for (size_t i = 0; pFormat == NULL && i < sizeof(cameraFormats) / sizeof(cameraFormats[0]); i++)
+	{
+		if (pixelFormat == cameraFormats[i].pylonName)
+			pFormat = &cameraFormats[i];
+	}
+	if (pFormat == NULL)
+	{
+		cout << "PixelFormat " << pixelFormat << " has no caps, so the sequence's other streams can't be sent." << endl;
+		return;
+	}
+
+	for (size_t stream = 1; stream < m_sequenceSources.size(); stream++)
+	{
+		for (size_t i = 0; i < m_sequence.size(); i++)
+		{
+			if (m_sequence[i].stream != (int)stream)
+				continue;
+			GstCaps *caps = gst_caps_new_simple(pFormat->mediaType,
+				"format", G_TYPE_STRING, pFormat->gstFormat,
+				"width", G_TYPE_INT, m_sequence[i].roi.width,
+				"height", G_TYPE_INT, m_sequence[i].roi.height,
+				"framerate", GST_TYPE_FRACTION, 0, 1,
+				NULL);
+			g_object_set(G_OBJECT(m_sequenceSources[stream]), "caps", caps, NULL);
+			gst_caps_unref(caps);
+			break;
+		}
+	}
+}
+
+// Stop converting on the host. Buffers still on their way downstream keep the converter's pool alive.
+void CInstantCameraAppSrc::delete_pixel_converter()
+{
+	if (m_pixelConverter != NULL)
+	{
+		delete m_pixelConverter;
+		m_pixelConverter = NULL;
+	}
+}
+
+// Pick the AppSrc's format: the first of the camera's formats downstream accepts (in downstream's order of preference). Fixes the AppSrc caps to it.
+bool CInstantCameraAppSrc::negotiate_caps()
+{
+	GstCaps *cameraCaps = GetCaps();
+	GstPad *srcPad = gst_element_get_static_pad(m_appsrc, "src");
+	GstCaps *peerCaps = gst_pad_peer_query_caps(srcPad, cameraCaps);
+	gst_object_unref(srcPad);
+	gst_caps_unref(cameraCaps);
+
+	if (gst_caps_is_empty(peerCaps) == TRUE)
+	{
+		cout << "Downstream elements accept none of the camera's formats." << endl;
+		gst_caps_unref(peerCaps);
+		return false;
+	}
+
+	GstCaps *caps = gst_caps_fixate(peerCaps);
+	bool isSet = SetPixelFormat(caps);
+	g_object_set(G_OBJECT(m_appsrc), "caps", caps, NULL);
+	gst_caps_unref(caps);
+
+	// In push mode, the AppSrc queue holds two images. The image size depends on the format.
+	if (m_isPushMode == true && m_features.GetPayloadSize() > 0)
+		g_object_set(G_OBJECT(m_appsrc), "max-bytes", (guint64)(2 * m_features.GetPayloadSize()), NULL);
+
+	return isSet;
+}
+
+// The AppSrc's caps again, in the format downstream picked, for the camera's size and frame rate now (eg: after SetRoi()).
+// Downstream took them already (see is_accepted_downstream()), so they're set without negotiating from scratch.
+bool CInstantCameraAppSrc::update_caps()
+{
+	GstCaps *current = NULL;
+	g_object_get(G_OBJECT(m_appsrc), "caps", &current, NULL);
+	if (current == NULL)
+		return negotiate_caps();
+
+	int width = this->GetWidth();
+	int height = this->GetHeight();
+	if (m_imageTransform != NULL)
+	{
+		width = m_outputWidth;
+		height = m_outputHeight;
+	}
+	int frameRate = (int)this->GetFrameRate();
+	if (frameRate < 0)
+		frameRate = 0;
+	GstCaps *caps = gst_caps_copy(current);
+	gst_caps_unref(current);
+	gst_caps_set_simple(caps,
+		"width", G_TYPE_INT, width,
+		"height", G_TYPE_INT, height,
+		"framerate", GST_TYPE_FRACTION, frameRate, 1,
+		NULL);
+
+	bool isSet = SetPixelFormat(caps);
+	g_object_set(G_OBJECT(m_appsrc), "caps", caps, NULL);
+	gst_caps_unref(caps);
+
+	if (m_isPushMode == true && m_features.GetPayloadSize() > 0)
+		g_object_set(G_OBJECT(m_appsrc), "max-bytes", (guint64)(2 * m_features.GetPayloadSize()), NULL);
+
+	return isSet;
+}
+
+// Start the Grab Engine, with MaxNumBuffer buffers and the grab strategy. The part of StartCamera() a restart needs (see restart_grabbing()).
+void CInstantCameraAppSrc::start_grabbing()
+{
+	if (m_bufferPool != NULL)
+		m_bufferPool->SetNumBuffers((int)MaxNumBuffer.GetValue());
+
+	// frame ids and the camera clock start over with each grab, so does our mapping of them.
+	m_isClockOffsetValid = false;
+	m_lastFrameId = -1;
+	m_isFrameIdWrapping = GetDeviceInfo().GetDeviceClass() == "BaslerGigE";
+	m_lastCameraTimestamp = 0;
+	m_lastPts = GST_CLOCK_TIME_NONE;
+	m_totalLostFrames = 0;
+
+	// (Pylon starts its threads with StartGrabbing())
+	set_grab_engine_priority();
+
+	// In push mode, the instant camera provides the grab loop thread, which calls RetrieveResult() for us and fires OnImageGrabbed().
+	if (m_isPushMode == true)
+		StartGrabbing(m_grabStrategy, Pylon::GrabLoop_ProvidedByInstantCamera);
+	else
+		StartGrabbing(m_grabStrategy);
+
+	// In zero-copy mode, keep a couple of buffers in reserve for the Grab Engine (LatestImageOnly needs at least two to swap between).
+	// If the pipeline is holding on to more than this, retrieve_image() falls back to copying so the camera never starves.
+	m_maxBuffersInFlight = (int)MaxNumBuffer.GetValue() - reserved_buffers();
+}
+
+// For a change the camera only takes while not grabbing (PixelFormat, AOI): stop the Grab Engine if it's running, and start it again.
+// Only that: caps, startup timing, stats and the trigger and reconnect threads were set up by StartCamera() already, and stay as they are.
+void CInstantCameraAppSrc::restart_grabbing()
+{
+	if (IsGrabbing() == true)
+		StopGrabbing();
+	start_grabbing();
+}
+
+// Once the camera is gone, its settings can't be read anymore. So keep them when they're final (pfs file, AOI, PixelFormat, trigger...), for when it's reconnected.
+void CInstantCameraAppSrc::keep_camera_settings()
+{
+	CFeaturePersistence::SaveToString(m_cameraSettings, &GetNodeMap());
+}
+
+// The camera's features, looked up when it was opened. For reading and changing settings while grabbing (eg: exposure, gain) without searching the node map each time.
+CCameraFeatures& CInstantCameraAppSrc::GetFeatures()
+{
+	return m_features;
+}
+
+// The acquisition statistics so far: frames, failed grabs, skipped and lost images, latencies, and the frame rate achieved. Safe to call from any thread.
+AcquisitionStats CInstantCameraAppSrc::GetStats()
+{
+	AcquisitionStats stats = m_stats.Get();
+	stats.buffersInFlight = m_buffersInFlight->count;
+	stats.targetFps = m_targetFps;
+	return stats;
+}
+
+// Use the camera from another element instead of the AppSrc from GetSource() (eg: the pylonsrc plugin, see GstPylonSrc).
+// That element fetches its buffers with GrabBuffer(), and its clock is used for hardware timestamps.
+void CInstantCameraAppSrc::AttachToElement(GstElement *element)
+{
+	m_element = element;
+}
+
+// How late buffers are, compared to their timestamps, and how late they can get when the Grab Engine queues images. For answering LATENCY queries.
+void CInstantCameraAppSrc::GetLatency(GstClockTime &minLatency, GstClockTime &maxLatency)
+{
+	// an image is timestamped after it's exposed and transmitted (or with hardware timestamps, at the start of exposure), so it's always up to a frame late.
+	double frameRate = this->GetFrameRate();
+	GstClockTime frameTime = (frameRate > 0) ? (GstClockTime)(GST_SECOND / frameRate) : 0;
+	minLatency = frameTime;
+
+	// LatestImageOnly always delivers the newest image. Queueing strategies can deliver an image as old as the whole queue.
+	if (m_grabStrategy == Pylon::GrabStrategy_OneByOne)
+		maxLatency = frameTime * (GstClockTime)MaxNumBuffer.GetValue();
+	else if (m_grabStrategy == Pylon::GrabStrategy_LatestImages)
+		maxLatency = frameTime * (GstClockTime)OutputQueueSize.GetValue();
+	else
+		maxLatency = frameTime;
+}
+
+// Read downstream's answer to the ALLOCATION query, and grow the buffer pool if downstream holds on to more buffers than it has to spare.
+void CInstantCameraAppSrc::HandleAllocationQuery(GstQuery *query)
+{
+	if (m_bufferPool == NULL)
+		return;
+
+	// Keep a few buffers beyond what downstream asks for: some for the Grab Engine itself, one for the last good image, and a little slack for queues.
+	int downstreamMin = m_bufferPool->ParseAllocationQuery(query);
+	int required = downstreamMin + reserved_buffers() + 4;
+	if (required > m_maxBuffersInFlight + reserved_buffers())
+	{
+		m_requiredNumBuffers = required;
+		m_isPoolResizePending = true;
+		// Pulled, GrabBuffer() grows the pool between two images. Pushed, the grab loop thread can't restart grabbing from inside itself,
+		// and this streaming thread is what it waits for when the AppSrc's queue is full. So a thread of its own does it.
+		if (m_isPushMode == true && m_isPoolResizing.exchange(true) == false)
+		{
+			// (one which is done already, or just finishing)
+			if (m_poolResizer.joinable())
+				m_poolResizer.join();
+			m_poolResizer = std::thread([this]
+			{
+				do
+				{
+					resize_pool();
+					m_isPoolResizing = false;
+					// (unless more was asked for meanwhile, and no new thread took it on)
+				} while (m_isPoolResizePending == true && m_isPoolResizing.exchange(true) == false);
+			});
+		}
+	}
+}
+
+// Grow the Grab Engine's buffers to what downstream needs (see HandleAllocationQuery()): MaxNumBuffer, and the pool set up again for it by restart_grabbing().
+void CInstantCameraAppSrc::resize_pool()
+{
+	if (m_isPoolResizePending.exchange(false) == false || IsGrabbing() == false)
+		return;
+	cout << "Growing buffer pool to " << m_requiredNumBuffers << " buffers, as requested by downstream elements..." << endl;
+	MaxNumBuffer.SetValue(m_requiredNumBuffers);
+	restart_grabbing();
+}
+
+void CInstantCameraAppSrc::stop_resizing_pool()
+{
+	m_isPoolResizePending = false;
+	if (m_poolResizer.joinable())
+		m_poolResizer.join();
+}
+
+// The camera is gone (unplugged, powered off, cable fault). Reported once: a "pylon-camera-removed" message is posted, and unless told otherwise (GrabSettings), the AppSrc ends the stream.
+// Without EOS the pipeline keeps running. The AppSrc just gets no more images, so an input-selector downstream can switch to something else.
+// With reconnecting, the reconnect thread starts looking for the camera.
+// Called from GrabBuffer() on the streaming thread, or from Pylon's own thread (CAppSrcConfigurationEventHandler), whichever notices first.
+void CInstantCameraAppSrc::on_device_removed()
+{
+	if (m_isDeviceRemoved.exchange(true) == true)
+		return;
+
+	cout << "Camera Removed!" << endl;
+	post_camera_message("pylon-camera-removed");
+	if (m_isEosOnDeviceRemoved == true && m_appsrc != NULL)
+		gst_app_src_end_of_stream(GST_APP_SRC(m_appsrc));
+
+	if (m_reconnectInterval > 0)
+	{
+		std::lock_guard<std::mutex> lock(m_reconnectLock);
+		m_wakeReconnecter.notify_all();
+	}
+}
+
+// True from the camera being unplugged until it's back, if it's being looked for (GrabSettings::reconnectInterval), and not after StopCamera().
+bool CInstantCameraAppSrc::IsReconnecting()
+{
+	return m_reconnectInterval > 0 && m_isDeviceRemoved == true && m_isReconnectStopping == false;
+}
+
+// Wait up to timeoutMs for the unplugged camera to be back and grabbing. True if it is (or was never gone).
+// For elements which fetch their own images (pylonsrc), so their streaming thread can wait instead of ending the stream.
+bool CInstantCameraAppSrc::WaitForReconnect(int timeoutMs)
+{
+	std::unique_lock<std::mutex> lock(m_reconnectLock);
+	return m_reconnected.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this] { return m_isDeviceRemoved == false || m_isReconnectStopping == true; })
+		&& m_isDeviceRemoved == false;
+}
+
+// Sleeps until the camera is removed, then looks for it every m_reconnectInterval ms until it's back. Runs from the first StartCamera() until StopCamera().
+// Meanwhile the pipeline stays PLAYING. It just gets no images (or the fallback, see CPipelineHelper), so the timestamps have a gap.
+void CInstantCameraAppSrc::reconnect_thread()
+{
+	std::unique_lock<std::mutex> lock(m_reconnectLock);
+	while (m_isReconnectStopping == false)
+	{
+		m_wakeReconnecter.wait(lock, [this] { return m_isDeviceRemoved == true || m_isReconnectStopping == true; });
+		if (m_isReconnectStopping == true)
+			break;
+
+		// let go of the lock while talking to the camera, so the streaming thread can keep waiting in WaitForReconnect() meanwhile.
+		lock.unlock();
+		bool isBack = reconnect();
+		lock.lock();
+		if (isBack == true)
+			m_reconnected.notify_all();
+		else if (m_isReconnectStopping == false)
+			m_wakeReconnecter.wait_for(lock, std::chrono::milliseconds(m_reconnectInterval), [this] { return m_isReconnectStopping == true; });
+	}
+}
+
+// One attempt at getting the camera back: find it by serial number, attach and open it, put its settings back, and start grabbing again.
+bool CInstantCameraAppSrc::reconnect()
+{
+	try
+	{
+		// Let go of the removed device first. Buffers still in the pipeline keep their Grab Results, which stay valid after the device is gone.
+		if (IsPylonDeviceAttached() == true)
+		{
+			cout << "Waiting for camera " << m_serialNumber << " to come back..." << endl;
+			// (in push mode, this waits for the grab loop thread to be out of make_buffer(). So it's done before taking m_grabLock)
+			StopGrabbing();
+			// and for the streaming thread to be out of GrabBuffer(). From here it returns at once, as the camera is removed.
+			std::lock_guard<std::mutex> grabLock(m_grabLock);
+			if (m_lastGoodBuffer != NULL)
+			{
+				gst_buffer_unref(m_lastGoodBuffer);
+				m_lastGoodBuffer = NULL;
+			}
+			m_features.Reset();
+			DestroyDevice();
+		}
+
+		CDeviceInfo info;
+		info.SetSerialNumber(m_serialNumber.c_str());
+		DeviceInfoList_t filter;
+		filter.push_back(info);
+		DeviceInfoList_t devices;
+		if (CTlFactory::GetInstance().EnumerateDevices(devices, filter) == 0)
+			return false;
+
+		// the event handlers are the instant camera's, not the device's, so they come along.
+		restart_startup_times("Reconnect");
+		gint64 phaseBegin = g_get_monotonic_time();
+		Attach(CTlFactory::GetInstance().CreateDevice(devices[0]));
+		Open();
+		m_features.Resolve(GetNodeMap(), GetSfncVersion() >= Sfnc_2_0_0);
+		add_startup_phase("open camera", phaseBegin);
+		// The pfs file, AOI and everything else InitCamera() and SetPixelFormat() set up. The caps were made for them, so the pipeline doesn't renegotiate.
+		phaseBegin = g_get_monotonic_time();
+		load_settings(m_cameraSettings.c_str(), true);
+		set_transport_settings();
+		add_startup_phase("camera settings", phaseBegin);
+
+		if (StartCamera() == false)
+		{
+			m_features.Reset();
+			DestroyDevice();
+			return false;
+		}
+		// Only now, with the Grab Engine running: WaitForReconnect() goes on to GrabBuffer() as soon as it sees this.
+		{
+			std::lock_guard<std::mutex> lock(m_reconnectLock);
+			m_isDeviceRemoved = false;
+			m_reconnected.notify_all();
+		}
+
+		cout << "Camera Restored!" << endl;
+		post_camera_message("pylon-camera-restored");
+		return true;
+	}
+	catch (GenICam::GenericException &e)
+	{
+		// eg: the camera is still booting. Try again next time.
+		cerr << "An exception occured in reconnect(): " << endl << e.GetDescription() << endl;
+	}
+	catch (std::exception &e)
+	{
+		cerr << "An exception occurred in reconnect(): " << endl << e.what() << endl;
+	}
+
+	// (if it was only something after restarting that failed, the camera is back all the same)
+	if (m_isDeviceRemoved == false)
+		return true;
+	m_features.Reset();
+	if (IsPylonDeviceAttached() == true)
+		DestroyDevice();
+	return false;
+}
+
+// Whether a feature already has the value a pfs file gives it. Floats are compared as numbers, as they're not always printed the same way.
+static bool is_same_value(GenApi::CValuePtr ptrValue, const string &value)
+{
+	if (string(ptrValue->ToString().c_str()) == value)
+		return true;
+
+	GenApi::CFloatPtr ptrFloat = ptrValue;
+	if (ptrFloat.IsValid() == false)
+		return false;
+	double fileValue = atof(value.c_str());
+	return fabs(ptrFloat->GetValue() - fileValue) <= 1e-6 * max(1.0, fabs(fileValue));
+}
+
+// Put the camera's features to the values in a pfs file's text (CFeaturePersistence format).
+// writeChangedOnly: a pfs file is a "name<tab>value" line for each feature, with selectors before the features they select. Going through it in order and
+// writing only the values which differ leaves the camera just as loading the whole file would, with a fraction of the writes (each one a round trip to the camera, while reads mostly come from the node map's cache).
+// Otherwise the whole file is written, then read back to validate it, which is what CFeaturePersistence::Load() does.
+void CInstantCameraAppSrc::load_settings(const string &settings, bool writeChangedOnly)
+{
+	if (writeChangedOnly == false)
+	{
+		CFeaturePersistence::LoadFromString(settings.c_str(), &GetNodeMap(), true);
+		return;
+	}
+
+	istringstream lines(settings);
+	string line;
+	int numFeatures = 0;
+	int numWritten = 0;
+	while (getline(lines, line))
+	{
+		if (line.empty() == false && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+		size_t tab = line.find('\t');
+		if (line.empty() == true || line[0] == '#' || tab == string::npos)
+			continue;
+
+		string name = line.substr(0, tab);
+		string value = line.substr(tab + 1);
+		numFeatures++;
+		GenApi::CValuePtr ptrValue = GetNodeMap().GetNode(name.c_str());
+		// (eg: depends on a mode which is off, or is read-only on this camera. Load() skips these too)
+		if (IsWritable(ptrValue) == false)
+			continue;
+		try
+		{
+			if (is_same_value(ptrValue, value) == true)
+				continue;
+			ptrValue->FromString(value.c_str());
+			numWritten++;
+		}
+		catch (GenICam::GenericException &e)
+		{
+			cerr << "Could not set " << name << " to " << value << ": " << e.GetDescription() << endl;
+		}
+	}
+	cout << "Wrote " << numWritten << " of " << numFeatures << " camera features. The rest were set already." << endl;
+}
+
+// Remember how long a step of bringing up the camera took (from begin until now). Only until the first image is reported.
+void CInstantCameraAppSrc::add_startup_phase(const string &name, gint64 begin)
+{
+	std::lock_guard<std::mutex> lock(m_startupLock);
+	if (m_isStartupReported == true)
+		return;
+	StartupPhase phase;
+	phase.name = name;
+	phase.duration = g_get_monotonic_time() - begin;
+	m_startupPhases.push_back(phase);
+}
+
+// Time bringing the camera up again from here (eg: after reconnecting), reported at the next image.
+void CInstantCameraAppSrc::restart_startup_times(const string &name)
+{
+	std::lock_guard<std::mutex> lock(m_startupLock);
+	m_startupPhases.clear();
+	m_startupName = name;
+	m_startupBegin = g_get_monotonic_time();
+	m_isStartupReported = false;
+}
+
+// The first image is here. Print how long each step took to get it.
+void CInstantCameraAppSrc::report_startup()
+{
+	std::lock_guard<std::mutex> lock(m_startupLock);
+	if (m_isStartupReported == true)
+		return;
+
+	StartupPhase phase;
+	phase.name = "first image";
+	phase.duration = g_get_monotonic_time() - m_imagesWaitBegin;
+	m_startupPhases.push_back(phase);
+	m_isStartupReported = true;
+
+	cout << m_startupName << " took " << (g_get_monotonic_time() - m_startupBegin) / 1000 << " ms:";
+	for (size_t i = 0; i < m_startupPhases.size(); i++)
+		cout << (i > 0 ? "," : "") << " " << m_startupPhases[i].name << " " << m_startupPhases[i].duration / 1000 << " ms";
+	cout << endl;
+}
+
+// How long each step of bringing up the camera took (see StartupPhase), once the first image is here. Empty before then.
+vector<StartupPhase> CInstantCameraAppSrc::GetStartupTimes()
+{
+	std::lock_guard<std::mutex> lock(m_startupLock);
+	if (m_isStartupReported == false)
+		return vector<StartupPhase>();
+	return m_startupPhases;
+}
+
+// Stop looking for the camera, and wait for the reconnect thread to finish.
+void CInstantCameraAppSrc::stop_reconnecting()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_reconnectLock);
+		m_isReconnectStopping = true;
+		m_wakeReconnecter.notify_all();
+		m_reconnected.notify_all();
+	}
+	// (m_isReconnectStopping stays set, so nothing waits for a camera nobody looks for. StartCamera() clears it with the next reconnect thread.)
+	if (m_reconnecter.joinable())
+		m_reconnecter.join();
+}
+
+// Pylon's grab loop thread (push mode) and internal grab engine thread (USB) are started and prioritized by Pylon, so it's told the priority to give them.
+// The internal grab engine thread gets one more, so it can always hand the images on to the grab loop thread. Their cores can't be chosen here (see apply_thread_policy()).
+void CInstantCameraAppSrc::set_grab_engine_priority()
+{
+	try
+	{
+		int priority = m_grabThreadPolicy.GetPriority();
+		if (priority <= 0)
+			return;
+
+		if (IsWritable(&GrabLoopThreadPriorityOverride))
+		{
+			GrabLoopThreadPriorityOverride.SetValue(true);
+			GrabLoopThreadPriority.SetValue(max(GrabLoopThreadPriority.GetMin(), min(GrabLoopThreadPriority.GetMax(), (int64_t)priority)));
+		}
+		if (IsWritable(&InternalGrabEngineThreadPriorityOverride))
+		{
+			InternalGrabEngineThreadPriorityOverride.SetValue(true);
+			InternalGrabEngineThreadPriority.SetValue(max(InternalGrabEngineThreadPriority.GetMin(), min(InternalGrabEngineThreadPriority.GetMax(), (int64_t)priority + 1)));
+		}
+	}
+	catch (GenICam::GenericException &e)
+	{
+		cerr << "An exception occured in set_grab_engine_priority(): " << endl << e.GetDescription() << endl;
+	}
+}
+
+// Apply a thread policy to the calling thread, unless it already has it. Cheap enough to call for every image.
+void CInstantCameraAppSrc::apply_thread_policy(const CThreadPolicy &policy, std::thread::id &appliedThread, const char *threadName)
+{
+	if (policy.IsSet() == false || appliedThread == std::this_thread::get_id())
+		return;
+	appliedThread = std::this_thread::get_id();
+	policy.Apply(string(threadName) + " of camera " + m_serialNumber);
+}
+
+// Post an element message about the camera ("camera" = its serial number) on the bus of the pipeline the AppSrc (or pylonsrc) is in.
+void CInstantCameraAppSrc::post_camera_message(const char *name)
+{
+	if (m_element == NULL)
+		return;
+
+	GstStructure *structure = gst_structure_new(name, "camera", G_TYPE_STRING, m_serialNumber.c_str(), NULL);
+	gst_element_post_message(m_element, gst_message_new_element(GST_OBJECT(m_element), structure));
+}
+
+// the callback that's fired when the appsrc element sends the 'need-data' signal.
+void CInstantCameraAppSrc::cb_need_data(GstElement *appsrc, guint unused_size, gpointer user_data)
+{
+	try
+	{
+		// remember, the "user data" the signal passes to the callback is really the address of the Instant Camera
+		CInstantCameraAppSrc *pCamera = (CInstantCameraAppSrc*)user_data;
+
+		// tell the CInstantCameraAppSrc to Retrieve an Image. If the camera is removed, this reports it (see on_device_removed()) and pushes nothing.
+		// It will pull an image from the pylon driver, and place it into it's CInstantCameraAppSrc::image container.
+		pCamera->retrieve_image();
+	}
+	catch (GenICam::GenericException &e)
+	{
+		cerr << "An exception occured in cb_need_data(): " << endl << e.GetDescription() << endl;
+	}
+	catch (std::exception &e)
+	{
+		cerr << "An exception occurred in cb_need_data(): " << endl << e.what() << endl;
+	}
+
+}
+
+// the callback that's fired for each buffer the AppSrc pushes, on its streaming thread.
+GstPadProbeReturn CInstantCameraAppSrc::cb_streaming_thread(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	CInstantCameraAppSrc *pCamera = (CInstantCameraAppSrc*)user_data;
+	pCamera->apply_thread_policy(pCamera->m_streamingThreadPolicy, pCamera->m_streamingPolicyThread, "streaming thread");
+	return GST_PAD_PROBE_OK;
+}
+
+// the callback that's fired after the AppSrc's ALLOCATION query has been answered by downstream.
+GstPadProbeReturn CInstantCameraAppSrc::cb_allocation_query(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	CInstantCameraAppSrc *pCamera = (CInstantCameraAppSrc*)user_data;
+	GstQuery *query = GST_PAD_PROBE_INFO_QUERY(info);
+
+	if (GST_QUERY_TYPE(query) != GST_QUERY_ALLOCATION)
+		return GST_PAD_PROBE_OK;
+
+	pCamera->HandleAllocationQuery(query);
+
+	return GST_PAD_PROBE_OK;
 }
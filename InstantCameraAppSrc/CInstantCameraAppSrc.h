@@ -23,15 +23,143 @@
 
 #include <pylon/PylonIncludes.h>
 #include <gst/gst.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <memory>
+#include <functional>
+#include "CPylonBufferPool.h"
+#include "PylonFrameMeta.h"
+#include "CThreadPolicy.h"
+#include "CPixelConverter.h"
+#include "CImageTransform.h"
+#include "CAcquisitionStats.h"
+#include "CCameraFeatures.h"
+#include "CTriggerScheduler.h"
+#include "CFrameAnalyzer.h"
 
 using namespace Pylon;
 using namespace GenApi;
 using namespace std;
 
+// ******* GrabSettings *******
+// How the Pylon Grab Engine buffers images, and how they get to the AppSrc. Passed to InitCamera().
+// LatestImageOnly (the default) always delivers the newest image and drops the rest, which is right for display.
+// OneByOne and LatestImages queue up to MaxNumBuffer / OutputQueueSize images, which is right for recording, where a short hiccup downstream should not lose frames.
+struct GrabSettings
+{
+	Pylon::EGrabStrategy strategy;
+	int maxNumBuffer;     // number of buffers the Grab Engine allocates (-1 = pylon default, or 16 in zero-copy mode)
+	int outputQueueSize;  // number of images kept ready for retrieval with LatestImages (-1 = pylon default)
+	bool useZeroCopy;     // hand the Grab Engine's buffers to the pipeline instead of copying each image
+	bool useBufferPool;   // let the Grab Engine allocate from a GstBufferPool (implies useZeroCopy)
+	bool usePushMode;     // push images from the grab loop thread instead of retrieving them on need-data
+	bool useHardwareTimestamps; // timestamp buffers with the camera's exposure timestamp instead of the time they reach the AppSrc
+	int statsInterval;    // report the acquisition statistics every so many ms (0 = never. GetStats() always works)
+	string statsdAddress; // also send the reports to statsd at host:port ("" = don't)
+	string prometheusFile; // also write the reports to this file in Prometheus text format ("" = don't)
+	bool sendEosOnDeviceRemoved; // end the stream when the camera is unplugged. Either way a "pylon-camera-removed" element message is posted (eg: to switch to a fallback screen)
+	int reconnectInterval; // look for the unplugged camera every so many ms, and carry on grabbing when it's back ("pylon-camera-restored"). 0 = don't. Implies no EOS on removal
+	bool writeChangedFeaturesOnly; // with a pfs file, only write the features the camera doesn't already have (false = load the whole file, then read it all back to validate it)
+	string userSet;       // load this user set stored in the camera instead of a pfs file (eg: "UserSet1", see SaveSettingsToCamera()). "" = use the pfs file
+	CThreadPolicy grabThread;      // cores and SCHED_FIFO priority of the grab loop thread (push mode). Its priority also goes to Pylon's internal grab engine thread
+	CThreadPolicy streamingThread; // cores and priority of the AppSrc's (or pylonsrc's) streaming thread, which retrieves the images in pull mode
+	ETriggerSchedule triggerSchedule; // who fires the software trigger (useOnDemand). A rate or the application's FireTrigger() use the software trigger either way
+	int triggerDepth;     // on demand: images triggered ahead of the one being retrieved (0 = trigger each as it's asked for, 1 or 2 = pipelined, a frame or two early)
+	double triggerRate;   // frames per second with TriggerSchedule_Rate
+	int analysisStep;     // measure each image on the grab thread from every so many pixels and rows, into its PylonFrameMeta (see CFrameAnalyzer). 0 = don't
+
+	GrabSettings()
+	{
+		strategy = Pylon::GrabStrategy_LatestImageOnly;
+		maxNumBuffer = -1;
+		outputQueueSize = -1;
+		useZeroCopy = false;
+		useBufferPool = false;
+		usePushMode = false;
+		useHardwareTimestamps = false;
+		statsInterval = 0;
+		statsdAddress = "";
+		prometheusFile = "";
+		sendEosOnDeviceRemoved = true;
+		reconnectInterval = 0;
+		writeChangedFeaturesOnly = true;
+		userSet = "";
+		triggerSchedule = TriggerSchedule_OnDemand;
+		triggerDepth = 0;
+		triggerRate = 0;
+		analysisStep = 0;
+	}
+};
+
+// ******* RoiSettings *******
+// The part of the sensor read out, and how. Passed to SetRoi().
+// Binning adds neighbouring pixels together (more light, less noise), decimation skips them. Either way less data crosses the link, and the sensor reads out faster.
+// Width and height are in binned / decimated pixels, and rounded to what the camera allows.
+struct RoiSettings
+{
+	int width;          // -1 = as wide as the sensor (after binning) allows
+	int height;         // -1 = as high
+	int offsetX;        // -1 = centered
+	int offsetY;
+	int binningH;       // 1 = none. Ignored (left as it is) if the camera has no binning
+	int binningV;
+	int decimationH;    // 1 = none. Likewise
+	int decimationV;
+	bool maxFrameRate;  // run as fast as the new geometry allows, instead of at the frame rate set before
+
+	RoiSettings()
+	{
+		width = -1;
+		height = -1;
+		offsetX = -1;
+		offsetY = -1;
+		binningH = 1;
+		binningV = 1;
+		decimationH = 1;
+		decimationV = 1;
+		maxFrameRate = true;
+	}
+};
+
+// What became of a SetRoi(): true if the camera has the new geometry now, false if it has the one before (eg: downstream wouldn't take it).
+// Called on whichever thread made the change (in pull mode, the streaming thread). Keep it short.
+typedef std::function<void(bool isApplied)> RoiCallback;
+
+// ******* SequenceSet *******
+// One step of the camera's sequencer, passed to SetSequence(). The sequencer goes through the steps one image each, round and round.
+// To take more images of one step than another, list it more than once (eg: a crop four times, then the full frame once).
+struct SequenceSet
+{
+	RoiSettings roi;     // (maxFrameRate is ignored. The sequence runs as fast as its slowest step allows)
+	double exposureTime; // us, -1 = as it is
+	int stream;          // where its images go: 0 = the AppSrc from GetSource(), 1 and up = GetSequenceSource(stream)
+
+	SequenceSet()
+	{
+		exposureTime = -1;
+		stream = 0;
+	}
+};
+
+// ******* StartupPhase *******
+// How long one step of bringing up the camera took, from the constructor to the first image (see GetStartupTimes()). Also used for reconnecting.
+struct StartupPhase
+{
+	string name;
+	gint64 duration; // us
+};
+
 // ******* CInstantCameraAppSrc *******
 // Here we extend the Pylon CInstantCamera class with a few things to make it easier to integrate with Appsrc.
+struct SInFlightBuffers; // (see wrap_grab_result())
+
 class CInstantCameraAppSrc : public CInstantCamera
 {
+	friend class CAppSrcImageEventHandler;
+	friend class CAppSrcConfigurationEventHandler;
 public:
 	CInstantCameraAppSrc(string serialnumber = "");
 	~CInstantCameraAppSrc();
@@ -48,7 +176,8 @@ public:
 		int scaledHeight = -1,
 		int rotation = -1,
 		int numFramesToGrab = -1,
-		string filename = "");
+		string filename = "",
+		const GrabSettings &grabSettings = GrabSettings());
 	bool StartCamera();
 	bool StopCamera();
 	bool OpenCamera();
@@ -59,6 +188,41 @@ public:
 	bool SaveSettingsToCamera(bool BootWithNewSettings = false);
 	double GetFrameRate();
 	GstElement* GetSource();	
+	GstCaps* GetCaps();
+	bool SetPixelFormat(GstCaps *caps);
+	GstBuffer* GrabBuffer();
+	void AttachToElement(GstElement *element);
+	void GetLatency(GstClockTime &minLatency, GstClockTime &maxLatency);
+	void HandleAllocationQuery(GstQuery *query);
+	AcquisitionStats GetStats();
+	CCameraFeatures& GetFeatures();
+	vector<StartupPhase> GetStartupTimes();
+	bool IsReconnecting();
+	bool WaitForReconnect(int timeoutMs);
+	// Wake a GrabBuffer() waiting for an image: it returns NULL, and so do the next ones until UnlockStop(). Grabbing carries on,
+	// so an element can pause (its basesrc unlock vfunc) and play again without restarting the Grab Engine.
+	void Unlock();
+	void UnlockStop();
+	// Change the AOI, binning and decimation. While grabbing, grabbing is stopped and restarted around the change (in pull mode, by the streaming thread with
+	// its next image, so nothing is retrieved mid-change), and the AppSrc's caps follow on with the next buffer. Downstream has to take the new size:
+	// a capsfilter with a fixed width or height won't, and then the old geometry is put back. False if the camera can't do it at all, or (not deferred) it was put back.
+	// As the outcome may only be known later, it's also given to done (exactly once, false if another SetRoi() came first), and posted as a
+	// "pylon-roi-changed" element message (camera, applied, width, height).
+	bool SetRoi(const RoiSettings &roi, RoiCallback done = RoiCallback());
+	RoiSettings GetRoi();
+	// Program the camera's sequencer with these steps (USB cameras with SFNC 2 sequencers, eg: ace U), so one readout alternates between regions or exposures.
+	// Each image is sent to the stream of its step, told by the SequencerSetActive chunk or, without it, by its size and place: stream 0 is the AppSrc as usual,
+	// the others get an AppSrc each, from GetSequenceSource(). Call after InitCamera() and before GetSource(). An empty list turns the sequencer off.
+	// Use a grab strategy that queues (OneByOne): LatestImageOnly keeps only the newest image, whichever stream it's for.
+	bool SetSequence(const vector<SequenceSet> &sets);
+	// Stream 1 and up of the sequence. Its caps are the camera's pixel format at its step's size, as the camera delivers it (no conversion, rescaling or rotation),
+	// at a variable frame rate. NULL if there's no such stream.
+	GstElement* GetSequenceSource(int stream);
+	// Take an image now, with TriggerSchedule_Application. Waits up to timeoutMs for the camera to be ready for it. False if it wasn't (see GetTriggerStats()).
+	bool FireTrigger(int timeoutMs = 1000);
+	TriggerStats GetTriggerStats();
+	// With GrabSettings analysisStep: called on the grab thread with each image's analysis (see FrameAnalysisCallback). Set it before StartCamera().
+	void SetFrameAnalysisCallback(FrameAnalysisCallback callback);
 	
 private:
 	int m_width;
@@ -72,13 +236,124 @@ private:
 	bool m_isColor;
 	bool m_isOnDemand;
 	bool m_isTriggered;
+	CTriggerScheduler m_triggers; // (software trigger only)
+	bool m_isAnalyzing;
+	CFrameAnalyzer m_analyzer;
+	FrameAnalysis m_analysis; // the image in make_buffer()
 	bool m_isOpen;
+	bool m_isZeroCopy;
+	int m_maxBuffersInFlight;
+	std::shared_ptr<SInFlightBuffers> m_buffersInFlight; // zero-copy buffers held by the pipeline, shared with them (they can outlive us)
+	CPylonBufferPool* m_bufferPool;
+	bool m_isPushMode;
+	Pylon::EGrabStrategy m_grabStrategy;
+	int m_requiredNumBuffers;
+	std::atomic<bool> m_isPoolResizePending;
+	std::thread m_poolResizer; // push mode: restarts grabbing for a bigger pool, as neither the grab loop nor the streaming thread can (see HandleAllocationQuery())
+	std::atomic<bool> m_isPoolResizing;
+	std::mutex m_roiLock; // m_pendingRoi, handed from SetRoi() to the streaming thread
+	RoiSettings m_pendingRoi;
+	RoiCallback m_pendingRoiDone;
+	std::atomic<bool> m_isRoiChangePending;
+	std::atomic<bool> m_isUnlocked;
+	Pylon::WaitObjectEx m_unlockWait; // signaled by Unlock(), waited for with the Grab Engine's result wait object
+	vector<SequenceSet> m_sequence; // the steps as the camera took them (sizes rounded, offsets as they ended up)
+	vector<GstElement*> m_sequenceSources; // by stream. [0] is unused (the AppSrc), empty without a sequence
+	bool m_isHardwareTimestamps;
+	guint64 m_tickFrequency;
+	gint64 m_clockOffset;
+	bool m_isClockOffsetValid;
+	gint64 m_lastFrameId;
+	bool m_isFrameIdWrapping; // GigE: 16-bit block ids, which wrap. Other transport layers have 64-bit ones, which only go back when the camera starts over.
+	guint64 m_lastCameraTimestamp;
+	GstClockTime m_lastPts;
+	guint64 m_totalLostFrames;
+	std::atomic<double> m_targetFps; // (read by the stats reporter thread, so declared before m_stats)
+	CAcquisitionStats m_stats;
+	gint64 m_retrievedTime; // when the image being handled came out of the Grab Engine (g_get_monotonic_time())
+	int m_statsInterval;
+	string m_statsdAddress;
+	string m_prometheusFile;
+	bool m_isEosOnDeviceRemoved;
+	std::atomic<bool> m_isDeviceRemoved; // set once the removal has been reported, until the camera is back
+	int m_reconnectInterval;
+	std::thread m_reconnecter;
+	std::mutex m_reconnectLock;
+	std::condition_variable m_wakeReconnecter; // a removal, or stopping
+	std::condition_variable m_reconnected;
+	std::atomic<bool> m_isReconnectStopping; // from StopCamera() until the next StartCamera()
+	std::mutex m_grabLock; // the device and m_lastGoodBuffer: GrabBuffer() on the streaming thread, against reconnect() letting go of them
+	GenICam::gcstring m_cameraSettings; // the node map as StartCamera() left it, put back on the camera when it's reconnected
+	std::mutex m_startupLock;
+	vector<StartupPhase> m_startupPhases;
+	gint64 m_startupBegin;
+	gint64 m_imagesWaitBegin; // when grabbing started, for the time to the first image
+	std::atomic<bool> m_isStartupReported;
+	string m_startupName; // "Startup" or "Reconnect"
+	CThreadPolicy m_grabThreadPolicy;
+	CThreadPolicy m_streamingThreadPolicy;
+	std::thread::id m_grabPolicyThread; // the thread each policy was last applied to (threads come and go with grabbing and state changes)
+	std::thread::id m_streamingPolicyThread;
 	string m_serialNumber;
+	CCameraFeatures m_features; // (valid while the camera is open)
 	Pylon::CPylonImage m_Image;
 	Pylon::CImageFormatConverter m_FormatConverter;
+	Pylon::CPylonImage m_convertedImage; // the format converter's output, when it's rescaled / rotated on the cpu after (see transform_grab_result())
+	bool m_isConverting;
+	CPixelConverter* m_pixelConverter; // NULL unless the camera's images are converted to I420 / NV12 on the host
+	CImageTransform* m_imageTransform; // NULL unless the source bin rescales / rotates on the cpu
+	int m_outputWidth; // image size after the source bin's rescale / rotate
+	int m_outputHeight;
 	GstElement* m_appsrc;
+	GstElement* m_element;
 	GstElement* m_sourceBin;
 	GstBuffer* m_gstBuffer;
+	GstBuffer* m_lastGoodBuffer;
 	bool retrieve_image();
+	bool push_grab_result(const Pylon::CGrabResultPtr &ptrGrabResult);
+	bool push_buffer(GstBuffer *buffer);
+	GstBuffer* make_buffer(const Pylon::CGrabResultPtr &ptrGrabResult);
+	bool wait_for_result(unsigned int timeoutMs);
+	int reserved_buffers();
+	void stamp_buffer(GstBuffer *buffer, const Pylon::CGrabResultPtr &ptrGrabResult);
+	GstClockTime get_running_time();
+	GstBuffer* wrap_grab_result(const Pylon::CGrabResultPtr &ptrGrabResult);
+	GstBuffer* copy_grab_result(const Pylon::CGrabResultPtr &ptrGrabResult);
+	GstBuffer* convert_grab_result(const Pylon::CGrabResultPtr &ptrGrabResult);
+	bool negotiate_caps();
+	bool update_caps();
+	void start_grabbing();
+	void restart_grabbing();
+	void keep_camera_settings();
+	void resize_pool();
+	void stop_resizing_pool();
+	bool set_pixel_format(GstCaps *caps);
+	bool set_camera_pixel_format(const char *pylonName);
+	bool change_roi(const RoiSettings &roi);
+	void apply_roi(const RoiSettings &roi);
+	bool is_accepted_downstream();
+	int sequence_stream(const Pylon::CGrabResultPtr &ptrGrabResult);
+	void push_sequence_image(int stream, const Pylon::CGrabResultPtr &ptrGrabResult);
+	void set_sequence_caps();
+	void update_output_size();
+	GstBuffer* transform_grab_result(const Pylon::CGrabResultPtr &ptrGrabResult);
+	GstBuffer* transform_buffer(GstBuffer *buffer);
+	GstElement* make_source_bin();
+	void delete_pixel_converter();
+	void on_device_removed();
+	void reconnect_thread();
+	bool reconnect();
+	void stop_reconnecting();
+	void set_transport_settings();
+	void load_settings(const string &settings, bool writeChangedOnly);
+	void add_startup_phase(const string &name, gint64 begin);
+	void restart_startup_times(const string &name);
+	void report_startup();
+	void post_camera_message(const char *name);
+	void set_grab_engine_priority();
+	void apply_thread_policy(const CThreadPolicy &policy, std::thread::id &appliedThread, const char *threadName);
 	static void cb_need_data(GstElement *appsrc, guint unused_size, gpointer user_data);
+	static void cb_release_grab_result(gpointer user_data);
+	static GstPadProbeReturn cb_allocation_query(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+	static GstPadProbeReturn cb_streaming_thread(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
 };
@@ -0,0 +1,501 @@
+/*  CPixelConverter.cpp: Definition file for CPixelConverter Class.
+    This converts Bayer and YUY2 images to I420 or NV12 on the host, using SIMD (SSE2 or NEON) and several threads, into pooled gst buffers.
+
+	Copyright 2017, 2018, 2019 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+	*/
+
+/*
+	Both conversions work on pairs of rows, because I420 and NV12 have one chroma sample per 2x2 pixels.
+
+	Bayer: each 2x2 quad has one R, two G and one B sample. Every pixel keeps its own sample and takes the other colours from its quad
+	(the two G pixels keep their own G, the R and B pixels use the average of the two). So the luma keeps the full resolution of the sensor,
+	and the chroma of the quad is exactly the chroma plane's sample.
+
+	YUY2: the luma is copied, and the chroma of the two rows is averaged (YUY2 only has half the horizontal chroma resolution to begin with).
+
+	The SIMD code paths do 8 quads (16 pixels) at a time, the scalar code does the rest of each row (and everything, on other cpus).
+	All paths give the same results.
+*/
+
+#include "CPixelConverter.h"
+#include <iostream>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PIXEL_CONVERTER_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PIXEL_CONVERTER_NEON
+#include <arm_neon.h>
+#endif
+
+using namespace std;
+
+// ******* Bayer to YUV 4:2:0 *******
+// BT.601 limited range, fixed point (8 bit fraction):
+// Y =  ( 66 R + 129 G +  25 B + 128) >> 8 + 16
+// U =  (-38 R -  74 G + 112 B + 128) >> 8 + 128
+// V =  (112 R -  94 G -  18 B + 128) >> 8 + 128
+// None of the intermediate sums overflow 16 bits, which the SIMD code relies on.
+static void bayer_quads_scalar(const uint8_t *src0, const uint8_t *src1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, uint8_t *uv,
+	const int *order, int firstQuad, int numQuads)
+{
+	for (int x = firstQuad; x < numQuads; x++)
+	{
+		int q[4] = { src0[2 * x], src0[2 * x + 1], src1[2 * x], src1[2 * x + 1] };
+		int r = q[order[0]];
+		int ga = q[order[1]];
+		int gb = q[order[2]];
+		int b = q[order[3]];
+		int g = (ga + gb + 1) >> 1;
+
+		int gp[4];
+		gp[order[0]] = g;
+		gp[order[1]] = ga;
+		gp[order[2]] = gb;
+		gp[order[3]] = g;
+
+		int c = 66 * r + 25 * b + 128;
+		y0[2 * x] = (uint8_t)(((c + 129 * gp[0]) >> 8) + 16);
+		y0[2 * x + 1] = (uint8_t)(((c + 129 * gp[1]) >> 8) + 16);
+		y1[2 * x] = (uint8_t)(((c + 129 * gp[2]) >> 8) + 16);
+		y1[2 * x + 1] = (uint8_t)(((c + 129 * gp[3]) >> 8) + 16);
+
+		uint8_t cu = (uint8_t)(((112 * b - 38 * r - 74 * g + 128) >> 8) + 128);
+		uint8_t cv = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+		if (uv != NULL)
+		{
+			uv[2 * x] = cu;
+			uv[2 * x + 1] = cv;
+		}
+		else
+		{
+			u[x] = cu;
+			v[x] = cv;
+		}
+	}
+}
+
+// Returns the number of quads done. The scalar code does the rest.
+static int bayer_quads_simd(const uint8_t *src0, const uint8_t *src1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, uint8_t *uv,
+	const int *order, int numQuads)
+{
+	int x = 0;
+#if defined(PIXEL_CONVERTER_SSE2)
+	const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+	const __m128i c16 = _mm_set1_epi16(16);
+	const __m128i c128 = _mm_set1_epi16(128);
+	for (; x + 8 <= numQuads; x += 8)
+	{
+		__m128i row0 = _mm_loadu_si128((const __m128i*)(src0 + 2 * x));
+		__m128i row1 = _mm_loadu_si128((const __m128i*)(src1 + 2 * x));
+		__m128i q[4] = { _mm_and_si128(row0, lowBytes), _mm_srli_epi16(row0, 8), _mm_and_si128(row1, lowBytes), _mm_srli_epi16(row1, 8) };
+		__m128i r = q[order[0]];
+		__m128i ga = q[order[1]];
+		__m128i gb = q[order[2]];
+		__m128i b = q[order[3]];
+		__m128i g = _mm_avg_epu16(ga, gb);
+
+		__m128i gp[4];
+		gp[order[0]] = g;
+		gp[order[1]] = ga;
+		gp[order[2]] = gb;
+		gp[order[3]] = g;
+
+		__m128i c = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)), _mm_mullo_epi16(b, _mm_set1_epi16(25))), c128);
+		__m128i yp[4];
+		for (int i = 0; i < 4; i++)
+			yp[i] = _mm_add_epi16(_mm_srli_epi16(_mm_add_epi16(c, _mm_mullo_epi16(gp[i], _mm_set1_epi16(129))), 8), c16);
+		// Y fits in the low byte of each lane, so interleaving the even and odd pixels is a shift and an or.
+		_mm_storeu_si128((__m128i*)(y0 + 2 * x), _mm_or_si128(yp[0], _mm_slli_epi16(yp[1], 8)));
+		_mm_storeu_si128((__m128i*)(y1 + 2 * x), _mm_or_si128(yp[2], _mm_slli_epi16(yp[3], 8)));
+
+		__m128i cu = _mm_sub_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(112)), _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(38)), _mm_mullo_epi16(g, _mm_set1_epi16(74))));
+		__m128i cv = _mm_sub_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(112)), _mm_add_epi16(_mm_mullo_epi16(g, _mm_set1_epi16(94)), _mm_mullo_epi16(b, _mm_set1_epi16(18))));
+		cu = _mm_add_epi16(_mm_srai_epi16(_mm_add_epi16(cu, c128), 8), c128);
+		cv = _mm_add_epi16(_mm_srai_epi16(_mm_add_epi16(cv, c128), 8), c128);
+		if (uv != NULL)
+		{
+			_mm_storeu_si128((__m128i*)(uv + 2 * x), _mm_or_si128(cu, _mm_slli_epi16(cv, 8)));
+		}
+		else
+		{
+			_mm_storel_epi64((__m128i*)(u + x), _mm_packus_epi16(cu, cu));
+			_mm_storel_epi64((__m128i*)(v + x), _mm_packus_epi16(cv, cv));
+		}
+	}
+#elif defined(PIXEL_CONVERTER_NEON)
+	for (; x + 8 <= numQuads; x += 8)
+	{
+		uint8x8x2_t row0 = vld2_u8(src0 + 2 * x); // val[0] = even pixels, val[1] = odd pixels
+		uint8x8x2_t row1 = vld2_u8(src1 + 2 * x);
+		uint16x8_t q[4] = { vmovl_u8(row0.val[0]), vmovl_u8(row0.val[1]), vmovl_u8(row1.val[0]), vmovl_u8(row1.val[1]) };
+		uint16x8_t r = q[order[0]];
+		uint16x8_t ga = q[order[1]];
+		uint16x8_t gb = q[order[2]];
+		uint16x8_t b = q[order[3]];
+		uint16x8_t g = vrhaddq_u16(ga, gb);
+
+		uint16x8_t gp[4];
+		gp[order[0]] = g;
+		gp[order[1]] = ga;
+		gp[order[2]] = gb;
+		gp[order[3]] = g;
+
+		uint16x8_t c = vaddq_u16(vmlaq_n_u16(vmulq_n_u16(r, 66), b, 25), vdupq_n_u16(128));
+		uint8x8_t yp[4];
+		for (int i = 0; i < 4; i++)
+			yp[i] = vmovn_u16(vaddq_u16(vshrq_n_u16(vmlaq_n_u16(c, gp[i], 129), 8), vdupq_n_u16(16)));
+		uint8x8x2_t out0 = { { yp[0], yp[1] } };
+		uint8x8x2_t out1 = { { yp[2], yp[3] } };
+		vst2_u8(y0 + 2 * x, out0);
+		vst2_u8(y1 + 2 * x, out1);
+
+		int16x8_t rs = vreinterpretq_s16_u16(r);
+		int16x8_t gs = vreinterpretq_s16_u16(g);
+		int16x8_t bs = vreinterpretq_s16_u16(b);
+		int16x8_t cu = vmlaq_n_s16(vmlaq_n_s16(vmulq_n_s16(bs, 112), rs, -38), gs, -74);
+		int16x8_t cv = vmlaq_n_s16(vmlaq_n_s16(vmulq_n_s16(rs, 112), gs, -94), bs, -18);
+		uint8x8_t u8 = vqmovun_s16(vaddq_s16(vshrq_n_s16(vaddq_s16(cu, vdupq_n_s16(128)), 8), vdupq_n_s16(128)));
+		uint8x8_t v8 = vqmovun_s16(vaddq_s16(vshrq_n_s16(vaddq_s16(cv, vdupq_n_s16(128)), 8), vdupq_n_s16(128)));
+		if (uv != NULL)
+		{
+			uint8x8x2_t chroma = { { u8, v8 } };
+			vst2_u8(uv + 2 * x, chroma);
+		}
+		else
+		{
+			vst1_u8(u + x, u8);
+			vst1_u8(v + x, v8);
+		}
+	}
+#endif
+	return x;
+}
+
+// ******* YUY2 to YUV 4:2:0 *******
+static void yuy2_pairs_scalar(const uint8_t *src0, const uint8_t *src1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, uint8_t *uv,
+	int firstPair, int numPairs)
+{
+	for (int x = firstPair; x < numPairs; x++)
+	{
+		y0[2 * x] = src0[4 * x];
+		y0[2 * x + 1] = src0[4 * x + 2];
+		y1[2 * x] = src1[4 * x];
+		y1[2 * x + 1] = src1[4 * x + 2];
+
+		uint8_t cu = (uint8_t)((src0[4 * x + 1] + src1[4 * x + 1] + 1) >> 1);
+		uint8_t cv = (uint8_t)((src0[4 * x + 3] + src1[4 * x + 3] + 1) >> 1);
+		if (uv != NULL)
+		{
+			uv[2 * x] = cu;
+			uv[2 * x + 1] = cv;
+		}
+		else
+		{
+			u[x] = cu;
+			v[x] = cv;
+		}
+	}
+}
+
+// Returns the number of pixel pairs done. The scalar code does the rest.
+static int yuy2_pairs_simd(const uint8_t *src0, const uint8_t *src1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, uint8_t *uv, int numPairs)
+{
+	int x = 0;
+#if defined(PIXEL_CONVERTER_SSE2)
+	const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+	const __m128i zero = _mm_setzero_si128();
+	for (; x + 8 <= numPairs; x += 8)
+	{
+		__m128i a0 = _mm_loadu_si128((const __m128i*)(src0 + 4 * x));
+		__m128i a1 = _mm_loadu_si128((const __m128i*)(src0 + 4 * x + 16));
+		__m128i b0 = _mm_loadu_si128((const __m128i*)(src1 + 4 * x));
+		__m128i b1 = _mm_loadu_si128((const __m128i*)(src1 + 4 * x + 16));
+
+		_mm_storeu_si128((__m128i*)(y0 + 2 * x), _mm_packus_epi16(_mm_and_si128(a0, lowBytes), _mm_and_si128(a1, lowBytes)));
+		_mm_storeu_si128((__m128i*)(y1 + 2 * x), _mm_packus_epi16(_mm_and_si128(b0, lowBytes), _mm_and_si128(b1, lowBytes)));
+
+		// U V U V ... of both rows, averaged. That's already the NV12 layout.
+		__m128i chroma0 = _mm_packus_epi16(_mm_srli_epi16(a0, 8), _mm_srli_epi16(a1, 8));
+		__m128i chroma1 = _mm_packus_epi16(_mm_srli_epi16(b0, 8), _mm_srli_epi16(b1, 8));
+		__m128i chroma = _mm_avg_epu8(chroma0, chroma1);
+		if (uv != NULL)
+		{
+			_mm_storeu_si128((__m128i*)(uv + 2 * x), chroma);
+		}
+		else
+		{
+			_mm_storel_epi64((__m128i*)(u + x), _mm_packus_epi16(_mm_and_si128(chroma, lowBytes), zero));
+			_mm_storel_epi64((__m128i*)(v + x), _mm_packus_epi16(_mm_srli_epi16(chroma, 8), zero));
+		}
+	}
+#elif defined(PIXEL_CONVERTER_NEON)
+	for (; x + 8 <= numPairs; x += 8)
+	{
+		uint8x8x4_t a = vld4_u8(src0 + 4 * x); // val[0] = Y0, val[1] = U, val[2] = Y1, val[3] = V
+		uint8x8x4_t b = vld4_u8(src1 + 4 * x);
+		uint8x8x2_t out0 = { { a.val[0], a.val[2] } };
+		uint8x8x2_t out1 = { { b.val[0], b.val[2] } };
+		vst2_u8(y0 + 2 * x, out0);
+		vst2_u8(y1 + 2 * x, out1);
+
+		uint8x8_t u8 = vrhadd_u8(a.val[1], b.val[1]);
+		uint8x8_t v8 = vrhadd_u8(a.val[3], b.val[3]);
+		if (uv != NULL)
+		{
+			uint8x8x2_t chroma = { { u8, v8 } };
+			vst2_u8(uv + 2 * x, chroma);
+		}
+		else
+		{
+			vst1_u8(u + x, u8);
+			vst1_u8(v + x, v8);
+		}
+	}
+#endif
+	return x;
+}
+
+CPixelConverter::CPixelConverter()
+{
+	m_width = 0;
+	m_height = 0;
+	m_isBayer = false;
+	m_outputFormat = OutputFormat_I420;
+	m_sourceStride = 0;
+	m_yStride = 0;
+	m_chromaStride = 0;
+	m_uOffset = 0;
+	m_vOffset = 0;
+	m_outputSize = 0;
+	m_pool = NULL;
+	m_pSource = NULL;
+	m_pDestination = NULL;
+	m_numStripes = 1;
+	m_jobNumber = 0;
+	m_pendingStripes = 0;
+	m_isStopping = false;
+	for (int i = 0; i < 4; i++)
+		m_bayerOrder[i] = i;
+}
+
+CPixelConverter::~CPixelConverter()
+{
+	stop_workers();
+	// buffers still in the pipeline keep the pool alive until they're freed.
+	if (m_pool != NULL)
+	{
+		gst_buffer_pool_set_active(m_pool, FALSE);
+		gst_object_unref(m_pool);
+	}
+}
+
+bool CPixelConverter::IsSupported(const string &sourceFormat)
+{
+	return sourceFormat == "rggb" || sourceFormat == "bggr" || sourceFormat == "grbg" || sourceFormat == "gbrg" || sourceFormat == "YUY2";
+}
+
+bool CPixelConverter::Configure(const string &sourceFormat, EOutputFormat outputFormat, int width, int height, int numThreads)
+{
+	if (IsSupported(sourceFormat) == false || width <= 0 || height <= 0 || width % 2 != 0 || height % 2 != 0)
+	{
+		cerr << "CPixelConverter: Can't convert " << sourceFormat << " " << width << "x" << height << "." << endl;
+		return false;
+	}
+
+	m_sourceFormat = sourceFormat;
+	m_outputFormat = outputFormat;
+	m_width = width;
+	m_height = height;
+	m_isBayer = sourceFormat != "YUY2";
+	m_sourceStride = m_isBayer ? (size_t)width : (size_t)width * 2; // camera images have no line padding
+
+	// where R, G, G and B are in each 2x2 quad: 0 1 on the first row, 2 3 on the second.
+	if (sourceFormat == "rggb") { m_bayerOrder[0] = 0; m_bayerOrder[1] = 1; m_bayerOrder[2] = 2; m_bayerOrder[3] = 3; }
+	if (sourceFormat == "bggr") { m_bayerOrder[0] = 3; m_bayerOrder[1] = 1; m_bayerOrder[2] = 2; m_bayerOrder[3] = 0; }
+	if (sourceFormat == "grbg") { m_bayerOrder[0] = 1; m_bayerOrder[1] = 0; m_bayerOrder[2] = 3; m_bayerOrder[3] = 2; }
+	if (sourceFormat == "gbrg") { m_bayerOrder[0] = 2; m_bayerOrder[1] = 0; m_bayerOrder[2] = 3; m_bayerOrder[3] = 1; }
+
+	// Plane layout as GStreamer's video info has it: lines start on 4 byte boundaries.
+	m_yStride = GST_ROUND_UP_4(width);
+	if (outputFormat == OutputFormat_I420)
+	{
+		m_chromaStride = GST_ROUND_UP_4(width / 2);
+		m_uOffset = m_yStride * height;
+		m_vOffset = m_uOffset + m_chromaStride * (height / 2);
+		m_outputSize = m_vOffset + m_chromaStride * (height / 2);
+	}
+	else
+	{
+		m_chromaStride = m_yStride; // interleaved U and V
+		m_uOffset = m_yStride * height;
+		m_vOffset = m_uOffset;
+		m_outputSize = m_uOffset + m_chromaStride * (height / 2);
+	}
+
+	// a fresh pool for the new size. The old one lives on until its buffers come back.
+	if (m_pool != NULL)
+	{
+		gst_buffer_pool_set_active(m_pool, FALSE);
+		gst_object_unref(m_pool);
+	}
+	m_pool = gst_buffer_pool_new();
+	GstStructure *config = gst_buffer_pool_get_config(m_pool);
+	gst_buffer_pool_config_set_params(config, NULL, (guint)m_outputSize, 4, 0);
+	if (gst_buffer_pool_set_config(m_pool, config) == FALSE || gst_buffer_pool_set_active(m_pool, TRUE) == FALSE)
+	{
+		cerr << "CPixelConverter: Could not configure the gst buffer pool." << endl;
+		gst_object_unref(m_pool);
+		m_pool = NULL;
+		return false;
+	}
+
+	if (numThreads < 1)
+	{
+		numThreads = (int)std::thread::hardware_concurrency();
+		if (numThreads < 1)
+			numThreads = 1;
+		if (numThreads > 4)
+			numThreads = 4;
+	}
+	if (numThreads > height / 2)
+		numThreads = height / 2;
+	stop_workers();
+	start_workers(numThreads);
+
+	return true;
+}
+
+GstBuffer* CPixelConverter::Convert(const void *pSource, size_t sourceSize)
+{
+	if (m_pool == NULL || sourceSize < m_sourceStride * m_height)
+		return NULL;
+
+	GstBuffer *buffer = NULL;
+	if (gst_buffer_pool_acquire_buffer(m_pool, &buffer, NULL) != GST_FLOW_OK)
+		return NULL;
+
+	GstMapInfo map;
+	gst_buffer_map(buffer, &map, GST_MAP_WRITE);
+	m_pSource = (const uint8_t*)pSource;
+	m_pDestination = map.data;
+
+	// hand the other stripes to the workers, do the first one here, then wait for the rest.
+	{
+		lock_guard<mutex> lock(m_lock);
+		m_pendingStripes = m_numStripes - 1;
+		m_jobNumber++;
+	}
+	m_wakeWorkers.notify_all();
+	convert_stripe(0);
+	{
+		unique_lock<mutex> lock(m_lock);
+		m_stripesDone.wait(lock, [this] { return m_pendingStripes == 0; });
+	}
+
+	gst_buffer_unmap(buffer, &map);
+	return buffer;
+}
+
+// Convert the row pairs of one stripe of the current image.
+void CPixelConverter::convert_stripe(int stripe)
+{
+	int numRowPairs = m_height / 2;
+	int firstRowPair = stripe * numRowPairs / m_numStripes;
+	int lastRowPair = (stripe + 1) * numRowPairs / m_numStripes;
+	int numQuads = m_width / 2;
+
+	for (int pair = firstRowPair; pair < lastRowPair; pair++)
+	{
+		const uint8_t *src0 = m_pSource + (size_t)(2 * pair) * m_sourceStride;
+		const uint8_t *src1 = src0 + m_sourceStride;
+		uint8_t *y0 = m_pDestination + (size_t)(2 * pair) * m_yStride;
+		uint8_t *y1 = y0 + m_yStride;
+		uint8_t *u = NULL;
+		uint8_t *v = NULL;
+		uint8_t *uv = NULL;
+		if (m_outputFormat == OutputFormat_NV12)
+		{
+			uv = m_pDestination + m_uOffset + (size_t)pair * m_chromaStride;
+		}
+		else
+		{
+			u = m_pDestination + m_uOffset + (size_t)pair * m_chromaStride;
+			v = m_pDestination + m_vOffset + (size_t)pair * m_chromaStride;
+		}
+
+		if (m_isBayer == true)
+		{
+			int done = bayer_quads_simd(src0, src1, y0, y1, u, v, uv, m_bayerOrder, numQuads);
+			bayer_quads_scalar(src0, src1, y0, y1, u, v, uv, m_bayerOrder, done, numQuads);
+		}
+		else
+		{
+			int done = yuy2_pairs_simd(src0, src1, y0, y1, u, v, uv, numQuads);
+			yuy2_pairs_scalar(src0, src1, y0, y1, u, v, uv, done, numQuads);
+		}
+	}
+}
+
+// Stripe 0 is always done by the thread calling Convert(), so there's one worker for each other stripe.
+// Each worker is told the current job number, so a job handed out before it gets going isn't missed.
+void CPixelConverter::start_workers(int numThreads)
+{
+	m_numStripes = numThreads;
+	m_isStopping = false;
+	for (int stripe = 1; stripe < numThreads; stripe++)
+		m_workers.push_back(std::thread(&CPixelConverter::worker_thread, this, stripe, m_jobNumber));
+}
+
+void CPixelConverter::stop_workers()
+{
+	{
+		lock_guard<mutex> lock(m_lock);
+		m_isStopping = true;
+	}
+	m_wakeWorkers.notify_all();
+	for (size_t i = 0; i < m_workers.size(); i++)
+		m_workers[i].join();
+	m_workers.clear();
+	m_numStripes = 1;
+}
+
+void CPixelConverter::worker_thread(int stripe, unsigned int jobNumber)
+{
+	while (true)
+	{
+		{
+			unique_lock<mutex> lock(m_lock);
+			m_wakeWorkers.wait(lock, [this, jobNumber] { return m_isStopping == true || m_jobNumber != jobNumber; });
+			if (m_isStopping == true)
+				return;
+			jobNumber = m_jobNumber;
+		}
+
+		convert_stripe(stripe);
+
+		{
+			lock_guard<mutex> lock(m_lock);
+			m_pendingStripes--;
+			if (m_pendingStripes == 0)
+				m_stripesDone.notify_one();
+		}
+	}
+}
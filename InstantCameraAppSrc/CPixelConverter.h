@@ -0,0 +1,91 @@
+/*  CPixelConverter.h: header file for CPixelConverter Class.
+    This converts Bayer and YUY2 images to I420 or NV12 on the host, using SIMD (SSE2 or NEON) and several threads, into pooled gst buffers.
+
+	Copyright 2017 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+
+*/
+
+#pragma once
+
+#include <gst/gst.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+
+// ******* CPixelConverter *******
+// Hardware encoders (eg: omxh264enc) and many sinks only take I420 or NV12, which no camera delivers.
+// Instead of a videoconvert element (scalar, single threaded), CInstantCameraAppSrc converts each image right where it's grabbed:
+// Bayer (rggb, bggr, grbg, gbrg) or YUY2 in, I420 or NV12 out, in the BT.601 limited range videoconvert uses.
+// The image is split into stripes of rows. The calling thread converts one stripe, and worker threads convert the others at the same time.
+// Output buffers come from a GstBufferPool, so steady-state conversion doesn't allocate.
+class CPixelConverter
+{
+public:
+	enum EOutputFormat
+	{
+		OutputFormat_I420,
+		OutputFormat_NV12
+	};
+
+	CPixelConverter();
+	~CPixelConverter();
+
+	// sourceFormat is the GStreamer format name of the camera image: "rggb", "bggr", "grbg", "gbrg" (video/x-bayer) or "YUY2".
+	// Width and height must be even. numThreads -1 = one per cpu core, up to 4.
+	bool Configure(const std::string &sourceFormat, EOutputFormat outputFormat, int width, int height, int numThreads = -1);
+	// Convert one image into a new gst buffer from the pool. Returns NULL if the source image is too small.
+	GstBuffer* Convert(const void *pSource, size_t sourceSize);
+	static bool IsSupported(const std::string &sourceFormat);
+
+private:
+	std::string m_sourceFormat;
+	EOutputFormat m_outputFormat;
+	int m_width;
+	int m_height;
+	int m_bayerOrder[4]; // quad position (0,1 = 1st row, 2,3 = 2nd row) of R, G, G, B
+	bool m_isBayer;
+	size_t m_sourceStride;
+	size_t m_yStride;
+	size_t m_chromaStride;
+	size_t m_uOffset;
+	size_t m_vOffset;
+	size_t m_outputSize;
+	GstBufferPool *m_pool;
+
+	// one job at a time: the image being converted, which the stripes share
+	const uint8_t *m_pSource;
+	uint8_t *m_pDestination;
+
+	std::vector<std::thread> m_workers;
+	int m_numStripes;
+	std::mutex m_lock;
+	std::condition_variable m_wakeWorkers;
+	std::condition_variable m_stripesDone;
+	unsigned int m_jobNumber;
+	int m_pendingStripes;
+	bool m_isStopping;
+
+	void start_workers(int numThreads);
+	void stop_workers();
+	void worker_thread(int stripe, unsigned int jobNumber);
+	void convert_stripe(int stripe);
+};
@@ -0,0 +1,192 @@
+/*  CPylonBufferPool.cpp: Definition file for CPylonBufferPool Class.
+    This is a Pylon buffer factory backed by a GstBufferPool, so the Pylon Grab Engine grabs straight into memory owned by GStreamer.
+
+	Copyright 2017, 2018, 2019 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+	*/
+
+#include "CPylonBufferPool.h"
+#include <iostream>
+
+using namespace std;
+
+// One Grab Engine buffer. The Grab Engine hands this back to us as the 'buffer context' in FreeBuffer(), and on each Grab Result (GetBufferContext()).
+struct SPoolSlot
+{
+	GstBufferPool *pool; // the pool this buffer came from. Kept in case the pool is replaced (eg: new AOI) while this buffer is still in use.
+	GstBuffer *buffer;
+};
+
+CPylonBufferPool::CPylonBufferPool()
+{
+	m_refCount = 1;
+	m_pool = NULL;
+	m_bufferSize = 0;
+	m_numBuffers = 10; // Pylon's default MaxNumBuffer
+	m_isConfigChanged = false;
+	m_numAllocated = 0;
+	gst_allocation_params_init(&m_params);
+}
+
+CPylonBufferPool::~CPylonBufferPool()
+{
+	// All of the Grab Engine's buffers are freed by now: each held a reference.
+	if (m_pool != NULL)
+	{
+		gst_buffer_pool_set_active(m_pool, FALSE);
+		gst_object_unref(m_pool);
+	}
+}
+
+void CPylonBufferPool::Ref()
+{
+	m_refCount++;
+}
+
+void CPylonBufferPool::Unref()
+{
+	if (--m_refCount == 0)
+		delete this;
+}
+
+void CPylonBufferPool::SetNumBuffers(int numBuffers)
+{
+	lock_guard<mutex> lock(m_lock);
+	if (numBuffers != m_numBuffers)
+		m_isConfigChanged = true;
+	m_numBuffers = numBuffers;
+}
+
+int CPylonBufferPool::GetNumAllocated()
+{
+	lock_guard<mutex> lock(m_lock);
+	return m_numAllocated;
+}
+
+// Called with the answered ALLOCATION query from the AppSrc's src pad.
+// Downstream can tell us how many buffers it keeps for itself (eg: an encoder's reference frames), and how the memory should be aligned.
+int CPylonBufferPool::ParseAllocationQuery(GstQuery *query)
+{
+	lock_guard<mutex> lock(m_lock);
+
+	guint downstreamMin = 0;
+	for (guint i = 0; i < gst_query_get_n_allocation_pools(query); i++)
+	{
+		guint size, min, max;
+		gst_query_parse_nth_allocation_pool(query, i, NULL, &size, &min, &max);
+		if (min > downstreamMin)
+			downstreamMin = min;
+	}
+
+	for (guint i = 0; i < gst_query_get_n_allocation_params(query); i++)
+	{
+		GstAllocationParams params;
+		gst_query_parse_nth_allocation_param(query, i, NULL, &params);
+		// keep the strictest alignment and largest padding asked for
+		GstAllocationParams previous = m_params;
+		m_params.align |= params.align;
+		if (params.prefix > m_params.prefix)
+			m_params.prefix = params.prefix;
+		if (params.padding > m_params.padding)
+			m_params.padding = params.padding;
+		if (m_params.align != previous.align || m_params.prefix != previous.prefix || m_params.padding != previous.padding)
+			m_isConfigChanged = true;
+	}
+
+	return (int)downstreamMin;
+}
+
+// (Re)create the gst buffer pool for buffers of the given size. m_lock must be held.
+bool CPylonBufferPool::create_pool(size_t bufferSize)
+{
+	// let go of the old pool. Buffers still out from it keep it alive until they're freed.
+	if (m_pool != NULL)
+		gst_object_unref(m_pool);
+
+	m_pool = gst_buffer_pool_new();
+	m_bufferSize = bufferSize;
+	m_isConfigChanged = false;
+
+	// all the Grab Engine's buffers are preallocated when the pool is activated, so steady-state grabbing never allocates.
+	GstStructure *config = gst_buffer_pool_get_config(m_pool);
+	gst_buffer_pool_config_set_params(config, NULL, (guint)bufferSize, (guint)m_numBuffers, 0);
+	gst_buffer_pool_config_set_allocator(config, NULL, &m_params);
+	if (gst_buffer_pool_set_config(m_pool, config) == FALSE || gst_buffer_pool_set_active(m_pool, TRUE) == FALSE)
+	{
+		cerr << "CPylonBufferPool: Could not configure the gst buffer pool." << endl;
+		gst_object_unref(m_pool);
+		m_pool = NULL;
+		return false;
+	}
+	return true;
+}
+
+// Called by the Grab Engine (for each of its MaxNumBuffer buffers) when grabbing starts.
+void CPylonBufferPool::AllocateBuffer(size_t bufferSize, void** pCreatedBuffer, intptr_t& bufferContext)
+{
+	lock_guard<mutex> lock(m_lock);
+
+	// a new pool for a new image size, and for new grab settings (MaxNumBuffer, downstream's alignment). Only for the first buffer of a grab: it clears m_isConfigChanged.
+	if (m_pool == NULL || bufferSize != m_bufferSize || m_isConfigChanged == true)
+	{
+		if (create_pool(bufferSize) == false)
+			throw RUNTIME_EXCEPTION("CPylonBufferPool: Could not create buffer pool.");
+	}
+
+	SPoolSlot *pSlot = new SPoolSlot();
+	pSlot->buffer = NULL;
+	if (gst_buffer_pool_acquire_buffer(m_pool, &pSlot->buffer, NULL) != GST_FLOW_OK)
+	{
+		delete pSlot;
+		throw RUNTIME_EXCEPTION("CPylonBufferPool: Could not acquire buffer from pool.");
+	}
+	pSlot->pool = (GstBufferPool*)gst_object_ref(m_pool);
+
+	// Pool buffers are system memory, so the pointer stays valid for the life of the buffer even after unmapping.
+	// The Grab Engine writes into it while the pool holds it for us, and gst buffers wrapping it are marked read-only.
+	GstMapInfo map;
+	gst_buffer_map(pSlot->buffer, &map, GST_MAP_WRITE);
+	*pCreatedBuffer = map.data;
+	gst_buffer_unmap(pSlot->buffer, &map);
+
+	bufferContext = (intptr_t)pSlot;
+	m_numAllocated++;
+	Ref(); // until FreeBuffer()
+}
+
+// Called by the Grab Engine when grabbing stops. For buffers still referenced by a Grab Result (eg: held by the pipeline),
+// this happens later, when the last reference is released, and can be on any thread.
+void CPylonBufferPool::FreeBuffer(void* pCreatedBuffer, intptr_t bufferContext)
+{
+	{
+		lock_guard<mutex> lock(m_lock);
+
+		SPoolSlot *pSlot = (SPoolSlot*)bufferContext;
+		gst_buffer_unref(pSlot->buffer); // goes back to its pool
+		gst_object_unref(pSlot->pool);
+		delete pSlot;
+		m_numAllocated--;
+	}
+	// (the last buffer of a camera which is gone deletes us, so not while m_lock is held)
+	Unref();
+}
+
+// The buffer factory is registered with Cleanup_None: CInstantCameraAppSrc and the buffers let go of it with Unref(), so there is nothing to do here.
+void CPylonBufferPool::DestroyBufferFactory()
+{
+}
@@ -0,0 +1,66 @@
+/*  CPylonBufferPool.h: header file for CPylonBufferPool Class.
+    This is a Pylon buffer factory backed by a GstBufferPool, so the Pylon Grab Engine grabs straight into memory owned by GStreamer.
+
+	Copyright 2017 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+
+*/
+
+#pragma once
+
+#include <pylon/PylonIncludes.h>
+#include <gst/gst.h>
+#include <mutex>
+#include <atomic>
+
+// ******* CPylonBufferPool *******
+// The Pylon Grab Engine asks its buffer factory for all of its buffers when grabbing starts (MaxNumBuffer of them), and gives them back when grabbing stops.
+// Here those buffers come out of a GstBufferPool, using the allocation parameters (eg: alignment) the downstream elements asked for.
+// A buffer is only reused by the Grab Engine after the Grab Result is released, and in zero-copy mode that only happens when the pipeline frees the gst buffer.
+// That can be after the camera is gone, so the factory is reference counted: the camera holds one reference, and each buffer handed out another.
+// Whichever is let go of last (Unref()) deletes it.
+class CPylonBufferPool : public Pylon::IBufferFactory
+{
+public:
+	CPylonBufferPool();
+	void Ref();
+	void Unref();
+
+	// The number of buffers the Grab Engine will ask for (MaxNumBuffer). Takes effect the next time grabbing starts, when the pool is set up for it again.
+	void SetNumBuffers(int numBuffers);
+	// Read the downstream ALLOCATION query answer. Returns the number of buffers downstream wants to keep (0 if it didn't say).
+	int ParseAllocationQuery(GstQuery *query);
+	int GetNumAllocated();
+
+	// Pylon::IBufferFactory
+	virtual void AllocateBuffer(size_t bufferSize, void** pCreatedBuffer, intptr_t& bufferContext);
+	virtual void FreeBuffer(void* pCreatedBuffer, intptr_t bufferContext);
+	virtual void DestroyBufferFactory();
+
+private:
+	virtual ~CPylonBufferPool(); // (see Unref())
+	std::atomic<int> m_refCount;
+	std::mutex m_lock;
+	GstBufferPool *m_pool;
+	size_t m_bufferSize;
+	int m_numBuffers;
+	bool m_isConfigChanged; // the number of buffers or the allocation params changed since the pool was made
+	int m_numAllocated;
+	GstAllocationParams m_params;
+	bool create_pool(size_t bufferSize);
+};
@@ -0,0 +1,173 @@
+/*  CThreadPolicy.cpp: Definition file for CThreadPolicy Class.
+    Which cores a thread may run on, and its real-time priority.
+
+	Copyright 2017, 2018, 2019 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+	*/
+
+#include "CThreadPolicy.h"
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+
+CThreadPolicy::CThreadPolicy()
+{
+	m_priority = 0;
+}
+
+CThreadPolicy::CThreadPolicy(const string &text)
+{
+	m_priority = 0;
+	Parse(text);
+}
+
+bool CThreadPolicy::Parse(const string &text)
+{
+	vector<int> cores;
+	int priority = 0;
+
+	size_t colon = text.find(':');
+	string coreList = text.substr(0, colon);
+	if (colon != string::npos)
+	{
+		char *end = NULL;
+		string priorityText = text.substr(colon + 1);
+		priority = (int)strtol(priorityText.c_str(), &end, 10);
+		if (priorityText == "" || *end != '\0' || priority < 0 || priority > 99)
+		{
+			cout << "Thread priority must be 0-99 (SCHED_FIFO): " << text << endl;
+			return false;
+		}
+	}
+
+	// "2,3", "0-1", or both ("0-1,3")
+	stringstream list(coreList);
+	string item;
+	while (getline(list, item, ','))
+	{
+		if (item == "")
+			continue;
+		size_t dash = item.find('-');
+		int first = atoi(item.substr(0, dash).c_str());
+		int last = (dash != string::npos) ? atoi(item.substr(dash + 1).c_str()) : first;
+		if (item.find_first_not_of("0123456789-") != string::npos || first < 0 || last < first)
+		{
+			cout << "Cores must be a list like 2,3 or 0-1: " << text << endl;
+			return false;
+		}
+		for (int core = first; core <= last; core++)
+			cores.push_back(core);
+	}
+
+	m_cores = cores;
+	m_priority = priority;
+	return true;
+}
+
+string CThreadPolicy::ToString() const
+{
+	string text = "";
+	for (size_t i = 0; i < m_cores.size(); i++)
+		text += (i > 0 ? "," : "") + to_string(m_cores[i]);
+	if (m_priority > 0)
+		text += ":" + to_string(m_priority);
+	return text;
+}
+
+bool CThreadPolicy::IsSet() const
+{
+	return m_cores.empty() == false || m_priority > 0;
+}
+
+const vector<int>& CThreadPolicy::GetCores() const
+{
+	return m_cores;
+}
+
+int CThreadPolicy::GetPriority() const
+{
+	return m_priority;
+}
+
+bool CThreadPolicy::Apply(const string &threadName) const
+{
+	if (IsSet() == false)
+		return true;
+
+	bool isApplied = true;
+#ifdef WIN32
+	if (m_cores.empty() == false)
+	{
+		DWORD_PTR mask = 0;
+		for (size_t i = 0; i < m_cores.size(); i++)
+			mask |= ((DWORD_PTR)1 << m_cores[i]);
+		if (SetThreadAffinityMask(GetCurrentThread(), mask) == 0)
+		{
+			cout << "Could not pin the " << threadName << " to cores " << ToString() << "." << endl;
+			isApplied = false;
+		}
+	}
+	// Windows has no SCHED_FIFO. The highest priorities are the nearest thing.
+	if (m_priority > 0 && SetThreadPriority(GetCurrentThread(), (m_priority >= 50) ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_HIGHEST) == 0)
+	{
+		cout << "Could not raise the priority of the " << threadName << "." << endl;
+		isApplied = false;
+	}
+#else
+	if (m_cores.empty() == false)
+	{
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		for (size_t i = 0; i < m_cores.size(); i++)
+			CPU_SET(m_cores[i], &cpus);
+		int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+		if (error != 0)
+		{
+			cout << "Could not pin the " << threadName << " to cores " << ToString() << ": " << strerror(error) << endl;
+			isApplied = false;
+		}
+	}
+	if (m_priority > 0)
+	{
+		sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = m_priority;
+		int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (error != 0)
+		{
+			cout << "Could not give the " << threadName << " real-time priority " << m_priority << ": " << strerror(error) << endl;
+			isApplied = false;
+		}
+	}
+#endif
+
+	if (isApplied == true)
+		cout << "The " << threadName << " runs on " << (m_cores.empty() ? "any core" : "core(s) " + ToString().substr(0, ToString().find(':')))
+			<< (m_priority > 0 ? " at real-time priority " + to_string(m_priority) : "") << "." << endl;
+	return isApplied;
+}
@@ -0,0 +1,52 @@
+/*  CThreadPolicy.h: header file for CThreadPolicy Class.
+    Which cores a thread may run on, and its real-time priority.
+
+	Copyright 2017 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+// ******* CThreadPolicy *******
+// On a small board (eg: 4 cores on a Pi or TX2) the cameras' grab threads, the pipeline's streaming threads and the encoder all compete for the cores,
+// and whichever loses stutters. Pinning each to its own cores, and giving the ones with deadlines a real-time priority (SCHED_FIFO), keeps them out of each other's way.
+// As text: "<cores>[:<priority>]", where cores is a list like "2", "2,3" or "0-1", eg: "3:60" is core 3 at SCHED_FIFO priority 60, ":60" is any core at priority 60.
+// Real-time priorities need the privilege (root, CAP_SYS_NICE, or an rtprio limit in /etc/security/limits.conf). Without it, Apply() says so and the thread carries on as before.
+class CThreadPolicy
+{
+public:
+	CThreadPolicy();
+	CThreadPolicy(const std::string &text);
+
+	bool Parse(const std::string &text);
+	std::string ToString() const;
+	bool IsSet() const;
+	const std::vector<int>& GetCores() const;
+	int GetPriority() const; // SCHED_FIFO priority 1-99, 0 = normal scheduling
+
+	// Apply the policy to the calling thread. The name is only for messages (eg: "grab thread 21734321").
+	bool Apply(const std::string &threadName) const;
+
+private:
+	std::vector<int> m_cores;
+	int m_priority;
+};
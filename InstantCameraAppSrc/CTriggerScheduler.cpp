@@ -0,0 +1,226 @@
+/*  CTriggerScheduler.cpp: Definition file for CTriggerScheduler Class.
+    Fires the camera's software triggers: on demand and a frame or two ahead, at a steady rate, or when the application says so.
+
+	Copyright 2017-2019 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+
+*/
+
+#include "CTriggerScheduler.h"
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+CTriggerScheduler::CTriggerScheduler(Pylon::CInstantCamera &camera) : m_camera(camera)
+{
+	m_schedule = TriggerSchedule_OnDemand;
+	m_depth = 0;
+	m_rate = 0;
+	m_isRunning = false;
+	m_isClockStopping = false;
+}
+
+CTriggerScheduler::~CTriggerScheduler()
+{
+	Join();
+}
+
+void CTriggerScheduler::Configure(ETriggerSchedule schedule, int depth, double rate)
+{
+	m_schedule = schedule;
+	m_depth = min(max(depth, 0), 2);
+	if (depth != m_depth)
+		cout << "Triggers can be between 0 and 2 images ahead. Using " << m_depth << "." << endl;
+	m_rate = rate;
+	if (m_schedule == TriggerSchedule_Rate && m_rate <= 0)
+	{
+		cout << "A trigger rate needs more than 0 frames per second. Triggering on demand instead." << endl;
+		m_schedule = TriggerSchedule_OnDemand;
+	}
+}
+
+ETriggerSchedule CTriggerScheduler::GetSchedule()
+{
+	return m_schedule;
+}
+
+double CTriggerScheduler::GetRate()
+{
+	return m_rate;
+}
+
+void CTriggerScheduler::Start()
+{
+	{
+		lock_guard<mutex> lock(m_lock);
+		m_stats.outstanding = 0;
+	}
+	{
+		lock_guard<mutex> lock(m_clockLock);
+		m_isRunning = true;
+	}
+	m_wakeClock.notify_all();
+
+	if (m_schedule == TriggerSchedule_Rate && m_clock.joinable() == false)
+	{
+		m_isClockStopping = false;
+		m_clock = std::thread(&CTriggerScheduler::clock_thread, this);
+	}
+}
+
+void CTriggerScheduler::Stop()
+{
+	{
+		lock_guard<mutex> lock(m_clockLock);
+		m_isRunning = false;
+	}
+	m_wakeClock.notify_all();
+	Reset();
+}
+
+void CTriggerScheduler::Join()
+{
+	Stop();
+	if (m_clock.joinable() == true)
+	{
+		{
+			lock_guard<mutex> lock(m_clockLock);
+			m_isClockStopping = true;
+		}
+		m_wakeClock.notify_all();
+		m_clock.join();
+	}
+}
+
+bool CTriggerScheduler::BeforeRetrieve(int timeoutMs)
+{
+	{
+		lock_guard<mutex> lock(m_lock);
+		if (m_stats.outstanding > 0)
+			return true;
+	}
+	if (fire(timeoutMs, true) == false)
+		return false;
+	lock_guard<mutex> lock(m_lock);
+	m_stats.outstanding++;
+	return true;
+}
+
+void CTriggerScheduler::Retrieved()
+{
+	int ahead;
+	{
+		lock_guard<mutex> lock(m_lock);
+		if (m_stats.outstanding > 0)
+			m_stats.outstanding--;
+		ahead = m_stats.outstanding;
+	}
+	// No waiting here: this is the streaming thread, with an image to hand over. A camera still busy with the last one gets its trigger in BeforeRetrieve().
+	for (; ahead < m_depth; ahead++)
+	{
+		if (fire(0, false) == false)
+			break;
+		lock_guard<mutex> lock(m_lock);
+		m_stats.outstanding++;
+	}
+}
+
+void CTriggerScheduler::Reset()
+{
+	lock_guard<mutex> lock(m_lock);
+	m_stats.outstanding = 0;
+}
+
+bool CTriggerScheduler::Fire(int timeoutMs)
+{
+	return fire(timeoutMs, true);
+}
+
+TriggerStats CTriggerScheduler::GetStats()
+{
+	lock_guard<mutex> lock(m_lock);
+	return m_stats;
+}
+
+bool CTriggerScheduler::fire(int timeoutMs, bool countMissed)
+{
+	try
+	{
+		if (m_isRunning == false || m_camera.IsGrabbing() == false)
+			return false;
+
+		// Cameras without FrameTriggerWait (or AcquisitionStatus) can't tell us, and get the trigger regardless, as before.
+		if (m_camera.CanWaitForFrameTriggerReady() == true && m_camera.WaitForFrameTriggerReady(timeoutMs, Pylon::TimeoutHandling_Return) == false)
+		{
+			if (countMissed == true)
+			{
+				lock_guard<mutex> lock(m_lock);
+				m_stats.missed++;
+			}
+			return false;
+		}
+		m_camera.ExecuteSoftwareTrigger();
+
+		lock_guard<mutex> lock(m_lock);
+		m_stats.fired++;
+		return true;
+	}
+	catch (GenICam::GenericException &e)
+	{
+		cerr << "An exception occured in fire(): " << endl << e.GetDescription() << endl;
+		return false;
+	}
+	catch (std::exception &e)
+	{
+		cerr << "An exception occurred in fire(): " << endl << e.what() << endl;
+		return false;
+	}
+}
+
+// Fires every 1/rate seconds, on the steady clock, so the period doesn't drift with however long each trigger took.
+void CTriggerScheduler::clock_thread()
+{
+	chrono::steady_clock::duration period = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(1.0 / m_rate));
+	// waiting any longer for the camera would run into the next trigger
+	int timeoutMs = max(1, (int)(1000.0 / m_rate));
+	chrono::steady_clock::time_point next = chrono::steady_clock::now();
+
+	unique_lock<mutex> lock(m_clockLock);
+	while (m_isClockStopping == false)
+	{
+		// grabbing stopped for a moment (a new AOI, PixelFormat, reconnecting...): the period starts over when it's back
+		if (m_isRunning == false)
+		{
+			m_wakeClock.wait(lock, [this] { return m_isRunning == true || m_isClockStopping == true; });
+			next = chrono::steady_clock::now();
+			continue;
+		}
+		lock.unlock();
+		fire(timeoutMs, true);
+		lock.lock();
+
+		// Behind (the camera kept us waiting): carry on from now, rather than firing a burst to catch up.
+		next += period;
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		if (next < now)
+			next = now;
+		m_wakeClock.wait_until(lock, next, [this] { return m_isClockStopping == true || m_isRunning == false; });
+	}
+}
@@ -0,0 +1,107 @@
+/*  CTriggerScheduler.h: header file for CTriggerScheduler Class.
+    Fires the camera's software triggers: on demand and a frame or two ahead, at a steady rate, or when the application says so.
+
+	Copyright 2017 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+
+*/
+
+#pragma once
+
+#include <pylon/PylonIncludes.h>
+#include <gst/gst.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+// ******* ETriggerSchedule *******
+// Who decides when the camera takes the next image (with the software trigger, see GrabSettings).
+enum ETriggerSchedule
+{
+	TriggerSchedule_OnDemand,    // the pipeline: a trigger when the AppSrc (or pylonsrc) asks for an image, kept triggerDepth images ahead
+	TriggerSchedule_Rate,        // a clock: triggerRate times a second, from a thread of the scheduler's own
+	TriggerSchedule_Application  // the application, with CInstantCameraAppSrc::FireTrigger() (eg: from an encoder wheel, or another camera)
+};
+
+// ******* TriggerStats *******
+struct TriggerStats
+{
+	guint64 fired;    // software triggers executed
+	guint64 missed;   // triggers not fired because the camera wasn't ready for one in time (the rate is faster than exposure + readout allow)
+	int outstanding;  // fired, and their image not retrieved yet (on demand only)
+
+	TriggerStats()
+	{
+		fired = 0;
+		missed = 0;
+		outstanding = 0;
+	}
+};
+
+// ******* CTriggerScheduler *******
+// A software trigger the camera isn't ready for is simply ignored by it, and its image never comes (RetrieveResult() times out).
+// So before each trigger, we wait for the camera's FrameTriggerWait (WaitForFrameTriggerReady()), where the camera can tell us.
+// On demand, a trigger is fired when an image is wanted and none is on its way. With a depth of 1 or 2, as soon as an image is retrieved
+// the next one (or two) is triggered already, so it's exposing and being read out while this one goes down the pipeline: an image is
+// always ready a frame earlier, at the cost of it being a frame older.
+// The camera tells us (see CAppSrcConfigurationEventHandler) when grabbing starts and stops, however often that happens (new AOI, PixelFormat, reconnect...).
+class CTriggerScheduler
+{
+public:
+	CTriggerScheduler(Pylon::CInstantCamera &camera);
+	~CTriggerScheduler();
+	CTriggerScheduler(const CTriggerScheduler&) = delete;
+	CTriggerScheduler& operator=(const CTriggerScheduler&) = delete;
+
+	// depth: images triggered ahead on demand (0 to 2. 0 = only when asked). rate: frames per second with TriggerSchedule_Rate.
+	void Configure(ETriggerSchedule schedule, int depth, double rate);
+	ETriggerSchedule GetSchedule();
+	double GetRate();
+	// once grabbing has started / before it stops. The triggers in flight are forgotten: stopping the Grab Engine throws their images away.
+	// Both are called inside the camera's lock (its configuration event handlers), so they don't wait for anything: the rate's clock thread
+	// only idles between Stop() and Start(). Join() ends it, once grabbing has stopped and outside the camera's lock.
+	void Start();
+	void Stop();
+	void Join();
+	// On demand, before retrieving an image: make sure one is on its way. False if the camera wasn't ready for a trigger within timeoutMs.
+	bool BeforeRetrieve(int timeoutMs);
+	// On demand, an image was retrieved: trigger the ones ahead of it (if the camera is ready for them right now, otherwise next time).
+	void Retrieved();
+	// the retrieve failed: whatever was in flight isn't coming.
+	void Reset();
+	// With TriggerSchedule_Application. False if the camera wasn't ready within timeoutMs (counted as missed), or isn't grabbing.
+	bool Fire(int timeoutMs);
+	TriggerStats GetStats();
+
+private:
+	Pylon::CInstantCamera &m_camera;
+	ETriggerSchedule m_schedule;
+	int m_depth;
+	double m_rate;
+	std::atomic<bool> m_isRunning;
+	std::mutex m_lock; // the counts
+	TriggerStats m_stats;
+	std::thread m_clock;
+	std::mutex m_clockLock;
+	std::condition_variable m_wakeClock;
+	bool m_isClockStopping;
+
+	bool fire(int timeoutMs, bool countMissed);
+	void clock_thread();
+};
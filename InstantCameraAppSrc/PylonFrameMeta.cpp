@@ -0,0 +1,100 @@
+/*  PylonFrameMeta.cpp: Definition file for the PylonFrameMeta GstMeta.
+    This carries the camera's own information about each image (frame id, hardware timestamp, lost frames), and what the frame analysis found in it, along with the gst buffer.
+
+	Copyright 2017, 2018, 2019 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+	*/
+
+#include "PylonFrameMeta.h"
+
+// the API type is what elements look the meta up by. No tags, so the meta is kept through image transformations.
+GType pylon_frame_meta_api_get_type()
+{
+	static gsize type = 0;
+	static const gchar *tags[] = { NULL };
+
+	if (g_once_init_enter(&type))
+	{
+		GType newType = gst_meta_api_type_register("PylonFrameMetaAPI", tags);
+		g_once_init_leave(&type, newType);
+	}
+	return (GType)type;
+}
+
+static gboolean pylon_frame_meta_init(GstMeta *meta, gpointer params, GstBuffer *buffer)
+{
+	PylonFrameMeta *frameMeta = (PylonFrameMeta*)meta;
+	frameMeta->frameId = 0;
+	frameMeta->cameraTimestamp = 0;
+	frameMeta->lostFrames = 0;
+	frameMeta->totalLostFrames = 0;
+	frameMeta->skippedImages = 0;
+	frameMeta->isRepeated = FALSE;
+	frameMeta->isAnalyzed = FALSE;
+	frameMeta->meanLuminance = 0;
+	for (int i = 0; i < PYLON_FRAME_META_HISTOGRAM_BINS; i++)
+		frameMeta->histogram[i] = 0;
+	frameMeta->motion = 0;
+	frameMeta->focus = 0;
+	frameMeta->score = 0;
+	return TRUE;
+}
+
+// called when a buffer carrying the meta is copied or transformed (eg: videoconvert making its output buffer). The frame information stays the same.
+static gboolean pylon_frame_meta_transform(GstBuffer *dest, GstMeta *meta, GstBuffer *buffer, GQuark type, gpointer data)
+{
+	PylonFrameMeta *srcMeta = (PylonFrameMeta*)meta;
+	PylonFrameMeta *destMeta = gst_buffer_add_pylon_frame_meta(dest);
+	if (destMeta == NULL)
+		return FALSE;
+
+	destMeta->frameId = srcMeta->frameId;
+	destMeta->cameraTimestamp = srcMeta->cameraTimestamp;
+	destMeta->lostFrames = srcMeta->lostFrames;
+	destMeta->totalLostFrames = srcMeta->totalLostFrames;
+	destMeta->skippedImages = srcMeta->skippedImages;
+	destMeta->isRepeated = srcMeta->isRepeated;
+	destMeta->isAnalyzed = srcMeta->isAnalyzed;
+	destMeta->meanLuminance = srcMeta->meanLuminance;
+	for (int i = 0; i < PYLON_FRAME_META_HISTOGRAM_BINS; i++)
+		destMeta->histogram[i] = srcMeta->histogram[i];
+	destMeta->motion = srcMeta->motion;
+	destMeta->focus = srcMeta->focus;
+	destMeta->score = srcMeta->score;
+	return TRUE;
+}
+
+const GstMetaInfo* pylon_frame_meta_get_info()
+{
+	static const GstMetaInfo *info = NULL;
+
+	if (g_once_init_enter((gsize*)&info))
+	{
+		const GstMetaInfo *newInfo = gst_meta_register(PYLON_FRAME_META_API_TYPE, "PylonFrameMeta", sizeof(PylonFrameMeta),
+			pylon_frame_meta_init,
+			NULL,
+			pylon_frame_meta_transform);
+		g_once_init_leave((gsize*)&info, (gsize)newInfo);
+	}
+	return info;
+}
+
+PylonFrameMeta* gst_buffer_add_pylon_frame_meta(GstBuffer *buffer)
+{
+	return (PylonFrameMeta*)gst_buffer_add_meta(buffer, pylon_frame_meta_get_info(), NULL);
+}
@@ -0,0 +1,60 @@
+/*  PylonFrameMeta.h: header file for the PylonFrameMeta GstMeta.
+    This carries the camera's own information about each image (frame id, hardware timestamp, lost frames), and what the frame analysis found in it, along with the gst buffer.
+
+	Copyright 2017 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+
+*/
+
+#pragma once
+
+#include <gst/gst.h>
+
+#define PYLON_FRAME_META_HISTOGRAM_BINS 16
+
+// ******* PylonFrameMeta *******
+// Attached by CInstantCameraAppSrc to every buffer it pushes. Any element or pad probe downstream can read it with gst_buffer_get_pylon_frame_meta().
+// The meta has no tags, so elements that transform the image (videoconvert, videoscale, etc.) copy it to their output buffers.
+struct PylonFrameMeta
+{
+	GstMeta meta;
+
+	guint64 frameId;          // the camera's block id (frame counter) of this image
+	guint64 cameraTimestamp;  // the camera's hardware timestamp of this image, in nanoseconds
+	guint32 lostFrames;       // frames the camera sent (per frame id) that never arrived between the previous image and this one
+	guint64 totalLostFrames;  // lost frames since grabbing started
+	guint32 skippedImages;    // images the Grab Engine dropped (per grab strategy) before this one was retrieved
+	gboolean isRepeated;      // TRUE if the grab failed and this is the last good image pushed again
+
+	// With GrabSettings analysisStep, what CFrameAnalyzer saw in the image on the grab thread (see FrameAnalysis). Zero when isAnalyzed is FALSE.
+	gboolean isAnalyzed;
+	gdouble meanLuminance;    // 0-255
+	guint32 histogram[PYLON_FRAME_META_HISTOGRAM_BINS]; // samples per 16 levels of luminance
+	gdouble motion;           // 0-255, against the image before
+	gdouble focus;            // higher is sharper
+	gdouble score;            // the application's (FrameAnalysisCallback)
+};
+
+GType pylon_frame_meta_api_get_type();
+const GstMetaInfo* pylon_frame_meta_get_info();
+
+#define PYLON_FRAME_META_API_TYPE (pylon_frame_meta_api_get_type())
+#define gst_buffer_get_pylon_frame_meta(b) ((PylonFrameMeta*)gst_buffer_get_meta((b), PYLON_FRAME_META_API_TYPE))
+
+// Add a new, zeroed, PylonFrameMeta to the buffer. The buffer must be writable.
+PylonFrameMeta* gst_buffer_add_pylon_frame_meta(GstBuffer *buffer);
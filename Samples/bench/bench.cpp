@@ -0,0 +1,769 @@
+/*  bench.cpp: Benchmark and soak test for CInstantCameraAppSrc.
+	Runs the camera into a fakesink, an encoder, and an encoder writing to a file, over a matrix of sizes, pixel formats, grab strategies
+	and copy vs zero-copy, and writes fps, latency, drops, CPU and memory for each run as JSON lines.
+
+	Copyright 2017-2019 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+
+
+	Concept Overview:
+	<--------------- InstantCameraAppSrc -------------->    +------------+    +------------------------------------------------+
+	| source                                           |    | capsfilter |    | fakesink                                       |
+	| (camera + driver + GstAppSrc)                   src--sink (format)  src--| or: queue ! videoconvert ! encoder ! fakesink  |
+	+--------------------------------------------------+    +------------+    | or: queue ! videoconvert ! encoder ! filesink  |
+	                                                                          +------------------------------------------------+
+	Each configuration gets a camera and a pipeline of its own, so nothing carries over from one run to the next.
+	The latency is measured at the last element (benchsink): its running time when the buffer gets there, minus the buffer's timestamp,
+	which the AppSrc set when the image was pushed. The drops are the images the Grab Engine skipped, the frames lost on the way from the
+	camera, and the buffers the leaky queue in front of the encoder threw away.
+
+	Usage:
+	bench [options]
+	-camera <serialnumber> (Use a specific camera. If not specified, will use first camera found. Set PYLON_CAMEMU=1 to use the camera emulator.)
+	-sizes <list> (Comma separated <width>x<height>, or max for the whole sensor. Default: 640x480,max)
+	-formats <list> (GStreamer formats the camera is asked for, as in caps. Default: GRAY8,I420)
+	-strategies <list> (latest, onebyone, latestimages. Default: latest,onebyone)
+	-copies <list> (copy, zerocopy. Default: copy,zerocopy)
+	-sinks <list> (fakesink, encoder, file. Default: fakesink,encoder,file)
+	-encoder <description> (Default: x264enc tune=zerolatency speed-preset=ultrafast)
+	-filedir <directory> (Where the file sink writes, and deletes afterwards. Default: the current directory)
+	-fps <fps> (Camera frame rate, or max. Default: 30)
+	-seconds <s> (How long each configuration is measured. Default: 10)
+	-warmup <s> (How long each configuration runs before that. Default: 2)
+	-output <file> (JSON lines are appended to it. Default: bench_results.jsonl)
+	-soak <hours> (Run the first configuration of the matrix this long instead, eg: -soak 8)
+	-interval <s> (Soak: write a sample this often. Default: 60)
+	-settle <minutes> (Soak: memory may grow this long before it's expected to stay flat. Default: 5)
+	-maxgrowth <MB/h> (Soak: fail if memory grows faster than this after settling. Default: 1)
+
+	Examples:
+	PYLON_CAMEMU=1 bench
+	bench -sizes max -formats GRAY8 -sinks fakesink -copies copy,zerocopy -seconds 30
+	bench -sizes 1920x1080 -formats I420 -strategies onebyone -sinks file -soak 8 -interval 300
+
+	Output, one line each:
+	{"type":"run", ...}          each configuration: fps, latency p50/p99/max (us), drops, cpu (% of one core), rss (bytes). ok is false if it didn't run.
+	{"type":"soak-sample", ...}  every interval of a soak, the same for that interval. (The soak's run line has the latency of its last interval only:
+	                             keeping hours of latencies would grow the memory the soak is watching.)
+	{"type":"soak", ...}         the soak's memory check: rss growth after settling, in MB per hour (least squares), and pass
+	The exit code is -1 if a soak's memory didn't stay flat, or no configuration ran at all.
+
+	Note:
+	Some GStreamer elements (plugins) used in the pipeline examples may not be available on all systems. Consult GStreamer for more information:
+	https://gstreamer.freedesktop.org/
+*/
+
+
+#include "../../InstantCameraAppSrc/CInstantCameraAppSrc.h"
+#include <gst/gst.h>
+#include <glib/gstdio.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <stdio.h>
+#ifdef WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+
+int exitCode = 0;
+
+// ******* BenchConfig *******
+// One configuration of the matrix.
+struct BenchConfig
+{
+	int width;           // -1 = the whole sensor
+	int height;
+	string format;       // GStreamer format name, eg: GRAY8
+	string strategyName; // as on the command line
+	Pylon::EGrabStrategy strategy;
+	bool useZeroCopy;
+	string sink;         // fakesink, encoder or file
+};
+
+// ******* ProcessUsage *******
+// CPU time and resident memory of this process so far.
+struct ProcessUsage
+{
+	double cpuSeconds;
+	guint64 rssBytes;
+};
+
+// ******* Measurement *******
+// Everything counted from one moment: a run's start (after the warmup), or a soak's last sample.
+struct Measurement
+{
+	gint64 time; // us, monotonic
+	ProcessUsage usage;
+	AcquisitionStats stats;
+	guint64 sinkFrames;
+};
+
+// ******* SinkProbe *******
+// Counts and times the buffers reaching benchsink, from its streaming thread.
+struct SinkProbe
+{
+	std::mutex lock;
+	guint64 frames;
+	bool isMeasuring;
+	vector<gint64> latencies; // us, since the last take_latencies()
+
+	SinkProbe()
+	{
+		frames = 0;
+		isMeasuring = false;
+	}
+};
+
+// ******* RunState *******
+// What the timers and the bus watch of one run share.
+struct RunState
+{
+	GMainLoop *loop;
+	CInstantCameraAppSrc *camera;
+	SinkProbe probe;
+	BenchConfig config;
+	Measurement begin;  // after the warmup
+	Measurement last;   // the last soak sample
+	bool isFailed;
+	string error;
+	// the main loop's timers for this run, 0 once they're gone. They mustn't outlive it.
+	guint warmupTimer;
+	guint sampleTimer;
+	guint endTimer;
+	// soak
+	double soakHours;
+	int settleMinutes;
+	vector<pair<double, double> > memory; // hours since the warmup, MB. After settling only
+};
+
+// the bench's settings (see Usage)
+string serialNumber = "";
+string encoderDescription = "x264enc tune=zerolatency speed-preset=ultrafast";
+string fileDirectory = ".";
+string outputFile = "bench_results.jsonl";
+int frameRate = 30; // -1 = max
+double measureSeconds = 10;
+double warmupSeconds = 2;
+double soakHours = 0;
+int soakInterval = 60;
+int settleMinutes = 5;
+double maxGrowth = 1;
+ofstream output;
+
+// ******* process usage, percentiles, JSON ********
+
+#ifdef WIN32
+static double filetime_seconds(const FILETIME &time)
+{
+	ULARGE_INTEGER ticks; // 100 ns
+	ticks.LowPart = time.dwLowDateTime;
+	ticks.HighPart = time.dwHighDateTime;
+	return ticks.QuadPart / 1e7;
+}
+#endif
+
+static ProcessUsage process_usage()
+{
+	ProcessUsage usage;
+	usage.cpuSeconds = 0;
+	usage.rssBytes = 0;
+#ifdef WIN32
+	FILETIME creation, exited, kernel, user;
+	if (GetProcessTimes(GetCurrentProcess(), &creation, &exited, &kernel, &user))
+		usage.cpuSeconds = filetime_seconds(kernel) + filetime_seconds(user);
+	PROCESS_MEMORY_COUNTERS memory;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &memory, sizeof(memory)))
+		usage.rssBytes = memory.WorkingSetSize;
+#else
+	struct rusage rusage;
+	if (getrusage(RUSAGE_SELF, &rusage) == 0)
+		usage.cpuSeconds = rusage.ru_utime.tv_sec + rusage.ru_stime.tv_sec + (rusage.ru_utime.tv_usec + rusage.ru_stime.tv_usec) / 1e6;
+	// the second number in statm is the resident pages (ru_maxrss is only the peak)
+	FILE *statm = fopen("/proc/self/statm", "r");
+	if (statm != NULL)
+	{
+		unsigned long size = 0, resident = 0;
+		if (fscanf(statm, "%lu %lu", &size, &resident) == 2)
+			usage.rssBytes = (guint64)resident * sysconf(_SC_PAGESIZE);
+		fclose(statm);
+	}
+#endif
+	return usage;
+}
+
+// The latencies must be sorted. -1 if there are none.
+static gint64 percentile(const vector<gint64> &sorted, double fraction)
+{
+	if (sorted.empty())
+		return -1;
+	return sorted[(size_t)((sorted.size() - 1) * fraction + 0.5)];
+}
+
+static string json_string(const string &text)
+{
+	string quoted = "\"";
+	for (size_t i = 0; i < text.size(); i++)
+	{
+		char c = text[i];
+		if (c == '"' || c == '\\')
+			quoted += '\\';
+		if ((unsigned char)c < 0x20)
+			c = ' ';
+		quoted += c;
+	}
+	return quoted + "\"";
+}
+
+static string config_json(const BenchConfig &config, CInstantCameraAppSrc *camera)
+{
+	stringstream json;
+	// the camera's actual size, which may have been rounded
+	int width = (camera != NULL && camera->GetWidth() > 0) ? camera->GetWidth() : config.width;
+	int height = (camera != NULL && camera->GetHeight() > 0) ? camera->GetHeight() : config.height;
+	json << "\"width\":" << width << ",\"height\":" << height << ",\"format\":" << json_string(config.format)
+		<< ",\"strategy\":" << json_string(config.strategyName) << ",\"zeroCopy\":" << (config.useZeroCopy ? "true" : "false")
+		<< ",\"sink\":" << json_string(config.sink);
+	return json.str();
+}
+
+// fps, latency, drops, cpu and memory between two measurements, as JSON members
+static string interval_json(const Measurement &from, const Measurement &to, vector<gint64> &latencies)
+{
+	sort(latencies.begin(), latencies.end());
+	double seconds = (to.time - from.time) / 1e6;
+	guint64 frames = to.sinkFrames - from.sinkFrames;
+	guint64 pushed = to.stats.frames - from.stats.frames;
+	guint64 skipped = to.stats.skippedImages - from.stats.skippedImages;
+	guint64 lost = to.stats.lostFrames - from.stats.lostFrames;
+	// buffers pushed that never got to benchsink: the leaky queue in front of the encoder (a few may still be on their way)
+	guint64 downstream = (pushed > frames) ? pushed - frames : 0;
+
+	stringstream json;
+	json << "\"seconds\":" << seconds
+		<< ",\"frames\":" << frames
+		<< ",\"fps\":" << ((seconds > 0) ? frames / seconds : 0)
+		<< ",\"latencyP50Us\":" << percentile(latencies, 0.5)
+		<< ",\"latencyP99Us\":" << percentile(latencies, 0.99)
+		<< ",\"latencyMaxUs\":" << (latencies.empty() ? -1 : latencies.back())
+		<< ",\"grabToPushP99Us\":" << to.stats.grabToPush.Percentile(0.99)
+		<< ",\"skippedImages\":" << skipped
+		<< ",\"lostFrames\":" << lost
+		<< ",\"downstreamDrops\":" << downstream
+		<< ",\"dropped\":" << skipped + lost + downstream
+		<< ",\"failedGrabs\":" << to.stats.failedGrabs - from.stats.failedGrabs
+		<< ",\"cpuPercent\":" << ((seconds > 0) ? 100 * (to.usage.cpuSeconds - from.usage.cpuSeconds) / seconds : 0)
+		<< ",\"rssBytes\":" << to.usage.rssBytes;
+	return json.str();
+}
+
+static void write_line(const string &json)
+{
+	output << json << endl;
+	cout << json << endl;
+}
+
+// ******* variables, call-backs, etc. for use with gstreamer ********
+
+static Measurement measure(RunState *pState)
+{
+	Measurement measurement;
+	measurement.time = g_get_monotonic_time();
+	measurement.usage = process_usage();
+	measurement.stats = pState->camera->GetStats();
+	std::lock_guard<std::mutex> lock(pState->probe.lock);
+	measurement.sinkFrames = pState->probe.frames;
+	return measurement;
+}
+
+// the latencies so far, and start over
+static vector<gint64> take_latencies(RunState *pState)
+{
+	vector<gint64> latencies;
+	std::lock_guard<std::mutex> lock(pState->probe.lock);
+	latencies.swap(pState->probe.latencies);
+	return latencies;
+}
+
+// From benchsink's streaming thread, for every buffer.
+static GstPadProbeReturn cb_sink_buffer(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	SinkProbe *pProbe = (SinkProbe*)user_data;
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+	GstElement *sink = GST_ELEMENT(GST_OBJECT_PARENT(pad));
+
+	// The AppSrc's buffers are timestamped in running time, and time starts from 0 in its segment.
+	gint64 latency = -1;
+	GstClock *clock = gst_element_get_clock(sink);
+	if (clock != NULL && GST_BUFFER_PTS_IS_VALID(buffer))
+	{
+		GstClockTime runningTime = gst_clock_get_time(clock) - gst_element_get_base_time(sink);
+		latency = ((gint64)runningTime - (gint64)GST_BUFFER_PTS(buffer)) / 1000;
+	}
+	if (clock != NULL)
+		gst_object_unref(clock);
+
+	std::lock_guard<std::mutex> lock(pProbe->lock);
+	pProbe->frames++;
+	if (pProbe->isMeasuring == true && latency >= 0)
+		pProbe->latencies.push_back(latency);
+	return GST_PAD_PROBE_OK;
+}
+
+// handler for bus call messages
+gboolean bus_call(GstBus *bus, GstMessage *msg, gpointer data)
+{
+	try
+	{
+		RunState *pState = (RunState*)data;
+
+		switch (GST_MESSAGE_TYPE(msg)) {
+
+		case GST_MESSAGE_EOS:
+			pState->isFailed = true;
+			pState->error = "End of stream";
+			g_main_loop_quit(pState->loop);
+			break;
+
+		case GST_MESSAGE_ERROR: {
+			gchar  *debug;
+			GError *error;
+
+			gst_message_parse_error(msg, &error, &debug);
+			g_printerr("ERROR from element %s: %s\n", GST_OBJECT_NAME(msg->src), error->message);
+			g_printerr("Debugging info: %s\n", (debug) ? debug : "none");
+			pState->isFailed = true;
+			pState->error = error->message;
+
+			g_error_free(error);
+			g_free(debug);
+
+			g_main_loop_quit(pState->loop);
+			break;
+		}
+
+		default:
+			break;
+		}
+
+		return TRUE;
+	}
+	catch (std::exception &e)
+	{
+		cerr << "An exception occurred in bus_call(): " << endl << e.what() << endl;
+		return FALSE;
+	}
+}
+
+static gboolean cb_end(gpointer user_data)
+{
+	RunState *pState = (RunState*)user_data;
+	pState->endTimer = 0;
+	g_main_loop_quit(pState->loop);
+	return G_SOURCE_REMOVE;
+}
+
+// Soak: one line per interval, and the memory for the check at the end.
+static gboolean cb_soak_sample(gpointer user_data)
+{
+	RunState *pState = (RunState*)user_data;
+	Measurement now = measure(pState);
+	vector<gint64> latencies = take_latencies(pState);
+	double hours = (now.time - pState->begin.time) / 3.6e9;
+
+	write_line("{\"type\":\"soak-sample\"," + config_json(pState->config, pState->camera) + ",\"elapsedHours\":" + to_string(hours) + "," +
+		interval_json(pState->last, now, latencies) + "}");
+	if (hours * 60 >= pState->settleMinutes)
+		pState->memory.push_back(make_pair(hours, now.usage.rssBytes / 1048576.0));
+	pState->last = now;
+	return G_SOURCE_CONTINUE;
+}
+
+// The warmup is over: the camera and the encoder have allocated what they need. Measure from here.
+static gboolean cb_begin_measuring(gpointer user_data)
+{
+	RunState *pState = (RunState*)user_data;
+	pState->warmupTimer = 0;
+	take_latencies(pState);
+	pState->begin = measure(pState);
+	pState->last = pState->begin;
+	{
+		std::lock_guard<std::mutex> lock(pState->probe.lock);
+		pState->probe.isMeasuring = true;
+	}
+
+	if (pState->soakHours > 0)
+	{
+		pState->sampleTimer = g_timeout_add_seconds(soakInterval, cb_soak_sample, pState);
+		pState->endTimer = g_timeout_add_seconds((guint)(pState->soakHours * 3600), cb_end, pState);
+	}
+	else
+		pState->endTimer = g_timeout_add((guint)(measureSeconds * 1000), cb_end, pState);
+	return G_SOURCE_REMOVE;
+}
+
+// ******* END variables, call-backs, etc. for use with gstreamer ********
+
+static string sink_description(const BenchConfig &config)
+{
+	string description = "capsfilter caps=video/x-raw,format=" + config.format + " ! ";
+	// The queue is leaky like the demo's encodequeue: an encoder that can't keep up drops frames (downstreamDrops) instead of holding up the camera.
+	if (config.sink == "encoder")
+		return description + "queue leaky=downstream max-size-buffers=4 ! videoconvert ! " + encoderDescription + " ! fakesink name=benchsink sync=false";
+	if (config.sink == "file")
+		return description + "queue leaky=downstream max-size-buffers=4 ! videoconvert ! " + encoderDescription + " ! filesink name=benchsink sync=false location=\"" + fileDirectory + "/bench.h264\"";
+	return description + "fakesink name=benchsink sync=false";
+}
+
+// Least squares slope of memory over time, MB per hour. 0 with fewer than two samples.
+static double memory_growth(const vector<pair<double, double> > &memory)
+{
+	if (memory.size() < 2)
+		return 0;
+	double meanHours = 0, meanMegabytes = 0;
+	for (size_t i = 0; i < memory.size(); i++)
+	{
+		meanHours += memory[i].first;
+		meanMegabytes += memory[i].second;
+	}
+	meanHours /= memory.size();
+	meanMegabytes /= memory.size();
+	double covariance = 0, variance = 0;
+	for (size_t i = 0; i < memory.size(); i++)
+	{
+		covariance += (memory[i].first - meanHours) * (memory[i].second - meanMegabytes);
+		variance += (memory[i].first - meanHours) * (memory[i].first - meanHours);
+	}
+	return (variance > 0) ? covariance / variance : 0;
+}
+
+// One configuration, with a camera and a pipeline of its own. False if it didn't run (the line says why), or its memory grew (soak).
+static bool run_config(const BenchConfig &config, double hours)
+{
+	RunState state;
+	state.config = config;
+	state.camera = NULL;
+	state.isFailed = false;
+	state.warmupTimer = 0;
+	state.sampleTimer = 0;
+	state.endTimer = 0;
+	state.soakHours = hours;
+	state.settleMinutes = settleMinutes;
+	bool isPassed = true;
+	GstElement *pipeline = NULL;
+
+	cout << endl << "Running " << config.width << "x" << config.height << " " << config.format << " " << config.strategyName << " "
+		<< (config.useZeroCopy ? "zerocopy" : "copy") << " " << config.sink << "..." << endl;
+
+	try
+	{
+		CInstantCameraAppSrc camera(serialNumber);
+		state.camera = &camera;
+		state.loop = g_main_loop_new(NULL, FALSE);
+
+		GrabSettings grabSettings;
+		grabSettings.strategy = config.strategy;
+		grabSettings.useZeroCopy = config.useZeroCopy;
+		if (camera.IsPylonDeviceAttached() == false || camera.InitCamera(config.width, config.height, frameRate, false, false, -1, -1, -1, -1, "", grabSettings) == false)
+		{
+			state.isFailed = true;
+			state.error = "Could not initialize the camera";
+		}
+		else if (frameRate == -1)
+			camera.GetFeatures().SetMaxFrameRate();
+
+		if (state.isFailed == false)
+		{
+			pipeline = gst_pipeline_new("pipeline");
+			GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+			guint busWatchId = gst_bus_add_watch(bus, bus_call, &state);
+			gst_object_unref(bus);
+
+			GError *error = NULL;
+			GstElement *sinkBin = gst_parse_bin_from_description(sink_description(config).c_str(), TRUE, &error);
+			if (sinkBin == NULL)
+			{
+				state.isFailed = true;
+				state.error = (error != NULL) ? error->message : "Could not make the sink";
+				g_clear_error(&error);
+			}
+			else
+			{
+				GstElement *source = camera.GetSource();
+				gst_bin_add_many(GST_BIN(pipeline), source, sinkBin, NULL);
+				if (gst_element_link(source, sinkBin) == FALSE)
+				{
+					state.isFailed = true;
+					state.error = "Could not link the camera to the sink";
+				}
+			}
+
+			if (state.isFailed == false)
+			{
+				GstElement *sink = gst_bin_get_by_name(GST_BIN(sinkBin), "benchsink");
+				GstPad *sinkPad = gst_element_get_static_pad(sink, "sink");
+				gst_pad_add_probe(sinkPad, GST_PAD_PROBE_TYPE_BUFFER, cb_sink_buffer, &state.probe, NULL);
+				gst_object_unref(sinkPad);
+				gst_object_unref(sink);
+
+				// Start the camera and grab engine, then the pipeline.
+				if (camera.StartCamera() == false)
+				{
+					state.isFailed = true;
+					state.error = "Could not start the camera";
+				}
+				else if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+				{
+					state.isFailed = true;
+					state.error = "Could not start the pipeline";
+				}
+				else
+				{
+					state.warmupTimer = g_timeout_add((guint)(warmupSeconds * 1000), cb_begin_measuring, &state);
+					g_main_loop_run(state.loop);
+				}
+			}
+			// (a run that ended early still has some)
+			guint *timers[] = { &state.warmupTimer, &state.sampleTimer, &state.endTimer };
+			for (size_t i = 0; i < sizeof(timers) / sizeof(timers[0]); i++)
+			{
+				if (*timers[i] != 0)
+					g_source_remove(*timers[i]);
+				*timers[i] = 0;
+			}
+
+			// a run that ended early (an error, EOS) is still reported, for as long as it ran
+			Measurement end = measure(&state);
+			vector<gint64> latencies = take_latencies(&state);
+			string line = "{\"type\":\"run\",\"ok\":" + string(state.isFailed ? "false" : "true") + "," + config_json(config, &camera);
+			if (state.isFailed == true)
+				line += ",\"error\":" + json_string(state.error);
+			if (state.probe.isMeasuring == true)
+				line += "," + interval_json(state.begin, end, latencies);
+			write_line(line + "}");
+
+			if (hours > 0 && state.probe.isMeasuring == true)
+			{
+				double growth = memory_growth(state.memory);
+				isPassed = (state.memory.size() >= 2 && growth <= maxGrowth);
+				stringstream soak;
+				soak << "{\"type\":\"soak\"," << config_json(config, &camera) << ",\"hours\":" << (end.time - state.begin.time) / 3.6e9
+					<< ",\"settleMinutes\":" << settleMinutes << ",\"samples\":" << state.memory.size()
+					<< ",\"rssStartMB\":" << (state.memory.empty() ? 0 : state.memory.front().second)
+					<< ",\"rssEndMB\":" << (state.memory.empty() ? 0 : state.memory.back().second)
+					<< ",\"growthMBPerHour\":" << growth << ",\"maxGrowthMBPerHour\":" << maxGrowth
+					<< ",\"pass\":" << (isPassed ? "true" : "false") << "}";
+				write_line(soak.str());
+				if (state.memory.size() < 2)
+					cout << "Not enough samples after settling to tell whether memory stayed flat. Use a longer -soak or a shorter -interval." << endl;
+			}
+
+			gst_element_set_state(pipeline, GST_STATE_NULL);
+			camera.StopCamera();
+			g_source_remove(busWatchId);
+			gst_object_unref(GST_OBJECT(pipeline));
+			pipeline = NULL;
+			if (config.sink == "file")
+				g_remove((fileDirectory + "/bench.h264").c_str());
+		}
+		else
+			write_line("{\"type\":\"run\",\"ok\":false," + config_json(config, NULL) + ",\"error\":" + json_string(state.error) + "}");
+
+		camera.CloseCamera();
+		g_main_loop_unref(state.loop);
+	}
+	catch (GenICam::GenericException &e)
+	{
+		cerr << "An exception occured in run_config(): " << endl << e.GetDescription() << endl;
+		state.isFailed = true;
+	}
+	catch (std::exception &e)
+	{
+		cerr << "An exception occurred in run_config(): " << endl << e.what() << endl;
+		state.isFailed = true;
+	}
+
+	return state.isFailed == false && isPassed == true;
+}
+
+static vector<string> split(const string &list)
+{
+	vector<string> items;
+	gchar **parts = g_strsplit(list.c_str(), ",", -1);
+	for (gchar **part = parts; *part != NULL; part++)
+	{
+		if (**part != '\0')
+			items.push_back(*part);
+	}
+	g_strfreev(parts);
+	return items;
+}
+
+gint main(gint argc, gchar *argv[])
+{
+	try
+	{
+		string sizes = "640x480,max";
+		string formats = "GRAY8,I420";
+		string strategies = "latest,onebyone";
+		string copies = "copy,zerocopy";
+		string sinks = "fakesink,encoder,file";
+
+		for (int i = 1; i < argc; i++)
+		{
+			string arg = argv[i];
+			// every option takes a value
+			if (i + 1 >= argc)
+			{
+				cout << "No value for " << arg << ". See the top of bench.cpp for the options." << endl;
+				return -1;
+			}
+			string value = argv[++i];
+			if (arg == "-camera")
+				serialNumber = value;
+			else if (arg == "-sizes")
+				sizes = value;
+			else if (arg == "-formats")
+				formats = value;
+			else if (arg == "-strategies")
+				strategies = value;
+			else if (arg == "-copies")
+				copies = value;
+			else if (arg == "-sinks")
+				sinks = value;
+			else if (arg == "-encoder")
+				encoderDescription = value;
+			else if (arg == "-filedir")
+				fileDirectory = value;
+			else if (arg == "-fps")
+				frameRate = (value == "max") ? -1 : atoi(value.c_str());
+			else if (arg == "-seconds")
+				measureSeconds = g_ascii_strtod(value.c_str(), NULL);
+			else if (arg == "-warmup")
+				warmupSeconds = g_ascii_strtod(value.c_str(), NULL);
+			else if (arg == "-output")
+				outputFile = value;
+			else if (arg == "-soak")
+				soakHours = g_ascii_strtod(value.c_str(), NULL);
+			else if (arg == "-interval")
+				soakInterval = max(1, atoi(value.c_str()));
+			else if (arg == "-settle")
+				settleMinutes = atoi(value.c_str());
+			else if (arg == "-maxgrowth")
+				maxGrowth = g_ascii_strtod(value.c_str(), NULL);
+			else
+			{
+				cout << "Unknown option " << arg << ". See the top of bench.cpp for the options." << endl;
+				return -1;
+			}
+		}
+
+		// the matrix
+		vector<BenchConfig> configs;
+		vector<string> sizeList = split(sizes), formatList = split(formats), strategyList = split(strategies), copyList = split(copies), sinkList = split(sinks);
+		for (size_t s = 0; s < sizeList.size(); s++)
+		for (size_t f = 0; f < formatList.size(); f++)
+		for (size_t g = 0; g < strategyList.size(); g++)
+		for (size_t c = 0; c < copyList.size(); c++)
+		for (size_t k = 0; k < sinkList.size(); k++)
+		{
+			BenchConfig config;
+			config.width = -1;
+			config.height = -1;
+			if (sizeList[s] != "max" && sscanf(sizeList[s].c_str(), "%dx%d", &config.width, &config.height) != 2)
+			{
+				cout << "Sizes are <width>x<height> or max, not " << sizeList[s] << "." << endl;
+				return -1;
+			}
+			config.format = formatList[f];
+			config.strategyName = strategyList[g];
+			if (config.strategyName == "latest")
+				config.strategy = Pylon::GrabStrategy_LatestImageOnly;
+			else if (config.strategyName == "onebyone")
+				config.strategy = Pylon::GrabStrategy_OneByOne;
+			else if (config.strategyName == "latestimages")
+				config.strategy = Pylon::GrabStrategy_LatestImages;
+			else
+			{
+				cout << "Grab strategies are latest, onebyone or latestimages, not " << config.strategyName << "." << endl;
+				return -1;
+			}
+			config.useZeroCopy = (copyList[c] == "zerocopy");
+			config.sink = sinkList[k];
+			if (config.sink != "fakesink" && config.sink != "encoder" && config.sink != "file")
+			{
+				cout << "Sinks are fakesink, encoder or file, not " << config.sink << "." << endl;
+				return -1;
+			}
+			configs.push_back(config);
+		}
+		if (configs.empty())
+		{
+			cout << "Nothing to run." << endl;
+			return -1;
+		}
+
+		output.open(outputFile.c_str(), ios::app);
+		if (output.is_open() == false)
+		{
+			cout << "Could not open " << outputFile << endl;
+			return -1;
+		}
+
+		// initialize GStreamer
+		gst_init(NULL, NULL);
+
+		if (soakHours > 0)
+		{
+			cout << "Soak test for " << soakHours << " hours, a sample every " << soakInterval << " s. Results in " << outputFile << endl;
+			exitCode = (run_config(configs[0], soakHours) == true) ? 0 : -1;
+		}
+		else
+		{
+			cout << configs.size() << " configurations of " << warmupSeconds << " + " << measureSeconds << " s each. Results in " << outputFile << endl;
+			int ran = 0;
+			for (size_t i = 0; i < configs.size(); i++)
+			{
+				if (run_config(configs[i], 0) == true)
+					ran++;
+			}
+			cout << endl << ran << " of " << configs.size() << " configurations ran." << endl;
+			exitCode = (ran > 0) ? 0 : -1;
+		}
+	}
+	catch (GenICam::GenericException &e)
+	{
+		cerr << "An exception occured in main(): " << endl << e.GetDescription() << endl;
+		exitCode = -1;
+	}
+	catch (std::exception &e)
+	{
+		cerr << "An exception occurred in main(): " << endl << e.what() << endl;
+		exitCode = -1;
+	}
+
+	return exitCode;
+}
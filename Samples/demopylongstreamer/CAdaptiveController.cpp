@@ -0,0 +1,294 @@
+/*  CAdaptiveController.cpp: Definition file for CAdaptiveController Class.
+    Steps the encoder's bitrate and the camera's framerate down when the pipeline can't keep up, and back up when it can.
+
+	Copyright 2017-2019 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+*/
+
+#include "CAdaptiveController.h"
+#include "CEncoderFactory.h"
+
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+
+AdaptiveSettings::AdaptiveSettings()
+{
+	intervalMs = 500;
+	highWater = 0.7;
+	lowWater = 0.3;
+	stepDownAfter = 2;
+	stepUpAfter = 20;
+	minBitrate = 2000000;
+	bitrateStep = 0.15;
+	minFrameRate = 10;
+	frameRateStep = 5;
+	maxTemperature = 80;
+	thermalZone = "/sys/class/thermal/thermal_zone0/temp";
+}
+
+CAdaptiveController::CAdaptiveController(GstElement *pipeline, const AdaptiveSettings &settings)
+{
+	m_pipeline = GST_ELEMENT(gst_object_ref(pipeline));
+	m_settings = settings;
+	m_timer = 0;
+	m_messageHandler = 0;
+	m_qosMessages = 0;
+	m_diskLoad = 0;
+	m_diskStalls = 0;
+	m_lastDiskStalls = 0;
+	m_encoder = NULL;
+	m_fullBitrate = 0;
+	m_bitrate = 0;
+	m_fullFrameRate = 0;
+	m_frameRate = 0;
+	m_overloaded = 0;
+	m_spare = 0;
+}
+
+CAdaptiveController::~CAdaptiveController()
+{
+	if (m_timer != 0)
+		g_source_remove(m_timer);
+	if (m_messageHandler != 0)
+	{
+		GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(m_pipeline));
+		g_signal_handler_disconnect(bus, m_messageHandler);
+		gst_object_unref(bus);
+	}
+	if (m_encoder != NULL)
+		gst_object_unref(m_encoder);
+	gst_object_unref(m_pipeline);
+}
+
+void CAdaptiveController::SetBitrate(int bitsPerSecond)
+{
+	m_fullBitrate = bitsPerSecond;
+	m_bitrate = bitsPerSecond;
+}
+
+void CAdaptiveController::SetFrameRate(double framesPerSecond, std::function<bool(double)> setFrameRate)
+{
+	m_fullFrameRate = framesPerSecond;
+	m_frameRate = framesPerSecond;
+	m_setFrameRate = setFrameRate;
+}
+
+bool CAdaptiveController::Start()
+{
+	if (m_timer != 0)
+		return true;
+
+	if (m_fullBitrate > 0)
+	{
+		m_encoder = CEncoderFactory::FindEncoder(m_pipeline);
+		if (m_encoder == NULL)
+			cout << "Adaptive: this pipeline has no encoder to control." << endl;
+	}
+	if (m_encoder == NULL && (m_fullFrameRate <= 0 || !m_setFrameRate))
+	{
+		cout << "Adaptive: nothing to control." << endl;
+		return false;
+	}
+
+	// QoS and the disk's statistics come from the streaming threads. The signal, like CPipelineHelper's, leaves the bus's watch and sync handler to the application.
+	GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(m_pipeline));
+	gst_bus_enable_sync_message_emission(bus);
+	m_messageHandler = g_signal_connect(bus, "sync-message", G_CALLBACK(cb_message), this);
+	gst_object_unref(bus);
+
+	m_timer = g_timeout_add(m_settings.intervalMs, cb_timer, this);
+	cout << "Adaptive: starting at " << m_bitrate / 1000000.0 << " Mb/s, " << m_frameRate << " fps." << endl;
+	return true;
+}
+
+// 0 (empty) to 1 (full) for the fullest queue, and its name
+double CAdaptiveController::queue_load(string &worst)
+{
+	double load = 0;
+	GstIterator *elements = gst_bin_iterate_recurse(GST_BIN(m_pipeline));
+	GValue item = G_VALUE_INIT;
+	while (gst_iterator_next(elements, &item) == GST_ITERATOR_OK)
+	{
+		GstElement *element = GST_ELEMENT(g_value_get_object(&item));
+		GstElementFactory *factory = gst_element_get_factory(element);
+		if (factory != NULL && g_strcmp0(GST_OBJECT_NAME(factory), "queue") == 0)
+		{
+			guint buffers = 0, maxBuffers = 0, bytes = 0, maxBytes = 0;
+			guint64 time = 0, maxTime = 0;
+			g_object_get(G_OBJECT(element), "current-level-buffers", &buffers, "max-size-buffers", &maxBuffers,
+				"current-level-bytes", &bytes, "max-size-bytes", &maxBytes,
+				"current-level-time", &time, "max-size-time", &maxTime, NULL);
+			// whichever limit it's nearest (0 = no limit)
+			double fill = 0;
+			if (maxBuffers != 0)
+				fill = max(fill, (double)buffers / maxBuffers);
+			if (maxBytes != 0)
+				fill = max(fill, (double)bytes / maxBytes);
+			if (maxTime != 0)
+				fill = max(fill, (double)time / maxTime);
+			if (fill > load)
+			{
+				load = fill;
+				worst = GST_OBJECT_NAME(element);
+			}
+		}
+		g_value_reset(&item);
+	}
+	g_value_unset(&item);
+	gst_iterator_free(elements);
+	return load;
+}
+
+// degrees C, or 0 if there's no thermal zone to read
+double CAdaptiveController::temperature()
+{
+	gchar *contents = NULL;
+	if (m_settings.maxTemperature <= 0 || g_file_get_contents(m_settings.thermalZone.c_str(), &contents, NULL, NULL) == FALSE)
+		return 0;
+	double degrees = g_ascii_strtod(contents, NULL) / 1000;
+	g_free(contents);
+	return degrees;
+}
+
+// The bitrate goes first: fewer bits per frame costs less than fewer frames.
+void CAdaptiveController::step_down(const string &reason)
+{
+	int step = (int)(m_fullBitrate * m_settings.bitrateStep);
+	if (m_encoder != NULL && m_bitrate > m_settings.minBitrate)
+	{
+		m_bitrate = max(m_settings.minBitrate, m_bitrate - step);
+		CEncoderFactory::SetBitrate(m_encoder, m_bitrate);
+		cout << "Adaptive: " << reason << ". Bitrate down to " << m_bitrate / 1000000.0 << " Mb/s." << endl;
+	}
+	else if (m_setFrameRate && m_frameRate > m_settings.minFrameRate)
+	{
+		double frameRate = max(m_settings.minFrameRate, m_frameRate - m_settings.frameRateStep);
+		if (m_setFrameRate(frameRate))
+		{
+			m_frameRate = frameRate;
+			cout << "Adaptive: " << reason << ". Framerate down to " << m_frameRate << " fps." << endl;
+		}
+	}
+}
+
+// In the reverse order
+void CAdaptiveController::step_up()
+{
+	int step = (int)(m_fullBitrate * m_settings.bitrateStep);
+	if (m_setFrameRate && m_frameRate < m_fullFrameRate)
+	{
+		double frameRate = min(m_fullFrameRate, m_frameRate + m_settings.frameRateStep);
+		if (m_setFrameRate(frameRate))
+		{
+			m_frameRate = frameRate;
+			cout << "Adaptive: framerate back up to " << m_frameRate << " fps." << endl;
+		}
+	}
+	else if (m_encoder != NULL && m_bitrate < m_fullBitrate)
+	{
+		m_bitrate = min(m_fullBitrate, m_bitrate + step);
+		CEncoderFactory::SetBitrate(m_encoder, m_bitrate);
+		cout << "Adaptive: bitrate back up to " << m_bitrate / 1000000.0 << " Mb/s." << endl;
+	}
+}
+
+gboolean CAdaptiveController::cb_timer(gpointer user_data)
+{
+	CAdaptiveController *pController = (CAdaptiveController*)user_data;
+	const AdaptiveSettings &settings = pController->m_settings;
+
+	string worst;
+	double load = pController->queue_load(worst);
+	string reason = "queue " + worst + " " + to_string((int)(load * 100)) + "% full";
+	{
+		std::lock_guard<std::mutex> lock(pController->m_lock);
+		if (pController->m_diskLoad > load)
+		{
+			load = pController->m_diskLoad;
+			reason = "disk " + to_string((int)(load * 100)) + "% behind";
+		}
+		if (pController->m_diskStalls > pController->m_lastDiskStalls)
+		{
+			load = max(load, 1.0);
+			reason = "disk stalled";
+		}
+		pController->m_lastDiskStalls = pController->m_diskStalls;
+		if (pController->m_qosMessages > 0)
+		{
+			load = max(load, 1.0);
+			reason = to_string(pController->m_qosMessages) + " QoS messages";
+		}
+		pController->m_qosMessages = 0;
+	}
+	double degrees = pController->temperature();
+	if (settings.maxTemperature > 0 && degrees > settings.maxTemperature)
+	{
+		load = max(load, 1.0);
+		reason = to_string((int)degrees) + " C";
+	}
+
+	if (load > settings.highWater)
+	{
+		pController->m_spare = 0;
+		if (++pController->m_overloaded >= settings.stepDownAfter)
+		{
+			pController->m_overloaded = 0;
+			pController->step_down(reason);
+		}
+	}
+	else if (load < settings.lowWater)
+	{
+		pController->m_overloaded = 0;
+		if (++pController->m_spare >= settings.stepUpAfter)
+		{
+			pController->m_spare = 0;
+			pController->step_up();
+		}
+	}
+	else
+	{
+		pController->m_overloaded = 0;
+		pController->m_spare = 0;
+	}
+
+	return TRUE;
+}
+
+// From whichever thread posted the message. Only counted here: the timer does the rest.
+void CAdaptiveController::cb_message(GstBus *bus, GstMessage *message, gpointer user_data)
+{
+	CAdaptiveController *pController = (CAdaptiveController*)user_data;
+	if (GST_MESSAGE_TYPE(message) == GST_MESSAGE_QOS)
+	{
+		std::lock_guard<std::mutex> lock(pController->m_lock);
+		pController->m_qosMessages++;
+	}
+	else if (GST_MESSAGE_TYPE(message) == GST_MESSAGE_ELEMENT && gst_message_has_name(message, "async-file-sink-stats"))
+	{
+		const GstStructure *stats = gst_message_get_structure(message);
+		guint64 pending = 0, stalls = 0, maxPending = 0;
+		gst_structure_get_uint64(stats, "pending-bytes", &pending);
+		gst_structure_get_uint64(stats, "stalls", &stalls);
+		g_object_get(G_OBJECT(GST_MESSAGE_SRC(message)), "max-pending", &maxPending, NULL);
+		std::lock_guard<std::mutex> lock(pController->m_lock);
+		pController->m_diskLoad = (maxPending != 0) ? (double)pending / maxPending : 0;
+		pController->m_diskStalls = stalls;
+	}
+}
@@ -0,0 +1,98 @@
+/*  CAdaptiveController.h: header file for CAdaptiveController Class.
+    Steps the encoder's bitrate and the camera's framerate down when the pipeline can't keep up, and back up when it can.
+
+	Copyright 2017 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+*/
+
+#pragma once
+
+#include <gst/gst.h>
+#include <string>
+#include <mutex>
+#include <functional>
+
+// ******* AdaptiveSettings *******
+struct AdaptiveSettings
+{
+	int intervalMs;         // how often the pipeline is looked at
+	double highWater;       // load (0-1) above which it's overloaded
+	double lowWater;        // and below which there is room to spare
+	int stepDownAfter;      // intervals overloaded in a row before a step down
+	int stepUpAfter;        // intervals with room in a row before a step up. Longer, so it doesn't hunt.
+	int minBitrate;         // bits per second
+	double bitrateStep;     // fraction of the full bitrate per step
+	double minFrameRate;
+	double frameRateStep;   // frames per second per step
+	double maxTemperature;  // degrees C, 0 = not watched
+	std::string thermalZone; // eg: /sys/class/thermal/thermal_zone0/temp (millidegrees)
+
+	AdaptiveSettings();
+};
+
+// ******* CAdaptiveController *******
+// Every intervalMs, the load is the worst of:
+//   the queues      how full each queue in the pipeline is (time or buffers, whichever is nearer its limit). A full leaky queue is one losing frames.
+//   QoS             any QoS message since the last look: a sink is dropping late buffers
+//   the disk        an asyncfilesink's pending bytes against its max-pending, and any new stalls (see gstasyncfilesink.h)
+//   temperature     over maxTemperature counts as overloaded, however empty the queues are
+// Overloaded for stepDownAfter intervals: the bitrate comes down a step, until minBitrate, then the framerate, until minFrameRate.
+// With room for stepUpAfter intervals: the framerate goes back up a step first, then the bitrate, until they're where they started.
+// The encoder is the pipeline's element of class Encoder/Video (see CEncoderFactory::SetBitrate()). The framerate is changed by the function given, eg: the camera's SetFrameRate().
+// Runs in the default main context (the demo's main loop). Bus messages are seen as they're posted, from any thread.
+class CAdaptiveController
+{
+public:
+	CAdaptiveController(GstElement *pipeline, const AdaptiveSettings &settings);
+	~CAdaptiveController();
+	CAdaptiveController(const CAdaptiveController&) = delete;
+	CAdaptiveController& operator=(const CAdaptiveController&) = delete;
+
+	// where the bitrate starts, and comes back to. 0: not controlled.
+	void SetBitrate(int bitsPerSecond);
+	// where the framerate starts, and comes back to, and how to change it. 0: not controlled.
+	void SetFrameRate(double framesPerSecond, std::function<bool(double)> setFrameRate);
+	// after the pipeline is built
+	bool Start();
+
+private:
+	GstElement *m_pipeline;
+	AdaptiveSettings m_settings;
+	guint m_timer;
+	gulong m_messageHandler;
+	std::mutex m_lock; // the counts below, from the bus
+	int m_qosMessages;
+	double m_diskLoad;
+	guint64 m_diskStalls;
+	guint64 m_lastDiskStalls;
+	GstElement *m_encoder;
+	int m_fullBitrate;
+	int m_bitrate;
+	double m_fullFrameRate;
+	double m_frameRate;
+	std::function<bool(double)> m_setFrameRate;
+	int m_overloaded; // intervals in a row
+	int m_spare;
+
+	double queue_load(std::string &worst);
+	double temperature();
+	void step_down(const std::string &reason);
+	void step_up();
+	static gboolean cb_timer(gpointer user_data);
+	static void cb_message(GstBus *bus, GstMessage *message, gpointer user_data);
+};
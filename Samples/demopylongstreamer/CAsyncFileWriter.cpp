@@ -0,0 +1,456 @@
+/*  CAsyncFileWriter.cpp: Definition file for CAsyncFileWriter Class.
+    Writes files from a thread of its own, so a slow or stalling disk doesn't hold up the pipeline.
+
+	Copyright 2017-2019 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+*/
+
+#include "CAsyncFileWriter.h"
+
+#include <gio/gio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <algorithm>
+
+#ifdef WIN32
+#include <io.h>
+#include <malloc.h>
+#else
+#include <unistd.h>
+#include <stdlib.h>
+#endif
+
+using namespace std;
+
+// Chunks start on a page, so the kernel can hand them to the disk without shuffling them about.
+static const size_t chunkAlignment = 4096;
+
+static guint8* aligned_alloc_chunk(size_t size)
+{
+#ifdef WIN32
+	return (guint8*)_aligned_malloc(size, chunkAlignment);
+#else
+	void *memory = NULL;
+	if (posix_memalign(&memory, chunkAlignment, size) != 0)
+		return NULL;
+	return (guint8*)memory;
+#endif
+}
+
+static void aligned_free_chunk(guint8 *chunk)
+{
+#ifdef WIN32
+	_aligned_free(chunk);
+#else
+	free(chunk);
+#endif
+}
+
+FileWriterStats::FileWriterStats()
+{
+	bytesWritten = 0;
+	throughput = 0;
+	pendingBytes = 0;
+	freeSpace = 0;
+	longestWrite = 0;
+	stalls = 0;
+}
+
+CAsyncFileWriter::CAsyncFileWriter(size_t chunkSize, guint64 maxPending, int syncIntervalMs, guint64 preallocate)
+{
+	// round up to whole pages, and always queue at least two chunks' worth, or Write() would wait on every chunk.
+	m_chunkSize = max(chunkAlignment, ((chunkSize + chunkAlignment - 1) / chunkAlignment) * chunkAlignment);
+	m_maxPending = max(maxPending, (guint64)m_chunkSize * 2);
+	m_syncIntervalMs = syncIntervalMs;
+	m_preallocate = preallocate;
+
+	m_chunk = NULL;
+	m_chunkUsed = 0;
+	m_pendingBytes = 0;
+	m_isStopping = false;
+	m_isFlushing = false;
+	m_error = "";
+
+	m_statsIntervalMs = 0;
+	m_lastReportBytes = 0;
+	m_lastReportTime = g_get_monotonic_time();
+
+	m_fd = -1;
+	m_location = "";
+	m_position = 0;
+	m_fileSize = 0;
+	m_lastSyncTime = 0;
+
+	m_thread = thread(&CAsyncFileWriter::writer_thread, this);
+}
+
+CAsyncFileWriter::~CAsyncFileWriter()
+{
+	{
+		lock_guard<mutex> lock(m_lock);
+		queue_chunk();
+		m_isStopping = true;
+	}
+	m_wakeWriter.notify_all();
+	if (m_thread.joinable())
+		m_thread.join();
+
+	close_file();
+	if (m_chunk != NULL)
+		aligned_free_chunk(m_chunk);
+	for (size_t i = 0; i < m_freeChunks.size(); i++)
+		aligned_free_chunk(m_freeChunks[i]);
+}
+
+void CAsyncFileWriter::SetOnStats(int intervalMs, function<void(const FileWriterStats&)> onStats)
+{
+	lock_guard<mutex> lock(m_lock);
+	m_statsIntervalMs = intervalMs;
+	m_onStats = onStats;
+	m_wakeWriter.notify_all();
+}
+
+void CAsyncFileWriter::SetFlushing(bool isFlushing)
+{
+	lock_guard<mutex> lock(m_lock);
+	m_isFlushing = isFlushing;
+	m_wakeProducer.notify_all();
+}
+
+bool CAsyncFileWriter::HasFailed(string &error)
+{
+	lock_guard<mutex> lock(m_lock);
+	error = m_error;
+	return m_error != "";
+}
+
+// Call with m_lock held.
+guint8* CAsyncFileWriter::new_chunk()
+{
+	if (m_freeChunks.empty() == false)
+	{
+		guint8 *chunk = m_freeChunks.back();
+		m_freeChunks.pop_back();
+		return chunk;
+	}
+	return aligned_alloc_chunk(m_chunkSize);
+}
+
+// Hand the chunk being filled to the I/O thread, full or not. Call with m_lock held.
+void CAsyncFileWriter::queue_chunk()
+{
+	if (m_chunk == NULL || m_chunkUsed == 0)
+		return;
+
+	Task task;
+	task.type = Task_Write;
+	task.data = m_chunk;
+	task.size = m_chunkUsed;
+	task.offset = 0;
+	m_tasks.push_back(task);
+	m_chunk = NULL;
+	m_chunkUsed = 0;
+	m_wakeWriter.notify_all();
+}
+
+void CAsyncFileWriter::Open(const string &location)
+{
+	lock_guard<mutex> lock(m_lock);
+	queue_chunk();
+	Task task;
+	task.type = Task_Open;
+	task.location = location;
+	task.data = NULL;
+	task.size = 0;
+	task.offset = 0;
+	m_tasks.push_back(task);
+	m_wakeWriter.notify_all();
+}
+
+void CAsyncFileWriter::Seek(guint64 offset)
+{
+	lock_guard<mutex> lock(m_lock);
+	queue_chunk();
+	Task task;
+	task.type = Task_Seek;
+	task.data = NULL;
+	task.size = 0;
+	task.offset = offset;
+	m_tasks.push_back(task);
+	m_wakeWriter.notify_all();
+}
+
+void CAsyncFileWriter::Close()
+{
+	lock_guard<mutex> lock(m_lock);
+	queue_chunk();
+	Task task;
+	task.type = Task_Close;
+	task.data = NULL;
+	task.size = 0;
+	task.offset = 0;
+	m_tasks.push_back(task);
+	m_wakeWriter.notify_all();
+}
+
+bool CAsyncFileWriter::Write(const guint8 *data, size_t size)
+{
+	unique_lock<mutex> lock(m_lock);
+	while (size > 0)
+	{
+		if (m_error != "" || m_isFlushing == true)
+			return false;
+
+		if (m_chunk == NULL)
+		{
+			m_chunk = new_chunk();
+			m_chunkUsed = 0;
+			if (m_chunk == NULL)
+			{
+				m_error = "Out of memory for write buffers.";
+				return false;
+			}
+		}
+
+		size_t count = min(size, m_chunkSize - m_chunkUsed);
+		memcpy(m_chunk + m_chunkUsed, data, count);
+		m_chunkUsed += count;
+		m_pendingBytes += count;
+		data += count;
+		size -= count;
+		if (m_chunkUsed == m_chunkSize)
+			queue_chunk();
+
+		// the disk has fallen behind by more than we're willing to hold. Only now does the pipeline feel it.
+		if (m_pendingBytes > m_maxPending)
+		{
+			m_stats.stalls++;
+			m_wakeProducer.wait(lock, [this] { return m_pendingBytes <= m_maxPending || m_isFlushing == true || m_error != ""; });
+		}
+	}
+	return m_error == "";
+}
+
+void CAsyncFileWriter::fail(const string &error)
+{
+	cerr << error << endl;
+	lock_guard<mutex> lock(m_lock);
+	if (m_error == "")
+		m_error = error;
+	m_wakeProducer.notify_all();
+}
+
+void CAsyncFileWriter::writer_thread()
+{
+	unique_lock<mutex> lock(m_lock);
+	while (true)
+	{
+		gint64 now = g_get_monotonic_time();
+		if (m_statsIntervalMs > 0 && now - m_lastReportTime >= (gint64)m_statsIntervalMs * 1000)
+		{
+			FileWriterStats stats = m_stats;
+			double seconds = (now - m_lastReportTime) / 1000000.0;
+			stats.location = m_location;
+			stats.throughput = (stats.bytesWritten - m_lastReportBytes) / seconds;
+			stats.pendingBytes = m_pendingBytes;
+			m_lastReportBytes = m_stats.bytesWritten;
+			m_lastReportTime = now;
+			m_stats.longestWrite = 0;
+			function<void(const FileWriterStats&)> onStats = m_onStats;
+
+			lock.unlock();
+			report(stats, onStats);
+			lock.lock();
+			continue;
+		}
+
+		if (m_tasks.empty())
+		{
+			if (m_isStopping == true)
+				break;
+			if (m_statsIntervalMs > 0)
+				m_wakeWriter.wait_for(lock, chrono::microseconds(m_lastReportTime + (gint64)m_statsIntervalMs * 1000 - now));
+			else
+				m_wakeWriter.wait(lock);
+			continue;
+		}
+
+		Task task = m_tasks.front();
+		m_tasks.pop_front();
+		bool isFailed = m_error != "";
+
+		lock.unlock();
+		gint64 writeTime = 0;
+		if (isFailed == false || task.type == Task_Close)
+			writeTime = run_task(task);
+		lock.lock();
+
+		if (task.type == Task_Write)
+		{
+			if (isFailed == false && m_error == "")
+				m_stats.bytesWritten += task.size;
+			m_stats.longestWrite = max(m_stats.longestWrite, writeTime);
+			m_pendingBytes -= task.size;
+			m_freeChunks.push_back(task.data);
+			m_wakeProducer.notify_all();
+		}
+	}
+}
+
+// Returns how long it took, in us.
+gint64 CAsyncFileWriter::run_task(Task &task)
+{
+	gint64 start = g_get_monotonic_time();
+	switch (task.type)
+	{
+	case Task_Open:
+		close_file();
+		open_file(task.location);
+		break;
+	case Task_Close:
+		close_file();
+		break;
+	case Task_Seek:
+		if (m_fd < 0)
+			break;
+#ifdef WIN32
+		if (_lseeki64(m_fd, task.offset, SEEK_SET) < 0)
+#else
+		if (lseek(m_fd, (off_t)task.offset, SEEK_SET) < 0)
+#endif
+			fail("Could not seek in " + m_location + ": " + strerror(errno));
+		else
+			m_position = task.offset;
+		break;
+	case Task_Write:
+	{
+		if (m_fd < 0)
+		{
+			fail("Asked to write with no file open.");
+			break;
+		}
+		size_t done = 0;
+		while (done < task.size)
+		{
+#ifdef WIN32
+			int count = _write(m_fd, task.data + done, (unsigned int)(task.size - done));
+#else
+			ssize_t count = write(m_fd, task.data + done, task.size - done);
+#endif
+			if (count < 0 && errno == EINTR)
+				continue;
+			if (count < 0)
+			{
+				fail("Could not write to " + m_location + ": " + strerror(errno));
+				break;
+			}
+			done += count;
+		}
+		m_position += done;
+		m_fileSize = max(m_fileSize, m_position);
+
+		if (m_syncIntervalMs > 0 && g_get_monotonic_time() - m_lastSyncTime >= (gint64)m_syncIntervalMs * 1000)
+			sync_file();
+		break;
+	}
+	}
+	return g_get_monotonic_time() - start;
+}
+
+void CAsyncFileWriter::open_file(const string &location)
+{
+#ifdef WIN32
+	m_fd = _open(location.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+	m_fd = open(location.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+	if (m_fd < 0)
+	{
+		fail("Could not open " + location + " for writing: " + strerror(errno));
+		return;
+	}
+
+	{
+		lock_guard<mutex> lock(m_lock);
+		m_location = location;
+	}
+	m_position = 0;
+	m_fileSize = 0;
+	m_lastSyncTime = g_get_monotonic_time();
+
+#ifdef __linux__
+	// Not every file system can (eg: FAT on a USB stick). It's only a hint, so carry on without.
+	if (m_preallocate > 0 && fallocate(m_fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)m_preallocate) != 0)
+		cout << "Could not preallocate " << location << ": " << strerror(errno) << endl;
+#endif
+}
+
+void CAsyncFileWriter::sync_file()
+{
+	if (m_fd < 0)
+		return;
+#ifdef WIN32
+	_commit(m_fd);
+#elif defined(__linux__)
+	fdatasync(m_fd);
+#else
+	fsync(m_fd);
+#endif
+	m_lastSyncTime = g_get_monotonic_time();
+}
+
+void CAsyncFileWriter::close_file()
+{
+	if (m_fd < 0)
+		return;
+
+#ifdef __linux__
+	// give back what was preallocated and not used
+	if (m_preallocate > 0 && m_fileSize < m_preallocate && ftruncate(m_fd, (off_t)m_fileSize) != 0)
+		cout << "Could not trim " << m_location << ": " << strerror(errno) << endl;
+#endif
+	if (m_syncIntervalMs >= 0)
+		sync_file();
+#ifdef WIN32
+	_close(m_fd);
+#else
+	close(m_fd);
+#endif
+	m_fd = -1;
+}
+
+void CAsyncFileWriter::report(FileWriterStats &stats, const function<void(const FileWriterStats&)> &onStats)
+{
+	if (stats.location != "")
+	{
+		GFile *file = g_file_new_for_path(stats.location.c_str());
+		GFileInfo *info = g_file_query_filesystem_info(file, G_FILE_ATTRIBUTE_FILESYSTEM_FREE, NULL, NULL);
+		if (info != NULL)
+		{
+			stats.freeSpace = g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_FILESYSTEM_FREE);
+			g_object_unref(info);
+		}
+		g_object_unref(file);
+	}
+
+	if (onStats)
+		onStats(stats);
+}
@@ -0,0 +1,123 @@
+/*  CAsyncFileWriter.h: header file for CAsyncFileWriter Class.
+    Writes files from a thread of its own, so a slow or stalling disk doesn't hold up the pipeline.
+
+	Copyright 2017 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+*/
+
+#pragma once
+
+#include <glib.h>
+#include <string>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// ******* FileWriterStats *******
+// A snapshot for CAsyncFileWriter's onStats callback.
+struct FileWriterStats
+{
+	std::string location;  // the file being written (the last one, between files)
+	guint64 bytesWritten;  // since the writer was made, all files together
+	double throughput;     // bytes per second written since the last report
+	guint64 pendingBytes;  // handed to Write() but not on its way to the disk yet
+	guint64 freeSpace;     // bytes free on the file's file system, 0 if unknown
+	gint64 longestWrite;   // the slowest single write since the last report, in us
+	guint64 stalls;        // times Write() had to wait for the disk to catch up, since the writer was made
+
+	FileWriterStats();
+};
+
+// ******* CAsyncFileWriter *******
+// Write() only copies into a chunk of memory. Whole chunks (aligned, buffer-size bytes) go to the I/O thread, which does the
+// open/write/seek/close, in the order they were asked for. Nothing but Write() waits, and it only does when more than maxPending bytes are queued.
+// syncIntervalMs: >0 fdatasync that often while writing, 0 only when each file is closed, -1 never (leave it to the OS).
+// preallocate: reserve this many bytes for each file when it's opened (Linux, fallocate), so the file system can keep it in one piece.
+class CAsyncFileWriter
+{
+public:
+	CAsyncFileWriter(size_t chunkSize, guint64 maxPending, int syncIntervalMs, guint64 preallocate);
+	~CAsyncFileWriter(); // writes everything still queued, and closes the file
+	CAsyncFileWriter(const CAsyncFileWriter&) = delete;
+	CAsyncFileWriter& operator=(const CAsyncFileWriter&) = delete;
+
+	void Open(const std::string &location);
+	bool Write(const guint8 *data, size_t size); // false if the writer has failed (see HasFailed()) or is flushing
+	void Seek(guint64 offset);
+	void Close();
+	// While flushing, Write() doesn't wait for room (for GstBaseSink's unlock()).
+	void SetFlushing(bool isFlushing);
+	bool HasFailed(std::string &error);
+	// onStats is called from the I/O thread every intervalMs (0 = never).
+	void SetOnStats(int intervalMs, std::function<void(const FileWriterStats&)> onStats);
+
+private:
+	enum TaskType { Task_Open, Task_Write, Task_Seek, Task_Close };
+	struct Task
+	{
+		TaskType type;
+		std::string location;
+		guint8 *data;
+		size_t size;
+		guint64 offset;
+	};
+
+	size_t m_chunkSize;
+	guint64 m_maxPending;
+	int m_syncIntervalMs;
+	guint64 m_preallocate;
+
+	std::mutex m_lock;
+	std::condition_variable m_wakeWriter;
+	std::condition_variable m_wakeProducer;
+	std::deque<Task> m_tasks;
+	std::vector<guint8*> m_freeChunks;
+	guint8 *m_chunk; // being filled by Write()
+	size_t m_chunkUsed;
+	guint64 m_pendingBytes;
+	bool m_isStopping;
+	bool m_isFlushing;
+	std::string m_error;
+	std::thread m_thread;
+
+	int m_statsIntervalMs;
+	std::function<void(const FileWriterStats&)> m_onStats;
+	FileWriterStats m_stats;
+	guint64 m_lastReportBytes;
+	gint64 m_lastReportTime;
+
+	// only used by the I/O thread
+	int m_fd;
+	std::string m_location; // also read by the reports, under m_lock
+	guint64 m_position;
+	guint64 m_fileSize;
+	gint64 m_lastSyncTime;
+
+	void queue_chunk();
+	guint8* new_chunk();
+	void writer_thread();
+	gint64 run_task(Task &task);
+	void open_file(const std::string &location);
+	void close_file();
+	void sync_file();
+	void report(FileWriterStats &stats, const std::function<void(const FileWriterStats&)> &onStats);
+	void fail(const std::string &error);
+};
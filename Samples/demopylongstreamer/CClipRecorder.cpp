@@ -0,0 +1,299 @@
+/*  CClipRecorder.cpp: Definition file for CClipRecorder Class.
+    Keeps the last seconds of an encoded stream in memory, and writes them out as a clip (with what follows) when something happens.
+
+	Copyright 2017-2019 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+*/
+
+#include "CClipRecorder.h"
+
+#include <iostream>
+#include <ctime>
+#include <stdio.h>
+#include <algorithm>
+
+using namespace std;
+
+CClipRecorder::CClipRecorder(GstElement *appsink, const string &folder, double prerollSeconds, double postrollSeconds, int tzOffset, guint64 maxBytes)
+{
+	m_appsink = GST_ELEMENT(gst_object_ref(appsink));
+	m_folder = folder;
+	m_preroll = (GstClockTime)(prerollSeconds * GST_SECOND);
+	m_postroll = (GstClockTime)(postrollSeconds * GST_SECOND);
+	m_tzOffset = tzOffset;
+	m_maxBytes = maxBytes;
+	m_ringBytes = 0;
+	m_caps = NULL;
+	m_newestPts = GST_CLOCK_TIME_NONE;
+	m_clipPipeline = NULL;
+	m_clipSource = NULL;
+	m_clipStart = 0;
+	m_clipEnd = 0;
+	m_isFinisherStopping = false;
+	m_finisher = std::thread(&CClipRecorder::finisher_thread, this);
+
+	// The encoded stream is taken as it comes, from the streaming thread. No clock: the appsink is the end of the line, and nothing is shown.
+	g_object_set(G_OBJECT(m_appsink), "sync", FALSE, "max-buffers", 0, "drop", FALSE, NULL);
+	GstAppSinkCallbacks callbacks = { NULL, NULL, cb_new_sample };
+	gst_app_sink_set_callbacks(GST_APP_SINK(m_appsink), &callbacks, this, NULL);
+}
+
+// After the pipeline has stopped.
+CClipRecorder::~CClipRecorder()
+{
+	GstAppSinkCallbacks callbacks = { NULL, NULL, NULL };
+	gst_app_sink_set_callbacks(GST_APP_SINK(m_appsink), &callbacks, NULL, NULL);
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		// a clip cut short is still a clip
+		if (m_clipPipeline != NULL)
+			end_clip();
+		for (size_t i = 0; i < m_ring.size(); i++)
+			gst_buffer_unref(m_ring[i].buffer);
+		m_ring.clear();
+		if (m_caps != NULL)
+			gst_caps_unref(m_caps);
+	}
+	// (once the clips still finishing are done)
+	{
+		std::lock_guard<std::mutex> lock(m_finishLock);
+		m_isFinisherStopping = true;
+	}
+	m_wakeFinisher.notify_all();
+	m_finisher.join();
+	gst_object_unref(m_appsink);
+}
+
+bool CClipRecorder::Trigger(double postrollSeconds)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	GstClockTime postroll = (postrollSeconds >= 0) ? (GstClockTime)(postrollSeconds * GST_SECOND) : m_postroll;
+	if (m_ring.empty() == true || m_caps == NULL)
+	{
+		cout << "Nothing to record yet (waiting for the first keyframe)." << endl;
+		return false;
+	}
+
+	if (m_clipPipeline != NULL)
+	{
+		m_clipEnd = max(m_clipEnd, m_newestPts + postroll);
+		cout << "Clip " << m_clipFile << " will go on for " << (double)postroll / GST_SECOND << " s more." << endl;
+		return true;
+	}
+
+	m_clipEnd = m_newestPts + postroll;
+	return start_clip();
+}
+
+bool CClipRecorder::Stop()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (m_clipPipeline == NULL)
+		return false;
+	m_clipEnd = m_newestPts;
+	cout << "Clip " << m_clipFile << " ends here." << endl;
+	return true;
+}
+
+bool CClipRecorder::IsRecording()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_clipPipeline != NULL;
+}
+
+GstFlowReturn CClipRecorder::cb_new_sample(GstAppSink *appsink, gpointer user_data)
+{
+	CClipRecorder *pRecorder = (CClipRecorder*)user_data;
+	GstSample *sample = gst_app_sink_pull_sample(appsink);
+	if (sample == NULL)
+		return GST_FLOW_OK;
+	GstFlowReturn result = pRecorder->on_sample(sample);
+	gst_sample_unref(sample);
+	return result;
+}
+
+GstFlowReturn CClipRecorder::on_sample(GstSample *sample)
+{
+	GstBuffer *buffer = gst_sample_get_buffer(sample);
+	GstCaps *caps = gst_sample_get_caps(sample);
+	if (buffer == NULL || GST_BUFFER_PTS_IS_VALID(buffer) == false)
+		return GST_FLOW_OK;
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (caps != NULL && (m_caps == NULL || gst_caps_is_equal(caps, m_caps) == FALSE))
+		gst_caps_replace(&m_caps, caps);
+
+	RingEntry entry;
+	entry.buffer = gst_buffer_ref(buffer);
+	entry.isKeyframe = GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT) == FALSE;
+	m_ring.push_back(entry);
+	m_ringBytes += gst_buffer_get_size(buffer);
+	m_newestPts = GST_BUFFER_PTS(buffer);
+	trim_ring();
+
+	if (m_clipPipeline != NULL)
+	{
+		push_to_clip(buffer);
+		if (m_newestPts >= m_clipEnd)
+			end_clip();
+	}
+	return GST_FLOW_OK;
+}
+
+// Keep the ring to the preroll: it starts at the last keyframe at least prerollSeconds old (or the first one, until there's that much),
+// so a clip begins with something decodable and at least the preroll before the trigger. The memory limit cuts it shorter if need be.
+void CClipRecorder::trim_ring()
+{
+	while (m_ring.empty() == false && m_ring.front().isKeyframe == false)
+	{
+		m_ringBytes -= gst_buffer_get_size(m_ring.front().buffer);
+		gst_buffer_unref(m_ring.front().buffer);
+		m_ring.pop_front();
+	}
+
+	while (m_ring.empty() == false)
+	{
+		size_t nextKeyframe = 1;
+		while (nextKeyframe < m_ring.size() && m_ring[nextKeyframe].isKeyframe == false)
+			nextKeyframe++;
+		if (nextKeyframe >= m_ring.size())
+			break;
+
+		bool isOld = GST_BUFFER_PTS(m_ring[nextKeyframe].buffer) + m_preroll <= m_newestPts;
+		bool isFull = m_ringBytes > m_maxBytes;
+		if (isOld == false && isFull == false)
+			break;
+
+		for (size_t i = 0; i < nextKeyframe; i++)
+		{
+			m_ringBytes -= gst_buffer_get_size(m_ring.front().buffer);
+			gst_buffer_unref(m_ring.front().buffer);
+			m_ring.pop_front();
+		}
+	}
+}
+
+// With milliseconds: clips back to back can start within the same second.
+string CClipRecorder::clip_name()
+{
+	gint64 nowUs = g_get_real_time();
+	time_t now = (time_t)(nowUs / G_USEC_PER_SEC) + m_tzOffset * 3600;
+	char stamp[32];
+	strftime(stamp, sizeof(stamp), "%y.%m.%d_%H.%M.%S", gmtime(&now));
+	char milliseconds[8];
+	snprintf(milliseconds, sizeof(milliseconds), ".%03d", (int)((nowUs / 1000) % 1000));
+	return m_folder + "/" + stamp + milliseconds + "_clip.mp4";
+}
+
+// With the lock held: make the clip's pipeline, and give it the whole ring.
+bool CClipRecorder::start_clip()
+{
+	// the parser for what the encoder makes (${codec}, see CEncoderFactory)
+	const gchar *format = gst_structure_get_name(gst_caps_get_structure(m_caps, 0));
+	string parser = (g_strcmp0(format, "video/x-h265") == 0) ? "h265parse" : "h264parse";
+
+	GError *error = NULL;
+	GstElement *pipeline = gst_parse_launch(("appsrc name=clipsrc format=time ! " + parser + " ! mp4mux ! filesink name=clipfile").c_str(), &error);
+	if (error != NULL)
+	{
+		cout << "Could not make the clip pipeline: " << error->message << endl;
+		g_error_free(error);
+		if (pipeline != NULL)
+			gst_object_unref(pipeline);
+		return false;
+	}
+
+	m_clipFile = clip_name();
+	m_clipPipeline = pipeline;
+	m_clipSource = gst_bin_get_by_name(GST_BIN(m_clipPipeline), "clipsrc");
+	GstElement *fileSink = gst_bin_get_by_name(GST_BIN(m_clipPipeline), "clipfile");
+	g_object_set(G_OBJECT(fileSink), "location", m_clipFile.c_str(), NULL);
+	gst_object_unref(fileSink);
+	// the preroll goes in all at once, so let the AppSrc queue all of it
+	g_object_set(G_OBJECT(m_clipSource), "caps", m_caps, "max-bytes", (guint64)(2 * m_maxBytes), NULL);
+	gst_element_set_state(m_clipPipeline, GST_STATE_PLAYING);
+
+	// the clip starts at 0
+	GstBuffer *first = m_ring.front().buffer;
+	m_clipStart = GST_BUFFER_DTS_IS_VALID(first) ? min(GST_BUFFER_DTS(first), GST_BUFFER_PTS(first)) : GST_BUFFER_PTS(first);
+
+	cout << "Recording clip " << m_clipFile << " (from " << (double)(m_newestPts - GST_BUFFER_PTS(first)) / GST_SECOND << " s ago)" << endl;
+	for (size_t i = 0; i < m_ring.size(); i++)
+		push_to_clip(m_ring[i].buffer);
+	return true;
+}
+
+void CClipRecorder::push_to_clip(GstBuffer *buffer)
+{
+	// a shallow copy: the encoded data is shared with the ring, only the timestamps are the clip's own.
+	GstBuffer *clipBuffer = gst_buffer_copy(buffer);
+	if (GST_BUFFER_PTS_IS_VALID(clipBuffer))
+		GST_BUFFER_PTS(clipBuffer) = (GST_BUFFER_PTS(clipBuffer) > m_clipStart) ? GST_BUFFER_PTS(clipBuffer) - m_clipStart : 0;
+	if (GST_BUFFER_DTS_IS_VALID(clipBuffer))
+		GST_BUFFER_DTS(clipBuffer) = (GST_BUFFER_DTS(clipBuffer) > m_clipStart) ? GST_BUFFER_DTS(clipBuffer) - m_clipStart : 0;
+	gst_app_src_push_buffer(GST_APP_SRC(m_clipSource), clipBuffer);
+}
+
+// With the lock held: end the clip. mp4mux writes the file's index at EOS, which can take a moment, so the clip's pipeline is handed to the finisher thread.
+// Nothing here waits: this is the encoder's streaming thread, which the display shares through the tee.
+void CClipRecorder::end_clip()
+{
+	gst_app_src_end_of_stream(GST_APP_SRC(m_clipSource));
+	gst_object_unref(m_clipSource);
+	FinishingClip clip;
+	clip.pipeline = m_clipPipeline;
+	clip.file = m_clipFile;
+	m_clipPipeline = NULL;
+	m_clipSource = NULL;
+
+	{
+		std::lock_guard<std::mutex> lock(m_finishLock);
+		m_finishing.push_back(clip);
+	}
+	m_wakeFinisher.notify_all();
+}
+
+// For the recorder's life: waits for each finished clip's pipeline to have written its file, then lets go of it.
+void CClipRecorder::finisher_thread()
+{
+	std::unique_lock<std::mutex> lock(m_finishLock);
+	while (true)
+	{
+		m_wakeFinisher.wait(lock, [this] { return m_finishing.empty() == false || m_isFinisherStopping == true; });
+		if (m_finishing.empty() == true)
+			break;
+		FinishingClip clip = m_finishing.front();
+		m_finishing.pop_front();
+		lock.unlock();
+
+		GstBus *bus = gst_element_get_bus(clip.pipeline);
+		GstMessage *message = gst_bus_timed_pop_filtered(bus, 10 * GST_SECOND, (GstMessageType)(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+		if (message != NULL && GST_MESSAGE_TYPE(message) == GST_MESSAGE_EOS)
+			cout << "Clip saved: " << clip.file << endl;
+		else
+			cout << "Clip " << clip.file << " may be incomplete." << endl;
+		if (message != NULL)
+			gst_message_unref(message);
+		gst_object_unref(bus);
+		gst_element_set_state(clip.pipeline, GST_STATE_NULL);
+		gst_object_unref(clip.pipeline);
+
+		lock.lock();
+	}
+}
@@ -0,0 +1,102 @@
+/*  CClipRecorder.h: header file for CClipRecorder Class.
+    Keeps the last seconds of an encoded stream in memory, and writes them out as a clip (with what follows) when something happens.
+
+	Copyright 2017 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+*/
+
+#pragma once
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <string>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+// ******* CClipRecorder *******
+// Records clips instead of everything. The pipeline ends in an appsink with H.264 or H.265 (byte-stream, one access unit per buffer, SPS/PPS with each keyframe), eg:
+//   ... ! ${encoder} ! h264parse config-interval=-1 ! video/x-h264,stream-format=byte-stream,alignment=au ! appsink name=clipsink
+// The last prerollSeconds of it are kept in memory, starting from a keyframe so a clip can always be decoded from its first frame.
+// Trigger() writes them to a new mp4 file, followed by the next postrollSeconds. Triggering again while a clip is being written makes it longer.
+// Nothing is written to the disk in between.
+class CClipRecorder
+{
+public:
+	// folder: where the clips go, named for the time they were triggered. tzOffset: hours added to UTC in the names.
+	// maxBytes: the most the ring holds, whatever prerollSeconds says (eg: at a high bitrate).
+	CClipRecorder(GstElement *appsink, const std::string &folder, double prerollSeconds, double postrollSeconds, int tzOffset = 0, guint64 maxBytes = 64 * 1024 * 1024);
+	~CClipRecorder();
+	CClipRecorder(const CClipRecorder&) = delete;
+	CClipRecorder& operator=(const CClipRecorder&) = delete;
+
+	// Start a clip (or make the one being written longer). postrollSeconds: how long after now, -1 = as set in the constructor.
+	bool Trigger(double postrollSeconds = -1);
+	// End the clip being written with the next buffer, however much postroll it had left. False if there's none.
+	bool Stop();
+	bool IsRecording();
+
+private:
+	struct RingEntry
+	{
+		GstBuffer *buffer;
+		bool isKeyframe;
+	};
+	// a clip's pipeline after its EOS, until mp4mux has written the index
+	struct FinishingClip
+	{
+		GstElement *pipeline;
+		std::string file;
+	};
+
+	std::mutex m_lock;
+	GstElement *m_appsink;
+	std::string m_folder;
+	GstClockTime m_preroll;
+	GstClockTime m_postroll;
+	int m_tzOffset;
+	guint64 m_maxBytes;
+	std::deque<RingEntry> m_ring;
+	guint64 m_ringBytes;
+	GstCaps *m_caps;
+	GstClockTime m_newestPts;
+
+	// the clip being written: its own little pipeline (appsrc ! h264parse or h265parse ! mp4mux ! filesink)
+	GstElement *m_clipPipeline;
+	GstElement *m_clipSource;
+	std::string m_clipFile;
+	GstClockTime m_clipStart; // the first buffer's PTS, which becomes 0 in the clip
+	GstClockTime m_clipEnd;
+	// The finished clips' pipelines are waited for here, one after the other, rather than on the streaming thread.
+	std::thread m_finisher;
+	std::mutex m_finishLock;
+	std::condition_variable m_wakeFinisher;
+	std::deque<FinishingClip> m_finishing;
+	bool m_isFinisherStopping;
+
+	static GstFlowReturn cb_new_sample(GstAppSink *appsink, gpointer user_data);
+	GstFlowReturn on_sample(GstSample *sample);
+	void trim_ring();
+	bool start_clip();
+	void push_to_clip(GstBuffer *buffer);
+	void end_clip();
+	void finisher_thread();
+	std::string clip_name();
+};
@@ -0,0 +1,410 @@
+/*  CControlChannel.cpp: Definition file for CControlChannel Class.
+    Takes commands (overlay text, recording, error screens, settings, statistics) from a local socket and the console, on the main loop.
+
+	Copyright 2017-2019 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+*/
+
+#include "CControlChannel.h"
+
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+#include <glib/gstdio.h>
+#ifdef WIN32
+#include <thread>
+#else
+#include <gio/gunixsocketaddress.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+using namespace std;
+
+// the console's replies
+static void print_reply(const string &reply)
+{
+	if (reply != "")
+		cout << reply << endl;
+}
+
+#ifdef WIN32
+// the channel taking the console's lines, on the main loop only (NULL once it's closed)
+static CControlChannel *consoleChannel = NULL;
+#endif
+
+CControlChannel::CControlChannel()
+{
+	m_service = NULL;
+	m_cancellable = g_cancellable_new();
+	m_console = NULL;
+	m_consoleWatch = 0;
+	m_consoleFlags = -1;
+}
+
+CControlChannel::~CControlChannel()
+{
+	Close();
+	g_object_unref(m_cancellable);
+}
+
+void CControlChannel::AddCommand(const string &name, const string &help, ControlCommand command)
+{
+	AddDeferredCommand(name, help, [command](const string &arguments, ControlReply reply)
+	{
+		reply(command(arguments));
+	});
+}
+
+void CControlChannel::AddDeferredCommand(const string &name, const string &help, DeferredControlCommand command)
+{
+	gchar *upper = g_ascii_strup(name.c_str(), -1);
+	m_commands[upper].help = help;
+	m_commands[upper].command = command;
+	g_free(upper);
+}
+
+// a reply on its way to the main loop
+struct SLaterReply
+{
+	ControlReply reply;
+	string text;
+};
+
+static gboolean cb_reply_later(gpointer user_data)
+{
+	SLaterReply *pLater = (SLaterReply*)user_data;
+	pLater->reply(pLater->text);
+	delete pLater;
+	return G_SOURCE_REMOVE;
+}
+
+void CControlChannel::ReplyLater(ControlReply reply, const string &text)
+{
+	SLaterReply *pLater = new SLaterReply();
+	pLater->reply = reply;
+	pLater->text = text;
+	g_idle_add(cb_reply_later, pLater);
+}
+
+bool CControlChannel::Listen(const string &address)
+{
+	GSocketAddress *socketAddress = NULL;
+	bool isPort = (address.empty() == false && address.find_first_not_of("0123456789") == string::npos);
+	if (isPort == true)
+	{
+		// only this machine can connect
+		GInetAddress *loopback = g_inet_address_new_loopback(G_SOCKET_FAMILY_IPV4);
+		socketAddress = g_inet_socket_address_new(loopback, (guint16)atoi(address.c_str()));
+		g_object_unref(loopback);
+	}
+	else
+	{
+#ifdef WIN32
+		cout << "On Windows the control channel is a TCP port on 127.0.0.1 (eg: -control 5800), not " << address << "." << endl;
+		return false;
+#else
+		// A socket left behind by a run that didn't end cleanly is in the way. Anything else there is left alone (and bind fails).
+		struct stat status;
+		if (lstat(address.c_str(), &status) == 0 && S_ISSOCK(status.st_mode))
+			g_unlink(address.c_str());
+		socketAddress = g_unix_socket_address_new(address.c_str());
+#endif
+	}
+
+	GError *error = NULL;
+	m_service = g_socket_service_new();
+	if (g_socket_listener_add_address(G_SOCKET_LISTENER(m_service), socketAddress, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT, NULL, NULL, &error) == FALSE)
+	{
+		cout << "Could not listen for commands on " << address << ": " << error->message << endl;
+		g_error_free(error);
+		g_object_unref(socketAddress);
+		g_object_unref(m_service);
+		m_service = NULL;
+		return false;
+	}
+	g_object_unref(socketAddress);
+
+#ifndef WIN32
+	// Commands can stop the pipeline and change the camera: the socket is for this user only.
+	if (isPort == false)
+	{
+		m_socketPath = address;
+		g_chmod(m_socketPath.c_str(), 0600);
+	}
+#endif
+
+	// The service calls back on the main context, the one it was started from.
+	g_signal_connect(m_service, "incoming", G_CALLBACK(cb_incoming), this);
+	g_socket_service_start(m_service);
+	cout << "Listening for commands on " << address << " (HELP lists them)." << endl;
+	return true;
+}
+
+bool CControlChannel::WatchConsole()
+{
+#ifdef WIN32
+	// One thread for the program's life, blocked on the console. Each line it reads is run on the main loop, like the socket's.
+	if (consoleChannel == NULL)
+	{
+		static bool isReading = false;
+		consoleChannel = this;
+		if (isReading == false)
+		{
+			isReading = true;
+			thread reader([]()
+			{
+				string line;
+				while (getline(cin, line))
+					g_idle_add(cb_console_line, new string(line));
+			});
+			reader.detach();
+		}
+	}
+	return true;
+#else
+	if (m_consoleWatch != 0)
+		return true;
+	if (m_console == NULL)
+	{
+		// O_NONBLOCK is on the open file, which stdin shares with the shell (and whatever else runs in the terminal): it's put back as it was in Close().
+		m_consoleFlags = fcntl(STDIN_FILENO, F_GETFL);
+		m_console = g_io_channel_unix_new(STDIN_FILENO);
+		// a line typed halfway (or pasted in pieces) waits in the channel's buffer, instead of the main loop waiting for the rest.
+		g_io_channel_set_flags(m_console, G_IO_FLAG_NONBLOCK, NULL);
+	}
+	m_consoleWatch = g_io_add_watch(m_console, (GIOCondition)(G_IO_IN | G_IO_HUP | G_IO_ERR), cb_console, this);
+	return true;
+#endif
+}
+
+void CControlChannel::Execute(const string &line, ControlReply reply)
+{
+	try
+	{
+		// the name, then the rest of the line as it is
+		size_t begin = line.find_first_not_of(" \t\r\n");
+		if (begin == string::npos)
+		{
+			reply("");
+			return;
+		}
+		size_t end = line.find_first_of(" \t\r\n", begin);
+		string name = line.substr(begin, end - begin);
+		string arguments = "";
+		if (end != string::npos)
+		{
+			size_t argumentsBegin = line.find_first_not_of(" \t", end);
+			size_t argumentsEnd = line.find_last_not_of(" \t\r\n");
+			if (argumentsBegin != string::npos && argumentsEnd != string::npos && argumentsEnd >= argumentsBegin)
+				arguments = line.substr(argumentsBegin, argumentsEnd - argumentsBegin + 1);
+		}
+
+		gchar *upper = g_ascii_strup(name.c_str(), -1);
+		name = upper;
+		g_free(upper);
+		if (name == "HELP")
+		{
+			reply(help());
+			return;
+		}
+		map<string, Command>::iterator command = m_commands.find(name);
+		if (command == m_commands.end())
+		{
+			reply("error unknown command " + name + " (HELP lists them)");
+			return;
+		}
+		command->second.command(arguments, reply);
+	}
+	catch (std::exception &e)
+	{
+		// (a command throws before it replies)
+		cerr << "An exception occurred in Execute(): " << endl << e.what() << endl;
+		reply(string("error ") + e.what());
+	}
+}
+
+void CControlChannel::Close()
+{
+	if (m_service != NULL)
+	{
+		g_socket_service_stop(m_service);
+		g_socket_listener_close(G_SOCKET_LISTENER(m_service));
+		g_object_unref(m_service);
+		m_service = NULL;
+	}
+	if (m_socketPath != "")
+	{
+		g_unlink(m_socketPath.c_str());
+		m_socketPath = "";
+	}
+
+	// The clients' reads and writes finish with G_IO_ERROR_CANCELLED, and each frees its own client then (one waiting on a command frees itself when the reply comes). They don't touch the channel again.
+	g_cancellable_cancel(m_cancellable);
+	m_clients.clear();
+
+#ifdef WIN32
+	if (consoleChannel == this)
+		consoleChannel = NULL;
+#else
+	if (m_consoleWatch != 0)
+	{
+		g_source_remove(m_consoleWatch);
+		m_consoleWatch = 0;
+	}
+	if (m_console != NULL)
+	{
+		g_io_channel_unref(m_console);
+		m_console = NULL;
+		if (m_consoleFlags != -1)
+			fcntl(STDIN_FILENO, F_SETFL, m_consoleFlags);
+		m_consoleFlags = -1;
+	}
+#endif
+}
+
+string CControlChannel::help()
+{
+	// one line, like every other reply
+	stringstream help;
+	help << "ok";
+	for (map<string, Command>::iterator command = m_commands.begin(); command != m_commands.end(); command++)
+		help << (command == m_commands.begin() ? " " : " | ") << command->second.help;
+	return help.str();
+}
+
+void CControlChannel::read_next(Client *pClient)
+{
+	g_data_input_stream_read_line_async(pClient->input, G_PRIORITY_DEFAULT, pClient->cancellable, cb_line, pClient);
+}
+
+void CControlChannel::free_client(Client *pClient)
+{
+	g_object_unref(pClient->input);
+	g_object_unref(pClient->connection);
+	g_object_unref(pClient->cancellable);
+	delete pClient;
+}
+
+gboolean CControlChannel::cb_incoming(GSocketService *service, GSocketConnection *connection, GObject *sourceObject, gpointer user_data)
+{
+	CControlChannel *pChannel = (CControlChannel*)user_data;
+	Client *pClient = new Client();
+	pClient->pChannel = pChannel;
+	pClient->connection = G_SOCKET_CONNECTION(g_object_ref(connection));
+	pClient->input = g_data_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+	g_data_input_stream_set_newline_type(pClient->input, G_DATA_STREAM_NEWLINE_TYPE_ANY);
+	pClient->output = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+	pClient->cancellable = G_CANCELLABLE(g_object_ref(pChannel->m_cancellable));
+	pChannel->m_clients.insert(pClient);
+	pChannel->read_next(pClient);
+	return TRUE;
+}
+
+void CControlChannel::cb_line(GObject *source, GAsyncResult *result, gpointer user_data)
+{
+	Client *pClient = (Client*)user_data;
+	GError *error = NULL;
+	gchar *line = g_data_input_stream_read_line_finish(pClient->input, result, NULL, &error);
+	g_clear_error(&error);
+
+	// the channel is closed (and maybe gone), the client hung up, or it can't be read
+	bool isCancelled = g_cancellable_is_cancelled(pClient->cancellable) == TRUE;
+	if (line == NULL || isCancelled == true)
+	{
+		if (isCancelled == false)
+			pClient->pChannel->m_clients.erase(pClient);
+		g_free(line);
+		free_client(pClient);
+		return;
+	}
+
+	string command = line;
+	g_free(line);
+	pClient->pChannel->Execute(command, [pClient](const string &reply)
+	{
+		write_reply(pClient, reply);
+	});
+}
+
+// The command's reply, whenever it comes.
+void CControlChannel::write_reply(Client *pClient, const string &reply)
+{
+	// the channel was closed (and maybe is gone) while the command took its time. Close() has let go of the client already.
+	if (g_cancellable_is_cancelled(pClient->cancellable) == TRUE)
+	{
+		free_client(pClient);
+		return;
+	}
+	pClient->reply = reply + "\n";
+	g_output_stream_write_all_async(pClient->output, pClient->reply.data(), pClient->reply.size(), G_PRIORITY_DEFAULT, pClient->cancellable, cb_written, pClient);
+}
+
+void CControlChannel::cb_written(GObject *source, GAsyncResult *result, gpointer user_data)
+{
+	Client *pClient = (Client*)user_data;
+	GError *error = NULL;
+	gboolean isWritten = g_output_stream_write_all_finish(G_OUTPUT_STREAM(source), result, NULL, &error);
+	g_clear_error(&error);
+
+	bool isCancelled = g_cancellable_is_cancelled(pClient->cancellable) == TRUE;
+	if (isWritten == FALSE || isCancelled == true)
+	{
+		if (isCancelled == false)
+			pClient->pChannel->m_clients.erase(pClient);
+		free_client(pClient);
+		return;
+	}
+	pClient->pChannel->read_next(pClient);
+}
+
+// Every complete line in the console, then back to the main loop. The console closed (eg: run from a service): stop watching it.
+gboolean CControlChannel::cb_console(GIOChannel *source, GIOCondition condition, gpointer user_data)
+{
+	CControlChannel *pChannel = (CControlChannel*)user_data;
+	while (true)
+	{
+		gchar *line = NULL;
+		GIOStatus status = g_io_channel_read_line(source, &line, NULL, NULL, NULL);
+		if (status == G_IO_STATUS_NORMAL)
+		{
+			pChannel->Execute(line, print_reply);
+			g_free(line);
+			continue;
+		}
+		g_free(line);
+		if (status == G_IO_STATUS_AGAIN)
+			return TRUE;
+		pChannel->m_consoleWatch = 0;
+		return FALSE;
+	}
+}
+
+gboolean CControlChannel::cb_console_line(gpointer user_data)
+{
+#ifdef WIN32
+	string *pLine = (string*)user_data;
+	if (consoleChannel != NULL)
+	{
+		consoleChannel->Execute(*pLine, print_reply);
+	}
+	delete pLine;
+#endif
+	return G_SOURCE_REMOVE;
+}
@@ -0,0 +1,105 @@
+/*  CControlChannel.h: header file for CControlChannel Class.
+    Takes commands (overlay text, recording, error screens, settings, statistics) from a local socket and the console, on the main loop.
+
+	Copyright 2017 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+
+*/
+
+#pragma once
+
+#include <gst/gst.h>
+#include <gio/gio.h>
+#include <string>
+#include <map>
+#include <set>
+#include <functional>
+
+// ******* ControlCommand *******
+// What a command does. arguments: the rest of its line (eg: "1920 200 -1 -1 1" for ROI). Returns the reply: "ok", "ok <what>", or "error <why>".
+typedef std::function<std::string(const std::string &arguments)> ControlCommand;
+// Where a command's reply goes (the client, or the console). Call it once, on the main loop.
+typedef std::function<void(const std::string &reply)> ControlReply;
+// A command whose reply is only known later (eg: ROI, once the streaming thread has tried the new AOI). The client waits for it.
+typedef std::function<void(const std::string &arguments, ControlReply reply)> DeferredControlCommand;
+
+// ******* CControlChannel *******
+// A command is one line: its name (eg: MES, CLIP, STATS, in any case), then its arguments. Each gets one line back.
+// They come from:
+//  - clients of a Unix socket (eg: socat - UNIX-CONNECT:/tmp/demopylongstreamer.sock), or on Windows a TCP port on 127.0.0.1. Any number at once.
+//  - the console, as typed
+// Everything is read and run on the main loop (GIO), so commands never race the bus watch, the timers, or each other, and waiting for a line costs no thread.
+// (On Windows the console can't be watched by the main loop. One thread reads it, and hands each line over.)
+class CControlChannel
+{
+public:
+	CControlChannel();
+	~CControlChannel();
+	CControlChannel(const CControlChannel&) = delete;
+	CControlChannel& operator=(const CControlChannel&) = delete;
+
+	// help: one line, shown by HELP (eg: "ROI <width> <height> <offsetX> <offsetY> <binning>: change the AOI").
+	void AddCommand(const std::string &name, const std::string &help, ControlCommand command);
+	void AddDeferredCommand(const std::string &name, const std::string &help, DeferredControlCommand command);
+	// From any thread: reply on the main loop.
+	static void ReplyLater(ControlReply reply, const std::string &text);
+	// address: the path of a Unix socket (a socket left there by an earlier run is replaced), or a TCP port on 127.0.0.1 (eg: 5800).
+	bool Listen(const std::string &address);
+	// Take commands typed in the console too. The replies are printed.
+	bool WatchConsole();
+	// Run one command line, as if it had come in. On the main loop. The reply comes to reply, maybe before this returns ("" for an empty line).
+	void Execute(const std::string &line, ControlReply reply);
+	// Stop listening and reading, and drop the clients.
+	void Close();
+
+private:
+	struct Command
+	{
+		std::string help;
+		DeferredControlCommand command;
+	};
+	// one client of the socket. It's always waiting for exactly one thing: its next line, its command's reply, or the reply to go out.
+	struct Client
+	{
+		CControlChannel *pChannel;
+		GSocketConnection *connection;
+		GDataInputStream *input;
+		GOutputStream *output;
+		GCancellable *cancellable;
+		std::string reply;
+	};
+
+	std::map<std::string, Command> m_commands; // by name, upper case
+	GSocketService *m_service;
+	std::string m_socketPath;
+	GCancellable *m_cancellable;
+	std::set<Client*> m_clients;
+	GIOChannel *m_console;
+	guint m_consoleWatch;
+	int m_consoleFlags; // stdin's file status flags before WatchConsole(), put back by Close()
+
+	std::string help();
+	void read_next(Client *pClient);
+	static void free_client(Client *pClient);
+	static void write_reply(Client *pClient, const std::string &reply);
+	static gboolean cb_incoming(GSocketService *service, GSocketConnection *connection, GObject *sourceObject, gpointer user_data);
+	static void cb_line(GObject *source, GAsyncResult *result, gpointer user_data);
+	static void cb_written(GObject *source, GAsyncResult *result, gpointer user_data);
+	static gboolean cb_console(GIOChannel *source, GIOCondition condition, gpointer user_data);
+	static gboolean cb_console_line(gpointer user_data);
+};
@@ -0,0 +1,272 @@
+/*  CEncoderFactory.cpp: Definition file for CEncoderFactory Class.
+    Picks an H.264/H.265 encoder that this system has, and describes it (with its converter in front) from one set of settings.
+
+	Copyright 2017-2019 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+*/
+
+#include "CEncoderFactory.h"
+
+#include <iostream>
+#include <string.h>
+
+using namespace std;
+
+EncoderSettings::EncoderSettings()
+{
+	codec = "h264";
+	bitrate = 7853000;
+	constantBitrate = true;
+	keyframeInterval = 30;
+	profile = "high";
+	preset = "fast";
+	lowLatency = false;
+}
+
+// The element before the encoder (converting into the encoder's memory), and the encoder.
+static string converter_element(const string &backend)
+{
+	if (backend == "nvv4l2" || backend == "omx")
+		return "nvvidconv";
+	if (backend == "v4l2")
+		return "v4l2convert";
+	if (backend == "vaapi")
+		return "vaapipostproc";
+	return "videoconvert";
+}
+
+static string encoder_element(const string &backend, const string &codec)
+{
+	if (backend == "software")
+		return (codec == "h265") ? "x265enc" : "x264enc";
+	return backend + codec + "enc";
+}
+
+// 0 (ultrafast) to 3 (slow)
+static int preset_index(const string &preset)
+{
+	if (preset == "ultrafast")
+		return 0;
+	if (preset == "medium")
+		return 2;
+	if (preset == "slow")
+		return 3;
+	return 1;
+}
+
+vector<string> CEncoderFactory::GetBackends()
+{
+	vector<string> backends;
+	backends.push_back("nvv4l2");
+	backends.push_back("omx");
+	backends.push_back("v4l2");
+	backends.push_back("vaapi");
+	backends.push_back("software");
+	return backends;
+}
+
+bool CEncoderFactory::IsAvailable(const string &backend, const string &codec)
+{
+	string elements[] = { converter_element(backend), encoder_element(backend, codec) };
+	for (int i = 0; i < 2; i++)
+	{
+		GstElementFactory *factory = gst_element_factory_find(elements[i].c_str());
+		if (factory == NULL)
+			return false;
+		gst_object_unref(factory);
+	}
+	return true;
+}
+
+string CEncoderFactory::FindBackend(const string &codec, const string &preferred)
+{
+	vector<string> backends = GetBackends();
+	if (preferred != "" && preferred != "auto")
+	{
+		bool isKnown = false;
+		for (size_t i = 0; i < backends.size(); i++)
+			isKnown = isKnown || backends[i] == preferred;
+		if (isKnown == false)
+		{
+			cout << "Unknown encoder back end " << preferred << ". Use one of: auto";
+			for (size_t i = 0; i < backends.size(); i++)
+				cout << " " << backends[i];
+			cout << endl;
+			return "";
+		}
+		if (IsAvailable(preferred, codec) == false)
+		{
+			cout << "Encoder back end " << preferred << " needs " << converter_element(preferred) << " and " << encoder_element(preferred, codec) << ", which this system doesn't have." << endl;
+			return "";
+		}
+		return preferred;
+	}
+
+	for (size_t i = 0; i < backends.size(); i++)
+	{
+		if (IsAvailable(backends[i], codec))
+			return backends[i];
+	}
+	cout << "There is no " << codec << " encoder on this system." << endl;
+	return "";
+}
+
+string CEncoderFactory::GetDescription(const string &backend, const EncoderSettings &settings)
+{
+	const string &codec = settings.codec;
+	bool isH264 = (codec != "h265");
+	string bitrate = to_string(settings.bitrate);
+	string kbitrate = to_string(settings.bitrate / 1000);
+	string keyframes = to_string(settings.keyframeInterval);
+	// With intra refresh, the picture is refreshed over keyframeInterval frames instead. Full keyframes are then only for clients which join (CRtspServer asks for one).
+	string refreshKeyframes = to_string(settings.keyframeInterval * 10);
+	int preset = preset_index(settings.preset);
+	// the usual profile_idc order: baseline, main, high
+	int profile = (settings.profile == "baseline") ? 0 : (settings.profile == "main") ? 1 : 2;
+
+	string encoder = encoder_element(backend, codec);
+	string caps = "video/x-" + codec;
+	string description;
+
+	if (backend == "nvv4l2")
+	{
+		// control-rate: 0 variable, 1 constant. preset-level: 1 UltraFast to 4 Slow. h264 profile: 0 Baseline, 2 Main, 4 High.
+		description = "nvvidconv ! video/x-raw(memory:NVMM),format=NV12 ! " + encoder +
+			" control-rate=" + (settings.constantBitrate ? "1" : "0") +
+			" bitrate=" + bitrate +
+			" preset-level=" + to_string(preset + 1) +
+			" insert-sps-pps=true";
+		if (settings.lowLatency)
+			description += " iframeinterval=" + refreshKeyframes + " slice-intrarefresh-interval=" + keyframes + " num-B-Frames=0 maxperf-enable=true";
+		else
+			description += " iframeinterval=" + keyframes;
+		if (isH264)
+			description += " profile=" + to_string(profile * 2);
+	}
+	else if (backend == "omx")
+	{
+		// control-rate: 1 variable, 2 constant. preset-level: 0 UltraFast to 3 Slow. h264 profile: 1 Baseline, 2 Main, 8 High.
+		const char *omxProfiles[] = { "1", "2", "8" };
+		description = "nvvidconv ! video/x-raw(memory:NVMM),format=I420 ! " + encoder +
+			" control-rate=" + (settings.constantBitrate ? "2" : "1") +
+			" bitrate=" + bitrate +
+			" preset-level=" + to_string(preset) +
+			" insert-sps-pps=true";
+		if (settings.lowLatency)
+			description += " iframeinterval=" + refreshKeyframes + " SliceIntraRefreshEnable=true SliceIntraRefreshInterval=" + keyframes;
+		else
+			description += " iframeinterval=" + keyframes;
+		if (isH264)
+			description += string(" profile=") + omxProfiles[profile];
+	}
+	else if (backend == "v4l2")
+	{
+		// The converter's output buffers are exported as DMABUFs and imported by the encoder, instead of copied. V4L2 has no preset.
+		// The Pi's encoder makes no B-frames anyway, and has no intra refresh control, so lowLatency changes nothing here.
+		// video_bitrate_mode: 0 VBR, 1 CBR. h264_profile: 0 Baseline, 2 Main, 4 High.
+		string controls = "controls,video_bitrate=" + bitrate + ",video_bitrate_mode=" + (settings.constantBitrate ? "1" : "0");
+		if (isH264)
+			controls += ",h264_i_frame_period=" + keyframes + ",h264_profile=" + to_string(profile * 2);
+		else
+			controls += ",video_gop_size=" + keyframes;
+		description = "v4l2convert capture-io-mode=dmabuf ! " + encoder + " output-io-mode=dmabuf-import extra-controls=\"" + controls + "\"";
+		// the Pi's encoder won't start without a level
+		if (isH264)
+			caps += ",level=(string)4";
+	}
+	else if (backend == "vaapi")
+	{
+		// quality-level: 1 (best) to 7 (fastest)
+		const char *qualityLevels[] = { "7", "5", "4", "2" };
+		description = "vaapipostproc ! " + encoder +
+			" rate-control=" + (settings.constantBitrate ? "cbr" : "vbr") +
+			" bitrate=" + kbitrate +
+			" keyframe-period=" + keyframes +
+			" quality-level=" + qualityLevels[preset];
+		if (settings.lowLatency)
+			description += " max-bframes=0";
+		caps += ",profile=" + (isH264 ? settings.profile : string("main"));
+	}
+	else if (backend == "software")
+	{
+		// zerolatency: no B-frames, no lookahead, and a frame out for each frame in
+		const char *speedPresets[] = { "ultrafast", "veryfast", "medium", "slow" };
+		description = "videoconvert ! " + encoder +
+			" bitrate=" + kbitrate +
+			" key-int-max=" + (settings.lowLatency ? refreshKeyframes : keyframes) +
+			" speed-preset=" + speedPresets[preset] +
+			" tune=zerolatency";
+		// x265enc has no rate control choice
+		if (isH264)
+			description += string(" pass=") + (settings.constantBitrate ? "cbr" : "qual");
+		if (settings.lowLatency)
+			description += isH264 ? " intra-refresh=true" : " option-string=\"intra-refresh=1\"";
+		caps += ",profile=" + (isH264 ? settings.profile : string("main"));
+	}
+	else
+	{
+		cout << "Unknown encoder back end " << backend << "." << endl;
+		return "";
+	}
+
+	return description + " ! " + caps;
+}
+
+bool CEncoderFactory::SetBitrate(GstElement *encoder, int bitsPerSecond)
+{
+	GstElementFactory *factory = gst_element_get_factory(encoder);
+	if (factory == NULL)
+		return false;
+	string name = GST_OBJECT_NAME(factory);
+
+	// nvv4l2, omx: bits per second. vaapi, x264enc and x265enc: kbit/s. All of them take it while playing.
+	if (name.compare(0, 6, "nvv4l2") == 0 || name.compare(0, 3, "omx") == 0)
+		g_object_set(G_OBJECT(encoder), "bitrate", (guint)bitsPerSecond, NULL);
+	else if (name.compare(0, 5, "vaapi") == 0 || name == "x264enc" || name == "x265enc")
+		g_object_set(G_OBJECT(encoder), "bitrate", (guint)(bitsPerSecond / 1000), NULL);
+	else if (name.compare(0, 4, "v4l2") == 0)
+	{
+		// a V4L2 control, which the element passes straight on to the open device
+		GstStructure *controls = gst_structure_new("controls", "video_bitrate", G_TYPE_INT, bitsPerSecond, NULL);
+		g_object_set(G_OBJECT(encoder), "extra-controls", controls, NULL);
+		gst_structure_free(controls);
+	}
+	else
+		return false;
+	return true;
+}
+
+// Whichever element's klass says it's a video encoder, ours or not.
+GstElement *CEncoderFactory::FindEncoder(GstElement *pipeline)
+{
+	GstElement *encoder = NULL;
+	GstIterator *elements = gst_bin_iterate_recurse(GST_BIN(pipeline));
+	GValue item = G_VALUE_INIT;
+	while (encoder == NULL && gst_iterator_next(elements, &item) == GST_ITERATOR_OK)
+	{
+		GstElement *element = GST_ELEMENT(g_value_get_object(&item));
+		GstElementFactory *factory = gst_element_get_factory(element);
+		const gchar *klass = (factory != NULL) ? gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS) : NULL;
+		if (klass != NULL && strstr(klass, "Encoder") != NULL && strstr(klass, "Video") != NULL)
+			encoder = GST_ELEMENT(gst_object_ref(element));
+		g_value_reset(&item);
+	}
+	g_value_unset(&item);
+	gst_iterator_free(elements);
+	return encoder;
+}
@@ -0,0 +1,67 @@
+/*  CEncoderFactory.h: header file for CEncoderFactory Class.
+    Picks an H.264/H.265 encoder that this system has, and describes it (with its converter in front) from one set of settings.
+
+	Copyright 2017 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+*/
+
+#pragma once
+
+#include <gst/gst.h>
+#include <string>
+#include <vector>
+
+// ******* EncoderSettings *******
+// What the encoder should do, whichever element ends up doing it.
+struct EncoderSettings
+{
+	std::string codec;     // h264 or h265
+	int bitrate;           // bits per second
+	bool constantBitrate;  // CBR (streams, fixed size recordings), or VBR
+	int keyframeInterval;  // frames between keyframes
+	std::string profile;   // baseline, main or high (h265: main)
+	std::string preset;    // ultrafast, fast, medium or slow. Faster uses less of the encoder (or CPU), slower looks better for the bitrate.
+	bool lowLatency;       // for live viewing: no B-frames or lookahead, and intra refresh (a column of each frame coded fresh) instead of a burst every keyframeInterval, where the encoder can
+
+	EncoderSettings();
+};
+
+// ******* CEncoderFactory *******
+// Back ends, in the order auto tries them:
+//   nvv4l2    Jetson (L4T 32 and later): nvvidconv converts into NVMM memory in hardware, and nvv4l2h26xenc encodes it from there
+//   omx       older Jetson releases (TX1/TX2): nvvidconv into NVMM, then omxh26xenc
+//   v4l2      Raspberry Pi and other V4L2 codecs: v4l2convert hands DMABUFs to v4l2h264enc
+//   vaapi     Intel/AMD graphics: vaapipostproc uploads into VA surfaces for vaapih26xenc
+//   software  x264enc/x265enc, when there is nothing else
+// The converter takes the camera's images in whatever format they come, so the pipeline's videoconvert has nothing left to do and passes them through.
+// The description ends in the codec's caps, ready for ${codec}parse.
+class CEncoderFactory
+{
+public:
+	static std::vector<std::string> GetBackends();
+	// The elements the back end needs are in the registry (call after gst_init()).
+	static bool IsAvailable(const std::string &backend, const std::string &codec);
+	// The first available back end, or the one asked for ("auto" or "" for the first). "" if there is none, with the reason printed.
+	static std::string FindBackend(const std::string &codec, const std::string &preferred);
+	// gst-launch-1.0 style, eg: "nvvidconv ! video/x-raw(memory:NVMM),format=NV12 ! nvv4l2h264enc ... ! video/x-h264". "" for an unknown back end.
+	static std::string GetDescription(const std::string &backend, const EncoderSettings &settings);
+	// Change a running encoder's bitrate (bits per second), in the units its element takes. False if the element isn't one of ours.
+	static bool SetBitrate(GstElement *encoder, int bitsPerSecond);
+	// The pipeline's video encoder, with a reference, or NULL if it has none.
+	static GstElement *FindEncoder(GstElement *pipeline);
+};
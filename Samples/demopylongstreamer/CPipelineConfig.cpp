@@ -0,0 +1,319 @@
+/*  CPipelineConfig.cpp: Definition file for CPipelineConfig Class.
+    Named pipeline descriptions for CPipelineHelper, which can be changed without rebuilding the program.
+
+	Copyright 2017-2019 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+*/
+
+#include "CPipelineConfig.h"
+
+#include <iostream>
+
+using namespace std;
+
+// The sample pipelines. Depending on your platform, you may have to use some alternative elements here (eg: autovideosink instead of nvdrmvideosink).
+// Rather than changing them here, put the changes in a file and use -config <file> (see pipelines.ini), or -set <name>=<value> for a quick try.
+// ${encoder} is the encoder CEncoderFactory picked for this system (${autoencoder}), set up from codec, bitrate, rate-control, keyframe-interval, encoder-profile and encoder-preset.
+// Set encoder-backend to use a particular one (nvv4l2, omx, v4l2, vaapi, software), or encoder to a description of your own.
+// The streaming pipelines (h264stream, h264multicast, rtspserver, h264srt) use encoder-latency=low, send every frame as soon as it's encoded (sync=false),
+// and repeat SPS/PPS with every keyframe (config-interval=-1) so a viewer can join at any time.
+// fanout encodes once for all of its outputs (recorder, rtpstream and cliprecorder): each gets its own leaky queue after the tee named "encoded" (see CPipelineHelper::add_encoded_output()).
+// The queues are named (encodequeue, displayqueue, and <output>queue) so their branches' threads can be given cores and priorities (demo: -thread encodequeue=3:50).
+static const char *builtInPipelines =
+	"[settings]\n"
+	"width=1920\n"
+	"height=1080\n"
+	"bitrate=7853000\n"
+	"recordings=/home/pi/flywire/tmp/videos\n"
+	"segment-time=300000000000\n"
+	"host=127.0.0.1\n"
+	"port=5000\n"
+	"mtu=1400\n"
+	"multicast-ttl=1\n"
+	"rtsp-port=8554\n"
+	"rtsp-path=/camera\n"
+	"rtsp-payloader=${codec}parse ! rtp${codec}pay name=pay0 pt=96 config-interval=-1 mtu=${mtu}\n"
+	"srt-port=8888\n"
+	"srt-latency=50\n"
+	"fbdevice=/dev/fb0\n"
+	"displaysink=nvdrmvideosink conn_id=0 plane_id=1 set_mode=0\n"
+	"codec=h264\n"
+	"encoder-backend=auto\n"
+	"rate-control=cbr\n"
+	"keyframe-interval=30\n"
+	"encoder-profile=high\n"
+	"encoder-preset=fast\n"
+	"encoder=${autoencoder}\n"
+	"recorder=${codec}parse ! splitmuxsink location=${recordings}/video%02d.mp4 max-size-time=${segment-time}\n"
+	"cliprecorder=${codec}parse config-interval=-1 ! video/x-${codec},stream-format=byte-stream,alignment=au ! appsink name=clipsink\n"
+	"rtpstream=rtp${codec}pay config-interval=-1 pt=96 mtu=${mtu} ! udpsink host=${host} port=${port} sync=false async=false\n"
+	"rtspoutput=${codec}parse config-interval=-1 ! video/x-${codec},stream-format=byte-stream,alignment=au ! appsink name=rtspsink\n"
+	"output-queue-time=2000000000\n"
+	"clips=${recordings}\n"
+	"clip-preroll=10\n"
+	"clip-postroll=20\n"
+	"asyncwriter=asyncfilesink buffer-size=4194304 max-pending=67108864 sync-interval=0 preallocate=0\n"
+	"min-free-space=500\n"
+	"sequence=\n"
+	"sequence-branch=queue leaky=1 max-size-buffers=4 ! videoconvert ! videoanalyse ! fakesink sync=false\n"
+	"adaptive=false\n"
+	"adaptive-min-bitrate=2000000\n"
+	"adaptive-min-fps=10\n"
+	"adaptive-max-temp=80\n"
+	"thermal-zone=/sys/class/thermal/thermal_zone0/temp\n"
+	"analysis-step=0\n"
+	"analyser=videoanalyse\n"
+	"motion-clips=0\n"
+	"auto-adjust=false\n"
+	"control=\n"
+	"fallback=videotestsrc is-live=true pattern=black ! videoconvert ! textoverlay name=fallbacktext color=4294901760 draw-outline=0 ypad=225 font-desc=\"Sans, 65\" ! videoconvert\n"
+	"errorscreen=videotestsrc ! video/x-raw,width=${width},height=${height} ! videoconvert ! textoverlay text=\"${message}\" color=4294901760 draw-outline=0 ypad=225 font-desc=\"Sans, 65\" ! textoverlay name=overlay ! ${displaysink}\n"
+	"\n"
+	"[window]\n"
+	"description=videoconvert ! video/x-raw,format=I420,width=${width},height=${height} ! ${analyser} ! ${displaysink}\n"
+	"\n"
+	"[h264file]\n"
+	"description=videoconvert ! ${analyser} ! queue name=encodequeue leaky=1 max-size-time=200000000 ! ${encoder} ! ${recorder}\n"
+	"grab-strategy=onebyone\n"
+	"\n"
+	"[h264clips]\n"
+	"description=videoconvert ! ${analyser} ! queue name=encodequeue leaky=1 max-size-time=200000000 ! ${encoder} ! ${cliprecorder}\n"
+	"grab-strategy=onebyone\n"
+	"\n"
+	"[displayh264file]\n"
+	"bitrate=5750000\n"
+	"encoder-preset=slow\n"
+	"description=queue leaky=1 ! videoconvert ! tee name=t "
+		"t. ! queue name=displayqueue leaky=1 ! textoverlay name=overlay text=Recording color=4294901760 draw-outline=0 deltax=-500 font-desc=\"Sans, 15\" ! ${analyser} ! ${displaysink} "
+		"t. ! queue name=encodequeue leaky=1 ! ${encoder} ! ${recorder}\n"
+	"grab-strategy=onebyone\n"
+	"\n"
+	"[h264stream]\n"
+	"encoder-latency=low\n"
+	"description=videoconvert ! ${encoder} ! ${codec}parse ! rtp${codec}pay config-interval=-1 pt=96 mtu=${mtu} ! udpsink host=${host} port=${port} sync=false async=false\n"
+	"\n"
+	"[h264multicast]\n"
+	"encoder-latency=low\n"
+	"description=videoconvert ! ${encoder} ! ${codec}parse ! rtp${codec}pay config-interval=-1 pt=96 mtu=${mtu} ! udpsink host=${host} port=${port} auto-multicast=true ttl-mc=${multicast-ttl} sync=false async=false\n"
+	"\n"
+	"[rtspserver]\n"
+	"encoder-latency=low\n"
+	"description=videoconvert ! ${encoder} ! ${codec}parse config-interval=-1 ! video/x-${codec},stream-format=byte-stream,alignment=au ! appsink name=rtspsink\n"
+	"\n"
+	"[h264srt]\n"
+	"encoder-latency=low\n"
+	"description=videoconvert ! ${encoder} ! ${codec}parse config-interval=-1 ! mpegtsmux alignment=7 ! srtsink uri=srt://:${srt-port} latency=${srt-latency} wait-for-connection=false sync=false\n"
+	"\n"
+	"[fanout]\n"
+	"encoder-latency=low\n"
+	"outputs=recorder,rtpstream,cliprecorder\n"
+	"description=queue leaky=1 ! videoconvert ! tee name=t "
+		"t. ! queue name=displayqueue leaky=1 max-size-buffers=2 ! ${displaysink} "
+		"t. ! queue name=encodequeue leaky=1 max-size-buffers=2 ! ${encoder} ! ${codec}parse config-interval=-1 ! video/x-${codec},stream-format=byte-stream,alignment=au ! tee name=encoded\n"
+	"grab-strategy=onebyone\n"
+	"\n"
+	"[framebuffer]\n"
+	"description=videoconvert ! fbdevsink device=${fbdevice}\n"
+	"\n"
+	"[camfail]\n"
+	"message=CAMERA FAILURE\n"
+	"description=${errorscreen}\n"
+	"camera=false\n"
+	"\n"
+	"[syserr]\n"
+	"message=RESTART SYSTEM\n"
+	"description=${errorscreen}\n"
+	"camera=false\n"
+	"\n"
+	"[powfail]\n"
+	"message=LOW POWER\n"
+	"description=${errorscreen}\n"
+	"camera=false\n"
+	"\n"
+	"[fullusb]\n"
+	"message=REPLACE USB DRIVE\n"
+	"description=${errorscreen}\n"
+	"camera=false\n"
+	"\n"
+	"[temperr]\n"
+	"message=SYSTEM OVERHEATED\n"
+	"description=${errorscreen}\n"
+	"camera=false\n";
+
+static const char *settingsGroup = "settings";
+
+CPipelineConfig::CPipelineConfig()
+{
+	m_builtIn = g_key_file_new();
+	m_file = NULL;
+
+	GError *error = NULL;
+	if (g_key_file_load_from_data(m_builtIn, builtInPipelines, (gsize)-1, G_KEY_FILE_NONE, &error) == FALSE)
+	{
+		cerr << "CPipelineConfig: Could not load the built-in pipelines: " << error->message << endl;
+		g_error_free(error);
+	}
+}
+
+CPipelineConfig::~CPipelineConfig()
+{
+	g_key_file_free(m_builtIn);
+	if (m_file != NULL)
+		g_key_file_free(m_file);
+}
+
+bool CPipelineConfig::LoadFile(const string &filename)
+{
+	GKeyFile *keyFile = g_key_file_new();
+	GError *error = NULL;
+	if (g_key_file_load_from_file(keyFile, filename.c_str(), G_KEY_FILE_NONE, &error) == FALSE)
+	{
+		cerr << "Could not load pipelines from " << filename << ": " << error->message << endl;
+		g_error_free(error);
+		g_key_file_free(keyFile);
+		return false;
+	}
+
+	if (m_file != NULL)
+		g_key_file_free(m_file);
+	m_file = keyFile;
+	return true;
+}
+
+void CPipelineConfig::SetValue(const string &key, const string &value)
+{
+	m_values[key] = value;
+}
+
+void CPipelineConfig::SetDefault(const string &key, const string &value)
+{
+	m_defaults[key] = value;
+}
+
+bool CPipelineConfig::lookup(GKeyFile *keyFile, const string &group, const string &key, string &value)
+{
+	if (keyFile == NULL)
+		return false;
+
+	gchar *text = g_key_file_get_string(keyFile, group.c_str(), key.c_str(), NULL);
+	if (text == NULL)
+		return false;
+
+	value = text;
+	g_free(text);
+	return true;
+}
+
+bool CPipelineConfig::HasPipeline(const string &pipeline)
+{
+	string description;
+	return pipeline != settingsGroup && (lookup(m_file, pipeline, "description", description) || lookup(m_builtIn, pipeline, "description", description));
+}
+
+vector<string> CPipelineConfig::GetPipelineNames()
+{
+	vector<string> names;
+	GKeyFile *keyFiles[] = { m_builtIn, m_file };
+	for (int i = 0; i < 2; i++)
+	{
+		if (keyFiles[i] == NULL)
+			continue;
+
+		gchar **groups = g_key_file_get_groups(keyFiles[i], NULL);
+		for (gchar **group = groups; *group != NULL; group++)
+		{
+			bool isKnown = false;
+			for (size_t j = 0; j < names.size(); j++)
+				isKnown = isKnown || names[j] == *group;
+			if (isKnown == false && HasPipeline(*group))
+				names.push_back(*group);
+		}
+		g_strfreev(groups);
+	}
+	return names;
+}
+
+string CPipelineConfig::GetValue(const string &pipeline, const string &key)
+{
+	// most specific first: the command line, then the pipeline's own group, then the general settings, then the program's defaults. The file before the built-in ones each time.
+	map<string, string>::iterator value = m_values.find(key);
+	if (value != m_values.end())
+		return value->second;
+
+	string text;
+	if (pipeline != "" && (lookup(m_file, pipeline, key, text) || lookup(m_builtIn, pipeline, key, text)))
+		return text;
+	if (lookup(m_file, settingsGroup, key, text) || lookup(m_builtIn, settingsGroup, key, text))
+		return text;
+	value = m_defaults.find(key);
+	if (value != m_defaults.end())
+		return value->second;
+
+	return "";
+}
+
+string CPipelineConfig::Expand(const string &pipeline, const string &text)
+{
+	string expanded = text;
+	int replacements = 0;
+	size_t start = expanded.find("${");
+	while (start != string::npos)
+	{
+		size_t end = expanded.find("}", start);
+		if (end == string::npos)
+		{
+			cerr << "Unfinished setting in pipeline: " << expanded.substr(start) << endl;
+			return "";
+		}
+
+		string key = expanded.substr(start + 2, end - start - 2);
+		string value = GetValue(pipeline, key);
+		if (value == "")
+		{
+			cerr << "Pipeline setting " << key << " is not defined. eg: -set " << key << "=<value>" << endl;
+			return "";
+		}
+
+		// settings can hold other settings, so look again from the start of what was put in. But not forever.
+		if (++replacements > 100)
+		{
+			cerr << "Pipeline setting " << key << " refers to itself." << endl;
+			return "";
+		}
+		expanded.replace(start, end - start + 1, value);
+		start = expanded.find("${", start);
+	}
+
+	return expanded;
+}
+
+string CPipelineConfig::GetDescription(const string &pipeline)
+{
+	if (HasPipeline(pipeline) == false)
+	{
+		cerr << "There is no pipeline named " << pipeline << "." << endl;
+		return "";
+	}
+
+	// the description itself can't be overridden with -set, or every pipeline would become the same one.
+	string description;
+	if (lookup(m_file, pipeline, "description", description) == false)
+		lookup(m_builtIn, pipeline, "description", description);
+
+	return Expand(pipeline, description);
+}
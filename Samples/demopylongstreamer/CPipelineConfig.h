@@ -0,0 +1,88 @@
+/*  CPipelineConfig.h: header file for CPipelineConfig Class.
+    Named pipeline descriptions for CPipelineHelper, which can be changed without rebuilding the program.
+
+	Copyright 2017 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+*/
+
+#pragma once
+
+#include <glib.h>
+#include <string>
+#include <vector>
+#include <map>
+
+// ******* CPipelineConfig *******
+// Each pipeline is a group in a key file, with a gst-launch-1.0 style description of everything after the camera:
+//   [h264file]
+//   description=videoconvert ! queue leaky=1 ! ${encoder} ! ${recorder}
+//   grab-strategy=onebyone
+// ${name} is replaced by the setting of that name: from the command line (SetValue()), the pipeline's own group, the [settings] group, or the program (SetDefault()), in that order.
+// Settings can hold other settings, or whole pieces of pipeline (eg: the encoder and its properties).
+// The pipelines the demo has always had are built in. A file given to LoadFile() can change any of them, or add new ones.
+// Keys a pipeline group can have:
+//   description   the pipeline (required)
+//   grab-strategy latest, latestimages, onebyone or upcoming, if the pipeline wants a particular one (eg: recordings want every image)
+//   camera        false if the pipeline makes its own images (eg: error screens)
+//   fallback      what to show while the camera is gone (if it's not in [settings]). It ends up with the camera's caps, and its textoverlay named "fallbacktext" has the message.
+//   message       the error screen's text, also shown on the fallback (eg: -pipeline camfail, or camfail's message when the camera is unplugged)
+//   clips, clip-preroll, clip-postroll  for pipelines ending in an appsink named clipsink: the folder for clips, and the seconds before and after each trigger (see CClipRecorder)
+//   encoder-latency  low for streams: the encoder is set up without B-frames and with intra refresh (see CEncoderFactory)
+//   rtsp-port, rtsp-path, rtsp-payloader  for pipelines ending in an appsink named rtspsink: where the RTSP server listens, and how its media is payloaded (see CRtspServer)
+//   writer        the element each splitmuxsink writes its files with (eg: ${asyncwriter}, see gstasyncfilesink.h), instead of a filesink
+//   min-free-space  MB. The fullusb message is shown when a writer reports less free space than this
+//   outputs       for pipelines ending in a tee named "encoded": the settings (comma separated, eg: recorder,rtpstream) that each take a branch of the one encode
+//   output-queue-time  ns. How much each output's queue holds before it starts dropping the oldest data
+//   sequence      steps for the camera's sequencer, <width>x<height>[@<exposure us>]:<stream>,... (see CInstantCameraAppSrc::SetSequence()).
+//                 Stream 0 goes to the pipeline, the other streams each to a sequence-branch of their own
+//   adaptive      true to trade bitrate and framerate for keeping up (see CAdaptiveController), down to adaptive-min-bitrate and adaptive-min-fps.
+//                 adaptive-max-temp (C, 0 = not watched) is read from thermal-zone
+//   analysis-step pixels between the samples the camera measures each image from on its grab thread (see CFrameAnalyzer), 0 = none.
+//                 The pipelines' ${analyser} (videoanalyse) does the same downstream, reading the whole image: set it to identity with analysis
+//   motion-clips  with analysis: record a clip when the motion (0-255) between images goes over this, 0 = never. auto-adjust: true to run the
+//                 camera's auto functions once when the image is too dark or too bright for a second
+//   control       a Unix socket (or a TCP port on 127.0.0.1) to take the console's commands from too (see CControlChannel), empty = console only
+class CPipelineConfig
+{
+public:
+	CPipelineConfig();
+	~CPipelineConfig();
+	CPipelineConfig(const CPipelineConfig&) = delete;
+	CPipelineConfig& operator=(const CPipelineConfig&) = delete;
+
+	bool LoadFile(const std::string &filename);
+	void SetValue(const std::string &key, const std::string &value);
+	// A setting worked out by the program (eg: autoencoder), used if the file and built-in settings don't have it.
+	void SetDefault(const std::string &key, const std::string &value);
+	bool HasPipeline(const std::string &pipeline);
+	std::vector<std::string> GetPipelineNames();
+	// The setting as the pipeline sees it, not expanded. "" if not set.
+	std::string GetValue(const std::string &pipeline, const std::string &key);
+	// The pipeline's description with all settings filled in. "" if there is no such pipeline, or it uses a setting which doesn't exist.
+	std::string GetDescription(const std::string &pipeline);
+	// Fill in the settings in any text (eg: a pipeline from the command line), as the given pipeline would see them.
+	std::string Expand(const std::string &pipeline, const std::string &text);
+
+private:
+	GKeyFile *m_builtIn;
+	GKeyFile *m_file;
+	std::map<std::string, std::string> m_values;
+	std::map<std::string, std::string> m_defaults;
+
+	bool lookup(GKeyFile *keyFile, const std::string &group, const std::string &key, std::string &value);
+};
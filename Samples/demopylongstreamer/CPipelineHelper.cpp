@@ -23,8 +23,11 @@
 #include "CPipelineHelper.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <iostream>
 #include <ctime>
+#include <map>
+#include <vector>
 
 using namespace std;
 
@@ -40,23 +43,102 @@ static gboolean print_field (GQuark field, const GValue * value, gpointer pfx);
 static void print_caps (const GstCaps * caps, const gchar * pfx);
 static void print_pad_templates_information (GstElementFactory * factory);
 static void print_pad_capabilities (GstElement *element, gchar *pad_name);
-GstElement *overlay;
-int tz_Offset; // cant be passed as an arg to _on_format_location? (because of macro?)
 // ****************************************************************************
 
-CPipelineHelper::CPipelineHelper(GstElement *pipeline, GstElement *source)
+// Element factories looked up so far, by name. Missing ones are kept too (as NULL), so each plugin is only searched for once.
+// The registry holds on to the factories for the life of the program anyway.
+static map<string, GstElementFactory*> elementFactories;
+
+static GstElementFactory* find_factory(const string &name)
+{
+	map<string, GstElementFactory*>::iterator cached = elementFactories.find(name);
+	if (cached != elementFactories.end())
+		return cached->second;
+
+	GstElementFactory *factory = gst_element_factory_find(name.c_str());
+	elementFactories[name] = factory;
+	return factory;
+}
+
+// Split a gst-launch-1.0 description at each link ("!"), leaving quoted property values alone.
+static vector<string> split_links(const string &description)
+{
+	vector<string> parts;
+	string part = "";
+	bool isQuoted = false;
+	for (size_t i = 0; i < description.size(); i++)
+	{
+		if (description[i] == '"')
+			isQuoted = !isQuoted;
+		if (description[i] == '!' && isQuoted == false)
+		{
+			parts.push_back(part);
+			part = "";
+		}
+		else
+			part += description[i];
+	}
+	parts.push_back(part);
+	return parts;
+}
+
+// The element name a part of a description starts with. "" for caps (video/x-raw,...) and pad references (t., t.src_0, etc.).
+static string element_name(const string &part)
+{
+	size_t start = part.find_first_not_of(" \t\r\n");
+	if (start == string::npos)
+		return "";
+	size_t end = part.find_first_of(" \t\r\n", start);
+	string name = part.substr(start, end == string::npos ? string::npos : end - start);
+	if (name.find_first_of("/.(=") != string::npos)
+		return "";
+	return name;
+}
+
+CPipelineHelper::CPipelineHelper(GstElement *pipeline, GstElement *source, int tzOffset)
 {
 	m_pipelineBuilt = false;
 	m_pipeline = pipeline;
 	m_source = source;
+	m_tzOffset = tzOffset;
+	m_selector = NULL;
+	m_livePad = NULL;
+	m_fallbackPad = NULL;
+	m_fallbackSrc = NULL;
+	m_fallbackDrop = 0;
+	m_streamStatusHandler = 0;
+	m_clipRecorder = NULL;
+	m_clipFolder = ".";
+	m_clipPreroll = 10;
+	m_clipPostroll = 20;
+	m_recordingSink = "";
+	m_rtspServer = NULL;
+	m_rtspService = "8554";
+	m_rtspPath = "/camera";
+	m_rtspPayloader = "h264parse ! rtph264pay name=pay0 pt=96 config-interval=-1";
 }
 
 CPipelineHelper::~CPipelineHelper()
 {
+	delete m_clipRecorder;
+	delete m_rtspServer;
+	if (m_streamStatusHandler != 0)
+	{
+		GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(m_pipeline));
+		g_signal_handler_disconnect(bus, m_streamStatusHandler);
+		gst_object_unref(bus);
+	}
+	if (m_livePad != NULL)
+		gst_object_unref(m_livePad);
+	if (m_fallbackPad != NULL)
+		gst_object_unref(m_fallbackPad);
+	if (m_fallbackSrc != NULL)
+		gst_object_unref(m_fallbackSrc);
 }
 
 
-gchar* _on_format_location(GstElement* splitmux, guint fragment_id)
+// splitmuxsink asks for each new file name. The files go in the folder of its location property, named for the time they were started.
+gchar* _on_format_location(GstElement* splitmux, guint fragment_id, gpointer tzOffset)
 {
 	time_t curr_time = time(0);
 	tm* now = gmtime(&curr_time);
@@ -70,7 +152,7 @@ gchar* _on_format_location(GstElement* splitmux, guint fragment_id)
 	if (day.length() < 2){
 		day = "0" + day;
 	}
-	string hour = to_string((now->tm_hour + tz_Offset)%24);
+	string hour = to_string((now->tm_hour + GPOINTER_TO_INT(tzOffset))%24);
 	if (hour.length() < 2){
 		hour = "0" + hour;
 	}
@@ -83,14 +165,17 @@ gchar* _on_format_location(GstElement* splitmux, guint fragment_id)
 		sec = "0" + sec;
 	}
 	string datetime =  year + "." + month + "." + day + "_" + hour + "." + min + "." + sec + "_";
-	//string path = "/media/56C7-FC96/" + datetime + "_%04d.mp4";
-	string path = "/home/pi/flywire/tmp/videos/" + datetime + "_%04d.mp4";
-    const char* location = path.c_str();
-    //gchar* fileName = g_strdup_printf(location, fragment_id + *offset);
-	gchar* fileName = g_strdup_printf(location, fragment_id);
+
+	gchar *location = NULL;
+	g_object_get(G_OBJECT(splitmux), "location", &location, NULL);
+	gchar *folder = g_path_get_dirname(location != NULL ? location : ".");
+	string path = string(folder) + "/" + datetime + "_%04d.mp4";
+	g_free(folder);
+	g_free(location);
+
+	gchar* fileName = g_strdup_printf(path.c_str(), fragment_id);
 	cout << fileName << endl;
-    //g_free(location);
-    return fileName;
+	return fileName;
 }
 
 
@@ -99,664 +184,556 @@ bool CPipelineHelper::close_pipeline(){
 	return true;
 }
 
+// Change the text of the pipeline's textoverlay named "overlay" (see the pipelines in CPipelineConfig.cpp).
 bool CPipelineHelper::update_overlay(const gchar* updatetext){
 	try{
 		cout << updatetext << endl;
+		GstElement *overlay = gst_bin_get_by_name(GST_BIN(m_pipeline), "overlay");
+		if (overlay == NULL)
+		{
+			cout << "This pipeline has no element named overlay." << endl;
+			return false;
+		}
 		g_object_set(G_OBJECT(overlay), "text", updatetext, NULL);
+		gst_object_unref(overlay);
+		return true;
 	}catch (std::exception &e){
 		cerr << "An exception occurred in update_overlay: " << endl << e.what() << endl;
+		return false;
 	}
 }
 
-// example of how to create a pipeline for display in a window
-bool CPipelineHelper::build_pipeline_display()
+// Check every element of a description exists before anything is made, so a missing plugin is reported by name (and all of them at once).
+bool CPipelineHelper::check_elements(const string &launch)
 {
-	try
+	vector<string> parts = split_links(launch);
+	bool isMissingElements = false;
+	for (size_t i = 0; i < parts.size(); i++)
 	{
-		if (m_pipelineBuilt == true)
+		string name = element_name(parts[i]);
+		if (name != "" && find_factory(name) == NULL)
 		{
-			cout << "Cancelling -display. Another pipeline has already been built." << endl;
-			return false;
+			cout << "Element " << name << " is not available on this system." << endl;
+			isMissingElements = true;
 		}
-
-		GstElement *queue;
-		GstElement *videoflip;
-		GstElement *convert;
-		GstElement *sink;
-		GstElement *filter;
-		GstElement *filter2;
-		GstElement *analyse;
-		GstCaps *filter_caps;
-
-		cout << "Creating Pipeline for displaying images in local window..." << endl;
-		// Create gstreamer elements
-		queue = gst_element_factory_make("queue", "queue");
-		videoflip = gst_element_factory_make("videoflip", "videoflip");
-		convert = gst_element_factory_make("videoconvert", "converter");
-		sink = gst_element_factory_make("nvdrmvideosink", "nvdrmvideosink");
-		filter = gst_element_factory_make("capsfilter", "capsfilter");
-		filter2 = gst_element_factory_make("capsfilter", "capsfilter");
-		analyse = gst_element_factory_make("videoanalyse", "videoanalyse");
-
-		if (!videoflip){ cout << "Could not make videoflip" << endl; return false; }
-		if (!convert){ cout << "Could not make convert" << endl; return false; }
-		if (!sink){ cout << "Could not make sink" << endl; return false; }
-		if (!analyse){ cout << "Could not make analyse" << endl; return false; }
-
-		filter = gst_element_factory_make("capsfilter", "filter");
-		filter2 = gst_element_factory_make("capsfilter", "filter2");
-		filter_caps = gst_caps_new_simple("video/x-raw",
-			"format", G_TYPE_STRING, "I420",
-		  	"width", G_TYPE_INT, 1920,
-        	"height", G_TYPE_INT, 1080,
-		  NULL);
-		
-		g_object_set(G_OBJECT(filter), "caps", filter_caps, NULL);
-		g_object_set(G_OBJECT(filter2), "caps", filter_caps, NULL);
-		gst_caps_unref(filter_caps);
-
-		// Set up elements
-		g_object_set(G_OBJECT(queue), "leaky", 2, NULL);
-		g_object_set(G_OBJECT(queue), "max-size-time", 5000000000, NULL);
-
-		//g_object_set(G_OBJECT(videoflip), "method", "vertical-flip", NULL);
-		g_object_set(G_OBJECT(videoflip), "video-direction", 3, NULL);
-		
-		
-		g_object_set(G_OBJECT(sink), "conn_id", 0, NULL);
-		g_object_set(G_OBJECT(sink), "plane_id", 1, NULL);
-		g_object_set(G_OBJECT(sink), "set_mode", 0, NULL);
-
-		// add and link the pipeline elements
-		gst_bin_add_many(GST_BIN(m_pipeline), m_source, videoflip, convert, filter2, filter, analyse, sink, NULL);
-		gst_element_link_many(m_source, convert, videoflip, filter2, analyse, sink, NULL);
-		
-		
-		cout << "Pipeline Made." << endl;
-		
-		m_pipelineBuilt = true;
-
-		return true;
 	}
-	catch (std::exception &e)
-	{
-		cerr << "An exception occurred in build_pipeline_display(): " << endl << e.what() << endl;
-		gst_element_send_event(m_source, gst_event_new_eos());
-		return false;
-		
-	}
-
+	return isMissingElements == false;
 }
 
-// example of how to create a pipeline for encoding images in h264 format and streaming to local video file
-bool CPipelineHelper::build_pipeline_h264file(int timezoneOffset)
+// Build the pipeline from a gst-launch-1.0 style description (eg: from CPipelineConfig, or the command line).
+// If there is a source (the camera), it is linked to the start of the description. If the description starts with a source of its own (eg: videotestsrc), the camera takes its place.
+// Without a source, the description must make its own images.
+bool CPipelineHelper::build_pipeline(const string &description, const string &fallback)
 {
 	try
 	{
-		tz_Offset = timezoneOffset;
 		if (m_pipelineBuilt == true)
 		{
-			cout << "Cancelling -h264file. Another pipeline has already been built." << endl;
+			cout << "Cancelling pipeline. Another pipeline has already been built." << endl;
+			return false;
+		}
+
+		// people will paste whole gst-launch-1.0 command lines
+		string launch = description;
+		size_t start = launch.find_first_not_of(" \t");
+		if (start != string::npos && launch.compare(start, 14, "gst-launch-1.0") == 0)
+			launch = launch.substr(start + 14);
+
+		bool isFallback = (fallback != "" && m_source != NULL);
+		// the fallback ends in a capsfilter, which is given the source's caps (see cb_live_caps()), so switching doesn't make downstream renegotiate.
+		string fallbackLaunch = fallback + " ! capsfilter name=fallbackcaps";
+		if (check_elements(launch) == false)
+			return false;
+		if (isFallback == true && (check_elements(fallbackLaunch) == false || find_factory("input-selector") == NULL))
+		{
+			cout << "Could not make the fallback." << endl;
+			return false;
+		}
+
+		vector<string> parts = split_links(launch);
+
+		if (m_source != NULL && parts.size() > 1)
+		{
+			string name = element_name(parts[0]);
+			GstElementFactory *factory = (name != "") ? find_factory(name) : NULL;
+			const gchar *klass = (factory != NULL) ? gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS) : NULL;
+			if (klass != NULL && strstr(klass, "Source") != NULL)
+			{
+				cout << "Replacing " << name << " with the camera." << endl;
+				launch = launch.substr(parts[0].size() + 1);
+			}
+		}
+
+		cout << "Creating Pipeline: " << launch << endl;
+
+		// Elements with no link at the start (and end) of the description become the bin's pads, for the camera to link to.
+		GError *error = NULL;
+		GstElement *bin = gst_parse_bin_from_description(launch.c_str(), m_source != NULL ? TRUE : FALSE, &error);
+		if (error != NULL)
+		{
+			// this includes mistakes the parser could work around, like a misspelled property. Better to hear about them than to A/B the wrong settings.
+			cout << "Could not make the pipeline: " << error->message << endl;
+			g_error_free(error);
+			if (bin != NULL)
+				gst_object_unref(bin);
 			return false;
 		}
+		if (bin == NULL)
+		{
+			cout << "Could not make the pipeline." << endl;
+			return false;
+		}
+
+		gst_bin_add(GST_BIN(m_pipeline), bin);
+		if (isFallback == true)
+		{
+			// source --> selector sink_0 \
+			//                               selector --> the pipeline
+			// fallback -> selector sink_1 /
+			// The fallback branch runs from the start, so it's ready the moment it's needed. Until then its images are dropped at its end. Not blocked: a blocked live
+			// source would hand over the image it was held on first, long stale, and the switch would show it instead of one from now.
+			GstElement *fallbackBin = gst_parse_bin_from_description(fallbackLaunch.c_str(), TRUE, &error);
+			if (error != NULL)
+			{
+				cout << "Could not make the fallback: " << error->message << endl;
+				g_error_free(error);
+				if (fallbackBin != NULL)
+					gst_object_unref(fallbackBin);
+				return false;
+			}
+			m_selector = gst_element_factory_make("input-selector", "selector");
+			// the branches run on their own. Don't hold one back to keep pace with the other.
+			g_object_set(G_OBJECT(m_selector), "sync-streams", FALSE, NULL);
+			gst_bin_add_many(GST_BIN(m_pipeline), m_source, m_selector, fallbackBin, NULL);
+
+			m_livePad = gst_element_get_request_pad(m_selector, "sink_%u");
+			m_fallbackPad = gst_element_get_request_pad(m_selector, "sink_%u");
+			m_fallbackSrc = gst_element_get_static_pad(fallbackBin, "src");
+			m_fallbackDrop = gst_pad_add_probe(m_fallbackSrc, GST_PAD_PROBE_TYPE_BUFFER, cb_drop, NULL, NULL);
+			gst_pad_add_probe(m_livePad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, cb_live_caps, this, NULL);
+
+			GstPad *sourcePad = gst_element_get_static_pad(m_source, "src");
+			bool isLinked = gst_pad_link(sourcePad, m_livePad) == GST_PAD_LINK_OK && gst_pad_link(m_fallbackSrc, m_fallbackPad) == GST_PAD_LINK_OK;
+			gst_object_unref(sourcePad);
+			g_object_set(G_OBJECT(m_selector), "active-pad", m_livePad, NULL);
+			if (isLinked == false || gst_element_link(m_selector, bin) == FALSE)
+			{
+				cout << "Could not link the camera and the fallback to the pipeline." << endl;
+				return false;
+			}
+		}
+		else if (m_source != NULL)
+		{
+			gst_bin_add(GST_BIN(m_pipeline), m_source);
+			if (gst_element_link(m_source, bin) == FALSE)
+			{
+				cout << "Could not link the camera to the pipeline." << endl;
+				return false;
+			}
+		}
+
+		if (prepare_branch(bin) == false)
+			return false;
+
+		// the consumers of the encoded stream, each on its own branch of the tee named "encoded"
+		if (m_encodedOutputs.empty() == false)
+		{
+			GstElement *tee = gst_bin_get_by_name(GST_BIN(bin), "encoded");
+			if (tee == NULL)
+			{
+				cout << "This pipeline has no tee named encoded for the outputs to share." << endl;
+				return false;
+			}
+			// an output which hasn't started yet (or has gone) mustn't end the stream for the others
+			g_object_set(G_OBJECT(tee), "allow-not-linked", TRUE, NULL);
+			bool isLinked = true;
+			for (size_t i = 0; i < m_encodedOutputs.size() && isLinked == true; i++)
+				isLinked = link_encoded_output(tee, m_encodedOutputs[i]);
+			gst_object_unref(tee);
+			if (isLinked == false)
+				return false;
+		}
+
+		for (size_t i = 0; i < m_sourceBranches.size(); i++)
+		{
+			if (link_source_branch(m_sourceBranches[i]) == false)
+				return false;
+		}
 
-		GstElement *queue;
-		GstElement *videoflip;
-		GstElement *convert;
-		GstElement *encode;
-		GstElement *parse;
-		GstElement *analyse;
-		GstElement *sink;
-
-		cout << "Creating Pipeline for saving frames as h264 video on local host" << endl;
-
-		// Create gstreamer elements
-		queue = gst_element_factory_make("queue", "queue");
-		videoflip = gst_element_factory_make("videoflip", "videoflip");
-		convert = gst_element_factory_make("videoconvert", "converter");
-
-		// depending on your platform, you may have to use some alternative encoder here.
-		encode = gst_element_factory_make("omxh264enc", "omxh264enc"); // omxh264enc works good on Raspberry Pi
-		parse = gst_element_factory_make("h264parse", "h264parse");
-		sink = gst_element_factory_make("splitmuxsink", "splitmuxsink");
-		analyse = gst_element_factory_make("videoanalyse", "videoanalyse");
-
-		if (!videoflip){ cout << "Could not make videoflip" << endl; return false; }
-		if (!convert){ cout << "Could not make convert" << endl; return false; }
-		if (!encode){ cout << "Could not make encoder" << endl; return false; }
-		if (!analyse){ cout << "Could not make analyse" << endl; return false; }
-		if (!sink){ cout << "Could not make sink" << endl; return false; }
-
-		// Set up elements
-		g_object_set(G_OBJECT(queue), "leaky", 1, NULL);
-		g_object_set(G_OBJECT(queue), "max-size-time", 200000000, NULL);
-
-		g_object_set(G_OBJECT(videoflip), "video-direction", 3, NULL);
-
-		g_object_set(G_OBJECT(encode), "control-rate", 2, NULL);
-		g_object_set(G_OBJECT(encode), "bitrate", 7853000, NULL);
-
-		g_object_set(G_OBJECT(sink), "location", "/media/56C7-FC96/video%02d.mp4", NULL);
-		int offset = 0; //No current use, example for adding future functionality
-		g_signal_connect (sink, "format-location", G_CALLBACK(_on_format_location), &offset);
-		g_object_set(G_OBJECT(sink), "max-size-time", 300000000000, NULL);
-
-		// add and link the pipeline elements
-		gst_bin_add_many(GST_BIN(m_pipeline), m_source, queue, videoflip, convert, encode, parse, analyse, sink, NULL);
-		gst_element_link_many(m_source, convert, analyse, queue,  videoflip, encode, parse, sink, NULL);
-		
 		cout << "Pipeline Made." << endl;
-		
+
 		m_pipelineBuilt = true;
 
 		return true;
 	}
 	catch (std::exception &e)
 	{
-		cerr << "An exception occurred in build_pipeline_h264file(): " << endl << e.what() << endl;
-		gst_element_send_event(m_source, gst_event_new_eos());
+		cerr << "An exception occurred in build_pipeline(): " << endl << e.what() << endl;
+		if (m_source != NULL)
+			gst_element_send_event(m_source, gst_event_new_eos());
 		return false;
 	}
 }
 
-bool CPipelineHelper::build_pipeline_display_h264file(int timezoneOffset)
+// The elements of a branch which the helper looks after: splitmuxsinks, the clipsink and the rtspsink.
+bool CPipelineHelper::prepare_branch(GstElement *bin)
 {
-try
+	// recordings are named for the time they were started, and written by the recording sink if one is set
+	bool isRecordingSinkFailed = false;
+	GstIterator *elements = gst_bin_iterate_recurse(GST_BIN(bin));
+	GValue item = G_VALUE_INIT;
+	while (gst_iterator_next(elements, &item) == GST_ITERATOR_OK)
 	{
-		tz_Offset = timezoneOffset;
-		if (m_pipelineBuilt == true)
+		GstElement *element = GST_ELEMENT(g_value_get_object(&item));
+		GstElementFactory *factory = gst_element_get_factory(element);
+		if (factory != NULL && string(GST_OBJECT_NAME(factory)) == "splitmuxsink")
 		{
-			cout << "Cancelling -display. Another pipeline has already been built." << endl;
-			return false;
+			g_signal_connect(element, "format-location", G_CALLBACK(_on_format_location), GINT_TO_POINTER(m_tzOffset));
+			if (m_recordingSink != "" && set_recording_sink(element) == false)
+				isRecordingSinkFailed = true;
 		}
-		
-		GstElement *pipequeue;
-		GstElement *videoflip;
-		GstElement *convert;
-		GstElement *tee;
-
-		GstElement *analyse;
-		GstElement *dispqueue;
-		GstElement *overlay;
-		GstElement *dispsink;
-
-		GstElement *recqueue;
-		GstElement *encode;
-		GstElement *parse;
-		GstElement *filesink;
-
-		cout << "Creating Pipeline for displaying and encoding frames..." << endl;
-		// Create gstreamer elements
-		pipequeue = gst_element_factory_make("queue", "queue0");
-		videoflip = gst_element_factory_make("videoflip", "videoflip");
-		convert = gst_element_factory_make("videoconvert", "converter");
-		tee = gst_element_factory_make("tee","tee");
-
-		dispqueue = gst_element_factory_make("queue", "queue1");
-		analyse = gst_element_factory_make("videoanalyse", "videoanalyse");
-		dispsink = gst_element_factory_make("nvdrmvideosink", "nvdrmvideosink"); // depending on your platform, you may have to use some alternative here, like ("autovideosink", "sink")
-		overlay = gst_element_factory_make("textoverlay", "textoverlay");		
-		//dispsink = gst_element_factory_make("nveglglessink", "nveglglessink");
-
-		recqueue = gst_element_factory_make("queue", "queu2e");
-		encode = gst_element_factory_make("omxh264enc", "omxh264enc");
-		parse = gst_element_factory_make("h264parse", "h264parse");
-		filesink = gst_element_factory_make("splitmuxsink", "splitmuxsink");
-
-		if (!pipequeue){ cout << "Could not make pipequeue" << endl; return false; }
-		if (!videoflip){ cout << "Could not make videoflip" << endl; return false; }
-		if (!convert){ cout << "Could not make convert" << endl; return false; }
-		if (!tee){ cout << "Could not make tee" << endl; return false; }
-
-		if (!dispqueue){ cout << "Could not make dispqueue" << endl; return false; }
-		if (!overlay){ cout << "Could not make overlay" << endl; return false; }
-		if (!analyse){ cout << "Could not make analyse" << endl; return false; }
-		if (!dispsink){ cout << "Could not make dispsink" << endl; return false; }
-
-		if (!recqueue){ cout << "Could not make recqueue" << endl; return false; }
-		if (!encode){ cout << "Could not make encode" << endl; return false; }
-		if (!parse){ cout << "Could not make parse" << endl; return false; }
-		if (!filesink){ cout << "Could not make filesink" << endl; return false; }
-		
-		g_object_set(G_OBJECT(pipequeue), "leaky", 1, NULL);
-		//g_object_set(G_OBJECT(pipequeue), "max-size-time", 3000000000, NULL);
-		g_object_set(G_OBJECT(recqueue), "leaky", 1, NULL);
-		//g_object_set(G_OBJECT(recqueue), "max-size-time", 3000000000, NULL);
-
-		g_object_set(G_OBJECT(overlay), "text", "Recording", NULL);
-		g_object_set(G_OBJECT(overlay), "color", 4294901760, NULL); // #AARRGGBB -> int
-		g_object_set(G_OBJECT(overlay), "draw-outline", 0, NULL);
-		g_object_set(G_OBJECT(overlay), "deltax", -500, NULL); 
-		g_object_set(G_OBJECT(overlay), "font-desc", "Sans, 15", NULL); 
-
-		g_object_set(G_OBJECT(dispqueue), "leaky", 1, NULL);
-		//g_object_set(G_OBJECT(dispqueue), "max-size-time", 2000000, NULL);
-
-		g_object_set(G_OBJECT(videoflip), "video-direction", 3, NULL);
-
-		g_object_set(G_OBJECT(encode), "control-rate", 2, NULL);
-		g_object_set(G_OBJECT(encode), "bitrate", 5750000, NULL);
-		//g_object_set(G_OBJECT(encode), "bitrate", 5750000, NULL);
-		//g_object_set(G_OBJECT(encode), "bitrate", 8219473, NULL);
-		//g_object_set(G_OBJECT(encode), "bitrate", 7000000, NULL);
-		g_object_set(G_OBJECT(encode), "EnableTwopassCBR", 1, NULL);
-		g_object_set(G_OBJECT(encode), "EnableStringentBitrate", 1, NULL);
-		g_object_set(G_OBJECT(encode), "vbv-size", 30, NULL);
-
-		g_object_set(G_OBJECT(encode), "profile", 8, NULL);
-		g_object_set(G_OBJECT(encode), "preset-level", 3, NULL);
-
-		g_object_set(G_OBJECT(filesink), "location", "/media/56C7-FC96/video%02d.mp4", NULL);
-				int offset = 0; //No current use, example for adding future functionality
-		g_signal_connect (filesink, "format-location", G_CALLBACK(_on_format_location), &offset);
-		g_object_set(G_OBJECT(filesink), "max-size-time", 300000000000, NULL);
-		
-		g_object_set(G_OBJECT(dispsink), "conn_id", 0, NULL);
-		g_object_set(G_OBJECT(dispsink), "plane_id", 1, NULL);
-		g_object_set(G_OBJECT(dispsink), "set_mode", 0, NULL);
-
-		gst_bin_add_many(GST_BIN(m_pipeline), m_source, pipequeue, videoflip, convert, tee, dispqueue, overlay, dispsink, recqueue, encode, parse, analyse, filesink, NULL);
-		gst_element_link_many(m_source, pipequeue, videoflip, convert, tee, NULL);
-		gst_element_link_many(tee, dispqueue, overlay, analyse, dispsink, NULL);
-		gst_element_link_many(tee, recqueue, encode, parse, filesink, NULL);
-		
-		cout << "Pipeline Made." << endl;
-		
-		m_pipelineBuilt = true;
+		g_value_reset(&item);
+	}
+	g_value_unset(&item);
+	gst_iterator_free(elements);
+	if (isRecordingSinkFailed == true)
+		return false;
 
-		return true;
+	// clips are cut from what reaches the clipsink (one per pipeline)
+	GstElement *clipSink = gst_bin_get_by_name(GST_BIN(bin), "clipsink");
+	if (clipSink != NULL && m_clipRecorder != NULL)
+	{
+		cout << "Only one clipsink per pipeline." << endl;
+		gst_object_unref(clipSink);
+		return false;
 	}
-	catch (std::exception &e)
+	if (clipSink != NULL)
+	{
+		m_clipRecorder = new CClipRecorder(clipSink, m_clipFolder, m_clipPreroll, m_clipPostroll, m_tzOffset);
+		gst_object_unref(clipSink);
+		cout << "Keeping the last " << m_clipPreroll << " s in memory for clips (type CLIP to record one)." << endl;
+	}
+
+	// and streams are served from what reaches the rtspsink (likewise)
+	GstElement *rtspSink = gst_bin_get_by_name(GST_BIN(bin), "rtspsink");
+	if (rtspSink != NULL && m_rtspServer != NULL)
 	{
-		cerr << "An exception occurred in build_pipeline_display_h264file(): " << endl << e.what() << endl;
-		gst_element_send_event(m_source, gst_event_new_eos());
+		cout << "Only one rtspsink per pipeline." << endl;
+		gst_object_unref(rtspSink);
 		return false;
 	}
+	if (rtspSink != NULL)
+	{
+		m_rtspServer = new CRtspServer(rtspSink);
+		gst_object_unref(rtspSink);
+		if (m_rtspServer->Start(m_rtspService, m_rtspPath, m_rtspPayloader) == false)
+			return false;
+	}
+
+	return true;
 }
 
-bool CPipelineHelper::build_pipeline_camfail()
+void CPipelineHelper::add_encoded_output(const string &name, const string &description, GstClockTime maxQueueTime)
 {
-	try
-	{
-		if (m_pipelineBuilt == true)
-		{
-			cout << "Cancelling -display. Another pipeline has already been built." << endl;
-			return false;
-		}
+	EncodedOutput output;
+	output.name = name;
+	output.description = description;
+	output.maxQueueTime = maxQueueTime;
+	m_encodedOutputs.push_back(output);
+}
 
-		GstElement *source;
-		GstElement *filter;
-		GstCaps *filter_caps;
-		GstElement *convert;
-		GstElement *errmess;
-		GstElement *errinfo;
-		GstElement *sink;
-
-		cout << "Creating Pipeline for displaying images in local window..." << endl;
-		// Create gstreamer elements
-		source = gst_element_factory_make("videotestsrc", "videotestsrc");
-		filter = gst_element_factory_make("capsfilter", "capsfilter");
-		convert = gst_element_factory_make("videoconvert", "converter");
-		errmess = gst_element_factory_make("textoverlay", "textoverlay");
-		errinfo = gst_element_factory_make("textoverlay", "textoverlay2");
-		sink = gst_element_factory_make("nvdrmvideosink", "nvdrmvideosink"); // depending on your platform, you may have to use some alternative here, like ("autovideosink", "sink")
-
-		if (!source){ cout << "Could not make videotestsrc" << endl; return false; }
-		if (!filter){ cout << "Could not make filter" << endl; return false; }
-		if (!convert){ cout << "Could not make convert" << endl; return false; }
-		if (!errmess){ cout << "Could not make errmess" << endl; return false; }
-		if (!errinfo){ cout << "Could not make errinfo" << endl; return false; }
-		if (!sink){ cout << "Could not make sink" << endl; return false; }
-		
-		// Set up elements
-		//g_object_set(G_OBJECT(queue), "leaky", 2, NULL);
-		//g_object_set(G_OBJECT(queue), "max-size-time", 5000000000, NULL);
-
-		filter = gst_element_factory_make("capsfilter", "filter");
-		filter_caps = gst_caps_new_simple("video/x-raw",
-		  	"width", G_TYPE_INT, 1920,
-        	"height", G_TYPE_INT, 1080,
-		  NULL);
-		
-		g_object_set(G_OBJECT(filter), "caps", filter_caps, NULL);
-		gst_caps_unref(filter_caps);
-
-		g_object_set(G_OBJECT(errmess), "text", "CAMERA FAILURE", NULL);
-		g_object_set(G_OBJECT(errmess), "color", 4294901760, NULL); // #AARRGGBB -> int
-		g_object_set(G_OBJECT(errmess), "draw-outline", 0, NULL);
-		g_object_set(G_OBJECT(errmess), "ypad", 225, NULL); 
-		g_object_set(G_OBJECT(errmess), "font-desc", "Sans, 65", NULL); 
-
-		g_object_set(G_OBJECT(sink), "conn_id", 0, NULL);
-		g_object_set(G_OBJECT(sink), "plane_id", 1, NULL);
-		g_object_set(G_OBJECT(sink), "set_mode", 0, NULL);
-
-		// add and link the pipeline elements
-		gst_bin_add_many(GST_BIN(m_pipeline), source, filter, convert, errmess, errinfo, sink, NULL);
-		gst_element_link_many(source, filter, convert, errmess, errinfo, sink, NULL);
-		
-		
-		cout << "Pipeline Made." << endl;
-		
-		m_pipelineBuilt = true;
+//                  +-> queue (leaky) -> output 1 (eg: recorder)
+// ... encoder -> tee +-> queue (leaky) -> output 2 (eg: rtp stream)
+//                  +-> queue (leaky) -> output 3 (eg: clip recorder)
+// Each queue has its own thread. When its output can't keep up (eg: an SD card stalling), the queue fills and drops its oldest data, and only that output misses out.
+// The tee, the encoder and everything before it (the display) carry on. What follows a dropped frame can't be decoded without it, so after a drop the
+// output gets nothing until the next keyframe, and the encoder is asked for one right away (cb_encoded_overrun(), cb_keyframe_gate()).
+bool CPipelineHelper::link_encoded_output(GstElement *tee, const EncodedOutput &output)
+{
+	if (check_elements(output.description) == false)
+		return false;
 
-		return true;
+	cout << "Adding output " << output.name << ": " << output.description << endl;
+	GError *error = NULL;
+	GstElement *bin = gst_parse_bin_from_description(output.description.c_str(), TRUE, &error);
+	if (error != NULL)
+	{
+		cout << "Could not make output " << output.name << ": " << error->message << endl;
+		g_error_free(error);
+		if (bin != NULL)
+			gst_object_unref(bin);
+		return false;
 	}
-	catch (std::exception &e)
+
+	if (bin == NULL)
+	{
+		cout << "Could not make output " << output.name << "." << endl;
+		return false;
+	}
+
+	// leaky=2: drops the oldest. Named, so -thread <name>queue=<cores> can pin its thread.
+	GstElement *queue = gst_element_factory_make("queue", (output.name + "queue").c_str());
+	g_object_set(G_OBJECT(queue), "leaky", 2, "max-size-buffers", 0, "max-size-bytes", 0, "max-size-time", (guint64)output.maxQueueTime, NULL);
+	// 0: passing everything, 1: dropped something (a keyframe is to be asked for), 2: asked, waiting for it. Freed with the queue.
+	gint *pGate = g_new0(gint, 1);
+	g_object_set_data_full(G_OBJECT(queue), "keyframe-gate", pGate, g_free);
+	g_signal_connect(queue, "overrun", G_CALLBACK(cb_encoded_overrun), pGate);
+	GstPad *queueSrcPad = gst_element_get_static_pad(queue, "src");
+	gst_pad_add_probe(queueSrcPad, GST_PAD_PROBE_TYPE_BUFFER, cb_keyframe_gate, pGate, NULL);
+	gst_object_unref(queueSrcPad);
+	// next to the tee (in the pipeline's bin), since pads only link within a bin
+	GstObject *parent = gst_object_get_parent(GST_OBJECT(tee));
+	gst_bin_add_many(GST_BIN(parent), queue, bin, NULL);
+	gst_object_unref(parent);
+
+	GstPad *teePad = gst_element_get_request_pad(tee, "src_%u");
+	GstPad *queuePad = gst_element_get_static_pad(queue, "sink");
+	bool isLinked = gst_pad_link(teePad, queuePad) == GST_PAD_LINK_OK && gst_element_link(queue, bin) == TRUE;
+	gst_object_unref(queuePad);
+	gst_object_unref(teePad);
+	if (isLinked == false)
 	{
-		cerr << "An exception occurred in build_pipeline_display(): " << endl << e.what() << endl;
-		gst_element_send_event(m_source, gst_event_new_eos());
+		cout << "Could not link output " << output.name << " to the encoder." << endl;
 		return false;
-		
 	}
+
+	return prepare_branch(bin);
 }
 
-bool CPipelineHelper::build_pipeline_powerfail()
+void CPipelineHelper::add_source_branch(GstElement *source, const string &description)
 {
-	try
-	{
-		if (m_pipelineBuilt == true)
-		{
-			cout << "Cancelling -display. Another pipeline has already been built." << endl;
-			return false;
-		}
+	SourceBranch branch;
+	branch.source = source;
+	branch.description = description;
+	m_sourceBranches.push_back(branch);
+}
 
-		GstElement *source;
-		GstElement *filter;
-		GstCaps *filter_caps;
-		GstElement *convert;
-		GstElement *errmess;
-		GstElement *errinfo;
-		GstElement *sink;
-
-		cout << "Creating Pipeline for displaying images in local window..." << endl;
-		// Create gstreamer elements
-		source = gst_element_factory_make("videotestsrc", "videotestsrc");
-		filter = gst_element_factory_make("capsfilter", "capsfilter");
-		convert = gst_element_factory_make("videoconvert", "converter");
-		errmess = gst_element_factory_make("textoverlay", "textoverlay");
-		errinfo = gst_element_factory_make("textoverlay", "textoverlay2");
-		sink = gst_element_factory_make("nvdrmvideosink", "nvdrmvideosink"); // depending on your platform, you may have to use some alternative here, like ("autovideosink", "sink")
-
-		if (!source){ cout << "Could not make videotestsrc" << endl; return false; }
-		if (!filter){ cout << "Could not make filter" << endl; return false; }
-		if (!convert){ cout << "Could not make convert" << endl; return false; }
-		if (!errmess){ cout << "Could not make errmess" << endl; return false; }
-		if (!errinfo){ cout << "Could not make errinfo" << endl; return false; }
-		if (!sink){ cout << "Could not make sink" << endl; return false; }
-		
-		// Set up elements
-		//g_object_set(G_OBJECT(queue), "leaky", 2, NULL);
-		//g_object_set(G_OBJECT(queue), "max-size-time", 5000000000, NULL);
-
-		filter = gst_element_factory_make("capsfilter", "filter");
-		filter_caps = gst_caps_new_simple("video/x-raw",
-		  	"width", G_TYPE_INT, 1920,
-        	"height", G_TYPE_INT, 1080,
-		  NULL);
-		
-		g_object_set(G_OBJECT(filter), "caps", filter_caps, NULL);
-		gst_caps_unref(filter_caps);
-
-		g_object_set(G_OBJECT(errmess), "text", "LOW POWER", NULL);
-		g_object_set(G_OBJECT(errmess), "color", 4294901760, NULL); // #AARRGGBB -> int
-		g_object_set(G_OBJECT(errmess), "draw-outline", 0, NULL);
-		g_object_set(G_OBJECT(errmess), "ypad", 225, NULL); 
-		g_object_set(G_OBJECT(errmess), "font-desc", "Sans, 65", NULL); 
-
-		g_object_set(G_OBJECT(sink), "conn_id", 0, NULL);
-		g_object_set(G_OBJECT(sink), "plane_id", 1, NULL);
-		g_object_set(G_OBJECT(sink), "set_mode", 0, NULL);
-
-		// add and link the pipeline elements
-		gst_bin_add_many(GST_BIN(m_pipeline), source, filter, convert, errmess, errinfo, sink, NULL);
-		gst_element_link_many(source, filter, convert, errmess, errinfo, sink, NULL);
-		
-		
-		cout << "Pipeline Made." << endl;
-		
-		m_pipelineBuilt = true;
+// source -> its own branch, running alongside the pipeline
+bool CPipelineHelper::link_source_branch(const SourceBranch &branch)
+{
+	if (check_elements(branch.description) == false)
+		return false;
 
-		return true;
+	cout << "Adding branch for " << GST_OBJECT_NAME(branch.source) << ": " << branch.description << endl;
+	GError *error = NULL;
+	GstElement *bin = gst_parse_bin_from_description(branch.description.c_str(), TRUE, &error);
+	if (error != NULL)
+	{
+		cout << "Could not make the branch: " << error->message << endl;
+		g_error_free(error);
+		if (bin != NULL)
+			gst_object_unref(bin);
+		return false;
 	}
-	catch (std::exception &e)
+	if (bin == NULL)
 	{
-		cerr << "An exception occurred in build_pipeline_display(): " << endl << e.what() << endl;
-		gst_element_send_event(m_source, gst_event_new_eos());
+		cout << "Could not make the branch." << endl;
 		return false;
-		
 	}
+
+	gst_bin_add_many(GST_BIN(m_pipeline), branch.source, bin, NULL);
+	if (gst_element_link(branch.source, bin) == FALSE)
+	{
+		cout << "Could not link " << GST_OBJECT_NAME(branch.source) << " to its branch." << endl;
+		return false;
+	}
+	return prepare_branch(bin);
 }
 
-bool CPipelineHelper::build_pipeline_syserr()
+// Switch to the fallback. The message goes in its textoverlay named "fallbacktext", if it has one.
+bool CPipelineHelper::show_fallback(const string &message)
 {
-	try
+	if (m_selector == NULL)
 	{
-		if (m_pipelineBuilt == true)
-		{
-			cout << "Cancelling -display. Another pipeline has already been built." << endl;
-			return false;
-		}
-
-		GstElement *source;
-		GstElement *filter;
-		GstCaps *filter_caps;
-		GstElement *convert;
-		GstElement *errmess;
-		GstElement *errinfo;
-		GstElement *sink;
-
-		cout << "Creating Pipeline for displaying images in local window..." << endl;
-		// Create gstreamer elements
-		source = gst_element_factory_make("videotestsrc", "videotestsrc");
-		filter = gst_element_factory_make("capsfilter", "capsfilter");
-		convert = gst_element_factory_make("videoconvert", "converter");
-		errmess = gst_element_factory_make("textoverlay", "textoverlay");
-		errinfo = gst_element_factory_make("textoverlay", "textoverlay2");
-		sink = gst_element_factory_make("nvdrmvideosink", "nvdrmvideosink"); // depending on your platform, you may have to use some alternative here, like ("autovideosink", "sink")
-
-		if (!source){ cout << "Could not make videotestsrc" << endl; return false; }
-		if (!filter){ cout << "Could not make filter" << endl; return false; }
-		if (!convert){ cout << "Could not make convert" << endl; return false; }
-		if (!errmess){ cout << "Could not make errmess" << endl; return false; }
-		if (!errinfo){ cout << "Could not make errinfo" << endl; return false; }
-		if (!sink){ cout << "Could not make sink" << endl; return false; }
-		
-		// Set up elements
-		//g_object_set(G_OBJECT(queue), "leaky", 2, NULL);
-		//g_object_set(G_OBJECT(queue), "max-size-time", 5000000000, NULL);
-
-		filter = gst_element_factory_make("capsfilter", "filter");
-		filter_caps = gst_caps_new_simple("video/x-raw",
-		  	"width", G_TYPE_INT, 1920,
-        	"height", G_TYPE_INT, 1080,
-		  NULL);
-		
-		g_object_set(G_OBJECT(filter), "caps", filter_caps, NULL);
-		gst_caps_unref(filter_caps);
-
-		g_object_set(G_OBJECT(errmess), "text", "RESTART SYSTEM", NULL);
-		g_object_set(G_OBJECT(errmess), "color", 4294901760, NULL); // #AARRGGBB -> int
-		g_object_set(G_OBJECT(errmess), "draw-outline", 0, NULL);
-		g_object_set(G_OBJECT(errmess), "ypad", 225, NULL); 
-		g_object_set(G_OBJECT(errmess), "font-desc", "Sans, 65", NULL); 
-
-		g_object_set(G_OBJECT(sink), "conn_id", 0, NULL);
-		g_object_set(G_OBJECT(sink), "plane_id", 1, NULL);
-		g_object_set(G_OBJECT(sink), "set_mode", 0, NULL);
-
-		// add and link the pipeline elements
-		gst_bin_add_many(GST_BIN(m_pipeline), source, filter, convert, errmess, errinfo, sink, NULL);
-		gst_element_link_many(source, filter, convert, errmess, errinfo, sink, NULL);
-		
-		
-		cout << "Pipeline Made." << endl;
-		
-		m_pipelineBuilt = true;
+		cout << "This pipeline has no fallback." << endl;
+		return false;
+	}
 
-		return true;
+	cout << "Showing fallback: " << message << endl;
+	GstElement *text = gst_bin_get_by_name(GST_BIN(m_pipeline), "fallbacktext");
+	if (text != NULL)
+	{
+		g_object_set(G_OBJECT(text), "text", message.c_str(), NULL);
+		gst_object_unref(text);
 	}
-	catch (std::exception &e)
+
+	// let the fallback's images through (the next one is current), and pick them. The selector drops whatever the source sends meanwhile.
+	if (m_fallbackDrop != 0)
 	{
-		cerr << "An exception occurred in build_pipeline_display(): " << endl << e.what() << endl;
-		gst_element_send_event(m_source, gst_event_new_eos());
-		return false;
-		
+		gst_pad_remove_probe(m_fallbackSrc, m_fallbackDrop);
+		m_fallbackDrop = 0;
 	}
+	g_object_set(G_OBJECT(m_selector), "active-pad", m_fallbackPad, NULL);
+	return true;
 }
 
-bool CPipelineHelper::build_pipeline_fullusb()
+// Switch back to the source.
+bool CPipelineHelper::show_live()
 {
-	try
+	if (m_selector == NULL)
+		return false;
+
+	cout << "Showing live images." << endl;
+	g_object_set(G_OBJECT(m_selector), "active-pad", m_livePad, NULL);
+	if (m_fallbackDrop == 0)
+		m_fallbackDrop = gst_pad_add_probe(m_fallbackSrc, GST_PAD_PROBE_TYPE_BUFFER, cb_drop, NULL, NULL);
+	return true;
+}
+
+void CPipelineHelper::set_thread_policy(const string &elementName, const CThreadPolicy &policy)
+{
+	m_threadPolicies[elementName] = policy;
+
+	// Each streaming thread posts a stream-status message as it starts, from the thread itself. Synchronous messages are handled right there, so the policy is applied to it.
+	// (The signal, rather than a sync handler, leaves the bus's sync handler free for the application)
+	if (m_streamStatusHandler == 0)
 	{
-		if (m_pipelineBuilt == true)
-		{
-			cout << "Cancelling -display. Another pipeline has already been built." << endl;
-			return false;
-		}
+		GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(m_pipeline));
+		gst_bus_enable_sync_message_emission(bus);
+		m_streamStatusHandler = g_signal_connect(bus, "sync-message::stream-status", G_CALLBACK(cb_stream_status), this);
+		gst_object_unref(bus);
+	}
+}
 
-		GstElement *source;
-		GstElement *filter;
-		GstCaps *filter_caps;
-		GstElement *convert;
-		GstElement *errmess;
-		GstElement *errinfo;
-		GstElement *sink;
-
-		cout << "Creating Pipeline for displaying images in local window..." << endl;
-		// Create gstreamer elements
-		source = gst_element_factory_make("videotestsrc", "videotestsrc");
-		filter = gst_element_factory_make("capsfilter", "capsfilter");
-		convert = gst_element_factory_make("videoconvert", "converter");
-		errmess = gst_element_factory_make("textoverlay", "textoverlay");
-		errinfo = gst_element_factory_make("textoverlay", "textoverlay2");
-		sink = gst_element_factory_make("nvdrmvideosink", "nvdrmvideosink"); // depending on your platform, you may have to use some alternative here, like ("autovideosink", "sink")
-
-		if (!source){ cout << "Could not make videotestsrc" << endl; return false; }
-		if (!filter){ cout << "Could not make filter" << endl; return false; }
-		if (!convert){ cout << "Could not make convert" << endl; return false; }
-		if (!errmess){ cout << "Could not make errmess" << endl; return false; }
-		if (!errinfo){ cout << "Could not make errinfo" << endl; return false; }
-		if (!sink){ cout << "Could not make sink" << endl; return false; }
-		
-		// Set up elements
-		//g_object_set(G_OBJECT(queue), "leaky", 2, NULL);
-		//g_object_set(G_OBJECT(queue), "max-size-time", 5000000000, NULL);
-
-		filter = gst_element_factory_make("capsfilter", "filter");
-		filter_caps = gst_caps_new_simple("video/x-raw",
-		  	"width", G_TYPE_INT, 1920,
-        	"height", G_TYPE_INT, 1080,
-		  NULL);
-		
-		g_object_set(G_OBJECT(filter), "caps", filter_caps, NULL);
-		gst_caps_unref(filter_caps);
-
-		g_object_set(G_OBJECT(errmess), "text", "REPLACE USB DRIVE", NULL);
-		g_object_set(G_OBJECT(errmess), "color", 4294901760, NULL); // #AARRGGBB -> int
-		g_object_set(G_OBJECT(errmess), "draw-outline", 0, NULL);
-		g_object_set(G_OBJECT(errmess), "ypad", 225, NULL); 
-		g_object_set(G_OBJECT(errmess), "font-desc", "Sans, 65", NULL); 
-
-		g_object_set(G_OBJECT(sink), "conn_id", 0, NULL);
-		g_object_set(G_OBJECT(sink), "plane_id", 1, NULL);
-		g_object_set(G_OBJECT(sink), "set_mode", 0, NULL);
-
-		// add and link the pipeline elements
-		gst_bin_add_many(GST_BIN(m_pipeline), source, filter, convert, errmess, errinfo, sink, NULL);
-		gst_element_link_many(source, filter, convert, errmess, errinfo, sink, NULL);
-		
-		
-		cout << "Pipeline Made." << endl;
-		
-		m_pipelineBuilt = true;
+void CPipelineHelper::set_clip_recording(const string &folder, double prerollSeconds, double postrollSeconds)
+{
+	m_clipFolder = folder;
+	m_clipPreroll = prerollSeconds;
+	m_clipPostroll = postrollSeconds;
+}
 
-		return true;
+void CPipelineHelper::set_recording_sink(const string &description)
+{
+	m_recordingSink = description;
+}
+
+void CPipelineHelper::set_rtsp_server(const string &service, const string &path, const string &payloader)
+{
+	m_rtspService = service;
+	m_rtspPath = path;
+	m_rtspPayloader = payloader;
+}
+
+// One sink for each splitmuxsink. It sets the location on it for each file.
+bool CPipelineHelper::set_recording_sink(GstElement *splitmux)
+{
+	GError *error = NULL;
+	GstElement *sink = gst_parse_launch(m_recordingSink.c_str(), &error);
+	if (error != NULL || sink == NULL)
+	{
+		cout << "Could not make the recording sink " << m_recordingSink << ": " << (error != NULL ? error->message : "") << endl;
+		if (error != NULL)
+			g_error_free(error);
+		if (sink != NULL)
+			gst_object_unref(sink);
+		return false;
 	}
-	catch (std::exception &e)
+	if (GST_IS_BIN(sink))
 	{
-		cerr << "An exception occurred in build_pipeline_display(): " << endl << e.what() << endl;
-		gst_element_send_event(m_source, gst_event_new_eos());
+		cout << "The recording sink must be a single element, not " << m_recordingSink << endl;
+		gst_object_unref(sink);
 		return false;
-		
 	}
+
+	cout << "Recording with " << m_recordingSink << endl;
+	g_object_set(G_OBJECT(splitmux), "sink", sink, NULL);
+	return true;
 }
 
-bool CPipelineHelper::build_pipeline_temperr()
+bool CPipelineHelper::record_clip(double postrollSeconds)
 {
-	try
+	if (m_clipRecorder == NULL)
 	{
-		if (m_pipelineBuilt == true)
-		{
-			cout << "Cancelling -display. Another pipeline has already been built." << endl;
-			return false;
-		}
+		cout << "This pipeline has no element named clipsink to record clips from." << endl;
+		return false;
+	}
+	return m_clipRecorder->Trigger(postrollSeconds);
+}
 
-		GstElement *source;
-		GstElement *filter;
-		GstCaps *filter_caps;
-		GstElement *convert;
-		GstElement *errmess;
-		GstElement *errinfo;
-		GstElement *sink;
-
-		cout << "Creating Pipeline for displaying images in local window..." << endl;
-		// Create gstreamer elements
-		source = gst_element_factory_make("videotestsrc", "videotestsrc");
-		filter = gst_element_factory_make("capsfilter", "capsfilter");
-		convert = gst_element_factory_make("videoconvert", "converter");
-		errmess = gst_element_factory_make("textoverlay", "textoverlay");
-		errinfo = gst_element_factory_make("textoverlay", "textoverlay2");
-		sink = gst_element_factory_make("nvdrmvideosink", "nvdrmvideosink"); // depending on your platform, you may have to use some alternative here, like ("autovideosink", "sink")
-
-		if (!source){ cout << "Could not make videotestsrc" << endl; return false; }
-		if (!filter){ cout << "Could not make filter" << endl; return false; }
-		if (!convert){ cout << "Could not make convert" << endl; return false; }
-		if (!errmess){ cout << "Could not make errmess" << endl; return false; }
-		if (!errinfo){ cout << "Could not make errinfo" << endl; return false; }
-		if (!sink){ cout << "Could not make sink" << endl; return false; }
-		
-		// Set up elements
-		//g_object_set(G_OBJECT(queue), "leaky", 2, NULL);
-		//g_object_set(G_OBJECT(queue), "max-size-time", 5000000000, NULL);
-
-		filter = gst_element_factory_make("capsfilter", "filter");
-		filter_caps = gst_caps_new_simple("video/x-raw",
-		  	"width", G_TYPE_INT, 1920,
-        	"height", G_TYPE_INT, 1080,
-		  NULL);
-		
-		g_object_set(G_OBJECT(filter), "caps", filter_caps, NULL);
-		gst_caps_unref(filter_caps);
-
-		g_object_set(G_OBJECT(errmess), "text", "SYSTEM OVERHEATED", NULL);
-		g_object_set(G_OBJECT(errmess), "color", 4294901760, NULL); // #AARRGGBB -> int
-		g_object_set(G_OBJECT(errmess), "draw-outline", 0, NULL);
-		g_object_set(G_OBJECT(errmess), "ypad", 225, NULL); 
-		g_object_set(G_OBJECT(errmess), "font-desc", "Sans, 65", NULL); 
-
-		g_object_set(G_OBJECT(sink), "conn_id", 0, NULL);
-		g_object_set(G_OBJECT(sink), "plane_id", 1, NULL);
-		g_object_set(G_OBJECT(sink), "set_mode", 0, NULL);
-
-		// add and link the pipeline elements
-		gst_bin_add_many(GST_BIN(m_pipeline), source, filter, convert, errmess, errinfo, sink, NULL);
-		gst_element_link_many(source, filter, convert, errmess, errinfo, sink, NULL);
-		
-		
-		cout << "Pipeline Made." << endl;
-		
-		m_pipelineBuilt = true;
+bool CPipelineHelper::stop_clip()
+{
+	if (m_clipRecorder == NULL)
+	{
+		cout << "This pipeline has no element named clipsink to record clips from." << endl;
+		return false;
+	}
+	return m_clipRecorder->Stop();
+}
 
-		return true;
+// On the streaming thread which posted the message.
+void CPipelineHelper::cb_stream_status(GstBus *bus, GstMessage *message, gpointer user_data)
+{
+	CPipelineHelper *pHelper = (CPipelineHelper*)user_data;
+	GstStreamStatusType type;
+	GstElement *owner = NULL;
+	gst_message_parse_stream_status(message, &type, &owner);
+	if (type != GST_STREAM_STATUS_TYPE_ENTER || owner == NULL)
+		return;
+
+	map<string, CThreadPolicy>::iterator policy = pHelper->m_threadPolicies.find(GST_OBJECT_NAME(owner));
+	if (policy != pHelper->m_threadPolicies.end())
+		policy->second.Apply(string("streaming thread of ") + GST_OBJECT_NAME(owner));
+}
+
+// Whenever the source's caps are set, give the fallback the same ones.
+GstPadProbeReturn CPipelineHelper::cb_live_caps(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	CPipelineHelper *pHelper = (CPipelineHelper*)user_data;
+	GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+	if (GST_EVENT_TYPE(event) != GST_EVENT_CAPS)
+		return GST_PAD_PROBE_OK;
+
+	GstCaps *caps = NULL;
+	gst_event_parse_caps(event, &caps);
+	GstElement *filter = gst_bin_get_by_name(GST_BIN(pHelper->m_pipeline), "fallbackcaps");
+	if (filter != NULL)
+	{
+		g_object_set(G_OBJECT(filter), "caps", caps, NULL);
+		gst_object_unref(filter);
 	}
-	catch (std::exception &e)
+	return GST_PAD_PROBE_OK;
+}
+
+// Throws the fallback's images away while the probe is there.
+GstPadProbeReturn CPipelineHelper::cb_drop(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	return GST_PAD_PROBE_DROP;
+}
+
+// An encoded output's queue is full, and drops its oldest frame (leaky=2). On the encoder's streaming thread.
+void CPipelineHelper::cb_encoded_overrun(GstElement *queue, gpointer user_data)
+{
+	g_atomic_int_set((gint*)user_data, 1);
+}
+
+// On the output's queue thread: after a drop, only a keyframe (not a DELTA_UNIT) lets the output start again.
+GstPadProbeReturn CPipelineHelper::cb_keyframe_gate(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	gint *pGate = (gint*)user_data;
+	if (g_atomic_int_get(pGate) == 0)
+		return GST_PAD_PROBE_OK;
+
+	// Ask upstream (through the queue's sink pad, to the tee, to the encoder) rather than wait for the keyframe interval.
+	// (the GstForceKeyUnit event gst_video_event_new_upstream_force_key_unit() makes, without needing gstreamer-video)
+	if (g_atomic_int_compare_and_exchange(pGate, 1, 2) == TRUE)
 	{
-		cerr << "An exception occurred in build_pipeline_display(): " << endl << e.what() << endl;
-		gst_element_send_event(m_source, gst_event_new_eos());
-		return false;
-		
+		GstStructure *structure = gst_structure_new("GstForceKeyUnit",
+			"running-time", G_TYPE_UINT64, GST_CLOCK_TIME_NONE,
+			"all-headers", G_TYPE_BOOLEAN, TRUE,
+			"count", G_TYPE_UINT, 0,
+			NULL);
+		GstElement *queue = gst_pad_get_parent_element(pad);
+		GstPad *sinkPad = gst_element_get_static_pad(queue, "sink");
+		gst_pad_push_event(sinkPad, gst_event_new_custom(GST_EVENT_CUSTOM_UPSTREAM, structure));
+		gst_object_unref(sinkPad);
+		gst_object_unref(queue);
 	}
+
+	if (GST_BUFFER_FLAG_IS_SET(GST_PAD_PROBE_INFO_BUFFER(info), GST_BUFFER_FLAG_DELTA_UNIT))
+		return GST_PAD_PROBE_DROP;
+	// a keyframe: decodable from here. (If the queue overran again meanwhile, the gate stays shut for the next one)
+	g_atomic_int_compare_and_exchange(pGate, 2, 0);
+	return GST_PAD_PROBE_OK;
 }
 
 // ****************************************************************************
@@ -23,31 +23,99 @@
 #include <gst/gst.h>
 #include <gst/app/gstappsrc.h>
 #include <string>
+#include <map>
+#include <vector>
+#include "../../InstantCameraAppSrc/CThreadPolicy.h"
+#include "CClipRecorder.h"
+#include "CRtspServer.h"
 
 using namespace std;
 
 // Given a pipeline and source, this class will finish building pipelines of various elements for various purposes.
+// The pipelines themselves are descriptions in gst-launch-1.0 syntax (see CPipelineConfig), so they can be changed without rebuilding.
 
 class CPipelineHelper
 {
 public:
-	CPipelineHelper(GstElement *pipeline, GstElement *source);
+	// source: the camera, or NULL for pipelines which make their own images. tzOffset: hours added to UTC in the names of recordings.
+	CPipelineHelper(GstElement *pipeline, GstElement *source, int tzOffset = 0);
 	~CPipelineHelper();
+	CPipelineHelper(const CPipelineHelper&) = delete;
+	CPipelineHelper& operator=(const CPipelineHelper&) = delete;
 	
 	bool close_pipeline();
 	bool update_overlay(const gchar* updatetext);
-	// example of how to create a pipeline for display in a window
-	bool build_pipeline_display();
-	bool build_pipeline_h264file(const int tzOffset);
-	bool build_pipeline_display_h264file(const int tzOffset);
-	bool build_pipeline_camfail();
-	bool build_pipeline_syserr();
-	bool build_pipeline_powerfail();
-	bool build_pipeline_fullusb();
-	bool build_pipeline_temperr();
+	// Check and build the pipeline described (eg: "videoconvert ! autovideosink"), after the source.
+	// With a fallback description (something that makes images, eg: a videotestsrc with a textoverlay named "fallbacktext"), an input-selector goes between
+	// the source and the pipeline, so show_fallback() can switch to the fallback at any time (eg: when the camera is unplugged) without stopping the pipeline.
+	bool build_pipeline(const string &description, const string &fallback = "");
+	// Show the fallback images with this message, or the source's images again.
+	bool show_fallback(const string &message);
+	bool show_live();
+	// Pin the streaming thread an element starts (eg: a queue named in the description, "queue name=encodequeue"), and all of the branch it runs, to cores and a real-time priority.
+	// Set before the pipeline starts. The camera's own threads are set with GrabSettings.
+	void set_thread_policy(const string &elementName, const CThreadPolicy &policy);
+	// Where clips go and how long they are, for pipelines ending in an appsink named "clipsink" (see CClipRecorder). Set before build_pipeline().
+	void set_clip_recording(const string &folder, double prerollSeconds, double postrollSeconds);
+	// Write the last prerollSeconds and the next postrollSeconds (-1 = as set) to a new clip. False if the pipeline has no clipsink.
+	bool record_clip(double postrollSeconds = -1);
+	// End the clip being written now. False if there's none.
+	bool stop_clip();
+	// The element each splitmuxsink writes its files with, instead of its filesink (eg: "asyncfilesink sync-interval=1000"). Set before build_pipeline().
+	void set_recording_sink(const string &description);
+	// Serve pipelines ending in an appsink named "rtspsink" at rtsp://<host>:<service><path>, payloaded with payloader (see CRtspServer). Set before build_pipeline().
+	void set_rtsp_server(const string &service, const string &path, const string &payloader);
+	// One encode, any number of consumers: the pipeline ends in a tee named "encoded" (after the encoder and parser), and each output is a description
+	// of its own (eg: the recorder, an RTP stream, the clipsink) on a branch of that tee, behind a leaky queue holding up to maxQueueTime.
+	// A slow output loses data from its own queue instead of holding up the others, the encoder, or the display. Add them before build_pipeline().
+	void add_encoded_output(const string &name, const string &description, GstClockTime maxQueueTime = 2 * GST_SECOND);
+	// Another source with a branch of its own (eg: another stream of the camera's sequence, see CInstantCameraAppSrc::GetSequenceSource()). Add before build_pipeline().
+	void add_source_branch(GstElement *source, const string &description);
 	
 private:
+	struct EncodedOutput
+	{
+		string name;
+		string description;
+		GstClockTime maxQueueTime;
+	};
+	struct SourceBranch
+	{
+		GstElement *source;
+		string description;
+	};
+
 	bool m_pipelineBuilt;
 	GstElement *m_pipeline;
 	GstElement *m_source;
-};
+	int m_tzOffset;
+	GstElement *m_selector;
+	GstPad *m_livePad; // the selector's pads
+	GstPad *m_fallbackPad;
+	GstPad *m_fallbackSrc; // the end of the fallback branch, its images dropped while it's not shown
+	gulong m_fallbackDrop; // the dropping probe, 0 while the fallback is shown
+	map<string, CThreadPolicy> m_threadPolicies; // by element name
+	gulong m_streamStatusHandler;
+	CClipRecorder *m_clipRecorder; // NULL unless the pipeline has a clipsink
+	string m_clipFolder;
+	double m_clipPreroll;
+	double m_clipPostroll;
+	string m_recordingSink;
+	CRtspServer *m_rtspServer; // NULL unless the pipeline has an rtspsink
+	string m_rtspService;
+	string m_rtspPath;
+	string m_rtspPayloader;
+	vector<EncodedOutput> m_encodedOutputs;
+	vector<SourceBranch> m_sourceBranches;
+
+	bool check_elements(const string &launch);
+	bool set_recording_sink(GstElement *splitmux);
+	bool prepare_branch(GstElement *bin);
+	bool link_encoded_output(GstElement *tee, const EncodedOutput &output);
+	bool link_source_branch(const SourceBranch &branch);
+	static GstPadProbeReturn cb_live_caps(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+	static GstPadProbeReturn cb_drop(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+	static void cb_encoded_overrun(GstElement *queue, gpointer user_data);
+	static GstPadProbeReturn cb_keyframe_gate(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+	static void cb_stream_status(GstBus *bus, GstMessage *message, gpointer user_data);
+};
\ No newline at end of file
@@ -0,0 +1,214 @@
+/*  CRtspServer.cpp: Definition file for CRtspServer Class.
+    Serves the pipeline's encoded video over RTSP. Every client gets the same encode.
+
+	Copyright 2017-2019 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+*/
+
+#include "CRtspServer.h"
+
+#include <iostream>
+
+using namespace std;
+
+CRtspServer::CRtspServer(GstElement *appsink)
+{
+	m_appsink = GST_ELEMENT(gst_object_ref(appsink));
+	m_appsrc = NULL;
+	m_caps = NULL;
+	m_clients = 0;
+#ifdef USE_RTSP_SERVER
+	m_server = NULL;
+	m_serverSource = 0;
+#endif
+
+	// Taken as it comes, from the streaming thread. No clock: the clients' jitter buffers do the pacing, and every ms here is latency.
+	g_object_set(G_OBJECT(m_appsink), "sync", FALSE, "max-buffers", 0, "drop", FALSE, NULL);
+	GstAppSinkCallbacks callbacks = { NULL, NULL, cb_new_sample };
+	gst_app_sink_set_callbacks(GST_APP_SINK(m_appsink), &callbacks, this, NULL);
+}
+
+CRtspServer::~CRtspServer()
+{
+	GstAppSinkCallbacks callbacks = { NULL, NULL, NULL };
+	gst_app_sink_set_callbacks(GST_APP_SINK(m_appsink), &callbacks, NULL, NULL);
+
+#ifdef USE_RTSP_SERVER
+	if (m_serverSource != 0)
+		g_source_remove(m_serverSource);
+	if (m_server != NULL)
+		g_object_unref(m_server);
+#endif
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (m_appsrc != NULL)
+		gst_object_unref(m_appsrc);
+	if (m_caps != NULL)
+		gst_caps_unref(m_caps);
+	gst_object_unref(m_appsink);
+}
+
+int CRtspServer::GetClientCount()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_clients;
+}
+
+// A new client can't decode anything until the next keyframe. Ask the encoder for one now, rather than waiting for the keyframe interval.
+// (gst_video_event_new_upstream_force_key_unit() makes the same event, without needing gstreamer-video)
+void CRtspServer::request_keyframe()
+{
+	GstStructure *structure = gst_structure_new("GstForceKeyUnit",
+		"running-time", G_TYPE_UINT64, GST_CLOCK_TIME_NONE,
+		"all-headers", G_TYPE_BOOLEAN, TRUE,
+		"count", G_TYPE_UINT, 0,
+		NULL);
+	GstPad *pad = gst_element_get_static_pad(m_appsink, "sink");
+	gst_pad_push_event(pad, gst_event_new_custom(GST_EVENT_CUSTOM_UPSTREAM, structure));
+	gst_object_unref(pad);
+}
+
+GstFlowReturn CRtspServer::cb_new_sample(GstAppSink *appsink, gpointer user_data)
+{
+	CRtspServer *pServer = (CRtspServer*)user_data;
+	GstSample *sample = gst_app_sink_pull_sample(appsink);
+	if (sample == NULL)
+		return GST_FLOW_OK;
+
+	GstBuffer *buffer = gst_sample_get_buffer(sample);
+	GstCaps *caps = gst_sample_get_caps(sample);
+	{
+		std::lock_guard<std::mutex> lock(pServer->m_lock);
+		if (caps != NULL && (pServer->m_caps == NULL || gst_caps_is_equal(caps, pServer->m_caps) == FALSE))
+		{
+			gst_caps_replace(&pServer->m_caps, caps);
+			if (pServer->m_appsrc != NULL)
+				gst_app_src_set_caps(pServer->m_appsrc, caps);
+		}
+
+		// Nobody watching: nothing to do. Otherwise the data is shared, only the timestamps are new (do-timestamp, from the media's clock).
+		if (pServer->m_appsrc != NULL && buffer != NULL)
+		{
+			GstBuffer *copy = gst_buffer_copy(buffer);
+			GST_BUFFER_PTS(copy) = GST_CLOCK_TIME_NONE;
+			GST_BUFFER_DTS(copy) = GST_CLOCK_TIME_NONE;
+			gst_app_src_push_buffer(pServer->m_appsrc, copy);
+		}
+	}
+
+	gst_sample_unref(sample);
+	return GST_FLOW_OK;
+}
+
+#ifdef USE_RTSP_SERVER
+
+bool CRtspServer::Start(const string &service, const string &path, const string &payloader)
+{
+	if (m_server != NULL)
+		return true;
+
+	m_server = gst_rtsp_server_new();
+	gst_rtsp_server_set_service(m_server, service.c_str());
+	g_signal_connect(m_server, "client-connected", G_CALLBACK(cb_client_connected), this);
+
+	// one media for everyone, made when the first client asks for it
+	GstRTSPMediaFactory *factory = gst_rtsp_media_factory_new();
+	string launch = "( appsrc name=rtspsrc ! " + payloader + " )";
+	gst_rtsp_media_factory_set_launch(factory, launch.c_str());
+	gst_rtsp_media_factory_set_shared(factory, TRUE);
+	g_signal_connect(factory, "media-configure", G_CALLBACK(cb_media_configure), this);
+
+	GstRTSPMountPoints *mounts = gst_rtsp_server_get_mount_points(m_server);
+	gst_rtsp_mount_points_add_factory(mounts, path.c_str(), factory);
+	g_object_unref(mounts);
+
+	m_serverSource = gst_rtsp_server_attach(m_server, NULL);
+	if (m_serverSource == 0)
+	{
+		cout << "Could not start the RTSP server on port " << service << "." << endl;
+		g_object_unref(m_server);
+		m_server = NULL;
+		return false;
+	}
+
+	cout << "RTSP server ready at rtsp://<this machine>:" << service << path << endl;
+	return true;
+}
+
+// The first client has asked for the media, and its pipeline has just been made.
+void CRtspServer::cb_media_configure(GstRTSPMediaFactory *factory, GstRTSPMedia *media, gpointer user_data)
+{
+	CRtspServer *pServer = (CRtspServer*)user_data;
+	GstElement *element = gst_rtsp_media_get_element(media);
+	GstElement *appsrc = gst_bin_get_by_name_recurse_up(GST_BIN(element), "rtspsrc");
+	gst_object_unref(element);
+	if (appsrc == NULL)
+		return;
+
+	// a little queued is plenty. Stamped on the way in, against the media's own clock.
+	g_object_set(G_OBJECT(appsrc), "is-live", TRUE, "format", GST_FORMAT_TIME, "do-timestamp", TRUE, "max-bytes", (guint64)(2 * 1024 * 1024), NULL);
+	g_signal_connect(media, "unprepared", G_CALLBACK(cb_media_unprepared), pServer);
+	{
+		std::lock_guard<std::mutex> lock(pServer->m_lock);
+		if (pServer->m_caps != NULL)
+			gst_app_src_set_caps(GST_APP_SRC(appsrc), pServer->m_caps);
+		if (pServer->m_appsrc != NULL)
+			gst_object_unref(pServer->m_appsrc);
+		pServer->m_appsrc = GST_APP_SRC(appsrc);
+	}
+	pServer->request_keyframe();
+}
+
+// The last client has gone, and the media with it.
+void CRtspServer::cb_media_unprepared(GstRTSPMedia *media, gpointer user_data)
+{
+	CRtspServer *pServer = (CRtspServer*)user_data;
+	std::lock_guard<std::mutex> lock(pServer->m_lock);
+	if (pServer->m_appsrc != NULL)
+	{
+		gst_object_unref(pServer->m_appsrc);
+		pServer->m_appsrc = NULL;
+	}
+}
+
+void CRtspServer::cb_client_connected(GstRTSPServer *server, GstRTSPClient *client, gpointer user_data)
+{
+	CRtspServer *pServer = (CRtspServer*)user_data;
+	g_signal_connect(client, "closed", G_CALLBACK(cb_client_closed), pServer);
+	std::lock_guard<std::mutex> lock(pServer->m_lock);
+	pServer->m_clients++;
+	cout << "RTSP client connected (" << pServer->m_clients << " watching)." << endl;
+}
+
+void CRtspServer::cb_client_closed(GstRTSPClient *client, gpointer user_data)
+{
+	CRtspServer *pServer = (CRtspServer*)user_data;
+	std::lock_guard<std::mutex> lock(pServer->m_lock);
+	pServer->m_clients--;
+	cout << "RTSP client left (" << pServer->m_clients << " watching)." << endl;
+}
+
+#else
+
+bool CRtspServer::Start(const string &service, const string &path, const string &payloader)
+{
+	cout << "This program was built without the RTSP server. Install gst-rtsp-server (eg: libgstrtspserver-1.0-dev) and rebuild." << endl;
+	return false;
+}
+
+#endif
@@ -0,0 +1,71 @@
+/*  CRtspServer.h: header file for CRtspServer Class.
+    Serves the pipeline's encoded video over RTSP. Every client gets the same encode.
+
+	Copyright 2017 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+*/
+
+#pragma once
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <string>
+#include <mutex>
+#ifdef USE_RTSP_SERVER
+#include <gst/rtsp-server/rtsp-server.h>
+#endif
+
+// ******* CRtspServer *******
+// The pipeline ends in an appsink with the encoded stream (byte-stream, one access unit per buffer, SPS/PPS with each keyframe), eg:
+//   ... ! ${encoder} ! h264parse config-interval=-1 ! video/x-h264,stream-format=byte-stream,alignment=au ! appsink name=rtspsink
+// Clients of rtsp://<host>:<service><path> share one media, which starts with the first of them: "( appsrc name=rtspsrc ! <payloader> )".
+// The payloader is a description ending in an RTP payloader named pay0 (eg: "h264parse ! rtph264pay name=pay0 pt=96 config-interval=-1 mtu=1400").
+// Buffers are stamped as they go into the media, so the camera pipeline's clock doesn't matter, and a keyframe is asked of the encoder whenever the media starts.
+// The server runs in the default main context (the demo's main loop).
+// Only built with USE_RTSP_SERVER (gst-rtsp-server). Without it Start() says so and returns false.
+class CRtspServer
+{
+public:
+	CRtspServer(GstElement *appsink);
+	~CRtspServer();
+	CRtspServer(const CRtspServer&) = delete;
+	CRtspServer& operator=(const CRtspServer&) = delete;
+
+	bool Start(const std::string &service, const std::string &path, const std::string &payloader);
+	int GetClientCount();
+
+private:
+	GstElement *m_appsink;
+	std::mutex m_lock;
+	GstAppSrc *m_appsrc; // the shared media's source while there is one
+	GstCaps *m_caps;
+	int m_clients;
+
+	void request_keyframe();
+	static GstFlowReturn cb_new_sample(GstAppSink *appsink, gpointer user_data);
+#ifdef USE_RTSP_SERVER
+	GstRTSPServer *m_server;
+	guint m_serverSource;
+
+	static void cb_media_configure(GstRTSPMediaFactory *factory, GstRTSPMedia *media, gpointer user_data);
+	static void cb_media_unprepared(GstRTSPMedia *media, gpointer user_data);
+	static void cb_client_connected(GstRTSPServer *server, GstRTSPClient *client, gpointer user_data);
+	static void cb_client_closed(GstRTSPClient *client, gpointer user_data);
+#endif
+};
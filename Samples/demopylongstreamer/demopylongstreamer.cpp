@@ -38,31 +38,76 @@
 
 	Options:
 	-camera <serialnumber> (Use a specific camera. If not specified, will use first camera found.)
-	-aoi <width> <height> (Camera's Area Of Interest. If not specified, will use camera's maximum.)
+	-aoi <width> <height> (Camera's Area Of Interest, centered. If not specified, will use the camera's settings (pfs file). While running, type ROI <width> <height> <offsetX> <offsetY> <binning> to change it (-1 = as big as it goes, or centered) and run at the highest frame rate it allows. eg: ROI -1 200 -1 -1 1 for a band of 200 lines.)
 	-rescale <width> <height> (Will rescale the image for the pipeline if desired.)
-	-rotate <degrees clockwise> (Will rotate 90, 180, 270 degrees clockwise)
+	-rotate <degrees clockwise> (Will rotate 90, 180, 270 degrees clockwise. Default is 270, for the portrait-mounted camera of the sample pipelines. 0 = no rotation.)
 	-framerate <fps> (If not specified, will use camera's maximum under current settings.)
 	-ondemand (Will software trigger the camera when needed instead of using continuous free run. May lower CPU load.)
 	-usetrigger (Will configure the camera to expect a hardware trigger on IO Line 1. eg: TTL signal.)
+	-triggerahead <images> (With -ondemand: trigger the next 1 or 2 images as soon as one is retrieved, so each is ready a frame earlier. Queues the images (onebyone).)
+	-triggerrate <fps> (Software trigger the camera at this rate, from a clock of its own, instead of free run.)
+	-triggerbyinput (Software trigger the camera each time TRIG is typed while running.)
+	-zerocopy (Will hand the driver's image buffers straight to the pipeline instead of copying each frame. Saves CPU at high resolutions.)
+	-bufferpool (Like -zerocopy, but the driver grabs into a GStreamer buffer pool sized to what the pipeline holds on to.)
+	-pushmode (Will push each image to the pipeline from a dedicated grab thread, instead of waiting for the pipeline to ask for one.)
+	-grabstrategy <latest|latestimages|onebyone|upcoming> (How the driver queues images. If not specified, onebyone for recording pipelines, latest otherwise.)
+	-maxbuffers <number> (Number of image buffers the driver grabs into. More buffers ride out longer pipeline hiccups without dropping images.)
+	-queuesize <number> (With -grabstrategy latestimages, how many of the newest images are kept waiting for the pipeline.)
+	-hwtimestamps (Will timestamp images with the camera's exposure time instead of their arrival time. Gives smoother timing in recordings.)
+	-reset (Will reset the camera to its default settings before loading NodeMap.pfs, or the -camparam file.)
+	-fullpfs (Will write every feature of the pfs file and read them all back, instead of only those the camera doesn't have already.)
+	-savesettings (Will save the camera's settings in UserSet1, and start the camera with them from now on. Then use -usersettings for a quicker start.)
+	-usersettings (Will load the settings saved in the camera with -savesettings instead of a pfs file. Quicker.)
+	-stats <ms> (Will print acquisition statistics (fps, latency, skipped images...) every so many milliseconds.)
+	-statsd <host:port> (With -stats, also sends the statistics to a statsd server.)
+	-prometheus <filename> (With -stats, also writes the statistics to a file in Prometheus text format. eg: for node_exporter's textfile collector.)
+	-grabthread <cores>[:<priority>] (Will pin the grab thread (-pushmode) to these cores, eg: 2 or 2,3. With a priority (1-99), it and the driver's grab engine run SCHED_FIFO. Needs root or CAP_SYS_NICE.)
+	-streamthread <cores>[:<priority>] (Likewise for the camera's streaming thread, which retrieves the images unless -pushmode is used. eg: -streamthread 1:60)
 
 	Pipeline Examples (pick one):
 	-h264stream <ipaddress> (Encodes images as h264 and transmits stream to another PC running a GStreamer receiving pipeline.)
 	-h264file <filename> <number of images> (Encodes images as h264 and records stream to local file.)
+	-rtspserver [port] (Encodes images for live viewing and serves them over RTSP, at rtsp://<this machine>:8554/camera by default. Every client shares the one encode. Needs gst-rtsp-server.)
+	-h264srt [port] (Encodes images for live viewing and serves them over SRT in MPEG-TS, on port 8888 by default. See the srt-latency setting.)
+	-fanout (Displays the images, and encodes them once for a recording, an RTP stream and clips together. A slow output drops its own data, not the others'. See the outputs setting.)
+	-h264clips (Encodes images as h264 and keeps the last seconds in memory. Type CLIP to save them, and the seconds after, to a clip file. See the clip-preroll and clip-postroll settings.)
 	-window (displays the raw image stream in a window on the local machine.)
 	-framebuffer <fbdevice> (directs raw image stream to Linux framebuffer. eg: /dev/fb0)
 	-parse <string> (try your existing gst-launch-1.0 pipeline string. We will replace the original pipeline source with the Basler camera.)
+	-pipeline <name> (any pipeline from CPipelineConfig.cpp, or from a -config file. eg: window, h264file, camfail)
+
+	Pipeline Settings:
+	-config <filename> (Loads pipelines and settings from a key file, which change or add to the built-in ones. See pipelines.ini.)
+	-set <name>=<value> (Overrides a pipeline setting, to try encoder and queue settings without rebuilding. eg: -set bitrate=5750000)
+	  The encoder is picked for this system. Change it with the codec (h264, h265), encoder-backend (auto, nvv4l2, omx, v4l2, vaapi, software), bitrate, rate-control (cbr, vbr), keyframe-interval, encoder-profile and encoder-preset settings. eg: -set codec=h265
+	-nofallback (Will end the pipeline when the camera is removed, instead of showing the camera failure screen until it's back.)
+	-reconnect <ms> (While the camera failure screen shows, looks for the camera every so many milliseconds, and goes back to live images when it's found. Default 1000. 0 = don't.)
+	-thread <element>=<cores>[:<priority>] (Will pin the streaming thread started by a named element of the pipeline, and the branch it runs, to these cores. eg: -thread encodequeue=3:50. Can be repeated.)
+	-sequence <steps> (Runs the camera's sequencer (USB cameras): each image is the next step of <width>x<height>[@<exposure us>]:<stream>, comma separated, -1 = full size. Stream 0 is the pipeline, the others go through the sequence-branch setting. eg: -sequence -1x-1:0,-1x200:1,-1x200:1,-1x200:1 for a full frame preview and a 200 line band at three times its rate.)
+	-asyncwrites (Recordings are written by asyncfilesink, from a thread of its own with large writes, so a slow disk doesn't hold up the pipeline. See the asyncwriter and min-free-space settings.)
+	-adaptive (When the pipeline can't keep up (full queues, QoS, a slow disk, or the CPU over adaptive-max-temp), steps the bitrate down to adaptive-min-bitrate, then the framerate down to adaptive-min-fps, and back up when it can.)
+	-analysis (Measures each image where it's grabbed, from 1 in 64 of its pixels (luminance, motion, focus, in its PylonFrameMeta), instead of a videoanalyse element reading all of it again. See the analysis-step and analyser settings.)
+	-motionclips <threshold> (With -analysis, and -h264clips: record a clip whenever the motion between images goes over <threshold>, 0-255. eg: -motionclips 8)
+	-autoadjust (With -analysis: when the image stays too dark or too bright for a second, runs the camera's exposure, gain and white balance auto functions once.)
+	-control <socket> (Takes commands from clients of this Unix socket too (eg: socat - UNIX-CONNECT:/tmp/demopylongstreamer.sock), or of this TCP port on 127.0.0.1 (eg: -control 5800, the only choice on Windows). They're the same ones typed in the console: HELP lists them.)
 
 	Examples:
 	demopylongstreamer -window
 	demopylongstreamer -camera 12345678 -aoi 640 480 -framerate 15 -rescale 320 240 -h264file mymovie.h264
 	demopylongstreamer -rescale 320 240 -parse "gst-launch-1.0 videotestsrc ! videoflip method=vertical-flip ! videoconvert ! autovideosink"
+	demopylongstreamer -config pipelines.ini -set bitrate=5000000 -h264file
 
 	Quick-Start Example:
 	demopylongstreamer -window
+
+	Watching the live streams with little latency (a small jitter buffer, and shown as soon as decoded):
+	gst-launch-1.0 udpsrc port=5000 caps="application/x-rtp,media=video,encoding-name=H264,payload=96" ! rtpjitterbuffer latency=20 ! rtph264depay ! avdec_h264 ! videoconvert ! autovideosink sync=false
+	gst-launch-1.0 rtspsrc location=rtsp://<camera machine>:8554/camera latency=20 ! rtph264depay ! avdec_h264 ! videoconvert ! autovideosink sync=false
+	gst-launch-1.0 srtsrc uri=srt://<camera machine>:8888 latency=50 ! tsdemux ! h264parse ! avdec_h264 ! videoconvert ! autovideosink sync=false
 	
 	NVIDIA TX1/TX2 Note:
 	When using autovideosink for display, the system-preferred built-in videosink plugin does advertise the formats it supports. So the image must be converted manually.
-	For an example of how to do this, see CPipelineHelper::build_pipeline_display(). 
+	For an example of how to do this, see the window pipeline in CPipelineConfig.cpp.
 	If you are using demopylongstreamer with the -parse argument in order to use your own pipeline, add a caps filter after the normal videoconvert and before autovideosink:
 	./demopylongstreamer -parse "gst-launch-1.0 videotestsrc ! videoflip method=vertical-flip ! videoconvert ! video/x-raw,format=I420 ! autovideosink"
 
@@ -74,8 +119,17 @@
 
 #include "../../InstantCameraAppSrc/CInstantCameraAppSrc.h"
 #include "CPipelineHelper.h"
+#include "CPipelineConfig.h"
+#include "gstasyncfilesink.h"
+#include "CEncoderFactory.h"
+#include "CAdaptiveController.h"
+#include "CControlChannel.h"
 #include <gst/gst.h>
-#include <thread>
+#ifndef WIN32
+#include <glib-unix.h>
+#endif
+#include <sstream>
+#include <stdio.h>
 
 //#include <mcheck.h>
 
@@ -84,8 +138,6 @@ using namespace std;
 
 int exitCode = 0;
 
-string input = "";
-
 // ******* variables, call-backs, etc. for use with gstreamer ********
 // The main event loop manages all the available sources of events for GLib and GTK+ applications
 GMainLoop *loop;
@@ -96,6 +148,14 @@ guint bus_watch_id;
 // we link elements together in a pipeline, and send messages to/from the pipeline.
 GstElement *pipeline;
 
+// the sample pipelines, and any changes to them (-config, -set)
+CPipelineConfig pipelineConfig;
+// builds the pipeline, and switches it to the fallback screen and back. Set while the pipeline runs.
+CPipelineHelper *pipelineHelper = NULL;
+CInstantCameraAppSrc *pCamera = NULL; // for ROI and -autoadjust, while the camera's pipeline runs
+// the fullusb message shows when a recording's disk has less than this many bytes free (the min-free-space setting, in MB)
+guint64 minFreeSpace = 0;
+
 static void sigint_restore()
 {
 	try
@@ -117,15 +177,20 @@ void TestHandler(int dummy){
 	cout << "TEST HANDLER:  " << dummy << endl;
 }
 
-// Signal handler for ctrl+c
+// send End Of Stream event to all pipeline elements. Each finishes what it has (eg: the recording's index), then bus_call() quits the main loop.
+static void send_eos()
+{
+	cout << endl;
+	cout << "Sending EOS event to pipeline..." << endl;
+	gst_element_send_event(pipeline, gst_event_new_eos());
+}
+
+// Signal handler for ctrl+c (Windows. Elsewhere, cb_quit_signal())
 void IntHandler(int dummy)
 {
 	try
 	{
-		// send End Of Stream event to all pipeline elements
-		cout << endl;
-		cout << "Sending EOS event to pipeline..." << endl;
-		gst_element_send_event(pipeline, gst_event_new_eos());
+		send_eos();
 		cout << "sigint_restore..." << endl;
 		sigint_restore();
 		cout << "return..." << endl;
@@ -137,6 +202,16 @@ void IntHandler(int dummy)
 	}
 }
 
+#ifndef WIN32
+// Ctrl+C and SIGTERM, on the main loop instead of in the signal handler, where the pipeline mustn't be touched.
+// The first one only: with its source gone, the next Ctrl+C ends the program at once (eg: if the EOS never makes it through).
+static gboolean cb_quit_signal(gpointer user_data)
+{
+	send_eos();
+	return G_SOURCE_REMOVE;
+}
+#endif
+
 // handler for bus call messages
 gboolean bus_call(GstBus *bus, GstMessage *msg, gpointer data)
 {
@@ -165,6 +240,53 @@ gboolean bus_call(GstBus *bus, GstMessage *msg, gpointer data)
 			break;
 		}
 
+		case GST_MESSAGE_ELEMENT: {
+			// acquisition statistics from the camera (see -stats)
+			if (gst_message_has_name(msg, "pylon-stats"))
+			{
+				const GstStructure *stats = gst_message_get_structure(msg);
+				guint64 frames = 0, skipped = 0, lost = 0, failed = 0;
+				gdouble fps = 0, targetFps = 0, latency = 0;
+				gint64 latencyP99 = 0;
+				gst_structure_get_uint64(stats, "frames", &frames);
+				gst_structure_get_uint64(stats, "skipped-images", &skipped);
+				gst_structure_get_uint64(stats, "lost-frames", &lost);
+				gst_structure_get_uint64(stats, "failed-grabs", &failed);
+				gst_structure_get_double(stats, "fps", &fps);
+				gst_structure_get_double(stats, "target-fps", &targetFps);
+				gst_structure_get_double(stats, "grab-to-push-mean-us", &latency);
+				gst_structure_get_int64(stats, "grab-to-push-p99-us", &latencyP99);
+				g_print("Camera %s: %" G_GUINT64_FORMAT " frames, %.1f/%.1f fps, latency %.0f us (p99 %" G_GINT64_FORMAT " us), %" G_GUINT64_FORMAT " skipped, %" G_GUINT64_FORMAT " lost, %" G_GUINT64_FORMAT " failed\n",
+					gst_structure_get_string(stats, "camera"), frames, fps, targetFps, latency, latencyP99, skipped, lost, failed);
+			}
+			// the recording's disk (see -asyncwrites). When it's nearly full, say so on the screen, once.
+			else if (gst_message_has_name(msg, "async-file-sink-stats"))
+			{
+				static bool isFullShown = false;
+				const GstStructure *stats = gst_message_get_structure(msg);
+				guint64 freeSpace = 0, pending = 0, stalls = 0;
+				gdouble throughput = 0;
+				gst_structure_get_uint64(stats, "free-space", &freeSpace);
+				gst_structure_get_uint64(stats, "pending-bytes", &pending);
+				gst_structure_get_uint64(stats, "stalls", &stalls);
+				gst_structure_get_double(stats, "throughput", &throughput);
+				g_print("Disk: %.1f MB/s, %" G_GUINT64_FORMAT " MB pending, %" G_GUINT64_FORMAT " MB free, %" G_GUINT64_FORMAT " stalls\n",
+					throughput / 1000000, pending / 1000000, freeSpace / 1000000, stalls);
+
+				if (freeSpace != 0 && freeSpace < minFreeSpace && isFullShown == false && pipelineHelper != NULL)
+				{
+					isFullShown = true;
+					pipelineHelper->show_fallback(pipelineConfig.GetValue("fullusb", "message"));
+				}
+			}
+			// With a fallback, the pipeline keeps running without the camera. Show the camera failure screen until it's back.
+			else if (gst_message_has_name(msg, "pylon-camera-removed") && pipelineHelper != NULL)
+				pipelineHelper->show_fallback(pipelineConfig.GetValue("camfail", "message"));
+			else if (gst_message_has_name(msg, "pylon-camera-restored") && pipelineHelper != NULL)
+				pipelineHelper->show_live();
+			break;
+		}
+
 		default:
 			break;
 		}
@@ -204,29 +326,113 @@ int frameRate = -1;
 int numImagesToRecord = -1; // capture indefinitley unless otherwise specified.
 int scaledWidth = -1; // do not scale by default
 int scaledHeight = -1;
-int rotation = -1; // do not rotate or flip image by default
+int rotation = 270; // the sample pipelines expect the 1080x1920 camera image turned to 1920x1080
 int tzOffset = 0;
 bool needCam = false;
-bool h264stream = false;
-bool h264multicast = false;
-bool h264file = false;
-bool display = false;
-bool displayh264file = false;
-bool camfail = false;
-bool powfail = false;
-bool syserr = false;
-bool fullusb = false;
-bool temperr = false;
-bool framebuffer = false;
-bool parsestring = false;
+string pipelineName = ""; // one of the pipelines in pipelineConfig, or "parse" for -parse
+int pipelinesRequested = 0;
 bool onDemand = false;
 bool useTrigger = false;
+int triggerAhead = 0;
+double triggerRate = 0; // fps, 0 = no trigger clock
+bool triggerByInput = false;
+bool zeroCopy = false;
+bool bufferPool = false;
+bool pushMode = false;
+string grabStrategy = ""; // picked to suit the pipeline unless specified
+int maxBuffers = -1; // driver default unless specified
+int queueSize = -1;
+bool hwTimestamps = false;
+int statsInterval = 0; // ms, 0 = no statistics
+string statsdAddress = "";
+string prometheusFile = "";
 string serialNumber = "";
 string ipaddress = "";
 string filename = "";
 string fbdev = "";
 string pipelineString = "";
+string pipelineDescription = "";
+string fallbackDescription = ""; // "" = no fallback, the pipeline ends when the camera is removed
+vector<pair<string, string> > encodedOutputs; // name and description of each branch of the pipeline's "encoded" tee
+bool useAdaptive = false;
+AdaptiveSettings adaptiveSettings;
+int encoderBitrate = 0; // where -adaptive starts, and comes back to
+int analysisStep = 0; // -analysis: pixels between the samples CFrameAnalyzer takes, 0 = no analysis
+double motionClipThreshold = 0; // -motionclips, 0 = no clips on motion
+bool useAutoAdjust = false;
+string controlAddress = ""; // -control: a Unix socket, or a TCP port on 127.0.0.1
+vector<SequenceSet> sequenceSets; // -sequence
+string sequenceBranch = ""; // for the sequence's streams after the first
+bool useFallback = true;
+int reconnectInterval = 1000; // ms, with a fallback only
 string camParamFile = "";
+bool resetCamera = false;
+bool writeFullPfs = false;
+bool saveUserSettings = false;
+bool useUserSettings = false;
+CThreadPolicy grabThreadPolicy;
+CThreadPolicy streamingThreadPolicy;
+map<string, CThreadPolicy> branchThreadPolicies; // by element name
+
+static void request_pipeline(const string &name)
+{
+	pipelineName = name;
+	pipelinesRequested++;
+}
+
+// On the main loop: what cb_frame_analysis() decided on the grab thread.
+static gboolean cb_record_motion_clip(gpointer user_data)
+{
+	if (pipelineHelper != NULL)
+		pipelineHelper->record_clip();
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean cb_auto_adjust(gpointer user_data)
+{
+	if (pCamera != NULL)
+	{
+		cout << "Image too dark or too bright. Adjusting exposure, gain and white balance..." << endl;
+		pCamera->AutoAdjustImage();
+	}
+	return G_SOURCE_REMOVE;
+}
+
+// On the grab thread, for every image (-analysis). Only decides: the work is handed to the main loop.
+static void cb_frame_analysis(const AnalysisSamples &samples, FrameAnalysis &analysis)
+{
+	static bool isMoving = false;
+	static int badExposures = 0; // images in a row too dark or too bright
+	static int adjustHoldOff = 0; // images to leave the auto functions alone for
+
+	// A clip when something starts moving. Triggering again while the clip is written only makes it longer.
+	if (motionClipThreshold > 0)
+	{
+		analysis.score = analysis.motion / motionClipThreshold;
+		bool moving = analysis.motion > motionClipThreshold;
+		if (moving == true && isMoving == false)
+			g_idle_add(cb_record_motion_clip, NULL);
+		isMoving = moving;
+	}
+
+	// about a second at 25 fps, and then ten for the auto functions to settle
+	if (useAutoAdjust == true)
+	{
+		if (adjustHoldOff > 0)
+			adjustHoldOff--;
+		else if (analysis.meanLuminance < 40 || analysis.meanLuminance > 215)
+		{
+			if (++badExposures >= 25)
+			{
+				badExposures = 0;
+				adjustHoldOff = 250;
+				g_idle_add(cb_auto_adjust, NULL);
+			}
+		}
+		else
+			badExposures = 0;
+	}
+}
 
 int ParseCommandLine(gint argc, gchar *argv[])
 {
@@ -251,21 +457,60 @@ int ParseCommandLine(gint argc, gchar *argv[])
 			cout << endl;
 			cout << "Options: " << endl;
 			cout << " -camera <serialnumber> (Use a specific camera. If not specified, will use first camera found.)" << endl;
-			cout << " -aoi <width> <height> (Camera's Area Of Interest. If not specified, will use camera's maximum.)" << endl;
+			cout << " -aoi <width> <height> (Camera's Area Of Interest, centered. If not specified, will use the camera's settings (pfs file). While running, type ROI <width> <height> <offsetX> <offsetY> <binning> to change it (-1 = as big as it goes, or centered) and run at the highest frame rate it allows. eg: ROI -1 200 -1 -1 1 for a band of 200 lines.)" << endl;
 			cout << " -rescale <width> <height> (Will rescale the image for the pipeline if desired.)" << endl;
-			cout << " -rotate <degrees clockwise> (Will rotate 90, 180, 270 degrees clockwise)" << endl;
+			cout << " -rotate <degrees clockwise> (Will rotate 90, 180, 270 degrees clockwise. Default is 270, for the portrait-mounted camera of the sample pipelines. 0 = no rotation.)" << endl;
 			cout << " -framerate <fps> (If not specified, will use camera's maximum under current settings.)" << endl;
 			cout << " -ondemand (Will software trigger the camera when needed instead of using continuous free run. May lower CPU load.)" << endl;
 			cout << " -usetrigger (Will configure the camera to expect a hardware trigger on IO Line 1. eg: TTL signal.)" << endl;
+			cout << " -triggerahead <images> (With -ondemand: trigger the next 1 or 2 images as soon as one is retrieved, so each is ready a frame earlier. Queues the images (onebyone).)" << endl;
+			cout << " -triggerrate <fps> (Software trigger the camera at this rate, from a clock of its own, instead of free run.)" << endl;
+			cout << " -triggerbyinput (Software trigger the camera each time TRIG is typed while running.)" << endl;
+			cout << " -zerocopy (Will hand the driver's image buffers straight to the pipeline instead of copying each frame. Saves CPU at high resolutions.)" << endl;
+			cout << " -bufferpool (Like -zerocopy, but the driver grabs into a GStreamer buffer pool sized to what the pipeline holds on to.)" << endl;
+			cout << " -pushmode (Will push each image to the pipeline from a dedicated grab thread, instead of waiting for the pipeline to ask for one.)" << endl;
+			cout << " -grabstrategy <latest|latestimages|onebyone|upcoming> (How the driver queues images. If not specified, onebyone for recording pipelines, latest otherwise.)" << endl;
+			cout << " -maxbuffers <number> (Number of image buffers the driver grabs into. More buffers ride out longer pipeline hiccups without dropping images.)" << endl;
+			cout << " -queuesize <number> (With -grabstrategy latestimages, how many of the newest images are kept waiting for the pipeline.)" << endl;
+			cout << " -hwtimestamps (Will timestamp images with the camera's exposure time instead of their arrival time. Gives smoother timing in recordings.)" << endl;
+			cout << " -reset (Will reset the camera to its default settings before loading NodeMap.pfs, or the -camparam file.)" << endl;
+			cout << " -fullpfs (Will write every feature of the pfs file and read them all back, instead of only those the camera doesn't have already.)" << endl;
+			cout << " -savesettings (Will save the camera's settings in UserSet1, and start the camera with them from now on. Then use -usersettings for a quicker start.)" << endl;
+			cout << " -usersettings (Will load the settings saved in the camera with -savesettings instead of a pfs file. Quicker.)" << endl;
+			cout << " -stats <ms> (Will print acquisition statistics (fps, latency, skipped images...) every so many milliseconds.)" << endl;
+			cout << " -statsd <host:port> (With -stats, also sends the statistics to a statsd server.)" << endl;
+			cout << " -prometheus <filename> (With -stats, also writes the statistics to a file in Prometheus text format. eg: for node_exporter's textfile collector.)" << endl;
+			cout << " -grabthread <cores>[:<priority>] (Will pin the grab thread (-pushmode) to these cores, eg: 2 or 2,3. With a priority (1-99), it and the driver's grab engine run SCHED_FIFO. Needs root or CAP_SYS_NICE.)" << endl;
+			cout << " -streamthread <cores>[:<priority>] (Likewise for the camera's streaming thread, which retrieves the images unless -pushmode is used. eg: -streamthread 1:60)" << endl;
 			cout << endl;
 			cout << "Pipeline Examples (pick one):" << endl;
 			cout << " -h264stream <ipaddress> (Encodes images as h264 and transmits stream to another PC running a GStreamer receiving pipeline.)" << endl;
 			cout << " -h264multicast <ipaddress> (Encodes images as h264 and multicasts stream to the network.)" << endl;
+			cout << " -rtspserver [port] (Encodes images for live viewing and serves them over RTSP, at rtsp://<this machine>:8554/camera by default. Every client shares the one encode. Needs gst-rtsp-server.)" << endl;
+			cout << " -h264srt [port] (Encodes images for live viewing and serves them over SRT in MPEG-TS, on port 8888 by default. See the srt-latency setting.)" << endl;
+			cout << " -fanout (Displays the images, and encodes them once for a recording, an RTP stream and clips together. A slow output drops its own data, not the others'. See the outputs setting.)" << endl;
 			cout << " -h264file <filename> <number of images> (Encodes images as h264 and records stream to local file.)" << endl;
 			cout << " -displayh264file <filename> <number of images> (Encodes images as h264 and records stream to local file.)" << endl;
+			cout << " -h264clips (Encodes images as h264 and keeps the last seconds in memory. Type CLIP to save them, and the seconds after, to a clip file. See the clip-preroll and clip-postroll settings.)" << endl;
 			cout << " -window (displays the raw image stream in a window on the local machine.)" << endl;
 			cout << " -framebuffer <fbdevice> (directs raw image stream to Linux framebuffer. eg: /dev/fb0)" << endl;
 			cout << " -parse <string> (try your existing gst-launch-1.0 pipeline string. We will replace the original pipeline source with the Basler camera if needed.)" << endl;
+			cout << " -pipeline <name> (any pipeline from CPipelineConfig.cpp, or from a -config file. eg: window, h264file, camfail)" << endl;
+			cout << endl;
+			cout << "Pipeline Settings:" << endl;
+			cout << " -config <filename> (Loads pipelines and settings from a key file, which change or add to the built-in ones. See pipelines.ini.)" << endl;
+			cout << " -set <name>=<value> (Overrides a pipeline setting, to try encoder and queue settings without rebuilding. eg: -set bitrate=5750000)" << endl;
+			cout << "   The encoder is picked for this system. Change it with the codec (h264, h265), encoder-backend (auto, nvv4l2, omx, v4l2, vaapi, software), bitrate, rate-control (cbr, vbr), keyframe-interval, encoder-profile and encoder-preset settings. eg: -set codec=h265" << endl;
+			cout << " -nofallback (Will end the pipeline when the camera is removed, instead of showing the camera failure screen until it's back.)" << endl;
+			cout << " -reconnect <ms> (While the camera failure screen shows, looks for the camera every so many milliseconds, and goes back to live images when it's found. Default 1000. 0 = don't.)" << endl;
+			cout << " -thread <element>=<cores>[:<priority>] (Will pin the streaming thread started by a named element of the pipeline, and the branch it runs, to these cores. eg: -thread encodequeue=3:50. Can be repeated.)" << endl;
+			cout << " -sequence <steps> (Runs the camera's sequencer (USB cameras): each image is the next step of <width>x<height>[@<exposure us>]:<stream>, comma separated, -1 = full size. Stream 0 is the pipeline, the others go through the sequence-branch setting. eg: -sequence -1x-1:0,-1x200:1,-1x200:1,-1x200:1 for a full frame preview and a 200 line band at three times its rate.)" << endl;
+			cout << " -asyncwrites (Recordings are written by asyncfilesink, from a thread of its own with large writes, so a slow disk doesn't hold up the pipeline. See the asyncwriter and min-free-space settings.)" << endl;
+			cout << " -adaptive (When the pipeline can't keep up (full queues, QoS, a slow disk, or the CPU over adaptive-max-temp), steps the bitrate down to adaptive-min-bitrate, then the framerate down to adaptive-min-fps, and back up when it can.)" << endl;
+			cout << " -analysis (Measures each image where it's grabbed, from 1 in 64 of its pixels (luminance, motion, focus, in its PylonFrameMeta), instead of a videoanalyse element reading all of it again. See the analysis-step and analyser settings.)" << endl;
+			cout << " -motionclips <threshold> (With -analysis, and -h264clips: record a clip whenever the motion between images goes over <threshold>, 0-255. eg: -motionclips 8)" << endl;
+			cout << " -autoadjust (With -analysis: when the image stays too dark or too bright for a second, runs the camera's exposure, gain and white balance auto functions once.)" << endl;
+			cout << " -control <socket> (Takes commands from clients of this Unix socket too (eg: socat - UNIX-CONNECT:/tmp/demopylongstreamer.sock), or of this TCP port on 127.0.0.1 (eg: -control 5800, the only choice on Windows). They're the same ones typed in the console: HELP lists them.)" << endl;
 			cout << endl;
 			cout << "Examples: " << endl;
 			cout << " demopylongstreamer -framebuffer /dev/fb0" << endl;
@@ -273,13 +518,14 @@ int ParseCommandLine(gint argc, gchar *argv[])
 			cout << " demopylongstreamer -camera 12345678 -aoi 640 480 -framerate 15 -rescale 320 240 -h264file mymovie.h264" << endl;
 			cout << " demopylongstreamer -rescale 320 240 -parse \"gst-launch-1.0 videotestsrc ! videoflip method=vertical-flip ! videoconvert ! autovideosink\"" << endl;
 			cout << " demopylongstreamer -rescale 320 240 -parse \"videoflip method=vertical-flip ! videoconvert ! autovideosink\"" << endl;
+			cout << " demopylongstreamer -config pipelines.ini -set bitrate=5000000 -h264file" << endl;
 			cout << endl;
 			cout << "Quick-Start Example to display stream:" << endl;
 			cout << " demopylongstreamer -window" << endl;
 			cout << endl;
 			cout << "NVIDIA TX1/TX2 Note:" << endl;
 			cout << "When using autovideosink for display, the system-preferred built-in videosink plugin does advertise the formats it supports. So the image must be converted manually." << endl;
-			cout << "For an example of how to do this, see CPipelineHelper::build_pipeline_display()." << endl;
+			cout << "For an example of how to do this, see the window pipeline in CPipelineConfig.cpp." << endl;
 			cout << "If you are using demopylongstreamer with the -parse argument in order to use your own pipeline, add a caps filter after the normal videoconvert and before autovideosink:" << endl;
 			cout << "./demopylongstreamer -parse \"gst-launch-1.0 videotestsrc ! videoflip method=vertical-flip ! videoconvert ! video/x-raw,format=I420 ! autovideosink\"" << endl;
 			cout << endl;
@@ -365,45 +611,289 @@ int ParseCommandLine(gint argc, gchar *argv[])
 			{
 				useTrigger = true;
 			}
-			else if (string(argv[i]) == "-displayh264file")
+			else if (string(argv[i]) == "-triggerahead")
+			{
+				if (argv[i + 1] != NULL)
+					triggerAhead = atoi(argv[i + 1]);
+				else
+				{
+					cout << "Number of images not specified. eg: -triggerahead 1" << endl;
+					return -1;
+				}
+			}
+			else if (string(argv[i]) == "-triggerrate")
 			{
-				needCam = true;
-				displayh264file = true;
+				if (argv[i + 1] != NULL)
+					triggerRate = atof(argv[i + 1]);
+				else
+				{
+					cout << "Trigger rate not specified. eg: -triggerrate 30" << endl;
+					return -1;
+				}
 			}
-			else if (string(argv[i]) == "-h264file")
+			else if (string(argv[i]) == "-triggerbyinput")
 			{
-				needCam = true;
-				h264file = true;
+				triggerByInput = true;
 			}
-			else if (string(argv[i]) == "-window")
+			else if (string(argv[i]) == "-zerocopy")
 			{
-				needCam = true;
-				display = true;
+				zeroCopy = true;
 			}
-			else if (string(argv[i]) == "-camfail")
+			else if (string(argv[i]) == "-bufferpool")
 			{
-				needCam = false;
-				camfail = true;
+				bufferPool = true;
 			}
-			else if (string(argv[i]) == "-syserr")
+			else if (string(argv[i]) == "-pushmode")
 			{
-				needCam = false;
-				syserr = true;
+				pushMode = true;
 			}
-			else if (string(argv[i]) == "-powfail")
+			else if (string(argv[i]) == "-hwtimestamps")
 			{
-				needCam = false;
-				powfail = true;
+				hwTimestamps = true;
 			}
-			else if (string(argv[i]) == "-fullusb")
+			else if (string(argv[i]) == "-reset")
+			{
+				resetCamera = true;
+			}
+			else if (string(argv[i]) == "-fullpfs")
+			{
+				writeFullPfs = true;
+			}
+			else if (string(argv[i]) == "-savesettings")
 			{
-				needCam = false;
-				fullusb = true;
+				saveUserSettings = true;
 			}
+			else if (string(argv[i]) == "-usersettings")
+			{
+				useUserSettings = true;
+			}
+			else if (string(argv[i]) == "-stats")
+			{
+				if (argv[i + 1] != NULL)
+					statsInterval = atoi(argv[i + 1]);
+				else
+				{
+					cout << "Statistics interval not specified. eg: -stats 1000" << endl;
+					return -1;
+				}
+			}
+			else if (string(argv[i]) == "-statsd")
+			{
+				if (argv[i + 1] != NULL)
+					statsdAddress = string(argv[i + 1]);
+				else
+				{
+					cout << "statsd server not specified. eg: -statsd 127.0.0.1:8125" << endl;
+					return -1;
+				}
+			}
+			else if (string(argv[i]) == "-prometheus")
+			{
+				if (argv[i + 1] != NULL)
+					prometheusFile = string(argv[i + 1]);
+				else
+				{
+					cout << "Prometheus file not specified. eg: -prometheus /var/lib/node_exporter/pylon.prom" << endl;
+					return -1;
+				}
+			}
+			else if (string(argv[i]) == "-grabstrategy")
+			{
+				if (argv[i + 1] != NULL)
+					grabStrategy = string(argv[i + 1]);
+				if (grabStrategy != "latest" && grabStrategy != "latestimages" && grabStrategy != "onebyone" && grabStrategy != "upcoming")
+				{
+					cout << "Grab strategy not specified. eg: -grabstrategy onebyone" << endl;
+					return -1;
+				}
+			}
+			else if (string(argv[i]) == "-maxbuffers")
+			{
+				if (argv[i + 1] != NULL)
+					maxBuffers = atoi(argv[i + 1]);
+				else
+				{
+					cout << "Number of buffers not specified. eg: -maxbuffers 50" << endl;
+					return -1;
+				}
+			}
+			else if (string(argv[i]) == "-queuesize")
+			{
+				if (argv[i + 1] != NULL)
+					queueSize = atoi(argv[i + 1]);
+				else
+				{
+					cout << "Queue size not specified. eg: -queuesize 5" << endl;
+					return -1;
+				}
+			}
+			else if (string(argv[i]) == "-displayh264file")
+				request_pipeline("displayh264file");
+			else if (string(argv[i]) == "-h264file")
+				request_pipeline("h264file");
+			else if (string(argv[i]) == "-h264clips")
+				request_pipeline("h264clips");
+			else if (string(argv[i]) == "-fanout")
+				request_pipeline("fanout");
+			else if (string(argv[i]) == "-window")
+				request_pipeline("window");
+			else if (string(argv[i]) == "-camfail")
+				request_pipeline("camfail");
+			else if (string(argv[i]) == "-syserr")
+				request_pipeline("syserr");
+			else if (string(argv[i]) == "-powfail")
+				request_pipeline("powfail");
+			else if (string(argv[i]) == "-fullusb")
+				request_pipeline("fullusb");
 			else if (string(argv[i]) == "-temperr")
+				request_pipeline("temperr");
+			else if (string(argv[i]) == "-h264stream" || string(argv[i]) == "-h264multicast")
+			{
+				if (argv[i + 1] != NULL)
+					pipelineConfig.SetValue("host", argv[i + 1]);
+				else
+				{
+					cout << "IP Address not specified. eg: " << argv[i] << " 172.17.1.199" << endl;
+					return -1;
+				}
+				request_pipeline(string(argv[i]).substr(1));
+			}
+			else if (string(argv[i]) == "-rtspserver" || string(argv[i]) == "-h264srt")
+			{
+				if (argv[i + 1] != NULL && argv[i + 1][0] != '-')
+					pipelineConfig.SetValue(string(argv[i]) == "-rtspserver" ? "rtsp-port" : "srt-port", argv[i + 1]);
+				request_pipeline(string(argv[i]).substr(1));
+			}
+			else if (string(argv[i]) == "-framebuffer")
+			{
+				if (argv[i + 1] != NULL)
+					pipelineConfig.SetValue("fbdevice", argv[i + 1]);
+				else
+				{
+					cout << "Framebuffer device not specified. eg: -framebuffer /dev/fb0" << endl;
+					return -1;
+				}
+				request_pipeline("framebuffer");
+			}
+			else if (string(argv[i]) == "-parse")
+			{
+				if (argv[i + 1] != NULL)
+					pipelineString = string(argv[i + 1]);
+				else
+				{
+					cout << "Pipeline string not specified. eg: -parse \"videoconvert ! autovideosink\"" << endl;
+					return -1;
+				}
+				request_pipeline("parse");
+			}
+			else if (string(argv[i]) == "-pipeline")
+			{
+				if (argv[i + 1] != NULL)
+					request_pipeline(argv[i + 1]);
+				else
+				{
+					cout << "Pipeline name not specified. eg: -pipeline window" << endl;
+					return -1;
+				}
+			}
+			else if (string(argv[i]) == "-config")
 			{
-				needCam = false;
-				temperr = true;
+				if (argv[i + 1] == NULL)
+				{
+					cout << "Pipeline file not specified. eg: -config pipelines.ini" << endl;
+					return -1;
+				}
+				if (pipelineConfig.LoadFile(argv[i + 1]) == false)
+					return -1;
+			}
+			else if (string(argv[i]) == "-nofallback")
+			{
+				useFallback = false;
+			}
+			else if (string(argv[i]) == "-reconnect")
+			{
+				if (argv[i + 1] != NULL)
+					reconnectInterval = atoi(argv[i + 1]);
+				else
+				{
+					cout << "Reconnect interval not specified. eg: -reconnect 1000" << endl;
+					return -1;
+				}
+			}
+			else if (string(argv[i]) == "-grabthread" || string(argv[i]) == "-streamthread")
+			{
+				if (argv[i + 1] == NULL)
+				{
+					cout << "Thread cores not specified. eg: " << argv[i] << " 2:50" << endl;
+					return -1;
+				}
+				CThreadPolicy &policy = (string(argv[i]) == "-grabthread") ? grabThreadPolicy : streamingThreadPolicy;
+				if (policy.Parse(argv[i + 1]) == false)
+					return -1;
+			}
+			else if (string(argv[i]) == "-thread")
+			{
+				string setting = (argv[i + 1] != NULL) ? string(argv[i + 1]) : "";
+				size_t equals = setting.find('=');
+				CThreadPolicy policy;
+				if (equals == string::npos || equals == 0)
+				{
+					cout << "Element and thread cores not specified. eg: -thread encodequeue=3:50" << endl;
+					return -1;
+				}
+				if (policy.Parse(setting.substr(equals + 1)) == false)
+					return -1;
+				branchThreadPolicies[setting.substr(0, equals)] = policy;
+			}
+			else if (string(argv[i]) == "-asyncwrites")
+				pipelineConfig.SetValue("writer", "${asyncwriter}");
+			else if (string(argv[i]) == "-adaptive")
+				pipelineConfig.SetValue("adaptive", "true");
+			else if (string(argv[i]) == "-analysis")
+			{
+				// the pipelines' videoanalyse has nothing left to do
+				pipelineConfig.SetValue("analysis-step", "8");
+				pipelineConfig.SetValue("analyser", "identity");
+			}
+			else if (string(argv[i]) == "-motionclips")
+			{
+				if (argv[i + 1] == NULL)
+				{
+					cout << "Motion threshold not specified. eg: -motionclips 8" << endl;
+					return -1;
+				}
+				pipelineConfig.SetValue("motion-clips", argv[i + 1]);
+			}
+			else if (string(argv[i]) == "-autoadjust")
+				pipelineConfig.SetValue("auto-adjust", "true");
+			else if (string(argv[i]) == "-control")
+			{
+				if (argv[i + 1] == NULL)
+				{
+					cout << "Control socket not specified. eg: -control /tmp/demopylongstreamer.sock" << endl;
+					return -1;
+				}
+				pipelineConfig.SetValue("control", argv[i + 1]);
+			}
+			else if (string(argv[i]) == "-sequence")
+			{
+				if (argv[i + 1] == NULL)
+				{
+					cout << "Sequence not specified. eg: -sequence -1x-1:0,-1x200:1" << endl;
+					return -1;
+				}
+				pipelineConfig.SetValue("sequence", argv[i + 1]);
+			}
+			else if (string(argv[i]) == "-set")
+			{
+				string setting = (argv[i + 1] != NULL) ? string(argv[i + 1]) : "";
+				size_t equals = setting.find('=');
+				if (equals == string::npos || equals == 0)
+				{
+					cout << "Pipeline setting not specified. eg: -set bitrate=5000000" << endl;
+					return -1;
+				}
+				pipelineConfig.SetValue(setting.substr(0, equals), setting.substr(equals + 1));
 			}
 			else if (string(argv[i]) == "-tz")
 			{
@@ -421,12 +911,6 @@ int ParseCommandLine(gint argc, gchar *argv[])
 			}
 		}
 
-		bool pipelinesAvailable[] = { display, framebuffer, h264file, h264stream, displayh264file, h264multicast, parsestring, camfail, syserr, powfail, fullusb, temperr };
-		int pipelinesRequested = 0;
-
-		for (int i = 0; i < sizeof(pipelinesAvailable); i++)
-			pipelinesRequested += (int)pipelinesAvailable[i];
-
 		if (pipelinesRequested == 0)
 		{
 			cout << "No Pipeline Specified. Please specifiy one (and only one)." << endl;
@@ -439,6 +923,117 @@ int ParseCommandLine(gint argc, gchar *argv[])
 			return -1;
 		}
 
+		// the encoder this system has, set up from the encoder settings (${autoencoder}, see CEncoderFactory)
+		EncoderSettings encoderSettings;
+		encoderSettings.codec = pipelineConfig.GetValue(pipelineName, "codec");
+		encoderSettings.bitrate = atoi(pipelineConfig.GetValue(pipelineName, "bitrate").c_str());
+		encoderSettings.constantBitrate = pipelineConfig.GetValue(pipelineName, "rate-control") != "vbr";
+		encoderSettings.keyframeInterval = atoi(pipelineConfig.GetValue(pipelineName, "keyframe-interval").c_str());
+		encoderSettings.profile = pipelineConfig.GetValue(pipelineName, "encoder-profile");
+		encoderSettings.preset = pipelineConfig.GetValue(pipelineName, "encoder-preset");
+		encoderSettings.lowLatency = pipelineConfig.GetValue(pipelineName, "encoder-latency") == "low";
+		if (encoderSettings.codec != "h264" && encoderSettings.codec != "h265")
+		{
+			cout << "Unknown codec " << encoderSettings.codec << ". Use h264 or h265." << endl;
+			return -1;
+		}
+		string encoderBackend = CEncoderFactory::FindBackend(encoderSettings.codec, pipelineConfig.GetValue(pipelineName, "encoder-backend"));
+		if (encoderBackend != "")
+			pipelineConfig.SetDefault("autoencoder", CEncoderFactory::GetDescription(encoderBackend, encoderSettings));
+
+		// Work out the whole pipeline now, so mistakes in it are found before the camera is opened.
+		if (pipelineName == "parse")
+			pipelineDescription = pipelineConfig.Expand("", pipelineString);
+		else if (pipelineConfig.HasPipeline(pipelineName))
+			pipelineDescription = pipelineConfig.GetDescription(pipelineName);
+		else
+		{
+			cout << "Unknown pipeline " << pipelineName << ". Available pipelines:";
+			vector<string> names = pipelineConfig.GetPipelineNames();
+			for (size_t i = 0; i < names.size(); i++)
+				cout << " " << names[i];
+			cout << endl;
+			return -1;
+		}
+		if (pipelineDescription == "")
+			return -1;
+		if (encoderBackend != "" && pipelineDescription.find(pipelineConfig.GetValue(pipelineName, "autoencoder")) != string::npos)
+			cout << "Encoding " << encoderSettings.codec << " with the " << encoderBackend << " encoder." << endl;
+
+		needCam = pipelineConfig.GetValue(pipelineName, "camera") != "false";
+
+		// the fallback is built with the pipeline, so switching to it is instant.
+		if (needCam == true && useFallback == true && pipelineConfig.GetValue(pipelineName, "fallback") != "")
+		{
+			fallbackDescription = pipelineConfig.Expand(pipelineName, pipelineConfig.GetValue(pipelineName, "fallback"));
+			if (fallbackDescription == "")
+				return -1;
+		}
+
+		useAdaptive = pipelineConfig.GetValue(pipelineName, "adaptive") == "true";
+		if (useAdaptive == true)
+		{
+			encoderBitrate = encoderSettings.bitrate;
+			adaptiveSettings.minBitrate = atoi(pipelineConfig.GetValue(pipelineName, "adaptive-min-bitrate").c_str());
+			adaptiveSettings.minFrameRate = g_ascii_strtod(pipelineConfig.GetValue(pipelineName, "adaptive-min-fps").c_str(), NULL);
+			adaptiveSettings.maxTemperature = g_ascii_strtod(pipelineConfig.GetValue(pipelineName, "adaptive-max-temp").c_str(), NULL);
+			adaptiveSettings.thermalZone = pipelineConfig.GetValue(pipelineName, "thermal-zone");
+		}
+
+		analysisStep = atoi(pipelineConfig.GetValue(pipelineName, "analysis-step").c_str());
+		motionClipThreshold = g_ascii_strtod(pipelineConfig.GetValue(pipelineName, "motion-clips").c_str(), NULL);
+		useAutoAdjust = pipelineConfig.GetValue(pipelineName, "auto-adjust") == "true";
+		controlAddress = pipelineConfig.Expand(pipelineName, pipelineConfig.GetValue(pipelineName, "control"));
+		if ((motionClipThreshold > 0 || useAutoAdjust == true) && analysisStep <= 0)
+		{
+			cout << "-motionclips and -autoadjust need -analysis. Measuring every 8th pixel." << endl;
+			analysisStep = 8;
+		}
+
+		// -sequence <width>x<height>[@<exposure>]:<stream>,...
+		gchar **steps = g_strsplit(pipelineConfig.GetValue(pipelineName, "sequence").c_str(), ",", -1);
+		for (gchar **step = steps; *step != NULL; step++)
+		{
+			if (g_strstrip(*step)[0] == '\0')
+				continue;
+			SequenceSet set;
+			double exposure = -1;
+			if (sscanf(*step, "%dx%d@%lf:%d", &set.roi.width, &set.roi.height, &exposure, &set.stream) != 4 &&
+				sscanf(*step, "%dx%d:%d", &set.roi.width, &set.roi.height, &set.stream) != 3)
+			{
+				cout << "Sequence step " << *step << " should be <width>x<height>[@<exposure us>]:<stream>, eg: -1x200:1" << endl;
+				g_strfreev(steps);
+				return -1;
+			}
+			set.exposureTime = exposure;
+			sequenceSets.push_back(set);
+		}
+		g_strfreev(steps);
+		if (sequenceSets.empty() == false)
+		{
+			sequenceBranch = pipelineConfig.Expand(pipelineName, pipelineConfig.GetValue(pipelineName, "sequence-branch"));
+			if (sequenceBranch == "")
+				return -1;
+		}
+
+		// the outputs sharing the encode, eg: outputs=recorder,rtpstream
+		gchar **outputs = g_strsplit(pipelineConfig.GetValue(pipelineName, "outputs").c_str(), ",", -1);
+		for (gchar **output = outputs; *output != NULL; output++)
+		{
+			string name = g_strstrip(*output);
+			if (name == "")
+				continue;
+			string description = pipelineConfig.Expand(pipelineName, "${" + name + "}");
+			if (description == "")
+			{
+				cout << "Output " << name << " has no description. Use the name of a setting, eg: outputs=recorder,rtpstream" << endl;
+				g_strfreev(outputs);
+				return -1;
+			}
+			encodedOutputs.push_back(make_pair(name, description));
+		}
+		g_strfreev(outputs);
+
 		return 0;
 	}
 	catch (GenICam::GenericException &e)
@@ -453,21 +1048,157 @@ int ParseCommandLine(gint argc, gchar *argv[])
 	}
 }
 
-void evalUsrInt(CPipelineHelper myPipelineHelper){
-	while(true){
-		cout << "waiting for input" << endl;
-		cin >> input;
-		cout << "Input: " << input << endl;
-		if (input == "EOS"){
-			IntHandler(0);
-		}
-		if (input == "MES"){
-			cout << "Before update overlay" << endl;
-			cin >> input;
-			myPipelineHelper.update_overlay((const gchar*) input.c_str());
-			cout << "After update overlay" << endl;
+static string reply(bool isOk, const string &error)
+{
+	return isOk ? "ok" : "error " + error;
+}
+
+// The commands of the console and -control, run on the main loop by CControlChannel. camera: NULL for the pipelines without one.
+static void add_control_commands(CControlChannel &control, CPipelineHelper *pHelper, CInstantCameraAppSrc *pCam)
+{
+	control.AddCommand("EOS", "EOS: end the stream, and the program", [](const string &arguments)
+	{
+		send_eos();
+		return string("ok");
+	});
+	control.AddCommand("MES", "MES <text>: show the text in the overlay", [pHelper](const string &arguments)
+	{
+		return reply(pHelper->update_overlay(arguments.c_str()), "this pipeline has no element named overlay");
+	});
+	// the fallback, with the message of that error screen (eg: ERR powfail)
+	control.AddCommand("ERR", "ERR <name>: show an error screen (eg: ERR powfail)", [pHelper](const string &arguments)
+	{
+		string message = pipelineConfig.GetValue(arguments, "message");
+		return reply(pHelper->show_fallback(message != "" ? message : arguments), "this pipeline has no fallback");
+	});
+	control.AddCommand("LIVE", "LIVE: back to the camera", [pHelper](const string &arguments)
+	{
+		return reply(pHelper->show_live(), "this pipeline has no fallback");
+	});
+	// what the clip recorder has kept in memory, and what follows (-h264clips)
+	control.AddCommand("CLIP", "CLIP [seconds]: record a clip, with this much after now", [pHelper](const string &arguments)
+	{
+		double postroll = (arguments != "") ? g_ascii_strtod(arguments.c_str(), NULL) : -1;
+		return reply(pHelper->record_clip(postroll), "nothing to record a clip from");
+	});
+	// a clip that goes on until REC STOP (or a day)
+	control.AddCommand("REC", "REC START [seconds] | REC STOP: start and stop recording a clip", [pHelper](const string &arguments)
+	{
+		istringstream words(arguments);
+		string action;
+		double seconds = 0;
+		words >> action >> seconds;
+		gchar *upper = g_ascii_strup(action.c_str(), -1);
+		action = upper;
+		g_free(upper);
+		if (action == "START")
+			return reply(pHelper->record_clip(seconds > 0 ? seconds : 24 * 3600), "nothing to record a clip from");
+		if (action == "STOP")
+			return reply(pHelper->stop_clip(), "not recording");
+		return string("error eg: REC START, REC START 60, REC STOP");
+	});
+	// The new AOI is tried between two images, on the streaming thread, and downstream may not take it: the reply waits for that.
+	control.AddDeferredCommand("ROI", "ROI <width> <height> <offsetX> <offsetY> <binning>: change the AOI while running (-1 = as big as it goes, or centered)", [pCam](const string &arguments, ControlReply done)
+	{
+		if (pCam == NULL)
+			return done("error no camera");
+		RoiSettings roi;
+		istringstream words(arguments);
+		words >> roi.width >> roi.height >> roi.offsetX >> roi.offsetY >> roi.binningH;
+		roi.binningV = roi.binningH;
+		if (words.fail())
+			return done("error eg: ROI 1920 200 -1 -1 1");
+		pCam->SetRoi(roi, [done](bool isApplied)
+		{
+			CControlChannel::ReplyLater(done, reply(isApplied, "the camera or downstream won't take it, the AOI is as it was"));
+		});
+	});
+	// takes an image (-triggerbyinput), and tells how the triggers are doing
+	control.AddCommand("TRIG", "TRIG: take an image (-triggerbyinput), and count the triggers", [pCam](const string &arguments)
+	{
+		if (pCam == NULL)
+			return string("error no camera");
+		if (triggerByInput == true)
+			pCam->FireTrigger();
+		TriggerStats triggers = pCam->GetTriggerStats();
+		return "ok fired=" + to_string(triggers.fired) + " missed=" + to_string(triggers.missed);
+	});
+	control.AddCommand("FPS", "FPS <fps>: change the camera's frame rate", [pCam](const string &arguments)
+	{
+		if (pCam == NULL)
+			return string("error no camera");
+		return reply(pCam->SetFrameRate(g_ascii_strtod(arguments.c_str(), NULL)), "the camera can't do that");
+	});
+	// (-adaptive carries on from the new bitrate)
+	control.AddCommand("BITRATE", "BITRATE <bits per second>: change the encoder's bitrate", [](const string &arguments)
+	{
+		GstElement *encoder = CEncoderFactory::FindEncoder(pipeline);
+		if (encoder == NULL)
+			return string("error this pipeline has no encoder");
+		bool isSet = CEncoderFactory::SetBitrate(encoder, atoi(arguments.c_str()));
+		gst_object_unref(encoder);
+		return reply(isSet, "don't know how to set this encoder's bitrate");
+	});
+	// any element the description named (eg: SET encodequeue.max-size-time=100000000, SET overlay.font-desc=Sans 30)
+	control.AddCommand("SET", "SET <element>.<property>=<value>: change a property of a named element", [](const string &arguments)
+	{
+		size_t dot = arguments.find('.');
+		size_t equals = arguments.find('=');
+		if (dot == string::npos || equals == string::npos || dot > equals)
+			return string("error eg: SET encodequeue.max-size-time=100000000");
+		string name = arguments.substr(0, dot);
+		string property = arguments.substr(dot + 1, equals - dot - 1);
+		GstElement *element = gst_bin_get_by_name(GST_BIN(pipeline), name.c_str());
+		if (element == NULL)
+			return "error no element named " + name;
+		GParamSpec *spec = g_object_class_find_property(G_OBJECT_GET_CLASS(element), property.c_str());
+		bool isWritable = (spec != NULL && (spec->flags & G_PARAM_WRITABLE) != 0);
+		if (isWritable == true)
+			gst_util_set_object_arg(G_OBJECT(element), property.c_str(), arguments.substr(equals + 1).c_str());
+		gst_object_unref(element);
+		return reply(isWritable, name + " has no property " + property + " to set");
+	});
+	control.AddCommand("GET", "GET <element>.<property>: a property of a named element", [](const string &arguments)
+	{
+		size_t dot = arguments.find('.');
+		if (dot == string::npos)
+			return string("error eg: GET encodequeue.current-level-time");
+		string name = arguments.substr(0, dot);
+		string property = arguments.substr(dot + 1);
+		GstElement *element = gst_bin_get_by_name(GST_BIN(pipeline), name.c_str());
+		if (element == NULL)
+			return "error no element named " + name;
+		GParamSpec *spec = g_object_class_find_property(G_OBJECT_GET_CLASS(element), property.c_str());
+		string value = "";
+		bool isReadable = (spec != NULL && (spec->flags & G_PARAM_READABLE) != 0);
+		if (isReadable == true)
+		{
+			GValue item = G_VALUE_INIT;
+			g_value_init(&item, spec->value_type);
+			g_object_get_property(G_OBJECT(element), property.c_str(), &item);
+			gchar *contents = g_strdup_value_contents(&item);
+			value = contents;
+			g_free(contents);
+			g_value_unset(&item);
 		}
-	}
+		gst_object_unref(element);
+		return isReadable ? "ok " + value : "error " + name + " has no property " + property;
+	});
+	// one line of name=value, for scripts
+	control.AddCommand("STATS", "STATS: the camera's acquisition statistics", [pCam](const string &arguments)
+	{
+		if (pCam == NULL)
+			return string("error no camera");
+		AcquisitionStats stats = pCam->GetStats();
+		TriggerStats triggers = pCam->GetTriggerStats();
+		stringstream line;
+		line << "ok frames=" << stats.frames << " fps=" << stats.fps << " targetFps=" << stats.targetFps
+			<< " failedGrabs=" << stats.failedGrabs << " retrieveErrors=" << stats.retrieveErrors
+			<< " skippedImages=" << stats.skippedImages << " lostFrames=" << stats.lostFrames << " buffersInFlight=" << stats.buffersInFlight
+			<< " grabToPushP50Us=" << stats.grabToPush.Percentile(0.5) << " grabToPushP99Us=" << stats.grabToPush.Percentile(0.99)
+			<< " triggersFired=" << triggers.fired << " triggersMissed=" << triggers.missed;
+		return line.str();
+	});
 }
 
 // *********** END Command line argument variables and parser **************
@@ -478,6 +1209,11 @@ gint main(gint argc, gchar *argv[])
 	try
 	{
 
+		// initialize GStreamer. The command line needs it to find the encoders.
+		gst_init(NULL, NULL);
+		// asyncfilesink is part of this program, for -asyncwrites
+		gst_async_file_sink_register();
+
 		if (ParseCommandLine(argc, argv) == -1)
 		{
 			exitCode = -1;
@@ -485,12 +1221,14 @@ gint main(gint argc, gchar *argv[])
 		}
 
 		// signal handler for ctrl+C
+#ifdef WIN32
 		signal(SIGINT, IntHandler);
+#else
+		g_unix_signal_add(SIGINT, cb_quit_signal, NULL);
+		g_unix_signal_add(SIGTERM, cb_quit_signal, NULL);
+#endif
 		cout << "Press CTRL+C at any time to quit." << endl;
 
-		// initialize GStreamer 
-		gst_init(NULL, NULL);
-
 		// create the mainloop
 		loop = g_main_loop_new(NULL, FALSE);
 
@@ -499,22 +1237,78 @@ gint main(gint argc, gchar *argv[])
 			// and provide a source element to the GStreamer pipeline.
 			CInstantCameraAppSrc camera(serialNumber);
 
-			// reset the camera to defaults if you like
-			cout << "Resetting camera to default settings..." << endl;
-			camera.ResetCamera();
+			// reset the camera to defaults if you like. The pfs file sets every feature anyway, so by default this is skipped (it's a slow start otherwise).
+			if (resetCamera == true)
+			{
+				cout << "Resetting camera to default settings..." << endl;
+				camera.ResetCamera();
+			}
 
 			// Initialize the camera and driver
 			cout << "Initializing camera and driver..." << endl;
 			if (camParamFile == "")
 				camParamFile = "NodeMap.pfs";
-			camera.InitCamera(1080, 1920, 25, onDemand, useTrigger, scaledWidth, scaledHeight, rotation, numImagesToRecord, camParamFile);		
+			GrabSettings grabSettings;
+			grabSettings.useZeroCopy = zeroCopy;
+			grabSettings.useBufferPool = bufferPool;
+			grabSettings.usePushMode = pushMode;
+			grabSettings.maxNumBuffer = maxBuffers;
+			grabSettings.outputQueueSize = queueSize;
+			grabSettings.useHardwareTimestamps = hwTimestamps;
+			grabSettings.statsInterval = statsInterval;
+			grabSettings.statsdAddress = statsdAddress;
+			grabSettings.prometheusFile = prometheusFile;
+			grabSettings.sendEosOnDeviceRemoved = (fallbackDescription == "");
+			// without a fallback the pipeline has ended by the time the camera is back, so there's nothing to reconnect to.
+			grabSettings.reconnectInterval = (fallbackDescription != "") ? reconnectInterval : 0;
+			grabSettings.writeChangedFeaturesOnly = (writeFullPfs == false);
+			grabSettings.grabThread = grabThreadPolicy;
+			grabSettings.streamingThread = streamingThreadPolicy;
+			grabSettings.analysisStep = analysisStep;
+			grabSettings.triggerDepth = triggerAhead;
+			grabSettings.triggerRate = triggerRate;
+			if (triggerByInput == true)
+				grabSettings.triggerSchedule = TriggerSchedule_Application;
+			else if (triggerRate > 0)
+				grabSettings.triggerSchedule = TriggerSchedule_Rate;
+			if (useUserSettings == true)
+				grabSettings.userSet = "UserSet1"; // (where SaveSettingsToCamera() puts them)
+			// Live display wants the newest image. Recordings want every image, so the recording pipelines ask for onebyone, to let the driver queue them while the encoder catches up.
+			if (grabStrategy == "")
+				grabStrategy = pipelineConfig.GetValue(pipelineName, "grab-strategy");
+			// every step of a sequence matters, not just the newest image
+			if (grabStrategy == "" && sequenceSets.empty() == false)
+				grabStrategy = "onebyone";
+			if (grabStrategy == "onebyone")
+				grabSettings.strategy = Pylon::GrabStrategy_OneByOne;
+			else if (grabStrategy == "latestimages")
+				grabSettings.strategy = Pylon::GrabStrategy_LatestImages;
+			else if (grabStrategy == "upcoming")
+				grabSettings.strategy = Pylon::GrabStrategy_UpcomingImage;
+			else
+				grabSettings.strategy = Pylon::GrabStrategy_LatestImageOnly;
+			if (grabSettings.strategy == Pylon::GrabStrategy_OneByOne && maxBuffers == -1)
+				grabSettings.maxNumBuffer = 50;
+			camera.InitCamera(width, height, 25, onDemand, useTrigger, scaledWidth, scaledHeight, rotation, numImagesToRecord, camParamFile, grabSettings);
+			if (saveUserSettings == true)
+			{
+				cout << "Saving camera settings to UserSet1. Use -usersettings from now on..." << endl;
+				camera.SaveSettingsToCamera(true);
+			}
+			if (analysisStep > 0)
+				camera.SetFrameAnalysisCallback(cb_frame_analysis);
+			if (sequenceSets.empty() == false && camera.SetSequence(sequenceSets) == false)
+			{
+				exitCode = -1;
+				throw std::runtime_error("Could not set up the sequence!");
+			}
 
 			cout << "Using Camera             : " << camera.GetDeviceInfo().GetFriendlyName() << endl;
 			cout << "Camera Area Of Interest  : " << camera.GetWidth() << "x" << camera.GetHeight() << endl;
 			cout << "Camera Speed             : " << camera.GetFrameRate() << " fps" << endl;
 			if (scaledWidth != -1 && scaledHeight != -1)
 				cout << "Images will be scaled to : " << scaledWidth << "x" << scaledHeight << endl;
-			if (rotation != -1)
+			if (rotation != -1 && rotation != 0)
 				cout << "Images will be rotated   : " << rotation << " degrees clockwise" << endl;
 
 			// create a new pipeline to add elements too
@@ -533,29 +1327,39 @@ gint main(gint argc, gchar *argv[])
 			// The pipeline helper can be expanded to create several kinds of pipelines
 			// as these can depend heavily on the application and host capabilities.
 			// Rescaling the image is optional. In this sample we do rescaling and rotation in the InstantCameraAppSrc.
-			CPipelineHelper myPipelineHelper(pipeline, source);
+			CPipelineHelper myPipelineHelper(pipeline, source, tzOffset);
+			pipelineHelper = &myPipelineHelper;
+			pCamera = &camera;
 
-			thread inptThread(evalUsrInt, myPipelineHelper);
-			inptThread.detach();
+			// commands from the console and -control, on the main loop once it runs
+			CControlChannel control;
+			add_control_commands(control, &myPipelineHelper, &camera);
+			control.WatchConsole();
+			if (controlAddress != "")
+				control.Listen(controlAddress);
 
 			bool pipelineBuilt = false;
 
-			if (display == true)
-				pipelineBuilt = myPipelineHelper.build_pipeline_display();
-			else if (h264file == true)
-				pipelineBuilt = myPipelineHelper.build_pipeline_h264file(tzOffset);
-			else if (displayh264file == true)
-				pipelineBuilt = myPipelineHelper.build_pipeline_display_h264file(tzOffset);
-			else if (camfail == true)
-				pipelineBuilt = myPipelineHelper.build_pipeline_camfail();
-			else if (syserr == true)
-				pipelineBuilt = myPipelineHelper.build_pipeline_syserr();
-			else if (powfail == true)
-				pipelineBuilt = myPipelineHelper.build_pipeline_powerfail();
-			else if (fullusb == true)
-				pipelineBuilt = myPipelineHelper.build_pipeline_fullusb();
-			else if (temperr == true)
-				pipelineBuilt = myPipelineHelper.build_pipeline_temperr();
+			for (map<string, CThreadPolicy>::iterator policy = branchThreadPolicies.begin(); policy != branchThreadPolicies.end(); policy++)
+				myPipelineHelper.set_thread_policy(policy->first, policy->second);
+			string clipFolder = pipelineConfig.Expand(pipelineName, pipelineConfig.GetValue(pipelineName, "clips"));
+			myPipelineHelper.set_clip_recording(clipFolder != "" ? clipFolder : ".", atof(pipelineConfig.GetValue(pipelineName, "clip-preroll").c_str()),
+				atof(pipelineConfig.GetValue(pipelineName, "clip-postroll").c_str()));
+
+			string writer = pipelineConfig.GetValue(pipelineName, "writer");
+			if (writer != "")
+				myPipelineHelper.set_recording_sink(pipelineConfig.Expand(pipelineName, writer));
+			myPipelineHelper.set_rtsp_server(pipelineConfig.GetValue(pipelineName, "rtsp-port"), pipelineConfig.GetValue(pipelineName, "rtsp-path"),
+				pipelineConfig.Expand(pipelineName, pipelineConfig.GetValue(pipelineName, "rtsp-payloader")));
+			minFreeSpace = g_ascii_strtoull(pipelineConfig.GetValue(pipelineName, "min-free-space").c_str(), NULL, 10) * 1000000;
+			GstClockTime outputQueueTime = g_ascii_strtoull(pipelineConfig.GetValue(pipelineName, "output-queue-time").c_str(), NULL, 10);
+			for (size_t i = 0; i < encodedOutputs.size(); i++)
+				myPipelineHelper.add_encoded_output(encodedOutputs[i].first, encodedOutputs[i].second, outputQueueTime);
+
+			for (int stream = 1; camera.GetSequenceSource(stream) != NULL; stream++)
+				myPipelineHelper.add_source_branch(camera.GetSequenceSource(stream), sequenceBranch);
+
+			pipelineBuilt = myPipelineHelper.build_pipeline(pipelineDescription, fallbackDescription);
 
 
 			if (pipelineBuilt == false)
@@ -575,10 +1379,24 @@ gint main(gint argc, gchar *argv[])
 			cout << "Starting pipeline..." << endl;
 			gst_element_set_state(pipeline, GST_STATE_PLAYING);
 
+			// -adaptive: give up bitrate, then framerate, rather than frames. The framerate is the camera's, so not when it's triggered.
+			CAdaptiveController *adaptiveController = NULL;
+			if (useAdaptive == true)
+			{
+				adaptiveController = new CAdaptiveController(pipeline, adaptiveSettings);
+				adaptiveController->SetBitrate(encoderBitrate);
+				if (onDemand == false && useTrigger == false && triggerRate == 0 && triggerByInput == false)
+					adaptiveController->SetFrameRate(camera.GetFrameRate(), [&camera](double framesPerSecond) { return camera.SetFrameRate(framesPerSecond); });
+				adaptiveController->Start();
+			}
+
 			// run the main loop. When Ctrl+C is pressed, an EOS event will be sent
 			// which will shutdown the pipeline in intHandler(), which will in turn quit the main loop.
 			g_main_loop_run(loop);
 			cout << "After g_main_loop_run..." << endl;
+			pipelineHelper = NULL;
+			pCamera = NULL;
+			delete adaptiveController;
 			// clean up
 			cout << "Stopping pipeline..." << endl;
 			gst_element_set_state(pipeline, GST_STATE_PAUSED);
@@ -597,37 +1415,18 @@ gint main(gint argc, gchar *argv[])
 			bus_watch_id = gst_bus_add_watch(bus, bus_call, loop);
 			gst_object_unref(bus);
 
-			// A pipeline needs a source element. The InstantCameraForAppSrc will create, configure, and provide an AppSrc which fits the camera.
-			GstElement *source = gst_element_factory_make("videotestsrc", "videotestsrc");
-			
-			// Build the rest of the pipeline based on the sample chosen.
-			// The PipelineHelper will manage the configuration of GStreamer pipelines.  
-			// The pipeline helper can be expanded to create several kinds of pipelines
-			// as these can depend heavily on the application and host capabilities.
-			// Rescaling the image is optional. In this sample we do rescaling and rotation in the InstantCameraAppSrc.
-			CPipelineHelper myPipelineHelper(pipeline, source);
+			// Without a camera, the pipeline makes its own images (eg: the error screens start with a videotestsrc).
+			CPipelineHelper myPipelineHelper(pipeline, NULL, tzOffset);
 
-			thread inptThread(evalUsrInt, myPipelineHelper);
-			inptThread.detach();
+			CControlChannel control;
+			add_control_commands(control, &myPipelineHelper, NULL);
+			control.WatchConsole();
+			if (controlAddress != "")
+				control.Listen(controlAddress);
 
 			bool pipelineBuilt = false;
 
-			if (display == true)
-				pipelineBuilt = myPipelineHelper.build_pipeline_display();
-			else if (h264file == true)
-				pipelineBuilt = myPipelineHelper.build_pipeline_h264file(tzOffset);
-			else if (displayh264file == true)
-				pipelineBuilt = myPipelineHelper.build_pipeline_display_h264file(tzOffset);
-			else if (camfail == true)
-				pipelineBuilt = myPipelineHelper.build_pipeline_camfail();
-			else if (syserr == true)
-				pipelineBuilt = myPipelineHelper.build_pipeline_syserr();
-			else if (powfail == true)
-				pipelineBuilt = myPipelineHelper.build_pipeline_powerfail();
-			else if (fullusb == true)
-				pipelineBuilt = myPipelineHelper.build_pipeline_fullusb();
-			else if (temperr == true)
-				pipelineBuilt = myPipelineHelper.build_pipeline_temperr();
+			pipelineBuilt = myPipelineHelper.build_pipeline(pipelineDescription);
 			if (pipelineBuilt == false)
 			{
 				exitCode = -1;
@@ -0,0 +1,341 @@
+/*  gstasyncfilesink.cpp: Definition file for the asyncfilesink GStreamer element.
+    A filesink which leaves the writing to a thread of its own (CAsyncFileWriter), for recordings on slow or stalling disks.
+
+	Copyright 2017-2019 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+*/
+
+/*
+	asyncfilesink:
+	  start() ---> CAsyncFileWriter::Open()    (queued)
+	  render() --> CAsyncFileWriter::Write()   (copied into a chunk, only waits if max-pending is reached)
+	  BYTES segment event --> CAsyncFileWriter::Seek()
+	  stop() ----> CAsyncFileWriter::Close()   (queued, and synced if sync-interval >= 0)
+	The I/O thread does the rest, in order.
+
+	eg: gst-launch style, once gst_async_file_sink_register() has been called:
+	... ! h264parse ! mp4mux ! asyncfilesink location=video.mp4 sync-interval=1000
+	... ! h264parse ! splitmuxsink location=video%02d.mp4 sink="asyncfilesink preallocate=536870912"
+*/
+
+#include "gstasyncfilesink.h"
+
+using namespace std;
+
+GST_DEBUG_CATEGORY_STATIC(gst_async_file_sink_debug);
+#define GST_CAT_DEFAULT gst_async_file_sink_debug
+
+enum
+{
+	PROP_0,
+	PROP_LOCATION,
+	PROP_BUFFER_SIZE,
+	PROP_MAX_PENDING,
+	PROP_SYNC_INTERVAL,
+	PROP_PREALLOCATE,
+	PROP_STATS_INTERVAL
+};
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE("sink",
+	GST_PAD_SINK,
+	GST_PAD_ALWAYS,
+	GST_STATIC_CAPS_ANY);
+
+#define gst_async_file_sink_parent_class parent_class
+G_DEFINE_TYPE(GstAsyncFileSink, gst_async_file_sink, GST_TYPE_BASE_SINK);
+
+static void gst_async_file_sink_set_property(GObject *object, guint propId, const GValue *value, GParamSpec *pspec)
+{
+	GstAsyncFileSink *self = GST_ASYNC_FILE_SINK(object);
+
+	switch (propId)
+	{
+	case PROP_LOCATION:
+		g_free(self->location);
+		self->location = g_value_dup_string(value);
+		break;
+	case PROP_BUFFER_SIZE:
+		self->bufferSize = g_value_get_uint(value);
+		break;
+	case PROP_MAX_PENDING:
+		self->maxPending = g_value_get_uint64(value);
+		break;
+	case PROP_SYNC_INTERVAL:
+		self->syncInterval = g_value_get_int(value);
+		break;
+	case PROP_PREALLOCATE:
+		self->preallocate = g_value_get_uint64(value);
+		break;
+	case PROP_STATS_INTERVAL:
+		self->statsInterval = g_value_get_int(value);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, propId, pspec);
+		break;
+	}
+}
+
+static void gst_async_file_sink_get_property(GObject *object, guint propId, GValue *value, GParamSpec *pspec)
+{
+	GstAsyncFileSink *self = GST_ASYNC_FILE_SINK(object);
+
+	switch (propId)
+	{
+	case PROP_LOCATION:
+		g_value_set_string(value, self->location);
+		break;
+	case PROP_BUFFER_SIZE:
+		g_value_set_uint(value, self->bufferSize);
+		break;
+	case PROP_MAX_PENDING:
+		g_value_set_uint64(value, self->maxPending);
+		break;
+	case PROP_SYNC_INTERVAL:
+		g_value_set_int(value, self->syncInterval);
+		break;
+	case PROP_PREALLOCATE:
+		g_value_set_uint64(value, self->preallocate);
+		break;
+	case PROP_STATS_INTERVAL:
+		g_value_set_int(value, self->statsInterval);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, propId, pspec);
+		break;
+	}
+}
+
+// An element message, so applications can pick it out in their bus watch with gst_message_has_name(msg, "async-file-sink-stats").
+// Called from the I/O thread.
+static void post_stats(GstAsyncFileSink *self, const FileWriterStats &stats)
+{
+	GstStructure *structure = gst_structure_new("async-file-sink-stats",
+		"location", G_TYPE_STRING, stats.location.c_str(),
+		"bytes-written", G_TYPE_UINT64, stats.bytesWritten,
+		"throughput", G_TYPE_DOUBLE, stats.throughput,
+		"pending-bytes", G_TYPE_UINT64, stats.pendingBytes,
+		"free-space", G_TYPE_UINT64, stats.freeSpace,
+		"longest-write-us", G_TYPE_INT64, stats.longestWrite,
+		"stalls", G_TYPE_UINT64, stats.stalls,
+		NULL);
+	gst_element_post_message(GST_ELEMENT(self), gst_message_new_element(GST_OBJECT(self), structure));
+}
+
+// READY->PAUSED. splitmuxsink does this for every fragment, with the new location set.
+static gboolean gst_async_file_sink_start(GstBaseSink *sink)
+{
+	GstAsyncFileSink *self = GST_ASYNC_FILE_SINK(sink);
+
+	if (self->location == NULL || self->location[0] == '\0')
+	{
+		GST_ELEMENT_ERROR(self, RESOURCE, NOT_FOUND, ("No file name given (location)."), (NULL));
+		return FALSE;
+	}
+
+	// The writer outlives each file, so one fragment's close can still be under way while the next one fills.
+	if (self->writer == NULL)
+	{
+		self->writer = new CAsyncFileWriter(self->bufferSize, self->maxPending, self->syncInterval, self->preallocate);
+		self->writer->SetOnStats(self->statsInterval, [self](const FileWriterStats &stats) { post_stats(self, stats); });
+	}
+
+	string error;
+	if (self->writer->HasFailed(error) == true)
+	{
+		GST_ELEMENT_ERROR(self, RESOURCE, OPEN_WRITE, ("%s", error.c_str()), (NULL));
+		return FALSE;
+	}
+
+	self->writer->Open(self->location);
+	self->position = 0;
+	return TRUE;
+}
+
+static gboolean gst_async_file_sink_stop(GstBaseSink *sink)
+{
+	GstAsyncFileSink *self = GST_ASYNC_FILE_SINK(sink);
+
+	if (self->writer != NULL)
+		self->writer->Close();
+	return TRUE;
+}
+
+static GstFlowReturn gst_async_file_sink_render(GstBaseSink *sink, GstBuffer *buffer)
+{
+	GstAsyncFileSink *self = GST_ASYNC_FILE_SINK(sink);
+
+	GstMapInfo map;
+	if (gst_buffer_map(buffer, &map, GST_MAP_READ) == FALSE)
+	{
+		GST_ELEMENT_ERROR(self, RESOURCE, WRITE, ("Could not read the buffer."), (NULL));
+		return GST_FLOW_ERROR;
+	}
+	bool isWritten = self->writer->Write(map.data, map.size);
+	self->position += map.size;
+	gst_buffer_unmap(buffer, &map);
+
+	if (isWritten == false)
+	{
+		string error;
+		if (self->writer->HasFailed(error) == false)
+			return GST_FLOW_FLUSHING; // unlock() let us go
+		GST_ELEMENT_ERROR(self, RESOURCE, WRITE, ("%s", error.c_str()), (NULL));
+		return GST_FLOW_ERROR;
+	}
+	return GST_FLOW_OK;
+}
+
+static gboolean gst_async_file_sink_event(GstBaseSink *sink, GstEvent *event)
+{
+	GstAsyncFileSink *self = GST_ASYNC_FILE_SINK(sink);
+
+	// muxers (eg: mp4mux at the end of a file) send a new BYTES segment to go back and fill in what they couldn't know before.
+	if (GST_EVENT_TYPE(event) == GST_EVENT_SEGMENT && self->writer != NULL)
+	{
+		const GstSegment *segment = NULL;
+		gst_event_parse_segment(event, &segment);
+		if (segment->format == GST_FORMAT_BYTES && segment->start != self->position)
+		{
+			self->writer->Seek(segment->start);
+			self->position = segment->start;
+		}
+	}
+
+	return GST_BASE_SINK_CLASS(parent_class)->event(sink, event);
+}
+
+static gboolean gst_async_file_sink_query(GstBaseSink *sink, GstQuery *query)
+{
+	GstAsyncFileSink *self = GST_ASYNC_FILE_SINK(sink);
+
+	switch (GST_QUERY_TYPE(query))
+	{
+	case GST_QUERY_SEEKING:
+	{
+		// without this, mp4mux refuses to record (it can't rewrite its header)
+		GstFormat format;
+		gst_query_parse_seeking(query, &format, NULL, NULL, NULL);
+		gst_query_set_seeking(query, format, format == GST_FORMAT_BYTES || format == GST_FORMAT_DEFAULT, 0, -1);
+		return TRUE;
+	}
+	case GST_QUERY_POSITION:
+	{
+		GstFormat format;
+		gst_query_parse_position(query, &format, NULL);
+		if (format != GST_FORMAT_BYTES && format != GST_FORMAT_DEFAULT)
+			break;
+		gst_query_set_position(query, GST_FORMAT_BYTES, self->position);
+		return TRUE;
+	}
+	case GST_QUERY_FORMATS:
+		gst_query_set_formats(query, 2, GST_FORMAT_DEFAULT, GST_FORMAT_BYTES);
+		return TRUE;
+	default:
+		break;
+	}
+	return GST_BASE_SINK_CLASS(parent_class)->query(sink, query);
+}
+
+// Flushing or stopping: don't leave render() waiting for the disk.
+static gboolean gst_async_file_sink_unlock(GstBaseSink *sink)
+{
+	GstAsyncFileSink *self = GST_ASYNC_FILE_SINK(sink);
+	if (self->writer != NULL)
+		self->writer->SetFlushing(true);
+	return TRUE;
+}
+
+static gboolean gst_async_file_sink_unlock_stop(GstBaseSink *sink)
+{
+	GstAsyncFileSink *self = GST_ASYNC_FILE_SINK(sink);
+	if (self->writer != NULL)
+		self->writer->SetFlushing(false);
+	return TRUE;
+}
+
+static void gst_async_file_sink_finalize(GObject *object)
+{
+	GstAsyncFileSink *self = GST_ASYNC_FILE_SINK(object);
+
+	// waits for whatever is still queued to be written
+	delete self->writer;
+	g_free(self->location);
+
+	G_OBJECT_CLASS(parent_class)->finalize(object);
+}
+
+static void gst_async_file_sink_class_init(GstAsyncFileSinkClass *klass)
+{
+	GObjectClass *gobjectClass = G_OBJECT_CLASS(klass);
+	GstElementClass *elementClass = GST_ELEMENT_CLASS(klass);
+	GstBaseSinkClass *baseSinkClass = GST_BASE_SINK_CLASS(klass);
+
+	gobjectClass->set_property = gst_async_file_sink_set_property;
+	gobjectClass->get_property = gst_async_file_sink_get_property;
+	gobjectClass->finalize = gst_async_file_sink_finalize;
+
+	GParamFlags flags = (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY);
+	g_object_class_install_property(gobjectClass, PROP_LOCATION,
+		g_param_spec_string("location", "File location", "Where to write the file", NULL, flags));
+	// the rest are read when the element first starts
+	g_object_class_install_property(gobjectClass, PROP_BUFFER_SIZE,
+		g_param_spec_uint("buffer-size", "Buffer size", "Bytes handed to the disk at a time (rounded up to whole pages)", 4096, G_MAXUINT, 4 * 1024 * 1024, flags));
+	g_object_class_install_property(gobjectClass, PROP_MAX_PENDING,
+		g_param_spec_uint64("max-pending", "Max pending", "Bytes which can be waiting for the disk before the pipeline has to wait too", 0, G_MAXUINT64, 64 * 1024 * 1024, flags));
+	g_object_class_install_property(gobjectClass, PROP_SYNC_INTERVAL,
+		g_param_spec_int("sync-interval", "Sync interval", "fdatasync every so many ms while writing (0 = only when each file is closed, -1 = never)", -1, G_MAXINT, 0, flags));
+	g_object_class_install_property(gobjectClass, PROP_PREALLOCATE,
+		g_param_spec_uint64("preallocate", "Preallocate", "Reserve this many bytes on the disk for each file when it's opened, where the file system can (0 = don't)", 0, G_MAXUINT64, 0, flags));
+	g_object_class_install_property(gobjectClass, PROP_STATS_INTERVAL,
+		g_param_spec_int("stats-interval", "Statistics interval", "Post an \"async-file-sink-stats\" element message every so many ms (0 = never)", 0, G_MAXINT, 1000, flags));
+
+	gst_element_class_set_static_metadata(elementClass,
+		"Asynchronous file sink", "Sink/File",
+		"Writes to a file from a thread of its own, with large aligned writes",
+		"Matthew Breit <matt.breit@gmail.com>");
+	gst_element_class_add_static_pad_template(elementClass, &sink_template);
+
+	baseSinkClass->start = GST_DEBUG_FUNCPTR(gst_async_file_sink_start);
+	baseSinkClass->stop = GST_DEBUG_FUNCPTR(gst_async_file_sink_stop);
+	baseSinkClass->render = GST_DEBUG_FUNCPTR(gst_async_file_sink_render);
+	baseSinkClass->event = GST_DEBUG_FUNCPTR(gst_async_file_sink_event);
+	baseSinkClass->query = GST_DEBUG_FUNCPTR(gst_async_file_sink_query);
+	baseSinkClass->unlock = GST_DEBUG_FUNCPTR(gst_async_file_sink_unlock);
+	baseSinkClass->unlock_stop = GST_DEBUG_FUNCPTR(gst_async_file_sink_unlock_stop);
+}
+
+static void gst_async_file_sink_init(GstAsyncFileSink *self)
+{
+	self->writer = NULL;
+	self->position = 0;
+	self->location = NULL;
+	self->bufferSize = 4 * 1024 * 1024;
+	self->maxPending = 64 * 1024 * 1024;
+	self->syncInterval = 0;
+	self->preallocate = 0;
+	self->statsInterval = 1000;
+
+	// like filesink: write as soon as it arrives, not at the buffer's running time
+	gst_base_sink_set_sync(GST_BASE_SINK(self), FALSE);
+}
+
+gboolean gst_async_file_sink_register()
+{
+	GST_DEBUG_CATEGORY_INIT(gst_async_file_sink_debug, "asyncfilesink", 0, "Asynchronous file sink");
+	return gst_element_register(NULL, "asyncfilesink", GST_RANK_NONE, GST_TYPE_ASYNC_FILE_SINK);
+}
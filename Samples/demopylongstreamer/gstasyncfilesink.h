@@ -0,0 +1,67 @@
+/*  gstasyncfilesink.h: header file for the asyncfilesink GStreamer element.
+    A filesink which leaves the writing to a thread of its own (CAsyncFileWriter), for recordings on slow or stalling disks.
+
+	Copyright 2017 Matthew Breit <matt.breit@gmail.com>
+
+	Licensed under the Apache License, Version 2.0 (the "License");
+	you may not use this file except in compliance with the License.
+	You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+	Unless required by applicable law or agreed to in writing, software
+	distributed under the License is distributed on an "AS IS" BASIS,
+	WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+	See the License for the specific language governing permissions and
+	limitations under the License.
+
+	THIS SOFTWARE REQUIRES ADDITIONAL SOFTWARE (IE: LIBRARIES) IN ORDER TO COMPILE
+	INTO BINARY FORM AND TO FUNCTION IN BINARY FORM. ANY SUCH ADDITIONAL SOFTWARE
+	IS OUTSIDE THE SCOPE OF THIS LICENSE.
+*/
+
+#pragma once
+
+#include "CAsyncFileWriter.h"
+#include <gst/gst.h>
+#include <gst/base/gstbasesink.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_ASYNC_FILE_SINK (gst_async_file_sink_get_type())
+#define GST_ASYNC_FILE_SINK(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_ASYNC_FILE_SINK, GstAsyncFileSink))
+#define GST_ASYNC_FILE_SINK_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST((klass), GST_TYPE_ASYNC_FILE_SINK, GstAsyncFileSinkClass))
+#define GST_IS_ASYNC_FILE_SINK(obj) (G_TYPE_CHECK_INSTANCE_TYPE((obj), GST_TYPE_ASYNC_FILE_SINK))
+
+// ******* GstAsyncFileSink *******
+// A GstBaseSink which hands each buffer to a CAsyncFileWriter and returns straight away. It can be splitmuxsink's "sink":
+// each fragment's close and the next one's open are queued like the writes, so the muxer never waits for the disk to finish a file.
+// Seekable, so mp4mux can go back and write its header at the end.
+// Posts an element message named "async-file-sink-stats" every stats-interval ms, with the throughput and the free space on the disk.
+struct GstAsyncFileSink
+{
+	GstBaseSink parent;
+
+	CAsyncFileWriter *writer; // made the first time the element starts, and kept until it's finalized
+	guint64 position;         // where the next buffer goes, in bytes
+
+	// properties
+	gchar *location;
+	guint bufferSize;
+	guint64 maxPending;
+	gint syncInterval;
+	guint64 preallocate;
+	gint statsInterval;
+};
+
+struct GstAsyncFileSinkClass
+{
+	GstBaseSinkClass parent_class;
+};
+
+GType gst_async_file_sink_get_type();
+
+// The element is part of the program rather than a plugin. Call after gst_init(), then use "asyncfilesink" in pipelines as usual.
+gboolean gst_async_file_sink_register();
+
+G_END_DECLS
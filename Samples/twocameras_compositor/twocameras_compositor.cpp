@@ -1,5 +1,5 @@
 /*  twocameras_compositor.cpp: Sample application using CInstantCameraAppSrc class.
-	This will grab and display images from two cameras.
+	This will grab and display images from two (or more) cameras side-by-side.
 	
 	Copyright 2018 Matthew Breit <matt.breit@gmail.com>
 
@@ -34,9 +34,10 @@
 */
 
 
-#include "../../InstantCameraAppSrc/CInstantCameraAppSrc.h"
+#include "../../InstantCameraAppSrc/CCameraManager.h"
 #include <gst/gst.h>
 #include <thread>
+#include <cmath>
 
 using namespace std;
 
@@ -137,6 +138,9 @@ void IntHandler(int dummy)
 
 gint main(gint argc, gchar *argv[])
 {
+	// The cameras are closed when it goes, after the pipeline.
+	CCameraManager cameras;
+
 	try
 	{
 		// signal handler for ctrl+C
@@ -150,70 +154,60 @@ gint main(gint argc, gchar *argv[])
 		// create the mainloop
 		loop = g_main_loop_new(NULL, FALSE);
 
-		// The InstantCameraForAppSrc will manage the physical camera and pylon driver
+		// The camera manager opens each camera as an InstantCameraForAppSrc, which will manage the physical camera and pylon driver
 		// and provide a source element to the GStreamer pipeline.
-		CInstantCameraAppSrc camera1("21734321");
-		CInstantCameraAppSrc camera2("21708961");
+		// Use the cameras with the serial numbers given on the command line (eg: twocameras_compositor 21734321 21708961), or every camera found.
+		vector<string> serials;
+		for (int i = 1; i < argc; i++)
+			serials.push_back(argv[i]);
+		if (cameras.Open(serials) == 0)
+		{
+			exitCode = -1;
+			throw std::runtime_error("No cameras found!");
+		}
 
-		// rescale both cameras' images to 320x240 for demo purposes
+		// rescale the cameras' images to 320x240 for demo purposes
 		int rescaleWidth = 320;
 		int rescaleHeight = 240;
 
 		// Initialize the cameras and driver for use with GStreamer
 		// use maximum possible width and height, and maximum possible framerate under current settings.
-		cout << "Initializing camera and driver..." << endl;
-		camera1.InitCamera(-1, -1, -1, true, false, rescaleWidth, rescaleHeight);
-		camera2.InitCamera(-1, -1, -1, true, false, rescaleWidth, rescaleHeight);
+		// (no Image-on-Demand, as the cameras will be triggered together if they can)
+		cout << "Initializing cameras and driver..." << endl;
+		cameras.InitCameras(-1, -1, -1, false, false, rescaleWidth, rescaleHeight);
 
 		// Apply some additional settings you may like
 		cout << "Applying additional user settings..." << endl;
-		// Set the same exposure time for both cameras
-		GenApi::CEnumerationPtr(camera1.GetNodeMap().GetNode("ExposureAuto"))->FromString("Off");
-		GenApi::CEnumerationPtr(camera2.GetNodeMap().GetNode("ExposureAuto"))->FromString("Off");
-		GenApi::CFloatPtr(camera1.GetNodeMap().GetNode("ExposureTime"))->SetValue(3000);
-		GenApi::CFloatPtr(camera2.GetNodeMap().GetNode("ExposureTime"))->SetValue(3000);
-
-		// Split the bandwidth between both cameras. This is critical for multi-camera operation.
-		// example: if we are using two usb cameras
-		if (camera1.GetDeviceInfo().GetDeviceClass() == Pylon::BaslerUsbDeviceClass && camera1.GetDeviceInfo().GetDeviceClass() == Pylon::BaslerUsbDeviceClass)
+		// Set the same exposure time for all cameras
+		for (size_t i = 0; i < cameras.GetSize(); i++)
 		{
-			// Turn on the bandwidth limiter
-			GenApi::CEnumerationPtr(camera1.GetNodeMap().GetNode("DeviceLinkThroughputLimitMode"))->FromString("On");
-			GenApi::CEnumerationPtr(camera2.GetNodeMap().GetNode("DeviceLinkThroughputLimitMode"))->FromString("On");
-
-			// Set each camera's limit to 150 MB/sec. Typically USB 3 can support ~350-400 MB/sec, but performance varies based on the host system's chipset.
-			// So, assuming a maximum of 300 MB/sec per chipset is usually safe.
-			GenApi::CIntegerPtr(camera1.GetNodeMap().GetNode("DeviceLinkThroughputLimit"))->SetValue(150000000);
-			GenApi::CIntegerPtr(camera2.GetNodeMap().GetNode("DeviceLinkThroughputLimit"))->SetValue(150000000);
+			if (GenApi::IsWritable(cameras.GetCamera(i).GetFeatures().ExposureAuto))
+				cameras.GetCamera(i).GetFeatures().ExposureAuto->FromString("Off");
+			cameras.GetCamera(i).GetFeatures().SetExposureTime(3000);
 		}
 
+		// Split the bandwidth between the cameras. This is critical for multi-camera operation.
+		// Cameras on the same link (USB, or the same network interface for GigE) each get a share in proportion to their AOI and framerate.
+		cameras.ShareBandwidth();
+
 		// If we change settings like exposuretime, bandwidth, width, height, etc.
 		// Then the camera's framerate possibilities have probably changed...
 		// Since we are using multiple cameras, we probably want them to be "in sync", so let's use the maximum common framerate between them
-		double frameRateCamera1 = camera1.GetFrameRate(); // get the max framerate based on current settings
-		double frameRateCamera2 = camera2.GetFrameRate();
-		double maxCommonFrameRate = 0;
-
-		if (frameRateCamera1 <= frameRateCamera2)
-			maxCommonFrameRate = frameRateCamera1;
-		else
-			maxCommonFrameRate = frameRateCamera2;
-
-		camera1.SetFrameRate(maxCommonFrameRate);
-		camera2.SetFrameRate(maxCommonFrameRate);
-		
-		cout << "Maximum common framerate: " << maxCommonFrameRate << endl;		
-		
-		cout << "Using Camera             : " << camera1.GetDeviceInfo().GetFriendlyName() << endl;
-		cout << "Camera Area Of Interest  : " << camera1.GetWidth() << "x" << camera1.GetHeight() << endl;
-		cout << "Camera Speed             : " << camera1.GetFrameRate() << " fps" << endl;
-		cout << endl;
-		cout << "Using Camera             : " << camera2.GetDeviceInfo().GetFriendlyName() << endl;
-		cout << "Camera Area Of Interest  : " << camera2.GetWidth() << "x" << camera2.GetHeight() << endl;
-		cout << "Camera Speed             : " << camera2.GetFrameRate() << " fps" << endl;
-		cout << endl;
+		double maxCommonFrameRate = cameras.SetCommonFrameRate();
+
+		// GigE cameras can also be triggered together (otherwise they run freely at the common framerate)
+		cameras.UseSynchronizedTrigger(maxCommonFrameRate);
 
-		cout << "Creating pipeline to display two cameras side-by-side..." << endl;
+		for (size_t i = 0; i < cameras.GetSize(); i++)
+		{
+			CInstantCameraAppSrc &camera = cameras.GetCamera(i);
+			cout << "Using Camera             : " << camera.GetDeviceInfo().GetFriendlyName() << endl;
+			cout << "Camera Area Of Interest  : " << camera.GetWidth() << "x" << camera.GetHeight() << endl;
+			cout << "Camera Speed             : " << camera.GetFrameRate() << " fps" << endl;
+			cout << endl;
+		}
+
+		cout << "Creating pipeline to display the cameras in a grid..." << endl;
 		cout << endl;
 
 		// create a new pipeline to add elements too
@@ -224,57 +218,50 @@ gint main(gint argc, gchar *argv[])
 		bus_watch_id = gst_bus_add_watch(bus, bus_call, loop);
 		gst_object_unref(bus);
 
-		// Create the other needed gstreamer pipeline elements
-		GstElement *source1;
-		GstElement *source2;
-		GstElement *videoconvert1;
-		GstElement *videoconvert2;
-		GstElement *compositor;
-		GstPad *compositor_sink_pad1;
-		GstPad *compositor_sink_pad2;
-		GstElement *capsfilter;
-		GstElement *sink;
-
-		// Use the cameras as the source of the pipeline.
-		source1 = camera1.GetSource();
-		source2 = camera2.GetSource();
-
-		// some video format converters may be needed
-		videoconvert1 = gst_element_factory_make("videoconvert", "videoconvert1");
-		videoconvert2 = gst_element_factory_make("videoconvert", "videoconvert2");
-			
-		// The compositor element will take care for mixing the two camera streams into one window for display
+		// The compositor element will take care for mixing the camera streams into one window for display
 		cout << "Creating compositor..." << endl;
-		compositor = gst_element_factory_make("compositor", "compositor");
-			
-		// The compositor's sink pads will decide where to place the videos (eg: next to each other)
-		GstPadTemplate* compositor_sink_pad_t = gst_element_class_get_pad_template(GST_ELEMENT_GET_CLASS(compositor), "sink_%u");
-		compositor_sink_pad1 = gst_element_request_pad(compositor, compositor_sink_pad_t, NULL, NULL);
-		compositor_sink_pad2 = gst_element_request_pad(compositor, compositor_sink_pad_t, NULL, NULL);
-		g_object_set(compositor_sink_pad1, "xpos", 0, "ypos", 0, NULL);
-		g_object_set(compositor_sink_pad2, "xpos", rescaleWidth, "ypos", 0, NULL);
+		GstElement *compositor = gst_element_factory_make("compositor", "compositor");
 
 		// The capsfilter element will tell the sink what framerate to support (if possible)
-		capsfilter = gst_element_factory_make("capsfilter", "capsfilter");
+		GstElement *capsfilter = gst_element_factory_make("capsfilter", "capsfilter");
 		GstCaps *caps = gst_caps_new_simple("video/x-raw", "framerate", GST_TYPE_FRACTION, (int)maxCommonFrameRate, 1, NULL);
 		g_object_set(G_OBJECT(capsfilter), "caps", caps, NULL);
 		gst_caps_unref(caps);
 
 		// The sink element for this sample will be whatever videosink the system prefers for display.
-		sink = gst_element_factory_make("autovideosink", "videosink");
+		GstElement *sink = gst_element_factory_make("autovideosink", "videosink");
 		g_object_set(sink, "sync", false, NULL);
 		g_object_set(sink, "message-forward", true, NULL);
 
-		// Add all the elements to the pipeline.
-		gst_bin_add_many(GST_BIN(pipeline), source1, videoconvert1, compositor, sink, source2, videoconvert2, capsfilter, NULL);
-		
-		// Link the elements together
-		gst_element_link_many(source1, videoconvert1, compositor, capsfilter, sink, NULL);
-		gst_element_link_many(source2, videoconvert2, compositor, capsfilter, sink, NULL);
-		gst_element_link_many(compositor, sink, NULL);
-		
-		// Start the camera and grab engine.
-		if (camera1.StartCamera() == false || camera2.StartCamera() == false)
+		gst_bin_add_many(GST_BIN(pipeline), compositor, capsfilter, sink, NULL);
+		gst_element_link_many(compositor, capsfilter, sink, NULL);
+
+		// Use the cameras as the sources of the pipeline. Each one goes through a video format converter to the compositor,
+		// whose sink pads decide where to place the videos (eg: a grid, as square as possible)
+		vector<GstElement*> sources = cameras.GetSources();
+		int columns = (int)ceil(sqrt((double)sources.size()));
+		GstPadTemplate* compositor_sink_pad_t = gst_element_class_get_pad_template(GST_ELEMENT_GET_CLASS(compositor), "sink_%u");
+		for (size_t i = 0; i < sources.size(); i++)
+		{
+			string convertName = "videoconvert" + to_string(i + 1);
+			GstElement *videoconvert = gst_element_factory_make("videoconvert", convertName.c_str());
+			gst_bin_add_many(GST_BIN(pipeline), sources[i], videoconvert, NULL);
+			gst_element_link(sources[i], videoconvert);
+
+			GstPad *compositor_sink_pad = gst_element_request_pad(compositor, compositor_sink_pad_t, NULL, NULL);
+			g_object_set(compositor_sink_pad, "xpos", (int)(i % columns) * rescaleWidth, "ypos", (int)(i / columns) * rescaleHeight, NULL);
+			GstPad *convert_src_pad = gst_element_get_static_pad(videoconvert, "src");
+			gst_pad_link(convert_src_pad, compositor_sink_pad);
+			gst_object_unref(convert_src_pad);
+			gst_object_unref(compositor_sink_pad);
+		}
+
+		// Release the cameras' images to the compositor in matched sets (by frame id when triggered together, otherwise by timestamp), all with the same timestamp.
+		// Otherwise the compositor pairs whatever arrives together, which can be up to a frame apart.
+		cameras.SynchronizeFrames(sources);
+
+		// Start the cameras and grab engines (and the trigger, if they are triggered together).
+		if (cameras.StartCameras() == false)
 		{
 			exitCode = -1;
 			throw std::runtime_error("Could not start camera!");
@@ -292,12 +279,11 @@ gint main(gint argc, gchar *argv[])
 		cout << "Stopping pipeline..." << endl;
 		gst_element_set_state(pipeline, GST_STATE_NULL);
 
-		camera1.StopCamera();
-		camera1.CloseCamera();
+		cameras.StopCameras();
+
+		FrameSyncStats syncStats = cameras.GetSynchronizer().GetStats();
+		cout << "Matched sets: " << syncStats.sets << ", unmatched images dropped: " << syncStats.orphans << endl;
 
-		camera2.StopCamera();
-		camera2.CloseCamera();
-		
 		gst_object_unref(GST_OBJECT(pipeline));
 		g_main_loop_unref(loop);
 